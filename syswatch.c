@@ -4,10 +4,13 @@
  * Multi-threaded system monitor for the assignment.
  *
  * Features:
- * - CPU + Memory monitor thread (every 5s)
- * - Disk monitor thread (every 10s)
- * - Log monitor thread (uses poll() to tail multiple logs; handles rotation)
+ * - Scheduler thread (timerfd + epoll) running the CPU + memory collector
+ *   (every 5s), the disk collector (every 10s) & a top-N process collector
+ * - Log monitor thread (uses inotify to tail any number of logs; handles
+ *   rotation & truncation; multi-pattern Aho-Corasick scan with a SIMD
+ *   prefilter)
  * - Network TCP service (status on demand)
+ * - Optional push exporter (InfluxDB line protocol or StatsD over UDP/TCP)
  * - Signal handling via dedicated signal thread using sigwait()
  * - Rolling in-memory ring buffer of last N metric samples
  * - Appends metrics to a logfile
@@ -17,17 +20,59 @@
  *
  * Basic usage:
  *   ./syswatch -c config.cfg
+ *   ./syswatch --read metrics.bin [--from "2025-11-12 17:00:00"] [--to ...] [--summary]
  *
  * Config format (simple key=value):
  *   LOGFILES=/var/log/syslog,/tmp/test.log
  *   PORT=9999
+ *   LISTEN_BACKLOG=128      (listen() backlog)
+ *   MAX_CLIENTS=1024        (concurrent TCP connections)
+ *   NET_WORKERS=0           (threads serializing responses; 0 = inline)
+ *   CLIENT_IDLE_TIMEOUT=30  (seconds a keep-alive connection may idle)
+ *   REQUEST_WAIT_MS=200     (silent clients get the status after this)
+ *   SUBSCRIBE_HEARTBEAT_S=15 (an idle "subscribe" stream gets a heartbeat; 0 = none)
+ *   LOG_PATTERNS=error,fail (case-insensitive substrings, up to 64)
  *   METRICS_LOG=./metrics.log
+ *   METRICS_LOG_FORMAT=text (or binary: fixed-size records, see --read)
+ *   WRITER_QUEUE=1024 WRITER_BATCH=64 WRITER_FLUSH_MS=1000 WRITER_FSYNC=1
+ *   LOG_BUFFER_SIZE=262144 (read buffer per followed log)
+ *   LOG_MMAP_MIN=1048576  (backlogs this large are scanned via mmap; 0 = off)
+ *   LOG_MATCH_RING=256 LOG_MATCH_ARENA_KB=256 (matched lines kept for "logs"; 0 = off)
+ *   ALERT_LOG=           (alerts & dumps; default METRICS_LOG, or METRICS_LOG.alerts if binary)
  *   RING_SIZE=200
+ *   STATE_FILE=./syswatch.state (ring & history mapped from this file, kept across
+ *                         restarts; empty = heap only)
+ *   CPU_INTERVAL_MS=5000  (CPU + memory sampling, wall-aligned; sub-second ok)
+ *   DISK_INTERVAL_MS=10000
+ *   DISKIO_INTERVAL_MS=5000 DISKIO_HISTORY=60 (per-disk IOPS, bytes/s, await &
+ *                         utilization from /proc/diskstats, see "diskio")
+ *   CGROUP_ROOT=/sys/fs/cgroup CGROUP_INTERVAL_MS=5000 CGROUP_MAX=4096
+ *   CGROUP_HISTORY=60     (per-cgroup cpu, memory, io & pressure, see "cgroups";
+ *                         empty CGROUP_ROOT disables)
+ *   HISTORY_RAW_KB=2048 HISTORY_1M_KB=512 HISTORY_1H_KB=256 (compressed history
+ *                         tiers, see the "history" request; 0 disables a tier)
+ *   STATVFS_TIMEOUT_MS=2000 (a mount whose statvfs hangs this long is skipped)
+ *   CORE_HISTORY=60       (per-core samples kept, independent of RING_SIZE)
+ *   PROC_TOP_N=10 PROC_INTERVAL_MS=5000 (top processes by CPU & RSS; 0 = off)
+ *   PROC_FD_CACHE=1024    (/proc/<pid>/stat fds kept open for busy long-lived pids)
+ *   PUSH_TARGET=udp://host:8089 (or tcp://; empty = no push export)
+ *   PUSH_FORMAT=influx    (or statsd) PUSH_PREFIX=syswatch
+ *   PUSH_INTERVAL_MS=10000 PUSH_BACKLOG=10000 (samples kept while unreachable)
+ *   ALERT=cpu>90 for 30s  (threshold/avg/rate rules on sample fields, repeatable;
+ *                         see "Alert rules") ALERT_HYSTERESIS=5 (% of the threshold)
+ *   CPU_AFFINITY=2-3      (CPUs for every daemon thread; CPU_AFFINITY_<ROLE> for one
+ *                         role: WRITER COLLECT STATVFS LOG NET SIGNAL PUSH AGGREGATE)
+ *   COLLECTOR_SCHED=idle COLLECTOR_NICE=10 (scheduler, statvfs & log threads)
+ *   MLOCK=1               (mlockall: sampling never waits on a page fault)
+ *   AGGREGATE_AGENTS=./agents (host:port per line: poll those agents & serve the
+ *                         fleet view, see "cluster") AGGREGATE_INTERVAL_MS=5000
+ *   AGGREGATE_TIMEOUT_MS=15000 AGGREGATE_THREADS=1 AGGREGATE_HISTORY=60
+ *   AGGREGATE_FIELDS=cpu,memory,disk
  *
  * Signals:
  *   SIGTERM -> graceful shutdown
  *   SIGUSR1 -> force dump metrics to disk (metrics.log)
- *   SIGHUP  -> reload config file
+ *   SIGHUP  -> reload config file (applied live; see config_apply)
  *
  * Note: this implementation is simplified for assignment/demo purposes.
  */
@@ -37,8 +82,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/statvfs.h>
@@ -47,84 +94,646 @@
 #include <poll.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <time.h>
 #include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 
 #define DEFAULT_PORT 9999
+#define DEFAULT_LISTEN_BACKLOG 128
+#define DEFAULT_MAX_CLIENTS 1024
+#define DEFAULT_CLIENT_IDLE_TIMEOUT 30
+#define DEFAULT_REQUEST_WAIT_MS 200
+#define DEFAULT_SUBSCRIBE_HEARTBEAT_S 15
 #define DEFAULT_METRICS_LOG "./metrics.log"
 #define DEFAULT_RING_SIZE 100
-#define MAX_LOGFILES 16
+#define DEFAULT_STATE_FILE "./syswatch.state"
+#define DEFAULT_CORE_HISTORY 60
+#define DEFAULT_LOG_PATTERNS "error,fail"
+#define DEFAULT_WRITER_QUEUE 1024
+#define DEFAULT_WRITER_BATCH 64
+#define DEFAULT_WRITER_FLUSH_MS 1000
+#define DEFAULT_CPU_INTERVAL_MS 5000
+#define DEFAULT_DISK_INTERVAL_MS 10000
+#define DEFAULT_DISKIO_INTERVAL_MS 5000
+#define DEFAULT_DISKIO_HISTORY 60
+#define DEFAULT_CGROUP_ROOT "/sys/fs/cgroup"
+#define DEFAULT_CGROUP_INTERVAL_MS 5000
+#define DEFAULT_CGROUP_MAX 4096
+#define DEFAULT_CGROUP_HISTORY 60
+#define MIN_INTERVAL_MS 10
+#define DEFAULT_STATVFS_TIMEOUT_MS 2000
+#define DEFAULT_HISTORY_RAW_KB 2048
+#define DEFAULT_HISTORY_1M_KB 512
+#define DEFAULT_HISTORY_1H_KB 256
+#define DEFAULT_LOG_BUFFER_SIZE (256 * 1024)
+#define DEFAULT_LOG_MMAP_MIN (1024 * 1024)
+#define DEFAULT_LOG_MATCH_RING 256
+#define DEFAULT_LOG_MATCH_ARENA_KB 256
+#define DEFAULT_PUSH_PREFIX "syswatch"
+#define DEFAULT_PUSH_INTERVAL_MS 10000
+#define DEFAULT_PUSH_BACKLOG 10000
+#define COLLECTOR_NICE_UNSET 100
+#define DEFAULT_AGGREGATE_INTERVAL_MS 5000
+#define DEFAULT_AGGREGATE_TIMEOUT_MS 15000
+#define DEFAULT_AGGREGATE_THREADS 1
+#define MAX_AGGREGATE_THREADS 64
+#define DEFAULT_AGGREGATE_HISTORY 60
+#define DEFAULT_AGGREGATE_FIELDS "cpu,memory,disk"
+#define DEFAULT_PROC_TOP_N 10
+#define DEFAULT_PROC_INTERVAL_MS 5000
+#define DEFAULT_PROC_FD_CACHE 1024
+#define DEFAULT_ALERT_HYSTERESIS 5.0
 #define BUFSZ 4096
+#define MAX_REPORTED_CORES 1024
+
+#define SAMPLE_TOP_PROCS 3
+
+/* A process from the last scan, as carried in every sample (the collector's
+ * full PROC_TOP_N lists are in proctop) */
+typedef struct {
+    int32_t pid;       // 0 = empty slot
+    float cpu;         // percent of one CPU
+    uint64_t rss_kb;
+    char comm[16];
+} sample_proc_t;
 
 typedef struct {
     double cpu_usage;      // percent
-    double memory_usage;   // percent used
+    double memory_usage;   // percent used (MemTotal - MemAvailable)
     double disk_usage;     // percent used (max across partitions)
+    double cpu_core_max;   // busiest core, percent
+    double cpu_core_p95;   // 95th percentile across cores, percent
+    double swap_usage;     // percent of swap used
+    uint64_t mem_avail_kb, mem_dirty_kb, mem_writeback_kb;
+    double mem_psi_some, mem_psi_full;  // /proc/pressure/memory avg10, percent
+    double net_rx_bps, net_tx_bps;      // bytes per second, all interfaces but lo
+    double net_rx_pps, net_tx_pps;      // packets per second
+    double net_errors, net_drops;       // rx + tx, per second
+    double net_util;                    // busiest link, percent of its speed
     time_t timestamp;
+    sample_proc_t top_cpu[SAMPLE_TOP_PROCS];  // busiest processes, largest first
+    sample_proc_t top_rss[SAMPLE_TOP_PROCS];
 } metric_sample_t;
 
+/* Scalar sample fields by name, in reply order. `get fields=`, push lines &
+ * status look them up here; u64 fields print as integers. */
+typedef struct {
+    const char *name;
+    size_t off;
+    int is_u64;  // uint64_t, else double
+} sample_field_t;
+
+#define SAMPLE_FIELD_D(name, member) { name, offsetof(metric_sample_t, member), 0 }
+#define SAMPLE_FIELD_U(name, member) { name, offsetof(metric_sample_t, member), 1 }
+
+static const sample_field_t sample_fields[] = {
+    SAMPLE_FIELD_D("cpu", cpu_usage),
+    SAMPLE_FIELD_D("memory", memory_usage),
+    SAMPLE_FIELD_D("disk", disk_usage),
+    SAMPLE_FIELD_D("core_max", cpu_core_max),
+    SAMPLE_FIELD_D("core_p95", cpu_core_p95),
+    SAMPLE_FIELD_D("swap", swap_usage),
+    SAMPLE_FIELD_U("mem_avail_kb", mem_avail_kb),
+    SAMPLE_FIELD_U("mem_dirty_kb", mem_dirty_kb),
+    SAMPLE_FIELD_U("mem_writeback_kb", mem_writeback_kb),
+    SAMPLE_FIELD_D("mem_psi_some", mem_psi_some),
+    SAMPLE_FIELD_D("mem_psi_full", mem_psi_full),
+    SAMPLE_FIELD_D("net_rx_bps", net_rx_bps),
+    SAMPLE_FIELD_D("net_tx_bps", net_tx_bps),
+    SAMPLE_FIELD_D("net_rx_pps", net_rx_pps),
+    SAMPLE_FIELD_D("net_tx_pps", net_tx_pps),
+    SAMPLE_FIELD_D("net_errors", net_errors),
+    SAMPLE_FIELD_D("net_drops", net_drops),
+    SAMPLE_FIELD_D("net_util", net_util),
+};
+
+#define N_SAMPLE_FIELDS (sizeof(sample_fields) / sizeof(sample_fields[0]))
+#define SAMPLE_BASE_FIELDS 5  // cpu..core_p95, the ones every reply always had
+
+static inline double sample_field(const metric_sample_t *s, size_t i) {
+    const char *p = (const char *)s + sample_fields[i].off;
+    return sample_fields[i].is_u64 ? (double)*(const uint64_t *)p : *(const double *)p;
+}
+
+/* "name":value (sep is placed before the name, e.g. "," or ", ") */
+static int sample_field_format(char *out, size_t outsz, const metric_sample_t *s, size_t i, const char *sep,
+                               const char *colon) {
+    const char *p = (const char *)s + sample_fields[i].off;
+    if (sample_fields[i].is_u64)
+        return snprintf(out, outsz, "%s\"%s\"%s%llu", sep, sample_fields[i].name, colon,
+                        (unsigned long long)*(const uint64_t *)p);
+    return snprintf(out, outsz, "%s\"%s\"%s%.2f", sep, sample_fields[i].name, colon, *(const double *)p);
+}
+
+static int sample_field_find(const char *name) {
+    for (size_t i = 0; i < N_SAMPLE_FIELDS; i++)
+        if (strcmp(name, sample_fields[i].name) == 0) return (int)i;
+    return -1;
+}
+
+/* "cpu,memory" -> bit i set for sample_fields[i]; 0 if a name is unknown */
+static uint64_t sample_field_mask(const char *list) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", list);
+    uint64_t mask = 0;
+    char *save = NULL;
+    for (char *f = strtok_r(buf, ",", &save); f; f = strtok_r(NULL, ",", &save)) {
+        int i = sample_field_find(f);
+        if (i < 0) return 0;
+        mask |= 1ULL << i;
+    }
+    return mask;
+}
+
+/* Sample ring guarded by a seqlock: producers bump seq to odd while they write a
+ * slot, readers copy optimistically & retry if seq moved. Readers never block
+ * the collectors. The slots live in a separately allocated store so RING_SIZE
+ * can change on reload: ring_resize swaps it under the write lock & frees the
+ * old one after an RCU grace period, since a reader may still be copying. A
+ * store may live in the STATE_FILE mapping instead of the heap; it then keeps
+ * its own copy of head, count & total so the next start can pick it up. */
 typedef struct {
-    metric_sample_t *buf;
     size_t size;
-    size_t head; // next write
-    size_t count;
-    pthread_mutex_t lock;
+    size_t head, count;  // mirror of the ringbuffer_t fields, written under seq
+    unsigned long total;
+    int mapped;          // part of the state file, not freed by ring_*
+    metric_sample_t buf[];
+} ring_store_t;
+
+typedef struct {
+    _Atomic(ring_store_t *) store;
+    atomic_size_t head; // next write
+    atomic_size_t count;
+    atomic_ulong total; // samples ever pushed; sample n (1-based) is its sequence number
+    atomic_uint seq;
 } ringbuffer_t;
 
 typedef struct {
     double cpu_usage;
     double memory_usage;
     double disk_usage;
+    double cpu_core_max;
+    double cpu_core_p95;
     pthread_mutex_t data_lock;
-    pthread_cond_t update_cond;
 } system_metrics_t;
 
+/* Settings. A config file is parsed into a fresh config_t (defaults first),
+ * which is then never modified: SIGHUP publishes the new one through
+ * cur_config & frees the old one after an RCU grace period, so threads read
+ * settings without a lock & never see a half-applied file. Fields marked
+ * "startup" size something allocated once; changing them needs a restart. */
+#define ALERT_MAX_RULES 32
+#define ALERT_TEXT 96
+
+/* Daemon thread roles, for CPU_AFFINITY_<ROLE> & the thread names */
+enum { THR_WRITER, THR_COLLECT, THR_STATVFS, THR_LOG, THR_NET, THR_SIGNAL, THR_PUSH, THR_AGGREGATE, THR_ROLES };
+static const char *const thread_role_keys[THR_ROLES] = { "WRITER", "COLLECT", "STATVFS", "LOG",
+                                                         "NET",    "SIGNAL",  "PUSH",    "AGGREGATE" };
+
+typedef struct {
+    unsigned long gen;          // bumped on every publication
+    char **logfiles;            // LOGFILES
+    int n_logfiles;
+    int listen_port, listen_backlog;
+    int net_workers;            // startup
+    int max_clients;
+    int client_idle_timeout, request_wait_ms;
+    int subscribe_heartbeat_s;  // SUBSCRIBE_HEARTBEAT_S, 0 = none
+    char metrics_logfile[1024];
+    int metrics_log_binary;     // METRICS_LOG_FORMAT=binary
+    char alert_logfile[1024];   // ALERT_LOG; empty -> derived from METRICS_LOG
+    char log_patterns[2048];    // LOG_PATTERNS, compiled by the log thread
+    int writer_queue_size;      // startup
+    int writer_batch, writer_flush_ms, writer_fsync;
+    int log_buffer_size;        // LOG_BUFFER_SIZE, per followed file
+    long log_mmap_min;          // LOG_MMAP_MIN, 0 = never mmap
+    int log_match_ring, log_match_arena_kb;  // startup, 0 = no line capture
+    int ring_size;
+    char state_file[1024];      // STATE_FILE, startup; empty keeps the ring & history on the heap
+    int cpu_interval_ms, disk_interval_ms, diskio_interval_ms;
+    int diskio_history;         // startup, rows kept
+    char cgroup_root[1024];     // CGROUP_ROOT, startup; empty disables the cgroup collector
+    int cgroup_interval_ms;
+    int cgroup_max, cgroup_history;  // startup: cgroups tracked, rows kept per cgroup
+    int statvfs_timeout_ms;
+    int history_raw_kb, history_1m_kb, history_1h_kb;  // startup, memory per history tier
+    int core_history;           // startup
+    int proc_top_n;             // 0 disables the process collector
+    int proc_interval_ms;
+    int proc_fd_cache;          // startup
+    double alert_hysteresis;    // ALERT_HYSTERESIS, percent of the threshold
+    char alert_rules[ALERT_MAX_RULES][ALERT_TEXT];  // ALERT lines, in file order
+    int n_alert_rules;
+    char push_target[256];      // PUSH_TARGET, udp://host:port or tcp://host:port
+    char push_prefix[64];
+    int push_statsd;            // PUSH_FORMAT=statsd, else influx line protocol
+    int push_interval_ms;
+    int push_backlog;           // startup, samples
+    char aggregate_agents[1024];  // AGGREGATE_AGENTS, startup; file of host:port lines, empty = off
+    int aggregate_interval_ms, aggregate_timeout_ms;
+    int aggregate_threads, aggregate_history;  // startup
+    uint64_t aggregate_fields;  // AGGREGATE_FIELDS, bit i: sample_fields[i]
+    cpu_set_t cpu_affinity[THR_ROLES + 1];  // CPU_AFFINITY_<ROLE>, then CPU_AFFINITY for the rest
+    unsigned cpu_affinity_set;  // bit i: cpu_affinity[i] was given
+    int collector_idle;         // COLLECTOR_SCHED=idle
+    int collector_nice;         // COLLECTOR_NICE, COLLECTOR_NICE_UNSET leaves it alone
+    int mlock;                  // MLOCK, startup
+} config_t;
+
+static _Atomic(config_t *) cur_config;
+
+/* The published config. Threads other than the one reloading must hold
+ * rcu_read_lock() while they use it. */
+static inline const config_t *config_get(void) {
+    return atomic_load(&cur_config);
+}
+
 /* Global state */
 static system_metrics_t sys_metrics;
 static ringbuffer_t ringbuf;
 static atomic_int running = 1;
-static char *logfiles[MAX_LOGFILES];
-static int n_logfiles = 0;
-static int listen_port = DEFAULT_PORT;
-static char metrics_logfile[1024] = DEFAULT_METRICS_LOG;
-static int ring_size = DEFAULT_RING_SIZE;
+static int shutdown_efd = -1;   // stays readable once shutdown starts; every loop polls it
+static int sample_efd = -1;     // poked on every publication while anyone subscribes, & on config changes
+static atomic_uint net_subscribers;
 static char config_path[1024] = "./syswatch.cfg";
 
+/* Text destination for alerts & dumps: ALERT_LOG, else METRICS_LOG in text
+ * mode, else METRICS_LOG + ".alerts" when the metrics log is binary. */
+static const char *text_log_path(const config_t *c, char *buf, size_t len) {
+    if (c->alert_logfile[0]) return c->alert_logfile;
+    if (!c->metrics_log_binary) return c->metrics_logfile;
+    snprintf(buf, len, "%s.alerts", c->metrics_logfile);
+    return buf;
+}
+
 /* forward */
 void dump_metrics_to_file();
+void writer_text(const char *line);
+static void alert_config_add(config_t *c, const char *rule);
+static void alert_config_commit(const config_t *c);
 void reload_config();
 
+/* Self-instrumentation.
+ *
+ * Hot paths record into fixed log-linear (HDR-style) histograms: exact below
+ * 16, then 16 sub-buckets per power of two, so any reported value is within
+ * 1/16 of the truth. Recording is three relaxed atomic adds & a max update,
+ * with no locks, so it is safe from any thread. Durations are in nanoseconds
+ * & reported in microseconds. Snapshots read live buckets, so a percentile
+ * may lag the count by the few records in flight. */
+
+#define INSTR_SUB_BITS 4
+#define INSTR_SUB (1 << INSTR_SUB_BITS)
+#define INSTR_MAX_EXP 47  // values >= 2^48 land in the top bucket
+#define INSTR_BUCKETS ((INSTR_MAX_EXP - INSTR_SUB_BITS + 2) * INSTR_SUB)
+
+enum {
+    INSTR_CPU_MEM,        // collect_cpu_mem, one sample
+    INSTR_DISK_SWEEP,     // disk worker, statvfs of every mount
+    INSTR_STATVFS,        // one statvfs call
+    INSTR_METRICS_LOCK,   // wait for sys_metrics.data_lock
+    INSTR_RING_WRITE,     // wait for the sample ring's write side
+    INSTR_STATUS_BUILD,   // status document rebuild
+    INSTR_METRICS_BUILD,  // /metrics page rebuild
+    INSTR_NET_HANDLE,     // building an on-demand network reply
+    INSTR_NET_SEND,       // reply queued -> last byte sent
+    INSTR_LOG_DRAIN,      // one log file drain (read + scan)
+    INSTR_LOG_DRAIN_BYTES,
+    INSTR_PROC_SCAN,      // one walk of /proc/<pid>/stat
+    INSTR_DISKIO,         // one /proc/diskstats sample
+    INSTR_CGROUPS,        // one read of every tracked cgroup
+    INSTR_AGG_MERGE,      // one fleet row from every agent's newest values
+    INSTR_COUNT
+};
+
+typedef struct {
+    const char *name;
+    int bytes;  // value is a size, not a duration
+    atomic_ulong count, sum, max;
+    atomic_ulong b[INSTR_BUCKETS];
+} instr_hist_t;
+
+static instr_hist_t instr[INSTR_COUNT] = {
+    [INSTR_CPU_MEM] = { .name = "collect_cpu_mem" },
+    [INSTR_DISK_SWEEP] = { .name = "disk_sweep" },
+    [INSTR_STATVFS] = { .name = "statvfs" },
+    [INSTR_METRICS_LOCK] = { .name = "metrics_lock_wait" },
+    [INSTR_RING_WRITE] = { .name = "ring_write_wait" },
+    [INSTR_STATUS_BUILD] = { .name = "status_build" },
+    [INSTR_METRICS_BUILD] = { .name = "metrics_build" },
+    [INSTR_NET_HANDLE] = { .name = "net_handle" },
+    [INSTR_NET_SEND] = { .name = "net_send" },
+    [INSTR_LOG_DRAIN] = { .name = "log_drain" },
+    [INSTR_LOG_DRAIN_BYTES] = { .name = "log_drain_bytes", .bytes = 1 },
+    [INSTR_PROC_SCAN] = { .name = "proc_scan" },
+    [INSTR_DISKIO] = { .name = "diskio" },
+    [INSTR_CGROUPS] = { .name = "cgroup_scan" },
+    [INSTR_AGG_MERGE] = { .name = "aggregate_merge" },
+};
+
+static inline uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline size_t instr_bucket(uint64_t v) {
+    if (v < INSTR_SUB) return (size_t)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e > INSTR_MAX_EXP) return INSTR_BUCKETS - 1;
+    return (size_t)(e - INSTR_SUB_BITS + 1) * INSTR_SUB + (size_t)((v >> (e - INSTR_SUB_BITS)) & (INSTR_SUB - 1));
+}
+
+/* Highest value that maps to bucket i */
+static uint64_t instr_bucket_top(size_t i) {
+    if (i < INSTR_SUB) return i;
+    int e = (int)(i / INSTR_SUB) + INSTR_SUB_BITS - 1;
+    uint64_t sub = i % INSTR_SUB;
+    return ((INSTR_SUB + sub + 1) << (e - INSTR_SUB_BITS)) - 1;
+}
+
+static inline void instr_hist_record(instr_hist_t *h, uint64_t v) {
+    atomic_fetch_add_explicit(&h->b[instr_bucket(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+    unsigned long m = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (v > m && !atomic_compare_exchange_weak_explicit(&h->max, &m, v, memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+static inline void instr_record(int id, uint64_t v) {
+    instr_hist_record(&instr[id], v);
+}
+
+static inline void instr_since(int id, uint64_t t0) {
+    instr_record(id, mono_ns() - t0);
+}
+
+typedef struct {
+    unsigned long count;
+    double sum, p50, p90, p99, max;  // microseconds, or bytes
+} instr_snap_t;
+
+static void instr_hist_snapshot(instr_hist_t *h, instr_snap_t *s) {
+    static const double qs[3] = { 0.50, 0.90, 0.99 };
+    double *out[3] = { &s->p50, &s->p90, &s->p99 };
+    double scale = h->bytes ? 1.0 : 1e-3;
+    unsigned long counts[INSTR_BUCKETS], total = 0;
+    for (size_t i = 0; i < INSTR_BUCKETS; i++) total += counts[i] = atomic_load_explicit(&h->b[i], memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    s->count = total;
+    s->sum = (double)atomic_load_explicit(&h->sum, memory_order_relaxed) * scale;
+    s->max = (double)max * scale;
+    s->p50 = s->p90 = s->p99 = 0.0;
+    unsigned long seen = 0;
+    int q = 0;
+    for (size_t i = 0; i < INSTR_BUCKETS && q < 3; i++) {
+        seen += counts[i];
+        while (q < 3 && total && seen >= (unsigned long)(qs[q] * (double)total + 0.999999)) {
+            uint64_t top = instr_bucket_top(i);
+            *out[q++] = (double)(top < max ? top : max) * scale;
+        }
+    }
+}
+
+static void instr_snapshot(int id, instr_snap_t *s) {
+    instr_hist_snapshot(&instr[id], s);
+}
+
+/* sys_metrics.data_lock, with the wait recorded */
+static void metrics_lock(void) {
+    uint64_t t0 = mono_ns();
+    pthread_mutex_lock(&sys_metrics.data_lock);
+    instr_since(INSTR_METRICS_LOCK, t0);
+}
+
+/* Seqlock primitives. Writers claim the lock by moving seq from even to odd, so
+ * the two collector threads still exclude each other without a mutex. */
+static inline unsigned seq_write_begin(atomic_uint *seq) {
+    unsigned s = atomic_load_explicit(seq, memory_order_relaxed);
+    for (;;) {
+        if (s & 1u) {
+            sched_yield();
+            s = atomic_load_explicit(seq, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(seq, &s, s + 1, memory_order_acquire, memory_order_relaxed))
+            break;
+    }
+    atomic_thread_fence(memory_order_release);
+    return s + 1;
+}
+
+static inline void seq_write_end(atomic_uint *seq, unsigned s) {
+    atomic_store_explicit(seq, s + 1, memory_order_release);
+}
+
+static inline unsigned seq_read_begin(atomic_uint *seq) {
+    unsigned s;
+    while ((s = atomic_load_explicit(seq, memory_order_acquire)) & 1u) sched_yield();
+    return s;
+}
+
+static inline int seq_read_retry(atomic_uint *seq, unsigned s) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != s;
+}
+
+/* RCU for objects that are replaced as a whole (the config, ring storage).
+ * A reader registers in the counter for the parity of the current epoch for
+ * the length of a short section & dereferences the pointer inside it; the
+ * updater publishes the new pointer, flips the epoch & waits for the old
+ * parity's readers to drain before it frees what it replaced. Readers only
+ * touch their counter, never block & never retry more than once per flip.
+ * Sections must not span a blocking wait or every grace period waits too. */
+static struct {
+    atomic_uint epoch;
+    atomic_uint readers[2];
+    pthread_mutex_t sync_lock;  // one grace period at a time
+} rcu = { .sync_lock = PTHREAD_MUTEX_INITIALIZER };
+
+static inline unsigned rcu_read_lock(void) {
+    for (;;) {
+        unsigned e = atomic_load(&rcu.epoch);
+        atomic_fetch_add(&rcu.readers[e & 1u], 1);
+        if (atomic_load(&rcu.epoch) == e) return e;
+        atomic_fetch_sub(&rcu.readers[e & 1u], 1);  // flipped under us: register with the new parity
+    }
+}
+
+static inline void rcu_read_unlock(unsigned e) {
+    atomic_fetch_sub_explicit(&rcu.readers[e & 1u], 1, memory_order_release);
+}
+
+/* Wait until no reader can still hold a pointer unpublished before the call */
+static void rcu_synchronize(void) {
+    pthread_mutex_lock(&rcu.sync_lock);
+    unsigned e = atomic_fetch_add(&rcu.epoch, 1);
+    while (atomic_load(&rcu.readers[e & 1u]) != 0) {
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+    }
+    pthread_mutex_unlock(&rcu.sync_lock);
+}
+
+static ring_store_t *ring_store_alloc(size_t size) {
+    ring_store_t *st = calloc(1, sizeof(ring_store_t) + size * sizeof(metric_sample_t));
+    if (st) st->size = size;
+    return st;
+}
+
 static void ring_init(ringbuffer_t *r, size_t size) {
-    r->buf = calloc(size, sizeof(metric_sample_t));
-    if (!r->buf) {
+    ring_store_t *st = ring_store_alloc(size);
+    if (!st) {
         fprintf(stderr, "FATAL: cannot allocate ringbuffer of size %zu\n", size);
         exit(1);
     }
-    r->size = size;
-    r->head = 0;
-    r->count = 0;
-    pthread_mutex_init(&r->lock, NULL);
+    atomic_init(&r->store, st);
+    atomic_init(&r->head, 0);
+    atomic_init(&r->count, 0);
+    atomic_init(&r->total, 0);
+    atomic_init(&r->seq, 0);
+}
+
+static void ring_free(ringbuffer_t *r) {
+    ring_store_t *st = atomic_load(&r->store);
+    if (st && !st->mapped) free(st);
+    atomic_store(&r->store, NULL);
+}
+
+/* Slots right now; a reader sizing a copy passes this on as its max */
+static size_t ring_capacity(ringbuffer_t *r) {
+    unsigned e = rcu_read_lock();
+    size_t size = atomic_load(&r->store)->size;
+    rcu_read_unlock(e);
+    return size;
 }
 
 static void ring_push(ringbuffer_t *r, metric_sample_t *s) {
-    pthread_mutex_lock(&r->lock);
-    r->buf[r->head] = *s;
-    r->head = (r->head + 1) % r->size;
-    if (r->count < r->size) r->count++;
-    pthread_mutex_unlock(&r->lock);
+    uint64_t t0 = mono_ns();
+    unsigned seq = seq_write_begin(&r->seq);
+    instr_since(INSTR_RING_WRITE, t0);
+    ring_store_t *st = atomic_load_explicit(&r->store, memory_order_relaxed);  // only swapped under seq
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t count = atomic_load_explicit(&r->count, memory_order_relaxed);
+    st->buf[head] = *s;
+    st->head = (head + 1 == st->size) ? 0 : head + 1;
+    if (count < st->size) st->count = count + 1;
+    st->total = atomic_load_explicit(&r->total, memory_order_relaxed) + 1;
+    atomic_store_explicit(&r->head, st->head, memory_order_relaxed);
+    atomic_store_explicit(&r->count, st->count, memory_order_relaxed);
+    atomic_store_explicit(&r->total, st->total, memory_order_relaxed);
+    seq_write_end(&r->seq, seq);
+}
+
+/* Move the newest samples (& their sequence numbers) into ns & make it the
+ * store. Collectors wait on the seqlock for the copy; readers retry. Returns
+ * the old store, which readers may use until the next RCU grace period. */
+static ring_store_t *ring_swap_store(ringbuffer_t *r, ring_store_t *ns) {
+    unsigned seq = seq_write_begin(&r->seq);
+    ring_store_t *os = atomic_load_explicit(&r->store, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t count = atomic_load_explicit(&r->count, memory_order_relaxed);
+    size_t keep = count < ns->size ? count : ns->size;
+    for (size_t i = 0; i < keep; i++) ns->buf[i] = os->buf[(head + os->size - keep + i) % os->size];
+    ns->head = keep == ns->size ? 0 : keep;
+    ns->count = keep;
+    ns->total = atomic_load_explicit(&r->total, memory_order_relaxed);
+    atomic_store(&r->store, ns);
+    atomic_store_explicit(&r->head, ns->head, memory_order_relaxed);
+    atomic_store_explicit(&r->count, keep, memory_order_relaxed);
+    seq_write_end(&r->seq, seq);
+    return os;
+}
+
+/* Give the ring `size` slots on the heap */
+static int ring_resize(ringbuffer_t *r, size_t size) {
+    ring_store_t *ns = ring_store_alloc(size);
+    if (!ns) return -1;
+    ring_store_t *os = ring_swap_store(r, ns);
+    rcu_synchronize();
+    if (!os->mapped) free(os);
+    return 0;
 }
 
-static void ring_snapshot(ringbuffer_t *r, metric_sample_t *out, size_t *out_len) {
-    pthread_mutex_lock(&r->lock);
-    size_t len = r->count;
+/* Continue from a store that already holds samples (a restored state file) */
+static void ring_attach(ringbuffer_t *r, ring_store_t *st) {
+    atomic_init(&r->store, st);
+    atomic_init(&r->head, st->head);
+    atomic_init(&r->count, st->count);
+    atomic_init(&r->total, st->total);
+    atomic_init(&r->seq, 0);
+}
+
+/* Copy the newest (at most max) samples oldest-first as (at most) two
+ * contiguous ranges */
+static void ring_snapshot(ringbuffer_t *r, metric_sample_t *out, size_t max, size_t *out_len) {
+    size_t len;
+    unsigned seq, e = rcu_read_lock();
+    do {
+        seq = seq_read_begin(&r->seq);
+        const ring_store_t *st = atomic_load(&r->store);
+        size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        len = atomic_load_explicit(&r->count, memory_order_relaxed);
+        if (head >= st->size) head = 0;  // raced a resize; the retry below discards this pass
+        if (len > st->size) len = st->size;
+        if (len > max) len = max;
+        size_t start = (head >= len) ? head - len : head + st->size - len;
+        size_t first = st->size - start;
+        if (first > len) first = len;
+        memcpy(out, &st->buf[start], first * sizeof(metric_sample_t));
+        memcpy(out + first, st->buf, (len - first) * sizeof(metric_sample_t));
+    } while (seq_read_retry(&r->seq, seq));
+    rcu_read_unlock(e);
     *out_len = len;
-    for (size_t i = 0; i < len; i++) {
-        size_t idx = (r->head + r->size - len + i) % r->size;
-        out[i] = r->buf[idx];
-    }
-    pthread_mutex_unlock(&r->lock);
+}
+
+/* Copy up to max samples with sequence number > after, oldest first, as (at
+ * most) two contiguous ranges like ring_snapshot. Returns the count & sets
+ * *first to the sequence number of out[0]; *first > after + 1 means the ring
+ * overwrote samples the caller had not read yet. */
+static size_t ring_read_after(ringbuffer_t *r, unsigned long after, metric_sample_t *out, size_t max,
+                              unsigned long *first) {
+    size_t n;
+    unsigned seq, e = rcu_read_lock();
+    do {
+        seq = seq_read_begin(&r->seq);
+        const ring_store_t *st = atomic_load(&r->store);
+        size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        size_t len = atomic_load_explicit(&r->count, memory_order_relaxed);
+        unsigned long total = atomic_load_explicit(&r->total, memory_order_relaxed);
+        if (head >= st->size) head = 0;
+        if (len > st->size) len = st->size;
+        if (len > total) len = (size_t)total;
+        unsigned long oldest = total - len + 1;
+        *first = (after + 1 > oldest) ? after + 1 : oldest;
+        n = (total >= *first) ? (size_t)(total - *first + 1) : 0;
+        if (n > max) n = max;
+        size_t back = (total >= *first) ? (size_t)(total - *first + 1) : 0;  // slots behind head
+        size_t start = (head >= back) ? head - back : head + st->size - back;
+        size_t run = st->size - start;
+        if (run > n) run = n;
+        memcpy(out, &st->buf[start], run * sizeof(metric_sample_t));
+        memcpy(out + run, st->buf, (n - run) * sizeof(metric_sample_t));
+    } while (seq_read_retry(&r->seq, seq));
+    rcu_read_unlock(e);
+    return n;
 }
 
 /* Utilities: read config */
@@ -141,13 +750,122 @@ void trim(char *s) {
     }
 }
 
-void parse_config(const char *path) {
+/* "0-3,8,10-11" -> set; 0 on success, -1 on a syntax error or a CPU past
+ * CPU_SETSIZE. An empty list gives an empty set. */
+int parse_cpu_list(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s == ' ') s++;
+    while (*s) {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s || lo < 0) return -1;
+        s = end;
+        if (*s == '-') {
+            hi = strtol(s + 1, &end, 10);
+            if (end == s + 1 || hi < lo) return -1;
+            s = end;
+        }
+        if (hi >= CPU_SETSIZE) return -1;
+        for (long cpu = lo; cpu <= hi; cpu++) CPU_SET((int)cpu, set);
+        while (*s == ' ') s++;
+        if (*s == ',') s++;
+        else if (*s) return -1;
+        while (*s == ' ') s++;
+    }
+    return 0;
+}
+
+static config_t *config_new(void) {
+    config_t *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->listen_port = DEFAULT_PORT;
+    c->listen_backlog = DEFAULT_LISTEN_BACKLOG;
+    c->max_clients = DEFAULT_MAX_CLIENTS;
+    c->client_idle_timeout = DEFAULT_CLIENT_IDLE_TIMEOUT;
+    c->request_wait_ms = DEFAULT_REQUEST_WAIT_MS;
+    c->subscribe_heartbeat_s = DEFAULT_SUBSCRIBE_HEARTBEAT_S;
+    snprintf(c->metrics_logfile, sizeof(c->metrics_logfile), "%s", DEFAULT_METRICS_LOG);
+    snprintf(c->log_patterns, sizeof(c->log_patterns), "%s", DEFAULT_LOG_PATTERNS);
+    c->writer_queue_size = DEFAULT_WRITER_QUEUE;
+    c->writer_batch = DEFAULT_WRITER_BATCH;
+    c->writer_flush_ms = DEFAULT_WRITER_FLUSH_MS;
+    c->writer_fsync = 1;
+    c->log_buffer_size = DEFAULT_LOG_BUFFER_SIZE;
+    c->log_mmap_min = DEFAULT_LOG_MMAP_MIN;
+    c->log_match_ring = DEFAULT_LOG_MATCH_RING;
+    c->log_match_arena_kb = DEFAULT_LOG_MATCH_ARENA_KB;
+    c->ring_size = DEFAULT_RING_SIZE;
+    snprintf(c->state_file, sizeof(c->state_file), "%s", DEFAULT_STATE_FILE);
+    c->cpu_interval_ms = DEFAULT_CPU_INTERVAL_MS;
+    c->disk_interval_ms = DEFAULT_DISK_INTERVAL_MS;
+    c->diskio_interval_ms = DEFAULT_DISKIO_INTERVAL_MS;
+    c->diskio_history = DEFAULT_DISKIO_HISTORY;
+    snprintf(c->cgroup_root, sizeof(c->cgroup_root), "%s", DEFAULT_CGROUP_ROOT);
+    c->cgroup_interval_ms = DEFAULT_CGROUP_INTERVAL_MS;
+    c->cgroup_max = DEFAULT_CGROUP_MAX;
+    c->cgroup_history = DEFAULT_CGROUP_HISTORY;
+    c->statvfs_timeout_ms = DEFAULT_STATVFS_TIMEOUT_MS;
+    c->history_raw_kb = DEFAULT_HISTORY_RAW_KB;
+    c->history_1m_kb = DEFAULT_HISTORY_1M_KB;
+    c->history_1h_kb = DEFAULT_HISTORY_1H_KB;
+    c->core_history = DEFAULT_CORE_HISTORY;
+    c->proc_top_n = DEFAULT_PROC_TOP_N;
+    c->proc_interval_ms = DEFAULT_PROC_INTERVAL_MS;
+    c->proc_fd_cache = DEFAULT_PROC_FD_CACHE;
+    c->alert_hysteresis = DEFAULT_ALERT_HYSTERESIS;
+    snprintf(c->push_prefix, sizeof(c->push_prefix), "%s", DEFAULT_PUSH_PREFIX);
+    c->push_interval_ms = DEFAULT_PUSH_INTERVAL_MS;
+    c->push_backlog = DEFAULT_PUSH_BACKLOG;
+    c->collector_nice = COLLECTOR_NICE_UNSET;
+    c->aggregate_interval_ms = DEFAULT_AGGREGATE_INTERVAL_MS;
+    c->aggregate_timeout_ms = DEFAULT_AGGREGATE_TIMEOUT_MS;
+    c->aggregate_threads = DEFAULT_AGGREGATE_THREADS;
+    c->aggregate_history = DEFAULT_AGGREGATE_HISTORY;
+    c->aggregate_fields = sample_field_mask(DEFAULT_AGGREGATE_FIELDS);
+    return c;
+}
+
+static void config_free_logfiles(config_t *c) {
+    for (int i = 0; i < c->n_logfiles; i++) free(c->logfiles[i]);
+    free(c->logfiles);
+    c->logfiles = NULL;
+    c->n_logfiles = 0;
+}
+
+static void config_free(config_t *c) {
+    if (!c) return;
+    config_free_logfiles(c);
+    free(c);
+}
+
+/* Make c current & return the previous config, which readers may still be
+ * using: free it only after rcu_synchronize(). One publisher at a time. */
+static config_t *config_publish(config_t *c) {
+    config_t *old = atomic_load(&cur_config);
+    c->gen = old ? old->gen + 1 : 1;
+    atomic_store(&cur_config, c);
+    return old;
+}
+
+/* A new config: the defaults, then path on top. NULL if path cannot be read. */
+static config_t *config_parse(const char *path) {
     FILE *f = fopen(path, "r");
-    if (!f) return;
+    if (!f) return NULL;
+    config_t *cfg = config_new();
+    if (!cfg) {
+        fclose(f);
+        return NULL;
+    }
     char line[2048];
     while (fgets(line, sizeof(line), f)) {
         trim(line);
         if (line[0] == '#' || line[0] == '\0') continue;
+        if (strncmp(line, "ALERT", 5) == 0 && (line[5] == ' ' || line[5] == '\t')) {  // "ALERT cpu>=90"
+            char *rule = line + 6;
+            while (*rule == ' ' || *rule == '\t') rule++;
+            alert_config_add(cfg, rule);
+            continue;
+        }
         char *eq = strchr(line, '=');
         if (!eq) continue;
         *eq = '\0';
@@ -156,32 +874,443 @@ void parse_config(const char *path) {
         trim(k);
         trim(v);
         if (strcmp(k, "LOGFILES") == 0) {
-            // free previous
-            for (int i = 0; i < n_logfiles; ++i) {
-                free(logfiles[i]);
-                logfiles[i] = NULL;
-            }
-            // comma separated
-            char *tok = strtok(v, ",");
-            n_logfiles = 0;
-            while (tok && n_logfiles < MAX_LOGFILES) {
+            // comma separated, no limit on the count
+            char **list = NULL;
+            int n = 0, cap = 0;
+            for (char *tok = strtok(v, ","); tok; tok = strtok(NULL, ",")) {
                 trim(tok);
-                logfiles[n_logfiles++] = strdup(tok);
-                tok = strtok(NULL, ",");
+                if (!*tok) continue;
+                if (n == cap) {
+                    int nc = cap ? cap * 2 : 16;
+                    char **nl = realloc(list, (size_t)nc * sizeof(char *));
+                    if (!nl) break;
+                    list = nl;
+                    cap = nc;
+                }
+                if ((list[n] = strdup(tok)) != NULL) n++;
             }
+            // a repeated key replaces the earlier list
+            config_free_logfiles(cfg);
+            cfg->logfiles = list;
+            cfg->n_logfiles = n;
         } else if (strcmp(k, "PORT") == 0) {
             int p = atoi(v);
-            if (p > 0 && p <= 65535) listen_port = p;
+            if (p > 0 && p <= 65535) cfg->listen_port = p;
+        } else if (strcmp(k, "LISTEN_BACKLOG") == 0) {
+            int b = atoi(v);
+            cfg->listen_backlog = (b > 0) ? b : DEFAULT_LISTEN_BACKLOG;
+        } else if (strcmp(k, "NET_WORKERS") == 0) {
+            int w = atoi(v);
+            cfg->net_workers = (w >= 0 && w <= 64) ? w : 0;
+        } else if (strcmp(k, "MAX_CLIENTS") == 0) {
+            int c = atoi(v);
+            cfg->max_clients = (c > 0) ? c : DEFAULT_MAX_CLIENTS;
+        } else if (strcmp(k, "CLIENT_IDLE_TIMEOUT") == 0) {
+            int t = atoi(v);
+            cfg->client_idle_timeout = (t > 0) ? t : DEFAULT_CLIENT_IDLE_TIMEOUT;
+        } else if (strcmp(k, "REQUEST_WAIT_MS") == 0) {
+            int t = atoi(v);
+            cfg->request_wait_ms = (t >= 0) ? t : DEFAULT_REQUEST_WAIT_MS;
+        } else if (strcmp(k, "SUBSCRIBE_HEARTBEAT_S") == 0) {
+            int t = atoi(v);
+            cfg->subscribe_heartbeat_s = (t >= 0) ? t : DEFAULT_SUBSCRIBE_HEARTBEAT_S;
         } else if (strcmp(k, "METRICS_LOG") == 0) {
-            strncpy(metrics_logfile, v, sizeof(metrics_logfile) - 1);
-            metrics_logfile[sizeof(metrics_logfile) - 1] = '\0';
+            strncpy(cfg->metrics_logfile, v, sizeof(cfg->metrics_logfile) - 1);
+            cfg->metrics_logfile[sizeof(cfg->metrics_logfile) - 1] = '\0';
+        } else if (strcmp(k, "METRICS_LOG_FORMAT") == 0) {
+            cfg->metrics_log_binary = (strcasecmp(v, "binary") == 0);
+        } else if (strcmp(k, "LOG_PATTERNS") == 0) {
+            snprintf(cfg->log_patterns, sizeof(cfg->log_patterns), "%s", v);
+        } else if (strcmp(k, "WRITER_QUEUE") == 0) {
+            int q = atoi(v);
+            cfg->writer_queue_size = (q > 0) ? q : DEFAULT_WRITER_QUEUE;
+        } else if (strcmp(k, "WRITER_BATCH") == 0) {
+            int b = atoi(v);
+            cfg->writer_batch = (b > 0) ? b : DEFAULT_WRITER_BATCH;
+        } else if (strcmp(k, "WRITER_FLUSH_MS") == 0) {
+            int t = atoi(v);
+            cfg->writer_flush_ms = (t > 0) ? t : DEFAULT_WRITER_FLUSH_MS;
+        } else if (strcmp(k, "WRITER_FSYNC") == 0) {
+            cfg->writer_fsync = atoi(v) != 0;
+        } else if (strcmp(k, "CPU_INTERVAL_MS") == 0) {
+            int t = atoi(v);
+            cfg->cpu_interval_ms = (t >= MIN_INTERVAL_MS) ? t : DEFAULT_CPU_INTERVAL_MS;
+        } else if (strcmp(k, "DISK_INTERVAL_MS") == 0) {
+            int t = atoi(v);
+            cfg->disk_interval_ms = (t >= MIN_INTERVAL_MS) ? t : DEFAULT_DISK_INTERVAL_MS;
+        } else if (strcmp(k, "HISTORY_RAW_KB") == 0) {
+            int kb = atoi(v);
+            cfg->history_raw_kb = (kb >= 0) ? kb : DEFAULT_HISTORY_RAW_KB;
+        } else if (strcmp(k, "HISTORY_1M_KB") == 0) {
+            int kb = atoi(v);
+            cfg->history_1m_kb = (kb >= 0) ? kb : DEFAULT_HISTORY_1M_KB;
+        } else if (strcmp(k, "HISTORY_1H_KB") == 0) {
+            int kb = atoi(v);
+            cfg->history_1h_kb = (kb >= 0) ? kb : DEFAULT_HISTORY_1H_KB;
+        } else if (strcmp(k, "STATVFS_TIMEOUT_MS") == 0) {
+            int t = atoi(v);
+            cfg->statvfs_timeout_ms = (t > 0) ? t : DEFAULT_STATVFS_TIMEOUT_MS;
+        } else if (strcmp(k, "LOG_BUFFER_SIZE") == 0) {
+            int b = atoi(v);
+            cfg->log_buffer_size = (b >= BUFSZ) ? b : DEFAULT_LOG_BUFFER_SIZE;
+        } else if (strcmp(k, "LOG_MMAP_MIN") == 0) {
+            long m = atol(v);
+            cfg->log_mmap_min = (m >= 0) ? m : DEFAULT_LOG_MMAP_MIN;
+        } else if (strcmp(k, "LOG_MATCH_RING") == 0) {
+            int n = atoi(v);
+            cfg->log_match_ring = (n >= 0) ? n : DEFAULT_LOG_MATCH_RING;
+        } else if (strcmp(k, "LOG_MATCH_ARENA_KB") == 0) {
+            int kb = atoi(v);
+            cfg->log_match_arena_kb = (kb >= 4) ? kb : 4;  // must hold the longest record
+        } else if (strcmp(k, "ALERT_LOG") == 0) {
+            strncpy(cfg->alert_logfile, v, sizeof(cfg->alert_logfile) - 1);
+            cfg->alert_logfile[sizeof(cfg->alert_logfile) - 1] = '\0';
+        } else if (strcmp(k, "PUSH_TARGET") == 0) {
+            snprintf(cfg->push_target, sizeof(cfg->push_target), "%s", v);
+        } else if (strcmp(k, "PUSH_FORMAT") == 0) {
+            cfg->push_statsd = (strcasecmp(v, "statsd") == 0);
+        } else if (strcmp(k, "PUSH_PREFIX") == 0) {
+            snprintf(cfg->push_prefix, sizeof(cfg->push_prefix), "%s", v[0] ? v : DEFAULT_PUSH_PREFIX);
+        } else if (strcmp(k, "PUSH_INTERVAL_MS") == 0) {
+            int t = atoi(v);
+            cfg->push_interval_ms = (t >= MIN_INTERVAL_MS) ? t : DEFAULT_PUSH_INTERVAL_MS;
+        } else if (strcmp(k, "PUSH_BACKLOG") == 0) {
+            int b = atoi(v);
+            cfg->push_backlog = (b > 0) ? b : DEFAULT_PUSH_BACKLOG;
+        } else if (strcmp(k, "PROC_TOP_N") == 0) {
+            int n = atoi(v);
+            cfg->proc_top_n = (n >= 0) ? n : DEFAULT_PROC_TOP_N;
+        } else if (strcmp(k, "PROC_INTERVAL_MS") == 0) {
+            int t = atoi(v);
+            cfg->proc_interval_ms = (t >= MIN_INTERVAL_MS) ? t : DEFAULT_PROC_INTERVAL_MS;
+        } else if (strcmp(k, "PROC_FD_CACHE") == 0) {
+            int n = atoi(v);
+            cfg->proc_fd_cache = (n >= 0) ? n : DEFAULT_PROC_FD_CACHE;
+        } else if (strcmp(k, "STATE_FILE") == 0) {
+            snprintf(cfg->state_file, sizeof(cfg->state_file), "%s", v);
         } else if (strcmp(k, "RING_SIZE") == 0) {
             int rs = atoi(v);
-            if (rs > 0) ring_size = rs;
-            else ring_size = DEFAULT_RING_SIZE;
+            if (rs > 0) cfg->ring_size = rs;
+            else cfg->ring_size = DEFAULT_RING_SIZE;
+        } else if (strcmp(k, "DISKIO_INTERVAL_MS") == 0) {
+            int t = atoi(v);
+            cfg->diskio_interval_ms = (t >= MIN_INTERVAL_MS) ? t : DEFAULT_DISKIO_INTERVAL_MS;
+        } else if (strcmp(k, "DISKIO_HISTORY") == 0) {
+            int h = atoi(v);
+            cfg->diskio_history = (h > 0) ? h : DEFAULT_DISKIO_HISTORY;
+        } else if (strcmp(k, "CGROUP_ROOT") == 0) {
+            snprintf(cfg->cgroup_root, sizeof(cfg->cgroup_root), "%s", v);
+        } else if (strcmp(k, "CGROUP_INTERVAL_MS") == 0) {
+            int t = atoi(v);
+            cfg->cgroup_interval_ms = (t >= MIN_INTERVAL_MS) ? t : DEFAULT_CGROUP_INTERVAL_MS;
+        } else if (strcmp(k, "CGROUP_MAX") == 0) {
+            int m = atoi(v);
+            cfg->cgroup_max = (m >= 0) ? m : DEFAULT_CGROUP_MAX;
+        } else if (strcmp(k, "CGROUP_HISTORY") == 0) {
+            int h = atoi(v);
+            cfg->cgroup_history = (h > 0) ? h : DEFAULT_CGROUP_HISTORY;
+        } else if (strcmp(k, "ALERT") == 0) {
+            alert_config_add(cfg, v);
+        } else if (strcmp(k, "ALERT_HYSTERESIS") == 0) {
+            char *end;
+            double h = strtod(v, &end);
+            cfg->alert_hysteresis = (end != v && h >= 0 && h < 100) ? h : DEFAULT_ALERT_HYSTERESIS;
+        } else if (strncmp(k, "CPU_AFFINITY", 12) == 0) {
+            int i = THR_ROLES;  // plain CPU_AFFINITY: every role without its own
+            cpu_set_t set;
+            if (k[12] == '_')
+                for (i = 0; i < THR_ROLES && strcmp(k + 13, thread_role_keys[i]) != 0; i++) {}
+            if (i == THR_ROLES && k[12]) {
+                fprintf(stderr, "config: unknown thread role in %s, ignoring\n", k);
+            } else if (parse_cpu_list(v, &set) != 0) {
+                fprintf(stderr, "config: bad CPU list '%s' for %s, ignoring\n", v, k);
+            } else {
+                cfg->cpu_affinity[i] = set;
+                if (CPU_COUNT(&set) > 0) cfg->cpu_affinity_set |= 1u << i;
+                else cfg->cpu_affinity_set &= ~(1u << i);  // empty: not pinned
+            }
+        } else if (strcmp(k, "COLLECTOR_SCHED") == 0) {
+            cfg->collector_idle = (strcasecmp(v, "idle") == 0);
+        } else if (strcmp(k, "COLLECTOR_NICE") == 0) {
+            char *end;
+            long n = strtol(v, &end, 10);
+            cfg->collector_nice = (end != v && !*end && n >= -20 && n <= 19) ? (int)n : COLLECTOR_NICE_UNSET;
+        } else if (strcmp(k, "AGGREGATE_AGENTS") == 0) {
+            snprintf(cfg->aggregate_agents, sizeof(cfg->aggregate_agents), "%s", v);
+        } else if (strcmp(k, "AGGREGATE_INTERVAL_MS") == 0) {
+            int t = atoi(v);
+            cfg->aggregate_interval_ms = (t >= MIN_INTERVAL_MS) ? t : DEFAULT_AGGREGATE_INTERVAL_MS;
+        } else if (strcmp(k, "AGGREGATE_TIMEOUT_MS") == 0) {
+            int t = atoi(v);
+            cfg->aggregate_timeout_ms = (t >= MIN_INTERVAL_MS) ? t : DEFAULT_AGGREGATE_TIMEOUT_MS;
+        } else if (strcmp(k, "AGGREGATE_THREADS") == 0) {
+            int n = atoi(v);
+            cfg->aggregate_threads = (n > 0 && n <= MAX_AGGREGATE_THREADS) ? n : DEFAULT_AGGREGATE_THREADS;
+        } else if (strcmp(k, "AGGREGATE_HISTORY") == 0) {
+            int h = atoi(v);
+            cfg->aggregate_history = (h > 0) ? h : DEFAULT_AGGREGATE_HISTORY;
+        } else if (strcmp(k, "AGGREGATE_FIELDS") == 0) {
+            uint64_t m = sample_field_mask(v);
+            if (m) cfg->aggregate_fields = m;
+            else fprintf(stderr, "config: bad AGGREGATE_FIELDS '%s', ignoring\n", v);
+        } else if (strcmp(k, "MLOCK") == 0) {
+            cfg->mlock = atoi(v) != 0;
+        } else if (strcmp(k, "CORE_HISTORY") == 0) {
+            int ch = atoi(v);
+            if (ch > 0) cfg->core_history = ch;
+            else cfg->core_history = DEFAULT_CORE_HISTORY;
         }
     }
     fclose(f);
+    return cfg;
+}
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Daemon threads. Every long-lived thread starts through thread_spawn(),
+ * which names it "sw-<role>" (top -H, perf) & registers its tid, so the
+ * CPU_AFFINITY* sets & the collector scheduling settings apply when it starts
+ * & again on every reload. A setting that is dropped goes back to what the
+ * process started with. Collectors are the roles that only sample. */
+#define THREAD_SLOTS 256
+
+typedef struct {
+    void *(*fn)(void *);
+    void *arg;
+    int role;
+    char name[16];
+} thread_start_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pid_t tid[THREAD_SLOTS];  // 0: free
+    int role[THREAD_SLOTS];
+    char name[THREAD_SLOTS][16];
+    cpu_set_t base_cpus;      // the process's own settings, captured by thread_base()
+    int base_policy, base_nice, have_base;
+    struct sched_param base_param;
+} threads = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int thread_collects(int role) {
+    return role == THR_COLLECT || role == THR_STATVFS || role == THR_LOG;
+}
+
+/* Remember the settings inherited from the launcher, before any are changed */
+static void thread_base(void) {
+    pthread_mutex_lock(&threads.lock);
+    if (!threads.have_base) {
+        if (sched_getaffinity(0, sizeof(threads.base_cpus), &threads.base_cpus) != 0) CPU_ZERO(&threads.base_cpus);
+        threads.base_policy = sched_getscheduler(0);
+        if (threads.base_policy < 0 || sched_getparam(0, &threads.base_param) != 0) {
+            threads.base_policy = SCHED_OTHER;
+            memset(&threads.base_param, 0, sizeof(threads.base_param));
+        }
+        errno = 0;
+        threads.base_nice = getpriority(PRIO_PROCESS, 0);
+        if (errno) threads.base_nice = 0;
+        threads.have_base = 1;
+    }
+    pthread_mutex_unlock(&threads.lock);
+}
+
+/* Apply c to one thread; caller holds threads.lock. Failures (a CPU that is
+ * offline, a nice value below the current one without CAP_SYS_NICE) are
+ * reported & leave that setting as it was. */
+static void thread_tune(pid_t tid, int role, const char *name, const config_t *c) {
+    const cpu_set_t *cpus = (c->cpu_affinity_set >> role & 1u)        ? &c->cpu_affinity[role]
+                            : (c->cpu_affinity_set >> THR_ROLES & 1u) ? &c->cpu_affinity[THR_ROLES]
+                                                                      : &threads.base_cpus;
+    if (CPU_COUNT(cpus) > 0 && sched_setaffinity(tid, sizeof(*cpus), cpus) != 0)
+        fprintf(stderr, "threads: %s: cannot set the CPU affinity: %s\n", name, strerror(errno));
+    if (!thread_collects(role)) return;
+    static const struct sched_param idle_param;
+    int policy = c->collector_idle ? SCHED_IDLE : threads.base_policy;
+    const struct sched_param *param = c->collector_idle ? &idle_param : &threads.base_param;
+    if (sched_getscheduler(tid) != policy && sched_setscheduler(tid, policy, param) != 0)
+        fprintf(stderr, "threads: %s: cannot set the scheduling policy: %s\n", name, strerror(errno));
+    int nice = c->collector_nice != COLLECTOR_NICE_UNSET ? c->collector_nice : threads.base_nice;
+    errno = 0;
+    int cur = getpriority(PRIO_PROCESS, (id_t)tid);
+    if ((cur != nice || errno) && setpriority(PRIO_PROCESS, (id_t)tid, nice) != 0)
+        fprintf(stderr, "threads: %s: cannot set nice %d: %s\n", name, nice, strerror(errno));
+}
+
+/* Re-apply c to every running thread (config reload) */
+static void threads_retune(const config_t *c) {
+    pthread_mutex_lock(&threads.lock);
+    for (int i = 0; i < THREAD_SLOTS; i++)
+        if (threads.tid[i]) thread_tune(threads.tid[i], threads.role[i], threads.name[i], c);
+    pthread_mutex_unlock(&threads.lock);
+}
+
+static void *thread_main(void *arg) {
+    thread_start_t st = *(thread_start_t *)arg;
+    free(arg);
+    pthread_setname_np(pthread_self(), st.name);
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    int slot = -1;
+    pthread_mutex_lock(&threads.lock);
+    for (int i = 0; i < THREAD_SLOTS && slot < 0; i++)
+        if (!threads.tid[i]) slot = i;
+    if (slot >= 0) {  // past THREAD_SLOTS a thread is tuned now but skipped on reload
+        threads.tid[slot] = tid;
+        threads.role[slot] = st.role;
+        memcpy(threads.name[slot], st.name, sizeof(st.name));
+    }
+    unsigned e = rcu_read_lock();
+    thread_tune(tid, st.role, st.name, config_get());
+    rcu_read_unlock(e);
+    pthread_mutex_unlock(&threads.lock);
+    void *ret = st.fn(st.arg);
+    pthread_mutex_lock(&threads.lock);
+    if (slot >= 0) threads.tid[slot] = 0;
+    pthread_mutex_unlock(&threads.lock);
+    return ret;
+}
+
+/* MLOCK: lock what is mapped now & everything mapped later, so sampling never
+ * waits for a page to come back from swap. Every page of a locked stack is
+ * resident, so threads started after this get THREAD_STACK_LOCKED stacks
+ * instead of the 8 MiB default. */
+#define THREAD_STACK_LOCKED (512 * 1024)
+
+static void memory_lock(void) {
+    pthread_attr_t a;
+    if (pthread_attr_init(&a) == 0) {
+        if (pthread_attr_setstacksize(&a, THREAD_STACK_LOCKED) == 0) pthread_setattr_default_np(&a);
+        pthread_attr_destroy(&a);
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        fprintf(stderr, "mlock: cannot lock memory (%s); needs CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK\n",
+                strerror(errno));
+}
+
+/* pthread_create() for a daemon thread of the given role, named name (at
+ * most 15 characters are kept). Returns 0 or an errno value. */
+static int thread_spawn(pthread_t *t, const pthread_attr_t *attr, int role, const char *name, void *(*fn)(void *),
+                        void *arg) {
+    thread_start_t *st = malloc(sizeof(*st));
+    if (!st) return ENOMEM;
+    st->fn = fn;
+    st->arg = arg;
+    st->role = role;
+    snprintf(st->name, sizeof(st->name), "%s", name);
+    thread_base();
+    int rc = pthread_create(t, attr, thread_main, st);
+    if (rc != 0) free(st);
+    return rc;
+}
+
+/* Collector layer: /proc files are opened once & re-read with pread() at offset 0
+ * into a reusable buffer, so a sample costs no open/close or stdio allocation. */
+typedef struct {
+    const char *path;
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t len;
+} proc_file_t;
+
+#define PROC_INITIAL_BUFSZ 4096
+
+void proc_file_init(proc_file_t *pf, const char *path) {
+    pf->path = path;
+    pf->fd = -1;
+    pf->buf = NULL;
+    pf->cap = 0;
+    pf->len = 0;
+}
+
+void proc_file_close(proc_file_t *pf) {
+    if (pf->fd >= 0) close(pf->fd);
+    pf->fd = -1;
+    free(pf->buf);
+    pf->buf = NULL;
+    pf->cap = pf->len = 0;
+}
+
+/* Re-read the whole file; the buffer only grows, so steady state does not allocate.
+ * Returns 0 on success (pf->buf is NUL terminated), -1 on error. */
+int proc_file_read(proc_file_t *pf) {
+    if (pf->fd < 0) {
+        pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+        if (pf->fd < 0) return -1;
+    }
+    if (!pf->buf) {
+        pf->buf = malloc(PROC_INITIAL_BUFSZ);
+        if (!pf->buf) return -1;
+        pf->cap = PROC_INITIAL_BUFSZ;
+    }
+    size_t off = 0;
+    for (;;) {
+        if (pf->cap - off < 2) {
+            char *nb = realloc(pf->buf, pf->cap * 2);
+            if (!nb) return -1;
+            pf->buf = nb;
+            pf->cap *= 2;
+        }
+        ssize_t r = pread(pf->fd, pf->buf + off, pf->cap - off - 1, (off_t)off);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            /* stale fd (e.g. namespace change): reopen next time */
+            close(pf->fd);
+            pf->fd = -1;
+            return -1;
+        }
+        if (r == 0) break;
+        off += (size_t)r;
+    }
+    pf->buf[off] = '\0';
+    pf->len = off;
+    return 0;
+}
+
+/* Minimal tokenizer over a NUL-terminated buffer */
+static inline const char *skip_blanks(const char *p) {
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+static inline const char *next_line(const char *p) {
+    while (*p && *p != '\n') p++;
+    return *p ? p + 1 : p;
+}
+
+static inline unsigned long long parse_u64(const char **pp) {
+    const char *p = skip_blanks(*pp);
+    unsigned long long v = 0;
+    while (*p >= '0' && *p <= '9') {
+        v = v * 10 + (unsigned long long)(*p - '0');
+        p++;
+    }
+    *pp = p;
+    return v;
+}
+
+/* Copy one whitespace separated field, decoding the \ooo escapes used by /proc/mounts */
+static const char *parse_field(const char *p, char *out, size_t outsz) {
+    size_t n = 0;
+    p = skip_blanks(p);
+    while (*p && *p != ' ' && *p != '\t' && *p != '\n') {
+        char c = *p++;
+        if (c == '\\' && p[0] >= '0' && p[0] <= '7' && p[1] >= '0' && p[1] <= '7' && p[2] >= '0' &&
+            p[2] <= '7') {
+            c = (char)(((p[0] - '0') << 6) | ((p[1] - '0') << 3) | (p[2] - '0'));
+            p += 3;
+        }
+        if (n + 1 < outsz) out[n++] = c;
+    }
+    if (outsz) out[n] = '\0';
+    return p;
+}
+
+/* "Key:" prefix match used by the meminfo parser */
+static inline int key_is(const char *p, const char *key, size_t keylen) {
+    return strncmp(p, key, keylen) == 0 && p[keylen] == ':';
 }
 
 /* CPU usage calculation (reads /proc/stat) */
@@ -190,18 +1319,37 @@ typedef struct {
     unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
 } cpu_times_t;
 
-int read_cpu_times(cpu_times_t *t) {
-    FILE *f = fopen("/proc/stat", "r");
-    if (!f) return -1;
-    char buf[512];
-    if (!fgets(buf, sizeof(buf), f)) { fclose(f); return -1; }
-    /* parse first line: cpu  3357 0 4313 1362393 ... */
-    sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
-           &t->user, &t->nice, &t->system, &t->idle, &t->iowait, &t->irq, &t->softirq, &t->steal);
-    fclose(f);
+static const char *parse_cpu_fields(const char *p, cpu_times_t *t) {
+    t->user = parse_u64(&p);
+    t->nice = parse_u64(&p);
+    t->system = parse_u64(&p);
+    t->idle = parse_u64(&p);
+    t->iowait = parse_u64(&p);
+    t->irq = parse_u64(&p);
+    t->softirq = parse_u64(&p);
+    t->steal = parse_u64(&p);
+    return p;
+}
+
+/* parse aggregate line (cpu  3357 0 4313 1362393 ...) & optionally every cpuN line.
+ * cores[] is indexed by N; cores missing from the file (offline) are left untouched. */
+int parse_cpu_stat(const char *buf, cpu_times_t *t, cpu_times_t *cores, size_t max_cores) {
+    if (strncmp(buf, "cpu ", 4) != 0) return -1;
+    const char *p = parse_cpu_fields(buf + 4, t);
+    if (!cores) return 0;
+    for (p = next_line(p); strncmp(p, "cpu", 3) == 0; p = next_line(p)) {
+        p += 3;
+        size_t n = (size_t)parse_u64(&p);
+        if (n < max_cores) p = parse_cpu_fields(p, &cores[n]);
+    }
     return 0;
 }
 
+int read_cpu_times(proc_file_t *pf, cpu_times_t *t, cpu_times_t *cores, size_t max_cores) {
+    if (proc_file_read(pf) != 0) return -1;
+    return parse_cpu_stat(pf->buf, t, cores, max_cores);
+}
+
 double calc_cpu_usage(cpu_times_t *a, cpu_times_t *b) {
     unsigned long long prev_idle = a->idle + a->iowait;
     unsigned long long idle = b->idle + b->iowait;
@@ -220,377 +1368,10041 @@ double calc_cpu_usage(cpu_times_t *a, cpu_times_t *b) {
     return cpu_percent;
 }
 
-/* Memory usage from /proc/meminfo */
-double read_memory_usage() {
-    FILE *f = fopen("/proc/meminfo", "r");
-    if (!f) return -1;
-    char line[256];
-    unsigned long long mem_total = 0, mem_free = 0, buffers = 0, cached = 0;
-    while (fgets(line, sizeof(line), f)) {
-        if (sscanf(line, "MemTotal: %llu kB", &mem_total) == 1) continue;
-        if (sscanf(line, "MemFree: %llu kB", &mem_free) == 1) continue;
-        if (sscanf(line, "Buffers: %llu kB", &buffers) == 1) continue;
-        if (sscanf(line, "Cached: %llu kB", &cached) == 1) continue;
+/* Per-core history kept as a structure of arrays: each field is one contiguous
+ * [slot][core] array, so a whole sample across cores is a single linear run.
+ * Depth is CORE_HISTORY (independent of RING_SIZE) to bound memory on big boxes. */
+typedef struct {
+    size_t ncores;
+    size_t size;  // slots
+    size_t head;  // next write
+    size_t count;
+    uint32_t *user, *nice, *system, *idle, *iowait, *irq, *softirq, *steal; // jiffy deltas
+    float *busy;                                                            // percent
+    time_t *timestamp;
+    atomic_uint seq; // seqlock, same protocol as ringbuffer_t
+} core_ring_t;
+
+static core_ring_t corering;
+
+static uint32_t *core_field_alloc(size_t n) {
+    uint32_t *p = calloc(n, sizeof(uint32_t));
+    if (!p) {
+        fprintf(stderr, "FATAL: cannot allocate per-core history\n");
+        exit(1);
     }
-    fclose(f);
-    if (mem_total == 0) return 0.0;
-    unsigned long long used = mem_total - mem_free - buffers - cached;
-    double perc = (double)used * 100.0 / (double)mem_total;
-    return perc;
-}
-
-/* Disk usage across mounted partitions (we will check /proc/mounts & statvfs) */
-double read_disk_usage_max() {
-    FILE *f = fopen("/proc/mounts", "r");
-    if (!f) return -1;
-    char dev[256], mnt[256], type[64], opts[256];
-    int freq, passno;
-    double maxp = 0.0;
-    while (fscanf(f, "%255s %255s %63s %255s %d %d\n", dev, mnt, type, opts, &freq, &passno) == 6) {
-        /* skip pseudo filesystems */
-        if (strcmp(type, "proc") == 0 || strcmp(type, "sysfs") == 0 || strcmp(type, "tmpfs") == 0 ||
-            strcmp(type, "devtmpfs") == 0 || strcmp(type, "devpts") == 0)
-            continue;
-        struct statvfs st;
-        if (statvfs(mnt, &st) == 0) {
-            unsigned long long total = st.f_blocks * st.f_frsize;
-            unsigned long long free = st.f_bfree * st.f_frsize;
-            unsigned long long used = (total > free) ? (total - free) : 0;
-            double perc = 0.0;
-            if (total > 0) perc = (double)used * 100.0 / (double)total;
-            if (perc > maxp) maxp = perc;
-        }
+    return p;
+}
+
+static void core_ring_init(core_ring_t *r, size_t ncores, size_t size) {
+    size_t n = ncores * size;
+    r->ncores = ncores;
+    r->size = size;
+    r->head = 0;
+    r->count = 0;
+    r->user = core_field_alloc(n);
+    r->nice = core_field_alloc(n);
+    r->system = core_field_alloc(n);
+    r->idle = core_field_alloc(n);
+    r->iowait = core_field_alloc(n);
+    r->irq = core_field_alloc(n);
+    r->softirq = core_field_alloc(n);
+    r->steal = core_field_alloc(n);
+    r->busy = calloc(n, sizeof(float));
+    r->timestamp = calloc(size, sizeof(time_t));
+    if (!r->busy || !r->timestamp) {
+        fprintf(stderr, "FATAL: cannot allocate per-core history\n");
+        exit(1);
     }
-    fclose(f);
-    return maxp;
+    atomic_init(&r->seq, 0);
 }
 
-/* Logging to file (append). */
-void append_metrics_log(metric_sample_t *m) {
-    FILE *f = fopen(metrics_logfile, "a");
-    if (!f) return;
-    char timestr[64];
-    struct tm tm;
-    localtime_r(&m->timestamp, &tm);
-    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
-    fprintf(f, "%s cpu=%.2f mem=%.2f disk=%.2f\n", timestr, m->cpu_usage, m->memory_usage, m->disk_usage);
-    fflush(f);
-    fclose(f);
+static void core_ring_free(core_ring_t *r) {
+    free(r->user);
+    free(r->nice);
+    free(r->system);
+    free(r->idle);
+    free(r->iowait);
+    free(r->irq);
+    free(r->softirq);
+    free(r->steal);
+    free(r->busy);
+    free(r->timestamp);
 }
 
-/* CPU+Memory monitor thread */
-void *cpu_mem_thread(void *arg) {
-    (void)arg;
-    cpu_times_t prev, cur;
-    if (read_cpu_times(&prev) != 0) {
-        fprintf(stderr, "Failed to read /proc/stat\n");
-        memset(&prev, 0, sizeof(prev));
+/* Store the deltas between prev & cur in the next slot & compute busy% per core,
+ * plus max & p95 across cores, in one pass (p95 from a 0.1% histogram). */
+static void core_ring_push(core_ring_t *r, const cpu_times_t *prev, const cpu_times_t *cur, time_t ts,
+                           double *out_max, double *out_p95) {
+    uint32_t hist[1001] = {0};
+    float maxb = 0.0f;
+
+    unsigned seq = seq_write_begin(&r->seq);
+    size_t base = r->head * r->ncores;
+    for (size_t c = 0; c < r->ncores; c++) {
+        const cpu_times_t *a = &prev[c], *b = &cur[c];
+        size_t i = base + c;
+        r->user[i] = (uint32_t)(b->user - a->user);
+        r->nice[i] = (uint32_t)(b->nice - a->nice);
+        r->system[i] = (uint32_t)(b->system - a->system);
+        r->idle[i] = (uint32_t)(b->idle - a->idle);
+        r->iowait[i] = (uint32_t)(b->iowait - a->iowait);
+        r->irq[i] = (uint32_t)(b->irq - a->irq);
+        r->softirq[i] = (uint32_t)(b->softirq - a->softirq);
+        r->steal[i] = (uint32_t)(b->steal - a->steal);
+        uint64_t idle = (uint64_t)r->idle[i] + r->iowait[i];
+        uint64_t total = idle + r->user[i] + r->nice[i] + r->system[i] + r->irq[i] + r->softirq[i] +
+                         r->steal[i];
+        float busy = total ? (float)((double)(total - idle) * 100.0 / (double)total) : 0.0f;
+        r->busy[i] = busy;
+        if (busy > maxb) maxb = busy;
+        hist[(unsigned)(busy * 10.0f + 0.5f) % 1001]++;
     }
-    while (atomic_load(&running)) {
-        sleep(5); /* every 5 seconds */
-        if (read_cpu_times(&cur) != 0) continue;
-        double cpu = calc_cpu_usage(&prev, &cur);
-        prev = cur;
-        double mem = read_memory_usage();
-        double disk = read_disk_usage_max();
+    r->timestamp[r->head] = ts;
+    r->head = (r->head + 1) % r->size;
+    if (r->count < r->size) r->count++;
+    seq_write_end(&r->seq, seq);
 
-        metric_sample_t sample;
-        sample.cpu_usage = cpu;
-        sample.memory_usage = mem;
-        sample.disk_usage = disk;
-        sample.timestamp = time(NULL);
-
-        pthread_mutex_lock(&sys_metrics.data_lock);
-        sys_metrics.cpu_usage = cpu;
-        sys_metrics.memory_usage = mem;
-        sys_metrics.disk_usage = disk;
-        pthread_cond_broadcast(&sys_metrics.update_cond);
-        pthread_mutex_unlock(&sys_metrics.data_lock);
+    /* smallest bucket with at least 95% of cores at or below it */
+    size_t need = (r->ncores * 95 + 99) / 100, seen = 0, k = 0;
+    for (; k < 1000 && seen + hist[k] < need; k++) seen += hist[k];
+    *out_max = maxb;
+    *out_p95 = r->ncores ? (double)k / 10.0 : 0.0;
+}
 
-        ring_push(&ringbuf, &sample);
-        append_metrics_log(&sample);
-    }
-    return NULL;
+/* Copy busy% of the newest slot; returns the number of cores written */
+static size_t core_ring_latest(core_ring_t *r, float *out, size_t max) {
+    size_t n;
+    unsigned seq;
+    do {
+        seq = seq_read_begin(&r->seq);
+        n = 0;
+        size_t head = r->head, count = r->count;
+        if (count > 0 && head < r->size) {
+            size_t slot = (head == 0) ? r->size - 1 : head - 1;
+            n = r->ncores < max ? r->ncores : max;
+            memcpy(out, &r->busy[slot * r->ncores], n * sizeof(float));
+        }
+    } while (seq_read_retry(&r->seq, seq));
+    return n;
 }
 
-/* Disk thread (poll less frequently) */
-void *disk_thread(void *arg) {
-    (void)arg;
-    while (atomic_load(&running)) {
-        sleep(10);
-        double disk = read_disk_usage_max();
-        pthread_mutex_lock(&sys_metrics.data_lock);
-        sys_metrics.disk_usage = disk;
-        pthread_cond_broadcast(&sys_metrics.update_cond);
-        pthread_mutex_unlock(&sys_metrics.data_lock);
+/* /proc/meminfo, in kB */
+typedef struct {
+    uint64_t total, free, available, buffers, cached, sreclaimable, shmem;
+    uint64_t swap_total, swap_free, dirty, writeback;
+    int have_available;  // MemAvailable (Linux 3.14+)
+} mem_stats_t;
 
-        metric_sample_t sample;
-        sample.cpu_usage = sys_metrics.cpu_usage;
-        sample.memory_usage = sys_metrics.memory_usage;
-        sample.disk_usage = disk;
-        sample.timestamp = time(NULL);
-        ring_push(&ringbuf, &sample);
-        append_metrics_log(&sample);
+static const struct {
+    const char *key;
+    size_t len, off;
+} meminfo_keys[] = {
+    { "MemTotal", 8, offsetof(mem_stats_t, total) },       { "MemFree", 7, offsetof(mem_stats_t, free) },
+    { "MemAvailable", 12, offsetof(mem_stats_t, available) }, { "Buffers", 7, offsetof(mem_stats_t, buffers) },
+    { "Cached", 6, offsetof(mem_stats_t, cached) },         { "SwapTotal", 9, offsetof(mem_stats_t, swap_total) },
+    { "SwapFree", 8, offsetof(mem_stats_t, swap_free) },    { "Dirty", 5, offsetof(mem_stats_t, dirty) },
+    { "Writeback", 9, offsetof(mem_stats_t, writeback) },   { "Shmem", 5, offsetof(mem_stats_t, shmem) },
+    { "SReclaimable", 12, offsetof(mem_stats_t, sreclaimable) },
+};
+
+#define MEMINFO_NKEYS (sizeof(meminfo_keys) / sizeof(meminfo_keys[0]))
+#define MEMINFO_AVAILABLE 2  // index of MemAvailable
+
+/* One pass over the lines: each "Key:" is looked up in meminfo_keys by length
+ * & memcmp, & the loop stops as soon as every key was seen (the last one,
+ * SReclaimable, sits about halfway down the file). Returns 0, or -1 without
+ * MemTotal. */
+int parse_meminfo(const char *buf, mem_stats_t *m) {
+    memset(m, 0, sizeof(*m));
+    uint32_t seen = 0;
+    const uint32_t all = (1u << MEMINFO_NKEYS) - 1;
+    for (const char *p = buf; *p && seen != all; p = next_line(p)) {
+        const char *colon = p;
+        while (*colon && *colon != ':' && *colon != '\n') colon++;
+        if (*colon != ':') continue;
+        size_t len = (size_t)(colon - p);
+        for (size_t i = 0; i < MEMINFO_NKEYS; i++) {
+            if (meminfo_keys[i].len != len || memcmp(p, meminfo_keys[i].key, len) != 0) continue;
+            if (!(seen & (1u << i))) {
+                const char *q = colon + 1;
+                *(uint64_t *)((char *)m + meminfo_keys[i].off) = parse_u64(&q);
+                seen |= 1u << i;
+            }
+            break;
+        }
     }
-    return NULL;
+    m->have_available = (seen >> MEMINFO_AVAILABLE) & 1u;
+    return m->total ? 0 : -1;
 }
 
-/* Helper: reopen if file rotated: check inode changes */
-int open_logfile_follow(const char *path, ino_t *last_inode) {
-    int fd = open(path, O_RDONLY | O_NONBLOCK);
-    if (fd < 0) return -1;
-    struct stat st;
-    if (fstat(fd, &st) == 0) {
-        if (last_inode) *last_inode = st.st_ino;
+/* Available memory: MemAvailable, or on kernels without it the classic
+ * estimate of free + buffers + page cache + reclaimable slab - shmem */
+static uint64_t meminfo_available(const mem_stats_t *m) {
+    uint64_t avail = m->available;
+    if (!m->have_available) {
+        avail = m->free + m->buffers + m->cached + m->sreclaimable;
+        avail = avail > m->shmem ? avail - m->shmem : 0;
     }
-    /* seek to end to only capture appended lines */
-    lseek(fd, 0, SEEK_END);
-    return fd;
+    return avail < m->total ? avail : m->total;
 }
 
-/* read new lines from fd & check for "error" pattern & react */
-void process_log_data(const char *path, int fd) {
-    char buf[BUFSZ];
-    ssize_t r;
-    while ((r = read(fd, buf, sizeof(buf) - 1)) > 0) {
-        buf[r] = '\0';
-        /* naive scan: if "error" or "ERROR" appears, print immediate alert */
-        if (strcasestr(buf, "error") || strcasestr(buf, "fail")) {
-            time_t t = time(NULL);
-            char timestr[64];
-            struct tm tm;
-            localtime_r(&t, &tm);
-            strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
-            fprintf(stderr, "[ALERT %s] Log %s contains error pattern\n", timestr, path);
-            FILE *f = fopen(metrics_logfile, "a");
-            if (f) {
-                fprintf(f, "%s ALERT log=%s contains error pattern\n", timestr, path);
-                fclose(f);
-            }
-        }
+double mem_used_percent(const mem_stats_t *m) {
+    if (m->total == 0) return 0.0;
+    return (double)(m->total - meminfo_available(m)) * 100.0 / (double)m->total;
+}
+
+double swap_used_percent(const mem_stats_t *m) {
+    if (m->swap_total == 0) return 0.0;
+    uint64_t free_kb = m->swap_free < m->swap_total ? m->swap_free : m->swap_total;
+    return (double)(m->swap_total - free_kb) * 100.0 / (double)m->swap_total;
+}
+
+/* Memory usage (percent) & the full meminfo record; -1 if unreadable */
+double read_memory_usage(proc_file_t *pf, mem_stats_t *m) {
+    if (proc_file_read(pf) != 0 || parse_meminfo(pf->buf, m) != 0) return -1;
+    return mem_used_percent(m);
+}
+
+/* /proc/pressure/memory: "some avg10=0.12 avg60=..." & "full avg10=..."; the
+ * avg10 of each line, in percent. Returns 0, or -1 if neither line parsed. */
+int parse_psi(const char *buf, double *some, double *full) {
+    int got = 0;
+    *some = *full = 0.0;
+    for (const char *p = buf; *p; p = next_line(p)) {
+        double *dst = strncmp(p, "some ", 5) == 0 ? some : strncmp(p, "full ", 5) == 0 ? full : NULL;
+        const char *a = dst ? strstr(p, "avg10=") : NULL;
+        if (!a) continue;
+        char *end;
+        double v = strtod(a + 6, &end);
+        if (end == a + 6) continue;
+        *dst = v;
+        got++;
     }
+    return got ? 0 : -1;
 }
 
-/* Log monitor thread using poll() */
-void *log_monitor_thread(void *arg) {
-    (void)arg;
-    int fds[MAX_LOGFILES];
-    ino_t inodes[MAX_LOGFILES];
-    for (int i = 0; i < MAX_LOGFILES; i++) { fds[i] = -1; inodes[i] = 0; }
-    while (atomic_load(&running)) {
-        int active = 0;
-        for (int i = 0; i < n_logfiles; i++) {
-            if (fds[i] < 0) {
-                fds[i] = open_logfile_follow(logfiles[i], &inodes[i]);
-            } else {
-                struct stat st;
-                if (stat(logfiles[i], &st) == 0) {
-                    if (st.st_ino != inodes[i]) {
-                        close(fds[i]);
-                        fds[i] = open_logfile_follow(logfiles[i], &inodes[i]);
-                    }
-                }
-            }
-            if (fds[i] >= 0) active++;
+/* skip pseudo filesystems (all of these report zero blocks) */
+static int is_pseudo_fs(const char *type) {
+    static const char *const pseudo[] = {
+        "proc", "sysfs", "tmpfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "mqueue", "debugfs", "tracefs",
+        "securityfs", "pstore", "bpf", "autofs", "configfs", "fusectl", "binfmt_misc", "nsfs", "hugetlbfs",
+        "rpc_pipefs", "efivarfs", "ramfs",
+    };
+    for (size_t i = 0; i < sizeof(pseudo) / sizeof(pseudo[0]); i++)
+        if (strcmp(type, pseudo[i]) == 0) return 1;
+    return 0;
+}
+
+/* Mount table.
+ *
+ * /proc/self/mountinfo is parsed once & again only when poll() on its fd
+ * reports POLLPRI (the kernel's "mount table changed" signal). Mounts are
+ * deduplicated by device, so bind mounts of one filesystem cost one statvfs.
+ * statvfs itself runs in a separate worker (see disk_worker), never on the
+ * scheduler thread; results & per-mount usage live here under lock. */
+
+typedef struct {
+    char *path, *fstype;
+    unsigned int major, minor;
+    uint64_t total, used, avail;  // bytes
+    double perc;
+    int have;   // statvfs has succeeded at least once
+    int hung;   // a statvfs on it is stuck past STATVFS_TIMEOUT_MS
+} mount_ent_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    proc_file_t mountinfo;  // only touched by the scheduler thread
+    mount_ent_t *m;
+    size_t n;
+    unsigned long table_gen;  // bumped whenever m is replaced
+    int sweep;                // sweep requested
+    int stop;
+    unsigned int worker_gen;  // workers started under an older gen were abandoned
+    int nalive;               // worker threads alive, including stuck ones
+    int nstuck;               // abandoned workers still inside statvfs
+    int busy;                 // current worker is inside statvfs
+    unsigned int busy_major, busy_minor;
+    long long busy_since;
+    unsigned long sweeps, timeouts;
+} disk_table_t;
+
+static disk_table_t disktab = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static void mount_ents_free(mount_ent_t *m, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        free(m[i].path);
+        free(m[i].fstype);
+    }
+    free(m);
+}
+
+/* Parse mountinfo into a fresh array, one entry per real device:
+ * id parent major:minor root mountpoint opts [optional...] - fstype source superopts */
+static mount_ent_t *parse_mountinfo(const char *buf, size_t *count) {
+    mount_ent_t *m = NULL;
+    size_t n = 0, cap = 0;
+    char root[1024], mnt[1024], f[256], type[64];
+    for (const char *p = buf; *p; p = next_line(p)) {
+        const char *q = parse_field(p, f, sizeof(f));   // mount id
+        q = parse_field(q, f, sizeof(f));               // parent id
+        q = parse_field(q, f, sizeof(f));               // major:minor
+        const char *d = f;
+        unsigned int major = (unsigned int)parse_u64(&d);
+        if (*d++ != ':') continue;
+        unsigned int minor = (unsigned int)parse_u64(&d);
+        q = parse_field(q, root, sizeof(root));
+        q = parse_field(q, mnt, sizeof(mnt));
+        do q = parse_field(q, f, sizeof(f));            // options, optional fields
+        while (f[0] && strcmp(f, "-") != 0);
+        parse_field(q, type, sizeof(type));
+        if (mnt[0] == '\0' || type[0] == '\0' || is_pseudo_fs(type)) continue;
+
+        size_t i = 0;
+        while (i < n && (m[i].major != major || m[i].minor != minor)) i++;
+        if (i < n) {
+            /* same device mounted again: prefer the mount of the filesystem root */
+            if (strcmp(root, "/") == 0 && strlen(mnt) < strlen(m[i].path)) {
+                char *np = strdup(mnt);
+                if (np) {
+                    free(m[i].path);
+                    m[i].path = np;
+                }
+            }
+            continue;
+        }
+        if (n == cap) {
+            size_t nc = cap ? cap * 2 : 32;
+            mount_ent_t *nm = realloc(m, nc * sizeof(*nm));
+            if (!nm) break;
+            m = nm;
+            cap = nc;
+        }
+        memset(&m[n], 0, sizeof(m[n]));
+        m[n].path = strdup(mnt);
+        m[n].fstype = strdup(type);
+        m[n].major = major;
+        m[n].minor = minor;
+        if (!m[n].path || !m[n].fstype) {
+            free(m[n].path);
+            free(m[n].fstype);
+            break;
+        }
+        n++;
+    }
+    *count = n;
+    return m;
+}
+
+static mount_ent_t *mount_find(unsigned int major, unsigned int minor) {
+    for (size_t i = 0; i < disktab.n; i++)
+        if (disktab.m[i].major == major && disktab.m[i].minor == minor) return &disktab.m[i];
+    return NULL;
+}
+
+/* Busiest mount, from the last sweep; caller holds disktab.lock */
+static double mount_usage_max(void) {
+    double maxp = 0.0;
+    for (size_t i = 0; i < disktab.n; i++)
+        if (disktab.m[i].have && disktab.m[i].perc > maxp) maxp = disktab.m[i].perc;
+    return maxp;
+}
+
+/* Disk usage across mounted partitions (cached; see the mount table above) */
+double read_disk_usage_max(void) {
+    pthread_mutex_lock(&disktab.lock);
+    double maxp = mount_usage_max();
+    pthread_mutex_unlock(&disktab.lock);
+    return maxp;
+}
+
+/* Block device I/O.
+ *
+ * /proc/diskstats is re-read through one pread fd. Each whole disk gets a
+ * fixed slot in diskio_ctx_t.devs with the counters from the previous read,
+ * so a sample is one parse plus arithmetic, with no allocation. Rates from
+ * the deltas go into diskioring, DISKIO_HISTORY rows of up to DISKIO_MAX_DEVS
+ * devices each, under the same seqlock protocol as corering. Partitions are
+ * left out (they would double count their disk), as are loop & ram devices;
+ * a device is a whole disk if it has an entry in /sys/block. */
+
+#define DISKIO_MAX_DEVS 32
+#define DISKIO_MAX_SKIP 256  // partitions etc. remembered so /sys/block is checked once
+#define DISKIO_NAME 32
+#define DISKIO_SECTOR 512    // diskstats counts 512-byte sectors whatever the device's block size
+
+typedef struct {
+    uint64_t rd_ios, rd_sectors, rd_ms, wr_ios, wr_sectors, wr_ms, io_ms;
+} diskio_counters_t;
+
+typedef struct {
+    char name[DISKIO_NAME];
+    unsigned int major, minor;
+    int used;
+    int have;          // c holds a previous read
+    unsigned int seen;  // generation of the last read that listed the device
+    diskio_counters_t c, next;
+} diskio_dev_t;
+
+/* One device in one ring row */
+typedef struct {
+    char name[DISKIO_NAME];
+    float rd_iops, wr_iops;
+    float rd_bps, wr_bps;  // bytes per second
+    float await_ms;        // mean time per completed request, queueing included
+    float util;            // percent of the interval with requests in flight
+} diskio_rate_t;
+
+typedef struct {
+    diskio_dev_t devs[DISKIO_MAX_DEVS];
+    uint32_t skip[DISKIO_MAX_SKIP];  // major:minor of devices that are not whole disks
+    size_t nskip;
+    unsigned int gen;
+    const char *sysblock;  // "/sys/block"; NULL: every device counts as a disk
+    proc_file_t f;
+    uint64_t last_ns;
+} diskio_ctx_t;
+
+typedef struct {
+    size_t size, head, count;
+    time_t *ts;
+    uint8_t *ndev;
+    diskio_rate_t *rows;  // [slot][DISKIO_MAX_DEVS]
+    atomic_uint seq;
+} diskio_ring_t;
+
+static diskio_ring_t diskioring;
+
+static int diskio_is_disk(const diskio_ctx_t *c, const char *name) {
+    if (strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0) return 0;
+    if (!c->sysblock) return 1;
+    char path[128];
+    int n = snprintf(path, sizeof(path), "%s/", c->sysblock);
+    for (const char *s = name; *s && (size_t)n + 1 < sizeof(path); s++) path[n++] = (*s == '/') ? '!' : *s;
+    path[n] = '\0';
+    return access(path, F_OK) == 0;
+}
+
+static int diskio_skipped(const diskio_ctx_t *c, uint32_t dev) {
+    for (size_t i = 0; i < c->nskip; i++)
+        if (c->skip[i] == dev) return 1;
+    return 0;
+}
+
+/* Parse one /proc/diskstats read into the slots' next counters & mark the
+ * devices seen in this generation. New disks take a free slot; once all
+ * DISKIO_MAX_DEVS are used further disks are ignored. Returns the number of
+ * disks listed. */
+int parse_diskstats(diskio_ctx_t *c, const char *buf) {
+    unsigned int gen = ++c->gen;
+    int n = 0;
+    for (const char *p = buf; *p; p = next_line(p)) {
+        const char *q = p;
+        unsigned int major = (unsigned int)parse_u64(&q), minor = (unsigned int)parse_u64(&q);
+        char name[DISKIO_NAME];
+        q = parse_field(q, name, sizeof(name));
+        if (!name[0]) continue;
+        uint32_t dev = (major << 20) | (minor & 0xfffffu);  // the kernel's dev_t layout
+        if (c->nskip && diskio_skipped(c, dev)) continue;
+        diskio_dev_t *d = NULL, *free_slot = NULL;
+        for (size_t i = 0; i < DISKIO_MAX_DEVS; i++) {
+            diskio_dev_t *e = &c->devs[i];
+            if (!e->used) {
+                if (!free_slot) free_slot = e;
+            } else if (e->major == major && e->minor == minor && strcmp(e->name, name) == 0) {
+                d = e;
+                break;
+            }
+        }
+        if (!d) {
+            if (!diskio_is_disk(c, name)) {
+                if (c->nskip < DISKIO_MAX_SKIP) c->skip[c->nskip++] = dev;
+                continue;
+            }
+            if (!free_slot) continue;
+            d = free_slot;
+            memset(d, 0, sizeof(*d));
+            snprintf(d->name, sizeof(d->name), "%s", name);
+            d->major = major;
+            d->minor = minor;
+            d->used = 1;
+        }
+        diskio_counters_t *x = &d->next;
+        x->rd_ios = parse_u64(&q);
+        (void)parse_u64(&q);  // reads merged
+        x->rd_sectors = parse_u64(&q);
+        x->rd_ms = parse_u64(&q);
+        x->wr_ios = parse_u64(&q);
+        (void)parse_u64(&q);  // writes merged
+        x->wr_sectors = parse_u64(&q);
+        x->wr_ms = parse_u64(&q);
+        (void)parse_u64(&q);  // in flight
+        x->io_ms = parse_u64(&q);
+        d->seen = gen;
+        n++;
+    }
+    return n;
+}
+
+static inline uint64_t diskio_delta(uint64_t cur, uint64_t prev, int *wrapped) {
+    if (cur < prev) *wrapped = 1;  // counter reset (device re-added, 32-bit wrap)
+    return cur - prev;
+}
+
+/* Rates for every disk seen by the last parse over elapsed_ms, into out
+ * (DISKIO_MAX_DEVS entries); slots of devices that went away are freed.
+ * A device's first read, or one whose counters went backwards, only
+ * primes it. Returns the number of entries written. */
+size_t diskio_rates(diskio_ctx_t *c, double elapsed_ms, diskio_rate_t *out) {
+    size_t n = 0;
+    double secs = elapsed_ms / 1000.0;
+    for (size_t i = 0; i < DISKIO_MAX_DEVS; i++) {
+        diskio_dev_t *d = &c->devs[i];
+        if (!d->used) continue;
+        if (d->seen != c->gen) {
+            d->used = 0;
+            continue;
+        }
+        if (d->have && secs > 0) {
+            const diskio_counters_t *a = &d->c, *b = &d->next;
+            int wrapped = 0;
+            uint64_t rd = diskio_delta(b->rd_ios, a->rd_ios, &wrapped);
+            uint64_t wr = diskio_delta(b->wr_ios, a->wr_ios, &wrapped);
+            uint64_t rs = diskio_delta(b->rd_sectors, a->rd_sectors, &wrapped);
+            uint64_t ws = diskio_delta(b->wr_sectors, a->wr_sectors, &wrapped);
+            uint64_t ms = diskio_delta(b->rd_ms, a->rd_ms, &wrapped) + diskio_delta(b->wr_ms, a->wr_ms, &wrapped);
+            uint64_t busy = diskio_delta(b->io_ms, a->io_ms, &wrapped);
+            if (!wrapped) {
+                diskio_rate_t *r = &out[n++];
+                memcpy(r->name, d->name, sizeof(r->name));
+                r->rd_iops = (float)((double)rd / secs);
+                r->wr_iops = (float)((double)wr / secs);
+                r->rd_bps = (float)((double)rs * DISKIO_SECTOR / secs);
+                r->wr_bps = (float)((double)ws * DISKIO_SECTOR / secs);
+                r->await_ms = (rd + wr) ? (float)((double)ms / (double)(rd + wr)) : 0.0f;
+                double util = (double)busy * 100.0 / elapsed_ms;
+                r->util = (float)(util < 100.0 ? util : 100.0);
+            }
+        }
+        d->c = d->next;
+        d->have = 1;
+    }
+    return n;
+}
+
+static void diskio_ring_init(diskio_ring_t *r, size_t size) {
+    r->size = size;
+    r->head = r->count = 0;
+    r->ts = calloc(size, sizeof(time_t));
+    r->ndev = calloc(size, 1);
+    r->rows = calloc(size * DISKIO_MAX_DEVS, sizeof(diskio_rate_t));
+    if (!r->ts || !r->ndev || !r->rows) {
+        fprintf(stderr, "FATAL: cannot allocate disk I/O history\n");
+        exit(1);
+    }
+    atomic_init(&r->seq, 0);
+}
+
+static void diskio_ring_free(diskio_ring_t *r) {
+    free(r->ts);
+    free(r->ndev);
+    free(r->rows);
+}
+
+static void diskio_ring_push(diskio_ring_t *r, time_t ts, const diskio_rate_t *row, size_t n) {
+    unsigned seq = seq_write_begin(&r->seq);
+    memcpy(&r->rows[r->head * DISKIO_MAX_DEVS], row, n * sizeof(diskio_rate_t));
+    r->ndev[r->head] = (uint8_t)n;
+    r->ts[r->head] = ts;
+    r->head = (r->head + 1) % r->size;
+    if (r->count < r->size) r->count++;
+    seq_write_end(&r->seq, seq);
+}
+
+/* Copy the newest max rows, oldest first (out: max * DISKIO_MAX_DEVS entries).
+ * Returns the number of rows copied. */
+static size_t diskio_ring_read(diskio_ring_t *r, size_t max, time_t *ts, uint8_t *ndev, diskio_rate_t *out) {
+    size_t n;
+    unsigned seq;
+    do {
+        seq = seq_read_begin(&r->seq);
+        size_t head = r->head, count = r->count;
+        n = (count < max) ? count : max;
+        if (head >= r->size) n = 0;
+        for (size_t i = 0; i < n; i++) {
+            size_t slot = (head + r->size - n + i) % r->size;
+            ts[i] = r->ts[slot];
+            ndev[i] = r->ndev[slot];
+            memcpy(&out[i * DISKIO_MAX_DEVS], &r->rows[slot * DISKIO_MAX_DEVS],
+                   (ndev[i] <= DISKIO_MAX_DEVS ? ndev[i] : DISKIO_MAX_DEVS) * sizeof(diskio_rate_t));
+        }
+    } while (seq_read_retry(&r->seq, seq));
+    return n;
+}
+
+/* cgroup v2 accounting.
+ *
+ * One series per cgroup below CGROUP_ROOT: CPU usage & throttling, memory,
+ * I/O & the three pressure files, as rates over the interval between reads.
+ * cgtab has CGROUP_MAX fixed slots, each with room for the last
+ * CGROUP_HISTORY rows, & an open-addressing index from path to slot. Every
+ * tick writes one row for every cgroup, so all series share a ring of
+ * timestamps & a slot's rows are the ones written since it was taken. The
+ * collector computes a tick's rows without the lock & copies them in under
+ * it, like the other tables readers copy from. */
+
+#define CG_PATH_MAX 256
+
+typedef struct {
+    float cpu;             // percent of one CPU
+    float throttled;       // percent of the interval throttled by cpu.max
+    uint64_t mem_bytes;    // memory.current
+    float rd_bps, wr_bps;  // io.stat, all devices
+    float rd_iops, wr_iops;
+    float cpu_psi, mem_psi, io_psi;  // "some" avg10, percent
+} cg_rate_t;
+
+typedef struct {
+    char path[CG_PATH_MAX];  // below CGROUP_ROOT, "" for the root itself
+    int used;
+    unsigned long first;     // first tick with a row for this cgroup
+} cg_series_t;
+
+/* Open-addressing index, key -> slot (-1: empty), linear probing with
+ * backward-shift deletion so churn leaves no tombstones behind */
+typedef struct {
+    uint64_t *key;
+    int32_t *slot;
+    size_t cap;  // power of two, at least twice the slots indexed
+} cg_index_t;
+
+static struct {
+    pthread_mutex_t lock;
+    size_t cap, hist;        // CGROUP_MAX, CGROUP_HISTORY
+    size_t n;                // slots in use
+    cg_series_t *series;
+    int32_t *free_slots;     // stack of the cap - n unused slots
+    cg_rate_t *rows;         // [slot * hist + tick % hist]
+    time_t *ts;              // [tick % hist]
+    unsigned long ticks;     // rows written; ticks are numbered from 1
+    cg_index_t byname;
+    unsigned long dropped;   // cgroups found while every slot was taken
+} cgtab = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t cg_hash(const char *s) {
+    uint64_t h = 1469598103934665603ull;  // FNV-1a
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    return h;
+}
+
+static int cg_index_init(cg_index_t *ix, size_t slots) {
+    ix->cap = 16;
+    while (ix->cap < slots * 2) ix->cap *= 2;
+    ix->key = calloc(ix->cap, sizeof(uint64_t));
+    ix->slot = malloc(ix->cap * sizeof(int32_t));
+    if (!ix->key || !ix->slot) return -1;
+    for (size_t i = 0; i < ix->cap; i++) ix->slot[i] = -1;
+    return 0;
+}
+
+static void cg_index_free(cg_index_t *ix) {
+    free(ix->key);
+    free(ix->slot);
+    ix->key = NULL;
+    ix->slot = NULL;
+}
+
+static inline size_t cg_index_home(const cg_index_t *ix, uint64_t key) {
+    return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (ix->cap - 1);
+}
+
+static void cg_index_put(cg_index_t *ix, uint64_t key, int32_t slot) {
+    size_t i = cg_index_home(ix, key);
+    while (ix->slot[i] >= 0) i = (i + 1) & (ix->cap - 1);
+    ix->key[i] = key;
+    ix->slot[i] = slot;
+}
+
+/* Next entry for key at or after probe position *pos (start at
+ * cg_index_home); returns its slot & leaves *pos on it, or -1 */
+static int32_t cg_index_scan(const cg_index_t *ix, uint64_t key, size_t *pos) {
+    for (size_t i = *pos & (ix->cap - 1); ix->slot[i] >= 0; i = (i + 1) & (ix->cap - 1)) {
+        if (ix->key[i] == key) {
+            *pos = i;
+            return ix->slot[i];
+        }
+    }
+    return -1;
+}
+
+static void cg_index_del(cg_index_t *ix, uint64_t key, int32_t slot) {
+    size_t mask = ix->cap - 1, i = cg_index_home(ix, key);
+    int32_t s;
+    while ((s = cg_index_scan(ix, key, &i)) >= 0 && s != slot) i++;
+    if (s < 0) return;
+    /* pull later entries of the probe run back over the hole */
+    for (size_t j = (i + 1) & mask; ix->slot[j] >= 0; j = (j + 1) & mask) {
+        size_t home = cg_index_home(ix, ix->key[j]);
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+        ix->key[i] = ix->key[j];
+        ix->slot[i] = ix->slot[j];
+        i = j;
+    }
+    ix->slot[i] = -1;
+}
+
+static void cgtab_init(size_t cap, size_t hist) {
+    cgtab.cap = cap;
+    cgtab.hist = hist ? hist : 1;
+    cgtab.series = calloc(cap ? cap : 1, sizeof(cg_series_t));
+    cgtab.rows = calloc((cap ? cap : 1) * cgtab.hist, sizeof(cg_rate_t));
+    cgtab.ts = calloc(cgtab.hist, sizeof(time_t));
+    cgtab.free_slots = malloc((cap ? cap : 1) * sizeof(int32_t));
+    if (!cgtab.series || !cgtab.rows || !cgtab.ts || !cgtab.free_slots || cg_index_init(&cgtab.byname, cap) != 0) {
+        fprintf(stderr, "FATAL: cannot allocate the cgroup table\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < cap; i++) cgtab.free_slots[i] = (int32_t)(cap - 1 - i);  // lowest slots first
+}
+
+static void cgtab_free(void) {
+    free(cgtab.series);
+    free(cgtab.rows);
+    free(cgtab.ts);
+    free(cgtab.free_slots);
+    cg_index_free(&cgtab.byname);
+    cgtab.series = NULL;
+    cgtab.rows = NULL;
+    cgtab.ts = NULL;
+    cgtab.free_slots = NULL;
+    cgtab.cap = cgtab.n = 0;
+}
+
+/* Slot of path, or -1; caller holds the lock (or is the collector) */
+static int32_t cgtab_find(const char *path) {
+    uint64_t key = cg_hash(path);
+    size_t pos = cg_index_home(&cgtab.byname, key);
+    int32_t s;
+    while ((s = cg_index_scan(&cgtab.byname, key, &pos)) >= 0) {
+        if (strcmp(cgtab.series[s].path, path) == 0) return s;
+        pos++;
+    }
+    return -1;
+}
+
+/* Take a slot for path; its first row is the tick after next, since the
+ * first read only primes the counters. Caller holds the lock. */
+static int32_t cgtab_add(const char *path) {
+    if (cgtab.n == cgtab.cap || strlen(path) >= CG_PATH_MAX) {
+        cgtab.dropped++;
+        return -1;
+    }
+    int32_t s = cgtab.free_slots[cgtab.cap - cgtab.n - 1];
+    cg_series_t *e = &cgtab.series[s];
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    e->used = 1;
+    e->first = cgtab.ticks + 2;
+    cg_index_put(&cgtab.byname, cg_hash(path), s);
+    cgtab.n++;
+    return s;
+}
+
+static void cgtab_remove(int32_t s) {
+    cg_series_t *e = &cgtab.series[s];
+    if (!e->used) return;
+    cg_index_del(&cgtab.byname, cg_hash(e->path), s);
+    e->used = 0;
+    cgtab.n--;
+    cgtab.free_slots[cgtab.cap - cgtab.n - 1] = s;
+}
+
+/* One row for every slot in use, from cur (cgtab.cap entries) */
+static void cgtab_publish(time_t ts, const cg_rate_t *cur) {
+    pthread_mutex_lock(&cgtab.lock);
+    unsigned long tick = ++cgtab.ticks;
+    size_t col = tick % cgtab.hist;
+    cgtab.ts[col] = ts;
+    for (size_t s = 0; s < cgtab.cap; s++)
+        if (cgtab.series[s].used) cgtab.rows[s * cgtab.hist + col] = cur[s];
+    pthread_mutex_unlock(&cgtab.lock);
+}
+
+/* cpu.stat: usage_usec & throttled_usec (0 without the cpu controller, which
+ * leaves only the usage lines). Returns 0, or -1 without usage_usec. */
+int parse_cg_cpu_stat(const char *buf, uint64_t *usage_us, uint64_t *throttled_us) {
+    int got = 0;
+    *usage_us = *throttled_us = 0;
+    for (const char *p = buf; *p; p = next_line(p)) {
+        if (strncmp(p, "usage_usec ", 11) == 0) {
+            p += 11;
+            *usage_us = parse_u64(&p);
+            got = 1;
+        } else if (strncmp(p, "throttled_usec ", 15) == 0) {
+            p += 15;
+            *throttled_us = parse_u64(&p);
+        }
+    }
+    return got ? 0 : -1;
+}
+
+/* io.stat: "8:0 rbytes=N wbytes=N rios=N wios=N dbytes=N dios=N" per device,
+ * summed into out[0..3] = rbytes, wbytes, rios, wios */
+void parse_cg_io_stat(const char *buf, uint64_t *out) {
+    static const char *const keys[] = { "rbytes=", "wbytes=", "rios=", "wios=" };
+    memset(out, 0, 4 * sizeof(uint64_t));
+    for (const char *p = buf; *p; p = next_line(p)) {
+        const char *q = p;
+        while (*q && *q != '\n') {
+            while (*q == ' ') q++;
+            for (int k = 0; k < 4; k++) {
+                size_t kl = strlen(keys[k]);
+                if (strncmp(q, keys[k], kl) == 0) {
+                    const char *v = q + kl;
+                    out[k] += parse_u64(&v);
+                    break;
+                }
+            }
+            while (*q && *q != ' ' && *q != '\n') q++;
+        }
+    }
+}
+
+/* Network interfaces.
+ *
+ * /proc/net/dev is re-read through one pread fd with every CPU/memory sample.
+ * Interfaces live in fixed slots of net_ctx_t.ifs that keep the previous
+ * counters, so a sample does no allocation. Each sample gets the totals over
+ * all interfaces but lo, plus the utilization of the busiest link with a
+ * known speed (from /sys/class/net/<if>/speed, re-read every
+ * NET_SPEED_REFRESH samples); nettab has the per-interface view. */
+
+#define NET_MAX_IFACES 64
+#define NET_IFNAME 16
+#define NET_SPEED_REFRESH 60
+
+typedef struct {
+    uint64_t rx_bytes, rx_packets, rx_errs, rx_drop;
+    uint64_t tx_bytes, tx_packets, tx_errs, tx_drop;
+} net_counters_t;
+
+typedef struct {
+    char name[NET_IFNAME];
+    int used, have;       // have: c holds a previous read
+    unsigned int seen;    // generation of the last read that listed it
+    uint32_t speed_mbps;  // 0: unknown (virtual, down)
+    net_counters_t c, next;
+    double rx_bps, tx_bps, rx_pps, tx_pps;  // bytes & packets per second
+    double errs_ps, drops_ps;               // rx + tx, per second
+    double util;                            // busier direction, percent of speed
+} net_iface_t;
+
+typedef struct {
+    net_iface_t ifs[NET_MAX_IFACES];
+    unsigned int gen;
+    const char *sysnet;  // "/sys/class/net"; NULL: link speeds unknown
+    proc_file_t f;
+    uint64_t last_ns;
+} net_ctx_t;
+
+/* Latest per-interface view, published by the CPU/memory job */
+static struct {
+    pthread_mutex_t lock;
+    size_t n;
+    net_iface_t v[NET_MAX_IFACES];
+} nettab = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint32_t net_link_speed(const char *sysnet, const char *name) {
+    if (!sysnet) return 0;
+    char path[128], buf[32];
+    snprintf(path, sizeof(path), "%s/%s/speed", sysnet, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t r = read(fd, buf, sizeof(buf) - 1);  // EINVAL while the link is down
+    close(fd);
+    if (r <= 0) return 0;
+    buf[r] = '\0';
+    long v = strtol(buf, NULL, 10);
+    return v > 0 ? (uint32_t)v : 0;
+}
+
+/* Parse one /proc/net/dev read into the slots' next counters. New
+ * interfaces take a free slot; beyond NET_MAX_IFACES they are ignored.
+ * Returns the number of interfaces listed. */
+int parse_net_dev(net_ctx_t *c, const char *buf) {
+    unsigned int gen = ++c->gen;
+    int n = 0;
+    for (const char *p = buf; *p; p = next_line(p)) {
+        const char *q = skip_blanks(p), *colon = q;
+        while (*colon && *colon != ':' && *colon != '\n') colon++;
+        if (*colon != ':' || colon == q || (size_t)(colon - q) >= NET_IFNAME) continue;  // the two header lines
+        char name[NET_IFNAME];
+        memcpy(name, q, (size_t)(colon - q));
+        name[colon - q] = '\0';
+        net_iface_t *e = NULL, *free_slot = NULL;
+        for (size_t i = 0; i < NET_MAX_IFACES; i++) {
+            net_iface_t *s = &c->ifs[i];
+            if (!s->used) {
+                if (!free_slot) free_slot = s;
+            } else if (strcmp(s->name, name) == 0) {
+                e = s;
+                break;
+            }
+        }
+        if (!e) {
+            if (!free_slot) continue;
+            e = free_slot;
+            memset(e, 0, sizeof(*e));
+            memcpy(e->name, name, sizeof(name));
+            e->used = 1;
+            e->speed_mbps = net_link_speed(c->sysnet, name);
+        } else if (gen % NET_SPEED_REFRESH == 0) {
+            e->speed_mbps = net_link_speed(c->sysnet, name);
+        }
+        q = colon + 1;
+        net_counters_t *x = &e->next;
+        x->rx_bytes = parse_u64(&q);
+        x->rx_packets = parse_u64(&q);
+        x->rx_errs = parse_u64(&q);
+        x->rx_drop = parse_u64(&q);
+        for (int k = 0; k < 4; k++) (void)parse_u64(&q);  // fifo frame compressed multicast
+        x->tx_bytes = parse_u64(&q);
+        x->tx_packets = parse_u64(&q);
+        x->tx_errs = parse_u64(&q);
+        x->tx_drop = parse_u64(&q);
+        e->seen = gen;
+        n++;
+    }
+    return n;
+}
+
+/* Per-interface rates over elapsed_ms & their totals into s; slots of
+ * interfaces that went away are freed. A first read, or counters that went
+ * backwards (the interface was re-created), only prime the slot. */
+void net_rates(net_ctx_t *c, double elapsed_ms, metric_sample_t *s) {
+    double secs = elapsed_ms / 1000.0;
+    for (size_t i = 0; i < NET_MAX_IFACES; i++) {
+        net_iface_t *e = &c->ifs[i];
+        if (!e->used) continue;
+        if (e->seen != c->gen) {
+            e->used = 0;
+            continue;
+        }
+        const net_counters_t *a = &e->c, *b = &e->next;
+        int ok = e->have && secs > 0 && b->rx_bytes >= a->rx_bytes && b->tx_bytes >= a->tx_bytes &&
+                 b->rx_packets >= a->rx_packets && b->tx_packets >= a->tx_packets && b->rx_errs >= a->rx_errs &&
+                 b->tx_errs >= a->tx_errs && b->rx_drop >= a->rx_drop && b->tx_drop >= a->tx_drop;
+        if (ok) {
+            e->rx_bps = (double)(b->rx_bytes - a->rx_bytes) / secs;
+            e->tx_bps = (double)(b->tx_bytes - a->tx_bytes) / secs;
+            e->rx_pps = (double)(b->rx_packets - a->rx_packets) / secs;
+            e->tx_pps = (double)(b->tx_packets - a->tx_packets) / secs;
+            e->errs_ps = (double)(b->rx_errs - a->rx_errs + b->tx_errs - a->tx_errs) / secs;
+            e->drops_ps = (double)(b->rx_drop - a->rx_drop + b->tx_drop - a->tx_drop) / secs;
+            double busier = e->rx_bps > e->tx_bps ? e->rx_bps : e->tx_bps;
+            e->util = e->speed_mbps ? busier * 8.0 * 100.0 / ((double)e->speed_mbps * 1e6) : 0.0;
+        } else {
+            e->rx_bps = e->tx_bps = e->rx_pps = e->tx_pps = e->errs_ps = e->drops_ps = e->util = 0.0;
+        }
+        e->c = e->next;
+        e->have = 1;
+        if (!s || strcmp(e->name, "lo") == 0) continue;
+        s->net_rx_bps += e->rx_bps;
+        s->net_tx_bps += e->tx_bps;
+        s->net_rx_pps += e->rx_pps;
+        s->net_tx_pps += e->tx_pps;
+        s->net_errors += e->errs_ps;
+        s->net_drops += e->drops_ps;
+        if (e->util > s->net_util) s->net_util = e->util;
+    }
+}
+
+static void net_init(net_ctx_t *c) {
+    memset(c, 0, sizeof(*c));
+    c->sysnet = access("/sys/class/net", F_OK) == 0 ? "/sys/class/net" : NULL;
+    proc_file_init(&c->f, "/proc/net/dev");
+    if (proc_file_read(&c->f) == 0) {
+        parse_net_dev(c, c->f.buf);
+        net_rates(c, 0, NULL);  // prime the counters
+    }
+    c->last_ns = mono_ns();
+}
+
+static void net_destroy(net_ctx_t *c) {
+    proc_file_close(&c->f);
+}
+
+/* Read /proc/net/dev, fill s's net_* fields & republish nettab */
+static void net_sample(net_ctx_t *c, metric_sample_t *s) {
+    uint64_t now = mono_ns();
+    if (proc_file_read(&c->f) != 0) return;
+    parse_net_dev(c, c->f.buf);
+    net_rates(c, (double)(now - c->last_ns) / 1e6, s);
+    c->last_ns = now;
+    pthread_mutex_lock(&nettab.lock);
+    nettab.n = 0;
+    for (size_t i = 0; i < NET_MAX_IFACES; i++)
+        if (c->ifs[i].used) nettab.v[nettab.n++] = c->ifs[i];
+    pthread_mutex_unlock(&nettab.lock);
+}
+/* Alert rules (ALERT=... lines in the config, or "ALERT <rule>").
+ *
+ *   ALERT=cpu>90 for 30s             above 90 in every sample for 30 s
+ *   ALERT=memory avg>=80 over 5m     the mean over the last 5 minutes
+ *   ALERT=disk rate>1%/min           change per minute, over the last minute
+ *   ALERT=net_util>70 for 1m clear 50
+ *
+ * <field> [avg|rate] <op> <number>[%][/s|/min|/h] [for|over <duration>] [clear <number>]
+ * with any field of sample_fields & op one of > >= < <=. Each rule keeps a
+ * window of its field's values over the last <duration>: a FIFO of values,
+ * monotonic min & max deques & a running sum, so a sample costs O(1)
+ * amortized whatever the window length. Once the window is full, a threshold
+ * rule fires when every value in it is past the threshold (its min, or max
+ * for < & <=), an avg rule when the mean is & a rate rule when the slope
+ * from the oldest to the newest value is. Alerts are edge-triggered: one
+ * ALERT record when a rule fires, one RESOLVED when it clears, which takes
+ * the same test against the clear level (by default ALERT_HYSTERESIS, 5 %
+ * of the threshold, back), so a value hovering at the threshold does not
+ * flap. Rules are rebuilt on reload; a rule whose text is unchanged keeps
+ * its state, so a reload does not repeat or lose an alert. */
+
+enum { ALERT_THRESH, ALERT_AVG, ALERT_RATE };
+enum { ALERT_GT, ALERT_GE, ALERT_LT, ALERT_LE };
+
+typedef struct {
+    char text[ALERT_TEXT];
+    int field, kind, op;
+    double threshold, clear;
+    double unit_ms;     // rate rules: the "per" unit
+    int64_t window_ms;  // 0: the latest sample only
+    /* window, indexed by sequence number % cap */
+    size_t cap;
+    int64_t *t;
+    double *v;
+    uint64_t head, tail;  // next & oldest sample
+    uint64_t *minq, *maxq;
+    uint64_t minh, mint, maxh, maxt;  // deque front & back
+    double sum;
+    int64_t start_ms;  // first sample, -1 before it
+    /* state */
+    int firing;
+    time_t since;
+    double value;  // last evaluated statistic
+    unsigned long fired;
+} alert_rule_t;
+
+static struct {
+    pthread_mutex_t lock;  // rules & their state; taken per sample & by the renderers
+    alert_rule_t *rules;
+    size_t n;
+} alerts = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Time unit suffix -> ms per unit (no suffix: seconds) */
+static const char *alert_parse_unit(const char *p, double *mul) {
+    *mul = 1000;
+    if (strncmp(p, "ms", 2) == 0) *mul = 1, p += 2;
+    else if (strncmp(p, "min", 3) == 0) *mul = 60000, p += 3;
+    else if (*p == 's') p++;
+    else if (*p == 'm') *mul = 60000, p++;
+    else if (*p == 'h') *mul = 3600000, p++;
+    return p;
+}
+
+/* "30s", "5m", "1h", "500ms" (bare numbers are seconds) -> ms; NULL on error */
+static const char *alert_parse_duration(const char *p, int64_t *ms) {
+    char *end;
+    double v = strtod(p, &end), mul;
+    if (end == p || v < 0) return NULL;
+    p = alert_parse_unit(end, &mul);
+    *ms = (int64_t)(v * mul);
+    return p;
+}
+
+static inline int alert_word(const char *p, const char *w) {
+    size_t n = strlen(w);
+    return strncmp(p, w, n) == 0 && !isalnum((unsigned char)p[n]) && p[n] != '_';
+}
+
+/* Parse a rule; 0 on success. Window storage is allocated separately. */
+int alert_rule_parse(alert_rule_t *r, const char *text) {
+    memset(r, 0, sizeof(*r));
+    snprintf(r->text, sizeof(r->text), "%s", text);
+    const char *p = skip_blanks(text);
+    char name[64];
+    size_t n = 0;
+    while ((isalnum((unsigned char)*p) || *p == '_') && n + 1 < sizeof(name)) name[n++] = *p++;
+    name[n] = '\0';
+    if ((r->field = sample_field_find(name)) < 0) return -1;
+    p = skip_blanks(p);
+    r->kind = ALERT_THRESH;
+    if (alert_word(p, "avg")) r->kind = ALERT_AVG, p = skip_blanks(p + 3);
+    else if (alert_word(p, "rate")) r->kind = ALERT_RATE, p = skip_blanks(p + 4);
+    if (*p == '>') r->op = (p[1] == '=') ? ALERT_GE : ALERT_GT;
+    else if (*p == '<') r->op = (p[1] == '=') ? ALERT_LE : ALERT_LT;
+    else return -1;
+    p += (p[1] == '=') ? 2 : 1;
+    char *end;
+    r->threshold = strtod(p, &end);
+    if (end == p) return -1;
+    p = end;
+    if (*p == '%') p++;
+    r->unit_ms = 1000;
+    if (*p == '/') {  // "/min", "/10s"
+        if (r->kind != ALERT_RATE) return -1;
+        const char *u = p + 1;
+        double count = strtod(u, &end), mul;
+        if (end == u) count = 1;
+        p = alert_parse_unit(end, &mul);
+        if (p == u) return -1;  // nothing after the '/'
+        r->unit_ms = count * mul;
+        if (r->unit_ms <= 0) return -1;
+    }
+    r->window_ms = (r->kind == ALERT_RATE) ? (int64_t)r->unit_ms : 0;
+    int have_clear = 0;
+    for (p = skip_blanks(p); *p; p = skip_blanks(p)) {
+        if (alert_word(p, "for") || alert_word(p, "over")) {
+            p = skip_blanks(p + (p[0] == 'f' ? 3 : 4));
+            if (!(p = alert_parse_duration(p, &r->window_ms))) return -1;
+        } else if (alert_word(p, "clear")) {
+            p = skip_blanks(p + 5);
+            r->clear = strtod(p, &end);
+            if (end == p) return -1;
+            p = (*end == '%') ? end + 1 : end;
+            have_clear = 1;
+        } else {
+            return -1;
+        }
+        if (*p && *p != ' ' && *p != '\t') return -1;
+    }
+    if (r->kind != ALERT_THRESH && r->window_ms <= 0) return -1;
+    int above = r->op == ALERT_GT || r->op == ALERT_GE;
+    if (!have_clear) {
+        double band = (r->threshold < 0 ? -r->threshold : r->threshold) * config_get()->alert_hysteresis / 100.0;
+        r->clear = above ? r->threshold - band : r->threshold + band;
+    }
+    if (above ? r->clear > r->threshold : r->clear < r->threshold) return -1;
+    r->start_ms = -1;
+    return 0;
+}
+
+/* Room for the window at interval_ms per sample, plus slack for jitter */
+static int alert_rule_alloc(alert_rule_t *r, int interval_ms) {
+    r->cap = (size_t)(r->window_ms / (interval_ms > 0 ? interval_ms : 1)) + 8;
+    r->t = malloc(r->cap * sizeof(int64_t));
+    r->v = malloc(r->cap * sizeof(double));
+    r->minq = malloc(r->cap * sizeof(uint64_t));
+    r->maxq = malloc(r->cap * sizeof(uint64_t));
+    return (r->t && r->v && r->minq && r->maxq) ? 0 : -1;
+}
+
+static void alert_rule_free(alert_rule_t *r) {
+    free(r->t);
+    free(r->v);
+    free(r->minq);
+    free(r->maxq);
+}
+
+static inline int alert_cmp(int op, double a, double b) {
+    switch (op) {
+    case ALERT_GT: return a > b;
+    case ALERT_GE: return a >= b;
+    case ALERT_LT: return a < b;
+    default: return a <= b;
+    }
+}
+
+/* Add one value at t_ms & re-evaluate. Returns 1 when the rule fires, -1
+ * when it clears, 0 otherwise. */
+int alert_rule_step(alert_rule_t *r, double v, int64_t t_ms) {
+    size_t cap = r->cap;
+    if (r->start_ms < 0) r->start_ms = t_ms;
+    while (r->tail != r->head && (r->t[r->tail % cap] <= t_ms - r->window_ms || r->head - r->tail == cap)) {
+        uint64_t s = r->tail++;
+        r->sum -= r->v[s % cap];
+        if (r->minh != r->mint && r->minq[r->minh % cap] == s) r->minh++;
+        if (r->maxh != r->maxt && r->maxq[r->maxh % cap] == s) r->maxh++;
+    }
+    uint64_t s = r->head++;
+    r->t[s % cap] = t_ms;
+    r->v[s % cap] = v;
+    r->sum = (r->tail == s) ? v : r->sum + v;  // restart the sum whenever the window empties
+    while (r->mint != r->minh && r->v[r->minq[(r->mint - 1) % cap] % cap] >= v) r->mint--;
+    r->minq[r->mint++ % cap] = s;
+    while (r->maxt != r->maxh && r->v[r->maxq[(r->maxt - 1) % cap] % cap] <= v) r->maxt--;
+    r->maxq[r->maxt++ % cap] = s;
+
+    int full = t_ms - r->start_ms >= r->window_ms;
+    int above = r->op == ALERT_GT || r->op == ALERT_GE;
+    double lo = r->v[r->minq[r->minh % cap] % cap], hi = r->v[r->maxq[r->maxh % cap] % cap];
+    double fire_stat, clear_stat;
+    if (r->kind == ALERT_THRESH) {
+        r->value = v;
+        fire_stat = above ? lo : hi;
+        clear_stat = above ? hi : lo;
+    } else if (r->kind == ALERT_AVG) {
+        r->value = fire_stat = clear_stat = r->sum / (double)(r->head - r->tail);
+    } else {
+        uint64_t o = r->tail % cap;
+        int64_t dt = t_ms - r->t[o];
+        if (dt <= 0) return 0;
+        r->value = fire_stat = clear_stat = (v - r->v[o]) * r->unit_ms / (double)dt;
+    }
+    if (!r->firing) {
+        if (full && alert_cmp(r->op, fire_stat, r->threshold)) {
+            r->firing = 1;
+            r->fired++;
+            return 1;
+        }
+    } else if (full && (above ? clear_stat < r->clear : clear_stat > r->clear)) {
+        r->firing = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Config side: config_parse collects the ALERT lines, reload installs them */
+static void alert_config_add(config_t *c, const char *rule) {
+    if (c->n_alert_rules == ALERT_MAX_RULES) {
+        fprintf(stderr, "config: more than %d ALERT rules, ignoring '%s'\n", ALERT_MAX_RULES, rule);
+        return;
+    }
+    size_t n = strlen(rule);
+    if (n >= ALERT_TEXT) {
+        fprintf(stderr, "config: ALERT rule longer than %d characters, ignoring '%s'\n", ALERT_TEXT - 1, rule);
+        return;
+    }
+    memcpy(c->alert_rules[c->n_alert_rules++], rule, n + 1);
+}
+
+/* Build c's rules (c must be the published config: parsing reads
+ * ALERT_HYSTERESIS from it) & swap them in */
+static void alert_config_commit(const config_t *c) {
+    alert_rule_t *rules = calloc(c->n_alert_rules ? (size_t)c->n_alert_rules : 1, sizeof(alert_rule_t));
+    if (!rules) return;
+    size_t n = 0;
+    for (int i = 0; i < c->n_alert_rules; i++) {
+        alert_rule_t *r = &rules[n];
+        if (alert_rule_parse(r, c->alert_rules[i]) != 0) {
+            fprintf(stderr, "config: bad ALERT rule '%s'\n", c->alert_rules[i]);
+            continue;
+        }
+        if (alert_rule_alloc(r, c->cpu_interval_ms) != 0) {
+            alert_rule_free(r);
+            continue;
+        }
+        n++;
+    }
+    pthread_mutex_lock(&alerts.lock);
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < alerts.n; j++)
+            if (strcmp(rules[i].text, alerts.rules[j].text) == 0) {
+                rules[i].firing = alerts.rules[j].firing;
+                rules[i].since = alerts.rules[j].since;
+                rules[i].value = alerts.rules[j].value;
+                rules[i].fired = alerts.rules[j].fired;
+                break;
+            }
+    alert_rule_t *old = alerts.rules;
+    size_t nold = alerts.n;
+    alerts.rules = rules;
+    alerts.n = n;
+    pthread_mutex_unlock(&alerts.lock);
+    for (size_t i = 0; i < nold; i++) alert_rule_free(&old[i]);
+    free(old);
+}
+
+/* Run every rule on a new sample (from publish_sample) */
+static void alert_eval(const metric_sample_t *s) {
+    int64_t t = now_ms();
+    pthread_mutex_lock(&alerts.lock);
+    for (size_t i = 0; i < alerts.n; i++) {
+        alert_rule_t *r = &alerts.rules[i];
+        int edge = alert_rule_step(r, sample_field(s, (size_t)r->field), t);
+        if (!edge) continue;
+        char timestr[64], line[ALERT_TEXT + 128];
+        struct tm tm;
+        localtime_r(&s->timestamp, &tm);
+        strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
+        if (edge > 0) {
+            r->since = s->timestamp;
+            snprintf(line, sizeof(line), "%s ALERT rule=\"%s\" value=%.2f\n", timestr, r->text, r->value);
+            fprintf(stderr, "[ALERT %s] %s (value %.2f)\n", timestr, r->text, r->value);
+        } else {
+            snprintf(line, sizeof(line), "%s RESOLVED rule=\"%s\" value=%.2f after=%llds\n", timestr, r->text,
+                     r->value, (long long)(s->timestamp - r->since));
+            fprintf(stderr, "[RESOLVED %s] %s (value %.2f)\n", timestr, r->text, r->value);
+            r->since = s->timestamp;
+        }
+        writer_text(line);
+    }
+    pthread_mutex_unlock(&alerts.lock);
+}
+
+#define MAX_PATTERNS 64         // LOG_PATTERNS entries, see the multi-pattern log scanner
+#define MAX_PATTERN_BYTES 4096
+
+/* Log ingest throughput, published by the log thread about once a second */
+typedef struct {
+    char path[256];
+    uint64_t bytes, lines;          // totals since the file was first followed
+    uint64_t alerts;                // lines that matched LOG_PATTERNS
+    uint64_t hits[MAX_PATTERNS];    // ... per pattern, in logstats.patterns order
+    double bytes_per_s, lines_per_s;
+} log_stat_t;
+
+static struct {
+    pthread_mutex_t lock;
+    log_stat_t *v;
+    size_t n, cap;
+    int npatterns;
+    char patterns[MAX_PATTERN_BYTES + MAX_PATTERNS];  // "error,fail", as compiled
+} logstats = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, "" };
+
+/* Recently matched log lines, for the "logs" request: the file, the byte
+ * offset of the line, when it was read, the patterns it hit & (the first
+ * LOG_MATCH_TEXT_MAX bytes of) the line itself. Records sit in a fixed ring of
+ * LOG_MATCH_RING slots; their strings go into one LOG_MATCH_ARENA_KB byte
+ * arena written round-robin, so a capture is a few memcpys under the lock &
+ * never allocates. The oldest record is evicted when the ring is full or when
+ * the arena comes round to its strings. Positions in the arena are logical
+ * (ever increasing), so "still there" is a single comparison. */
+#define LOG_MATCH_TEXT_MAX 1024
+#define LOG_MATCH_NAMES 256  // matched pattern list, cut there
+#define LOG_MATCH_PATH 256
+
+typedef struct {
+    uint64_t seq;        // matches captured ever, 1-based
+    int64_t t;           // wall clock when the line was read
+    uint64_t offset;     // of the line's first byte in the file
+    uint64_t pos;        // arena position of path\0names\0line\0
+    uint16_t path_len, names_len, text_len;
+} log_match_t;
+
+static struct {
+    pthread_mutex_t lock;
+    log_match_t *ring;
+    size_t size, head, count;
+    char *arena;
+    size_t arena_size;
+    uint64_t pos;        // logical end of the arena data
+    uint64_t total;
+} logmatch = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, NULL, 0, 0, 0 };
+
+/* size 0 turns capture off */
+static int logmatch_init(size_t size, size_t arena_kb) {
+    if (size == 0) return 0;
+    logmatch.ring = calloc(size, sizeof(log_match_t));
+    logmatch.arena = malloc(arena_kb * 1024);
+    if (!logmatch.ring || !logmatch.arena) {
+        free(logmatch.ring);
+        free(logmatch.arena);
+        logmatch.ring = NULL;
+        logmatch.arena = NULL;
+        return -1;
+    }
+    logmatch.size = size;
+    logmatch.arena_size = arena_kb * 1024;
+    return 0;
+}
+
+static void logmatch_free(void) {
+    free(logmatch.ring);
+    free(logmatch.arena);
+    logmatch.ring = NULL;
+    logmatch.arena = NULL;
+    logmatch.size = logmatch.arena_size = logmatch.head = logmatch.count = 0;
+    logmatch.pos = logmatch.total = 0;
+}
+
+static inline const log_match_t *logmatch_at(size_t i) {  // 0 = oldest
+    return &logmatch.ring[(logmatch.head + logmatch.size - logmatch.count + i) % logmatch.size];
+}
+
+static size_t logmatch_copy(char *dst, const char *src, size_t n, size_t max) {
+    if (n > max) n = max;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+    return n;
+}
+
+/* Record one matched line; its text is head[0..hn) + tail[0..tn), cut to
+ * LOG_MATCH_TEXT_MAX */
+static void logmatch_put(const char *path, const char *names, uint64_t offset, const char *head, size_t hn,
+                         const char *tail, size_t tn) {
+    if (!logmatch.size) return;
+    size_t pl = strlen(path), nl = strlen(names);
+    if (pl >= LOG_MATCH_PATH) pl = LOG_MATCH_PATH - 1;
+    if (nl >= LOG_MATCH_NAMES) nl = LOG_MATCH_NAMES - 1;
+    if (hn > LOG_MATCH_TEXT_MAX) hn = LOG_MATCH_TEXT_MAX;
+    if (tn > LOG_MATCH_TEXT_MAX - hn) tn = LOG_MATCH_TEXT_MAX - hn;
+    if (tn && tail[tn - 1] == '\r') tn--;
+    else if (!tn && hn && head[hn - 1] == '\r') hn--;  // split between \r & \n
+    size_t need = pl + nl + hn + tn + 3;
+    int64_t t = (int64_t)time(NULL);
+    pthread_mutex_lock(&logmatch.lock);
+    size_t cap = logmatch.arena_size;
+    uint64_t at = logmatch.pos;
+    if (at % cap + need > cap) at += cap - at % cap;  // a record's strings stay contiguous
+    uint64_t end = at + need;
+    while (logmatch.count && (logmatch.count == logmatch.size || logmatch_at(0)->pos + cap < end)) logmatch.count--;
+    log_match_t *m = &logmatch.ring[logmatch.head];
+    char *p = logmatch.arena + at % cap;
+    m->seq = ++logmatch.total;
+    m->t = t;
+    m->offset = offset;
+    m->pos = at;
+    m->path_len = (uint16_t)logmatch_copy(p, path, pl, pl);
+    m->names_len = (uint16_t)logmatch_copy(p + pl + 1, names, nl, nl);
+    char *text = p + pl + nl + 2;
+    memcpy(text, head, hn);
+    logmatch_copy(text + hn, tail, tn, tn);
+    m->text_len = (uint16_t)(hn + tn);
+    logmatch.head = (logmatch.head + 1) % logmatch.size;
+    logmatch.count++;
+    logmatch.pos = end;
+    pthread_mutex_unlock(&logmatch.lock);
+}
+
+/* Top processes by CPU & by RSS, published by the process collector */
+#define PROC_TOP_MAX 100
+
+typedef struct {
+    int pid;
+    char comm[32];
+    double cpu;       // percent of one CPU since the previous scan
+    uint64_t rss_kb;
+} proc_top_t;
+
+static struct {
+    pthread_mutex_t lock;
+    time_t ts;
+    size_t n_cpu, n_rss;
+    proc_top_t cpu[PROC_TOP_MAX], rss[PROC_TOP_MAX];  // largest first
+    unsigned long nprocs;                             // processes seen by the last scan
+} proctop = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Copy the head of the last scan's lists into a sample */
+static void proc_top_attach(metric_sample_t *s) {
+    pthread_mutex_lock(&proctop.lock);
+    for (int list = 0; list < 2; list++) {
+        const proc_top_t *v = list ? proctop.rss : proctop.cpu;
+        size_t n = list ? proctop.n_rss : proctop.n_cpu;
+        sample_proc_t *out = list ? s->top_rss : s->top_cpu;
+        memset(out, 0, SAMPLE_TOP_PROCS * sizeof(*out));
+        for (size_t i = 0; i < n && i < SAMPLE_TOP_PROCS; i++) {
+            out[i].pid = v[i].pid;
+            out[i].cpu = (float)v[i].cpu;
+            out[i].rss_kb = v[i].rss_kb;
+            snprintf(out[i].comm, sizeof(out[i].comm), "%s", v[i].comm);
+        }
+    }
+    pthread_mutex_unlock(&proctop.lock);
+}
+
+/* Copy s into out as the body of a JSON string */
+static void json_escape(char *out, size_t outsz, const char *s) {
+    size_t o = 0;
+    for (; *s && o + 7 < outsz; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out[o++] = '\\';
+            out[o++] = (char)c;
+        } else if (c < 0x20) {
+            o += (size_t)snprintf(out + o, outsz - o, "\\u%04x", c);
+        } else {
+            out[o++] = (char)c;
+        }
+    }
+    out[o] = '\0';
+}
+
+/* Growable output buffer for replies built on demand */
+typedef struct {
+    char *p;
+    size_t len, cap;
+    int err;
+} sbuf_t;
+
+static void sbuf_printf(sbuf_t *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void sbuf_printf(sbuf_t *b, const char *fmt, ...) {
+    if (b->err) return;
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->p ? b->p + b->len : NULL, b->p ? b->cap - b->len : 0, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            b->err = 1;
+            return;
+        }
+        if (b->p && (size_t)n < b->cap - b->len) {
+            b->len += (size_t)n;
+            return;
+        }
+        size_t nc = b->cap ? b->cap : 4096;
+        while (nc < b->len + (size_t)n + 1) nc *= 2;
+        char *np = realloc(b->p, nc);
+        if (!np) {
+            b->err = 1;
+            return;
+        }
+        b->p = np;
+        b->cap = nc;
+    }
+}
+
+static void sbuf_write(sbuf_t *b, const char *data, size_t n) {
+    if (b->err) return;
+    if (b->cap - b->len < n + 1) {
+        size_t nc = b->cap ? b->cap : 4096;
+        while (nc < b->len + n + 1) nc *= 2;
+        char *np = realloc(b->p, nc);
+        if (!np) {
+            b->err = 1;
+            return;
+        }
+        b->p = np;
+        b->cap = nc;
+    }
+    memcpy(b->p + b->len, data, n);
+    b->len += n;
+    b->p[b->len] = '\0';
+}
+
+/* Pre-serialized status document.
+ *
+ * Every published sample is formatted once into a fragment ring; the full JSON
+ * reply is then assembled with memcpy into a spare buffer & swapped in through
+ * an atomic pointer. Readers pin a buffer with a refcount & send it as is.
+ * Normally two buffers alternate; a slow client pinning an old one makes the
+ * producer use another (up to STATUS_MAX_BUFS) instead of waiting. Buffers are
+ * never freed while running, so a reader racing a swap only touches refs. */
+
+#define STATUS_FRAG_MAX 256
+#define STATUS_MAX_BUFS 8
+
+typedef struct {
+    atomic_int refs;
+    size_t len, cap;
+    size_t body_off;  // payload start, after a pre-rendered HTTP header (metricsdoc)
+    char *data;
+} status_buf_t;
+
+typedef struct {
+    pthread_mutex_t lock;  // serializes producers; readers never take it
+    char *frags;           // size * STATUS_FRAG_MAX
+    uint16_t *frag_len;
+    size_t size, head, count;
+    status_buf_t bufs[STATUS_MAX_BUFS];
+    int nbufs;
+    _Atomic(status_buf_t *) current;
+    atomic_ulong skipped;  // publications dropped because every buffer was pinned
+} status_doc_t;
+
+static status_doc_t statusdoc;
+
+static void status_doc_init(status_doc_t *d, size_t size) {
+    memset(d, 0, sizeof(*d));
+    pthread_mutex_init(&d->lock, NULL);
+    d->size = size;
+    d->frags = malloc(size * STATUS_FRAG_MAX);
+    d->frag_len = calloc(size, sizeof(uint16_t));
+    if (!d->frags || !d->frag_len) {
+        fprintf(stderr, "FATAL: cannot allocate status document of size %zu\n", size);
+        exit(1);
+    }
+    atomic_init(&d->current, NULL);
+    atomic_init(&d->skipped, 0);
+}
+
+static void status_doc_free(status_doc_t *d) {
+    for (int i = 0; i < d->nbufs; i++) free(d->bufs[i].data);
+    free(d->frags);
+    free(d->frag_len);
+    pthread_mutex_destroy(&d->lock);
+}
+
+/* RING_SIZE changed: keep the newest fragments. The caller republishes. */
+static int status_doc_resize(status_doc_t *d, size_t size) {
+    char *frags = malloc(size * STATUS_FRAG_MAX);
+    uint16_t *frag_len = calloc(size, sizeof(uint16_t));
+    if (!frags || !frag_len) {
+        free(frags);
+        free(frag_len);
+        return -1;
+    }
+    pthread_mutex_lock(&d->lock);
+    size_t keep = d->count < size ? d->count : size;
+    for (size_t i = 0; i < keep; i++) {
+        size_t idx = (d->head + d->size - keep + i) % d->size;
+        memcpy(frags + i * STATUS_FRAG_MAX, d->frags + idx * STATUS_FRAG_MAX, d->frag_len[idx]);
+        frag_len[i] = d->frag_len[idx];
+    }
+    char *old = d->frags;
+    uint16_t *old_len = d->frag_len;
+    d->frags = frags;
+    d->frag_len = frag_len;
+    d->size = size;
+    d->head = keep == size ? 0 : keep;
+    d->count = keep;
+    pthread_mutex_unlock(&d->lock);
+    free(old);
+    free(old_len);
+    return 0;
+}
+
+/* Pin the current document; NULL until the first publication */
+static status_buf_t *status_acquire(status_doc_t *d) {
+    for (;;) {
+        status_buf_t *b = atomic_load(&d->current);
+        if (!b) return NULL;
+        atomic_fetch_add(&b->refs, 1);
+        if (atomic_load(&d->current) == b) return b;
+        atomic_fetch_sub(&b->refs, 1);
+    }
+}
+
+static void status_release(status_buf_t *b) {
+    if (b) atomic_fetch_sub(&b->refs, 1);
+}
+
+/* A buffer that is neither current nor pinned; grows the pool if needed */
+static status_buf_t *status_spare(status_doc_t *d) {
+    status_buf_t *cur = atomic_load(&d->current);
+    for (int i = 0; i < d->nbufs; i++)
+        if (&d->bufs[i] != cur && atomic_load(&d->bufs[i].refs) == 0) return &d->bufs[i];
+    if (d->nbufs < STATUS_MAX_BUFS) {
+        status_buf_t *b = &d->bufs[d->nbufs++];
+        atomic_init(&b->refs, 0);
+        return b;
+    }
+    return NULL;
+}
+
+static int status_reserve(status_buf_t *b, size_t need) {
+    if (b->cap >= need) return 0;
+    size_t nc = b->cap ? b->cap : 4096;
+    while (nc < need) nc *= 2;
+    char *nd = realloc(b->data, nc);
+    if (!nd) return -1;
+    b->data = nd;
+    b->cap = nc;
+    return 0;
+}
+
+/* One disk's rates as a JSON object (status & the diskio request) */
+static void diskio_put(sbuf_t *sb, const diskio_rate_t *r, int first) {
+    char name[6 * DISKIO_NAME + 1];
+    json_escape(name, sizeof(name), r->name);
+    sbuf_printf(sb,
+                "%s{\"dev\":\"%s\",\"rd_iops\":%.2f,\"wr_iops\":%.2f,\"rd_bps\":%.0f,\"wr_bps\":%.0f,"
+                "\"await_ms\":%.2f,\"util\":%.2f}",
+                first ? "" : ",", name, r->rd_iops, r->wr_iops, r->rd_bps, r->wr_bps, r->await_ms, r->util);
+}
+
+/* Append the ring fragment for s; caller holds d->lock */
+static void status_frag_put(status_doc_t *d, const metric_sample_t *s) {
+    char ts[64];
+    struct tm tm;
+    localtime_r(&s->timestamp, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+    int n = snprintf(d->frags + d->head * STATUS_FRAG_MAX, STATUS_FRAG_MAX,
+                     "{\"timestamp\":\"%s\",\"cpu\":%.2f,\"memory\":%.2f,\"disk\":%.2f,"
+                     "\"core_max\":%.2f,\"core_p95\":%.2f}",
+                     ts, s->cpu_usage, s->memory_usage, s->disk_usage, s->cpu_core_max, s->cpu_core_p95);
+    d->frag_len[d->head] = (uint16_t)((n < STATUS_FRAG_MAX) ? n : STATUS_FRAG_MAX - 1);
+    d->head = (d->head + 1 == d->size) ? 0 : d->head + 1;
+    if (d->count < d->size) d->count++;
+}
+
+/* Append s (if any) to the fragment ring & republish the document */
+static void status_doc_update(status_doc_t *d, const metric_sample_t *s) {
+    uint64_t t0 = mono_ns();
+    pthread_mutex_lock(&d->lock);
+    if (s) status_frag_put(d, s);
+
+    status_buf_t *b = status_spare(d);
+    if (!b) {
+        atomic_fetch_add(&d->skipped, 1);
+        pthread_mutex_unlock(&d->lock);
+        return;
+    }
+
+    float cores[MAX_REPORTED_CORES];
+    size_t ncores = core_ring_latest(&corering, cores, MAX_REPORTED_CORES);
+    double cpu = s ? s->cpu_usage : 0.0, mem = s ? s->memory_usage : 0.0, disk = s ? s->disk_usage : 0.0;
+    double core_max = s ? s->cpu_core_max : 0.0, core_p95 = s ? s->cpu_core_p95 : 0.0;
+
+    /* built in place in the spare's storage, which sbuf grows as needed */
+    sbuf_t sb = { b->data, 0, b->cap, 0 };
+    sbuf_printf(&sb,
+                "{ \"current\": { \"cpu\": %.2f, \"memory\": %.2f, \"disk\": %.2f, "
+                "\"core_max\": %.2f, \"core_p95\": %.2f, ",
+                cpu, mem, disk, core_max, core_p95);
+    metric_sample_t zero;
+    if (!s) memset(&zero, 0, sizeof(zero));
+    for (size_t i = SAMPLE_BASE_FIELDS; i < N_SAMPLE_FIELDS; i++) {
+        char f[96];
+        sample_field_format(f, sizeof(f), s ? s : &zero, i, "", ": ");
+        sbuf_printf(&sb, "%s, ", f);
+    }
+    sbuf_printf(&sb, "\"cores\": [");
+    for (size_t i = 0; i < ncores; i++) sbuf_printf(&sb, "%.2f%s", cores[i], (i + 1 < ncores) ? "," : "");
+    sbuf_printf(&sb, "] }, \"logs\": [");
+    pthread_mutex_lock(&logstats.lock);
+    for (size_t i = 0; i < logstats.n; i++) {
+        const log_stat_t *l = &logstats.v[i];
+        char path[1536];
+        json_escape(path, sizeof(path), l->path);
+        sbuf_printf(&sb,
+                    "%s{\"path\":\"%s\",\"bytes\":%lu,\"lines\":%lu,\"alerts\":%lu,"
+                    "\"bytes_per_s\":%.0f,\"lines_per_s\":%.0f}",
+                    i ? "," : "", path, (unsigned long)l->bytes, (unsigned long)l->lines, (unsigned long)l->alerts,
+                    l->bytes_per_s, l->lines_per_s);
+    }
+    pthread_mutex_unlock(&logstats.lock);
+    sbuf_printf(&sb, "], \"mounts\": [");
+    pthread_mutex_lock(&disktab.lock);
+    for (size_t i = 0, first = 1; i < disktab.n; i++) {
+        const mount_ent_t *e = &disktab.m[i];
+        if (!e->have) continue;
+        char path[6 * 1024 + 1], type[6 * 64 + 1];
+        json_escape(path, sizeof(path), e->path);
+        json_escape(type, sizeof(type), e->fstype);
+        sbuf_printf(&sb,
+                    "%s{\"path\":\"%s\",\"fstype\":\"%s\",\"dev\":\"%u:%u\",\"total\":%lu,"
+                    "\"used\":%lu,\"avail\":%lu,\"percent\":%.2f%s}",
+                    first ? "" : ",", path, type, e->major, e->minor, (unsigned long)e->total,
+                    (unsigned long)e->used, (unsigned long)e->avail, e->perc, e->hung ? ",\"stale\":true" : "");
+        first = 0;
+    }
+    pthread_mutex_unlock(&disktab.lock);
+    sbuf_printf(&sb, "], \"diskio\": [");
+    diskio_rate_t io[DISKIO_MAX_DEVS];
+    time_t io_ts;
+    uint8_t io_n = 0;
+    diskio_ring_read(&diskioring, 1, &io_ts, &io_n, io);
+    for (size_t i = 0; i < io_n; i++) diskio_put(&sb, &io[i], i == 0);
+    sbuf_printf(&sb, "], \"net\": [");
+    pthread_mutex_lock(&nettab.lock);
+    for (size_t i = 0; i < nettab.n; i++) {
+        const net_iface_t *e = &nettab.v[i];
+        char name[6 * NET_IFNAME + 1];
+        json_escape(name, sizeof(name), e->name);
+        sbuf_printf(&sb,
+                    "%s{\"iface\":\"%s\",\"speed_mbps\":%u,\"rx_bytes\":%llu,\"tx_bytes\":%llu,"
+                    "\"rx_packets\":%llu,\"tx_packets\":%llu,\"rx_errs\":%llu,\"tx_errs\":%llu,"
+                    "\"rx_drop\":%llu,\"tx_drop\":%llu,\"rx_bps\":%.0f,\"tx_bps\":%.0f,\"rx_pps\":%.1f,"
+                    "\"tx_pps\":%.1f,\"util\":%.2f}",
+                    i ? "," : "", name, e->speed_mbps, (unsigned long long)e->c.rx_bytes,
+                    (unsigned long long)e->c.tx_bytes, (unsigned long long)e->c.rx_packets,
+                    (unsigned long long)e->c.tx_packets, (unsigned long long)e->c.rx_errs,
+                    (unsigned long long)e->c.tx_errs, (unsigned long long)e->c.rx_drop,
+                    (unsigned long long)e->c.tx_drop, e->rx_bps, e->tx_bps, e->rx_pps, e->tx_pps, e->util);
+    }
+    pthread_mutex_unlock(&nettab.lock);
+    sbuf_printf(&sb, "], \"alerts\": [");
+    pthread_mutex_lock(&alerts.lock);
+    for (size_t i = 0; i < alerts.n; i++) {
+        const alert_rule_t *r = &alerts.rules[i];
+        char rule[6 * ALERT_TEXT + 1];
+        json_escape(rule, sizeof(rule), r->text);
+        sbuf_printf(&sb, "%s{\"rule\":\"%s\",\"state\":\"%s\",\"value\":%.2f,\"since\":%lld,\"fired\":%lu}",
+                    i ? "," : "", rule, r->firing ? "firing" : "ok", r->value, (long long)r->since, r->fired);
+    }
+    pthread_mutex_unlock(&alerts.lock);
+    pthread_mutex_lock(&proctop.lock);
+    sbuf_printf(&sb, "], \"procs\": { \"count\": %lu, \"top_cpu\": [", proctop.nprocs);
+    for (int list = 0; list < 2; list++) {
+        const proc_top_t *v = list ? proctop.rss : proctop.cpu;
+        size_t n = list ? proctop.n_rss : proctop.n_cpu;
+        if (list) sbuf_printf(&sb, "], \"top_rss\": [");
+        for (size_t i = 0; i < n; i++) {
+            char comm[6 * sizeof(v[i].comm) + 1];
+            json_escape(comm, sizeof(comm), v[i].comm);
+            sbuf_printf(&sb, "%s{\"pid\":%d,\"comm\":\"%s\",\"cpu\":%.2f,\"rss_kb\":%lu}", i ? "," : "", v[i].pid,
+                        comm, v[i].cpu, (unsigned long)v[i].rss_kb);
+        }
+    }
+    pthread_mutex_unlock(&proctop.lock);
+    sbuf_printf(&sb, "] }, \"self\": {");
+    for (int i = 0; i < INSTR_COUNT; i++) {
+        instr_snap_t sn;
+        instr_snapshot(i, &sn);
+        sbuf_printf(&sb,
+                    "%s\"%s\":{\"unit\":\"%s\",\"count\":%lu,\"p50\":%.1f,\"p90\":%.1f,"
+                    "\"p99\":%.1f,\"max\":%.1f}",
+                    i ? "," : "", instr[i].name, instr[i].bytes ? "bytes" : "us", sn.count, sn.p50, sn.p90, sn.p99,
+                    sn.max);
+    }
+    sbuf_printf(&sb, "}, \"samples\": [");
+    size_t start = (d->head + d->size - d->count) % d->size;
+    for (size_t i = 0; i < d->count; i++) {
+        size_t idx = start + i;
+        if (idx >= d->size) idx -= d->size;
+        sbuf_write(&sb, d->frags + idx * STATUS_FRAG_MAX, d->frag_len[idx]);
+        if (i + 1 < d->count) sbuf_write(&sb, ",", 1);
+    }
+    sbuf_write(&sb, "] }\n", 4);
+    b->data = sb.p;  // realloc'd in place: a spare is never pinned
+    b->cap = sb.cap;
+    if (sb.err) {
+        atomic_fetch_add(&d->skipped, 1);
+        pthread_mutex_unlock(&d->lock);
+        return;
+    }
+    b->len = sb.len;
+    atomic_store(&d->current, b);
+    pthread_mutex_unlock(&d->lock);
+    instr_since(INSTR_STATUS_BUILD, t0);
+}
+
+/* Binary metrics log (METRICS_LOG_FORMAT=binary).
+ *
+ * Layout: a 64 byte header followed by fixed-size little-endian records. The
+ * file is preallocated in BINLOG_CHUNK steps & written with pwrite() through a
+ * persistent fd; unused space is zero, & a zero timestamp marks the end, so no
+ * header update is needed per record. Timestamps are assumed non-decreasing.
+ * A record is the timestamp followed by every sample_fields entry in table
+ * order, 8 bytes each; version 1 files (the first five fields only) are
+ * rejected rather than misread. */
+
+#define BINLOG_MAGIC "SWMLOG1"
+#define BINLOG_VERSION 2
+#define BINLOG_HEADER_SIZE 64
+#define BINLOG_RECORD_SIZE (8 + 8 * N_SAMPLE_FIELDS)
+#define BINLOG_CHUNK (1024 * 1024)
+
+typedef struct {
+    pthread_mutex_t lock;
+    int fd;
+    char path[1024];
+    off_t next;       // offset of the next record
+    off_t alloc_end;  // preallocated file size
+} binlog_t;
+
+static binlog_t binlog = { PTHREAD_MUTEX_INITIALIZER, -1, "", 0, 0 };
+
+static inline void put_le64(unsigned char *p, uint64_t v) {
+    v = htole64(v);
+    memcpy(p, &v, 8);
+}
+
+static inline uint64_t get_le64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return le64toh(v);
+}
+
+static inline void put_le_double(unsigned char *p, double d) {
+    uint64_t v;
+    memcpy(&v, &d, 8);
+    put_le64(p, v);
+}
+
+static inline double get_le_double(const unsigned char *p) {
+    uint64_t v = get_le64(p);
+    double d;
+    memcpy(&d, &v, 8);
+    return d;
+}
+
+static void binlog_encode(unsigned char *rec, const metric_sample_t *m) {
+    put_le64(rec, (uint64_t)(int64_t)m->timestamp);
+    for (size_t i = 0; i < N_SAMPLE_FIELDS; i++) {
+        const char *p = (const char *)m + sample_fields[i].off;
+        if (sample_fields[i].is_u64) put_le64(rec + 8 + 8 * i, *(const uint64_t *)p);
+        else put_le_double(rec + 8 + 8 * i, *(const double *)p);
+    }
+}
+
+static void binlog_decode(const unsigned char *rec, metric_sample_t *m) {
+    memset(m, 0, sizeof(*m));
+    m->timestamp = (time_t)(int64_t)get_le64(rec);
+    for (size_t i = 0; i < N_SAMPLE_FIELDS; i++) {
+        char *p = (char *)m + sample_fields[i].off;
+        if (sample_fields[i].is_u64) *(uint64_t *)p = get_le64(rec + 8 + 8 * i);
+        else *(double *)p = get_le_double(rec + 8 + 8 * i);
+    }
+}
+
+/* NULL if h is a header this build writes, else why not */
+static const char *binlog_header_check(const unsigned char *h) {
+    if (memcmp(h, BINLOG_MAGIC, 8) != 0 || get_le64(h + 24) != BINLOG_HEADER_SIZE)
+        return "not a syswatch binary log";
+    if (get_le64(h + 8) != BINLOG_VERSION || get_le64(h + 16) != BINLOG_RECORD_SIZE)
+        return "written with another record layout (move it aside to start a new log)";
+    return NULL;
+}
+
+/* Number of written records in [0, n): first slot with a zero timestamp */
+static size_t binlog_count(const unsigned char *recs, size_t n) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (get_le64(recs + mid * BINLOG_RECORD_SIZE) != 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void binlog_close(binlog_t *b) {
+    if (b->fd >= 0) close(b->fd);
+    b->fd = -1;
+    b->path[0] = '\0';
+}
+
+static int binlog_open(binlog_t *b, const char *path) {
+    binlog_close(b);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    unsigned char hdr[BINLOG_HEADER_SIZE];
+    if (st.st_size == 0) {
+        memset(hdr, 0, sizeof(hdr));
+        memcpy(hdr, BINLOG_MAGIC, 8);
+        put_le64(hdr + 8, BINLOG_VERSION);
+        put_le64(hdr + 16, BINLOG_RECORD_SIZE);
+        put_le64(hdr + 24, BINLOG_HEADER_SIZE);
+        if (pwrite(fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+            close(fd);
+            return -1;
+        }
+        b->next = b->alloc_end = BINLOG_HEADER_SIZE;
+    } else {
+        const char *why = pread(fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ? "not a syswatch binary log"
+                                                                                  : binlog_header_check(hdr);
+        if (why) {
+            fprintf(stderr, "binlog: %s: %s\n", path, why);
+            close(fd);
+            return -1;
+        }
+        size_t n = (size_t)(st.st_size - BINLOG_HEADER_SIZE) / BINLOG_RECORD_SIZE;
+        unsigned char *map = NULL;
+        if (n > 0) {
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) {
+                close(fd);
+                return -1;
+            }
+        }
+        size_t used = map ? binlog_count(map + BINLOG_HEADER_SIZE, n) : 0;
+        if (map) munmap(map, (size_t)st.st_size);
+        b->next = BINLOG_HEADER_SIZE + (off_t)used * BINLOG_RECORD_SIZE;
+        b->alloc_end = st.st_size;
+    }
+    b->fd = fd;
+    snprintf(b->path, sizeof(b->path), "%s", path);
+    return 0;
+}
+
+/* Append n encoded records with one pwrite() (then fdatasync if sync); writer
+ * thread only */
+static int binlog_write_batch(binlog_t *b, const char *path, const unsigned char *recs, size_t n, int sync) {
+    size_t bytes = n * BINLOG_RECORD_SIZE;
+    pthread_mutex_lock(&b->lock);
+    int rc = -1;
+    if ((b->fd < 0 || strcmp(b->path, path) != 0) && binlog_open(b, path) != 0) goto out;
+    if (b->next + (off_t)bytes > b->alloc_end) {
+        off_t want = b->alloc_end + BINLOG_CHUNK;
+        while (want < b->next + (off_t)bytes) want += BINLOG_CHUNK;
+        if (posix_fallocate(b->fd, b->alloc_end, want - b->alloc_end) != 0 && ftruncate(b->fd, want) != 0)
+            goto out;
+        b->alloc_end = want;
+    }
+    size_t off = 0;
+    while (off < bytes) {
+        ssize_t w = pwrite(b->fd, recs + off, bytes - off, b->next + (off_t)off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        off += (size_t)w;
+    }
+    /* only whole records count; a torn tail is overwritten next time */
+    b->next += (off_t)(off - off % BINLOG_RECORD_SIZE);
+    if (off == bytes) rc = 0;
+    if (off > 0 && sync) fdatasync(b->fd);
+out:
+    pthread_mutex_unlock(&b->lock);
+    return rc;
+}
+
+/* "1700000000", "2025-11-12" or "2025-11-12 17:42:17" (local time) */
+static int parse_time_arg(const char *s, time_t *out) {
+    char *end;
+    long long v = strtoll(s, &end, 10);
+    if (*s && *end == '\0') {
+        *out = (time_t)v;
+        return 0;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *r = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+    if (!r || *r) {
+        memset(&tm, 0, sizeof(tm));
+        r = strptime(s, "%Y-%m-%d", &tm);
+        if (!r || *r) return -1;
+    }
+    tm.tm_isdst = -1;
+    *out = mktime(&tm);
+    return 0;
+}
+
+typedef struct {
+    double min, max, sum;
+} field_stats_t;
+
+static inline void field_add(field_stats_t *f, double v, size_t n) {
+    if (n == 0 || v < f->min) f->min = v;
+    if (n == 0 || v > f->max) f->max = v;
+    f->sum += v;
+}
+
+/* syswatch --read FILE: print (or summarize) records in [from, to] */
+int binlog_read_main(const char *path, time_t from, time_t to, int summary) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BINLOG_HEADER_SIZE) {
+        fprintf(stderr, "%s: not a syswatch binary log\n", path);
+        close(fd);
+        return 1;
+    }
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    unsigned char *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    const char *why = binlog_header_check(map);
+    if (why) {
+        fprintf(stderr, "%s: %s\n", path, why);
+        munmap(map, (size_t)st.st_size);
+        return 1;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    const unsigned char *recs = map + BINLOG_HEADER_SIZE;
+    size_t n = binlog_count(recs, (size_t)(st.st_size - BINLOG_HEADER_SIZE) / BINLOG_RECORD_SIZE);
+
+    /* lower bound of from */
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((time_t)(int64_t)get_le64(recs + mid * BINLOG_RECORD_SIZE) < from) lo = mid + 1;
+        else hi = mid;
+    }
+
+    field_stats_t stats[N_SAMPLE_FIELDS];
+    memset(stats, 0, sizeof(stats));
+    size_t matched = 0;
+    time_t first = 0, last = 0;
+    for (size_t i = lo; i < n; i++) {
+        metric_sample_t m;
+        binlog_decode(recs + i * BINLOG_RECORD_SIZE, &m);
+        if (m.timestamp > to) break;
+        if (summary) {
+            for (size_t f = 0; f < N_SAMPLE_FIELDS; f++) field_add(&stats[f], sample_field(&m, f), matched);
+        } else {
+            char ts[64];
+            struct tm tm;
+            localtime_r(&m.timestamp, &tm);
+            strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+            printf("%s cpu=%.2f mem=%.2f disk=%.2f core_max=%.2f core_p95=%.2f", ts, m.cpu_usage,
+                   m.memory_usage, m.disk_usage, m.cpu_core_max, m.cpu_core_p95);
+            for (size_t f = SAMPLE_BASE_FIELDS; f < N_SAMPLE_FIELDS; f++) {
+                if (sample_fields[f].is_u64) printf(" %s=%.0f", sample_fields[f].name, sample_field(&m, f));
+                else printf(" %s=%.2f", sample_fields[f].name, sample_field(&m, f));
+            }
+            putchar('\n');
+        }
+        if (matched == 0) first = m.timestamp;
+        last = m.timestamp;
+        matched++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (summary) {
+        char a[64] = "-", b[64] = "-";
+        struct tm tm;
+        if (matched) {
+            localtime_r(&first, &tm);
+            strftime(a, sizeof(a), "%Y-%m-%d %H:%M:%S", &tm);
+            localtime_r(&last, &tm);
+            strftime(b, sizeof(b), "%Y-%m-%d %H:%M:%S", &tm);
+        }
+        printf("records=%zu (of %zu) from=%s to=%s\n", matched, n, a, b);
+        for (size_t f = 0; matched && f < N_SAMPLE_FIELDS; f++)
+            printf("%-16s min=%.2f avg=%.2f max=%.2f\n", sample_fields[f].name, stats[f].min,
+                   stats[f].sum / (double)matched, stats[f].max);
+        printf("scan took %.3f ms\n",
+               (double)(t1.tv_sec - t0.tv_sec) * 1e3 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6);
+    }
+    munmap(map, (size_t)st.st_size);
+    return 0;
+}
+
+/* Long-term history.
+ *
+ * Three tiers: raw (every published sample) & 1m / 1h buckets holding min, avg
+ * & max of each metric. Each tier is a ring of fixed-size blocks in one array;
+ * a block has a small header & a Gorilla-style bit stream: timestamps as
+ * delta-of-delta (one bit per point while the scheduler keeps its cadence) &
+ * values XORed against the previous value of the same column, storing only the
+ * meaningful bits. Values are quantized to 1/128 % first, so the XOR residues
+ * keep long trailing-zero runs. The oldest block is dropped when a tier is full.
+ * Buckets are written once complete; producers & queries share one mutex, &
+ * queries copy the blocks they need before decoding. */
+
+#define HIST_BLOCK_BYTES 4096
+#define HIST_BLOCK_HDR 32
+#define HIST_RAW_COLS 5
+#define HIST_AGG_COLS (3 * HIST_RAW_COLS)
+#define HIST_MAX_COLS HIST_AGG_COLS
+#define HIST_POINT_MAX_BITS (68 + HIST_MAX_COLS * 77)
+#define HIST_MAX_POINTS 2000
+
+enum { HIST_RAW, HIST_1M, HIST_1H, HIST_TIERS };
+
+static const char *const hist_tier_names[HIST_TIERS] = { "raw", "1m", "1h" };
+static const int hist_tier_step[HIST_TIERS] = { 0, 60, 3600 };
+static const char *const hist_col_names[HIST_RAW_COLS] = { "cpu", "memory", "disk", "core_max", "core_p95" };
+
+/* Block header (little-endian): first_ts, last_ts, count, bit length */
+typedef struct {
+    int64_t first_ts, last_ts;
+    uint32_t count, bits;
+} hist_hdr_t;
+
+/* Encoder state for a tier's open block */
+typedef struct {
+    int64_t prev_ts, prev_delta;
+    uint64_t prev[HIST_MAX_COLS];
+    int lead[HIST_MAX_COLS], trail[HIST_MAX_COLS];   // lead < 0: no window yet
+} hist_enc_t;
+
+typedef struct {
+    int ncols;
+    unsigned char *blocks;   // nblocks * HIST_BLOCK_BYTES
+    size_t nblocks, head, count;  // head: block being written
+    hist_enc_t enc;
+} hist_tier_t;
+
+typedef struct {
+    int64_t start;           // bucket start, 0 = empty
+    uint32_t n;
+    double min[HIST_RAW_COLS], max[HIST_RAW_COLS], sum[HIST_RAW_COLS];
+} hist_bucket_t;
+
+/* What the state file keeps besides the blocks themselves */
+typedef struct {
+    struct {
+        uint64_t head, count;
+        hist_enc_t enc;
+    } tier[HIST_TIERS];
+    hist_bucket_t bucket[HIST_TIERS];
+} hist_saved_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    hist_tier_t tiers[HIST_TIERS];
+    hist_bucket_t bucket[HIST_TIERS];  // [HIST_1M], [HIST_1H] used
+    hist_saved_t *saved;     // in the state file (blocks too), NULL if on the heap
+} history_t;
+
+static history_t history = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void hist_hdr_get(const unsigned char *b, hist_hdr_t *h) {
+    h->first_ts = (int64_t)get_le64(b);
+    h->last_ts = (int64_t)get_le64(b + 8);
+    h->count = (uint32_t)(get_le64(b + 16) & 0xffffffffu);
+    h->bits = (uint32_t)(get_le64(b + 16) >> 32);
+}
+
+static void hist_hdr_put(unsigned char *b, const hist_hdr_t *h) {
+    put_le64(b, (uint64_t)h->first_ts);
+    put_le64(b + 8, (uint64_t)h->last_ts);
+    put_le64(b + 16, (uint64_t)h->count | ((uint64_t)h->bits << 32));
+}
+
+/* MSB-first bit I/O over a block's payload */
+static void bits_put(unsigned char *p, uint32_t *pos, uint64_t v, int n) {
+    while (n > 0) {
+        uint32_t byte = *pos >> 3;
+        int room = 8 - (int)(*pos & 7);
+        int take = n < room ? n : room;
+        uint8_t chunk = (uint8_t)((v >> (n - take)) & ((1u << take) - 1));
+        p[byte] = (uint8_t)((p[byte] & ~(((1u << take) - 1) << (room - take))) | (chunk << (room - take)));
+        *pos += (uint32_t)take;
+        n -= take;
+    }
+}
+
+static uint64_t bits_get(const unsigned char *p, uint32_t *pos, int n) {
+    uint64_t v = 0;
+    while (n > 0) {
+        uint32_t byte = *pos >> 3;
+        int room = 8 - (int)(*pos & 7);
+        int take = n < room ? n : room;
+        v = (v << take) | ((uint64_t)(p[byte] >> (room - take)) & ((1u << take) - 1));
+        *pos += (uint32_t)take;
+        n -= take;
+    }
+    return v;
+}
+
+static inline uint64_t hist_quantize(double v) {
+    double q = (double)(long long)(v * 128.0 + (v < 0 ? -0.5 : 0.5)) / 128.0;
+    uint64_t u;
+    memcpy(&u, &q, sizeof(u));
+    return u;
+}
+
+static inline double hist_bits_to_double(uint64_t u) {
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+static void hist_put_ts(unsigned char *p, uint32_t *pos, int64_t dod) {
+    if (dod == 0) bits_put(p, pos, 0, 1);
+    else if (dod >= -63 && dod <= 64) { bits_put(p, pos, 0x2, 2); bits_put(p, pos, (uint64_t)(dod + 63), 7); }
+    else if (dod >= -255 && dod <= 256) { bits_put(p, pos, 0x6, 3); bits_put(p, pos, (uint64_t)(dod + 255), 9); }
+    else if (dod >= -2047 && dod <= 2048) { bits_put(p, pos, 0xe, 4); bits_put(p, pos, (uint64_t)(dod + 2047), 12); }
+    else { bits_put(p, pos, 0xf, 4); bits_put(p, pos, (uint64_t)dod, 64); }
+}
+
+static int64_t hist_get_ts(const unsigned char *p, uint32_t *pos) {
+    if (!bits_get(p, pos, 1)) return 0;
+    if (!bits_get(p, pos, 1)) return (int64_t)bits_get(p, pos, 7) - 63;
+    if (!bits_get(p, pos, 1)) return (int64_t)bits_get(p, pos, 9) - 255;
+    if (!bits_get(p, pos, 1)) return (int64_t)bits_get(p, pos, 12) - 2047;
+    return (int64_t)bits_get(p, pos, 64);
+}
+
+static void hist_put_value(unsigned char *p, uint32_t *pos, hist_enc_t *e, int col, uint64_t v) {
+    uint64_t x = v ^ e->prev[col];
+    e->prev[col] = v;
+    if (x == 0) {
+        bits_put(p, pos, 0, 1);
+        return;
+    }
+    int lead = __builtin_clzll(x), trail = __builtin_ctzll(x);
+    if (lead > 31) lead = 31;
+    if (e->lead[col] >= 0 && lead >= e->lead[col] && trail >= e->trail[col]) {
+        /* fits the previous window */
+        bits_put(p, pos, 0x2, 2);
+        bits_put(p, pos, x >> e->trail[col], 64 - e->lead[col] - e->trail[col]);
+        return;
+    }
+    int len = 64 - lead - trail;
+    bits_put(p, pos, 0x3, 2);
+    bits_put(p, pos, (uint64_t)lead, 5);
+    bits_put(p, pos, (uint64_t)(len & 63), 6);  // 64 is stored as 0
+    bits_put(p, pos, x >> trail, len);
+    e->lead[col] = lead;
+    e->trail[col] = trail;
+}
+
+static uint64_t hist_get_value(const unsigned char *p, uint32_t *pos, hist_enc_t *e, int col) {
+    if (!bits_get(p, pos, 1)) return e->prev[col];
+    if (bits_get(p, pos, 1)) {
+        e->lead[col] = (int)bits_get(p, pos, 5);
+        int len = (int)bits_get(p, pos, 6);
+        if (len == 0) len = 64;
+        e->trail[col] = 64 - e->lead[col] - len;
+    }
+    int len = 64 - e->lead[col] - e->trail[col];
+    e->prev[col] ^= bits_get(p, pos, len) << e->trail[col];
+    return e->prev[col];
+}
+
+static size_t hist_tier_blocks(int kb) {
+    return (size_t)kb * 1024 / HIST_BLOCK_BYTES;
+}
+
+static int hist_tier_init(hist_tier_t *t, int ncols, int kb) {
+    memset(t, 0, sizeof(*t));
+    t->ncols = ncols;
+    t->nblocks = hist_tier_blocks(kb);
+    if (t->nblocks == 0) return 0;  // tier disabled
+    t->blocks = calloc(t->nblocks, HIST_BLOCK_BYTES);
+    if (!t->blocks) {
+        t->nblocks = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Append one point (vals are ncols quantized values) */
+static void hist_tier_append(hist_tier_t *t, int64_t ts, const uint64_t *vals) {
+    if (t->nblocks == 0) return;
+    unsigned char *blk = t->count ? t->blocks + t->head * HIST_BLOCK_BYTES : NULL;
+    hist_hdr_t h;
+    if (blk) {
+        hist_hdr_get(blk, &h);
+        if (h.bits + HIST_POINT_MAX_BITS > (HIST_BLOCK_BYTES - HIST_BLOCK_HDR) * 8 || ts < h.last_ts) blk = NULL;
+    }
+    hist_enc_t *e = &t->enc;
+    unsigned char *p;
+    if (!blk) {
+        /* open a new block; the first point is stored verbatim */
+        if (t->count) t->head = (t->head + 1) % t->nblocks;
+        if (t->count < t->nblocks) t->count++;
+        blk = t->blocks + t->head * HIST_BLOCK_BYTES;
+        memset(blk, 0, HIST_BLOCK_BYTES);
+        p = blk + HIST_BLOCK_HDR;
+        h.first_ts = h.last_ts = ts;
+        h.count = 1;
+        h.bits = 0;
+        for (int c = 0; c < t->ncols; c++) {
+            bits_put(p, &h.bits, vals[c], 64);
+            e->prev[c] = vals[c];
+            e->lead[c] = -1;
+        }
+        e->prev_ts = ts;
+        e->prev_delta = 0;
+        hist_hdr_put(blk, &h);
+        return;
+    }
+    p = blk + HIST_BLOCK_HDR;
+    int64_t delta = ts - e->prev_ts;
+    hist_put_ts(p, &h.bits, delta - e->prev_delta);
+    e->prev_delta = delta;
+    e->prev_ts = ts;
+    for (int c = 0; c < t->ncols; c++) hist_put_value(p, &h.bits, e, c, vals[c]);
+    h.last_ts = ts;
+    h.count++;
+    hist_hdr_put(blk, &h);
+}
+
+/* point callback for hist_block_decode: ncols doubles */
+typedef void (*hist_point_cb)(void *ctx, int64_t ts, const double *vals);
+
+static void hist_block_decode(const unsigned char *blk, int ncols, int64_t from, int64_t to, hist_point_cb cb,
+                              void *ctx) {
+    hist_hdr_t h;
+    hist_hdr_get(blk, &h);
+    const unsigned char *p = blk + HIST_BLOCK_HDR;
+    uint32_t pos = 0;
+    hist_enc_t e;
+    double vals[HIST_MAX_COLS];
+    int64_t ts = h.first_ts, delta = 0;
+    for (uint32_t i = 0; i < h.count && pos <= h.bits; i++) {
+        if (i == 0) {
+            for (int c = 0; c < ncols; c++) {
+                e.prev[c] = bits_get(p, &pos, 64);
+                e.lead[c] = e.trail[c] = 0;
+            }
+        } else {
+            delta += hist_get_ts(p, &pos);
+            ts += delta;
+            for (int c = 0; c < ncols; c++) hist_get_value(p, &pos, &e, c);
+        }
+        if (ts > to) break;
+        if (ts < from) continue;
+        for (int c = 0; c < ncols; c++) vals[c] = hist_bits_to_double(e.prev[c]);
+        cb(ctx, ts, vals);
+    }
+}
+
+static void hist_bucket_flush(history_t *hs, int tier) {
+    hist_bucket_t *b = &hs->bucket[tier];
+    if (!b->start || !b->n) return;
+    uint64_t vals[HIST_AGG_COLS];
+    for (int c = 0; c < HIST_RAW_COLS; c++) {
+        vals[3 * c] = hist_quantize(b->min[c]);
+        vals[3 * c + 1] = hist_quantize(b->sum[c] / b->n);
+        vals[3 * c + 2] = hist_quantize(b->max[c]);
+    }
+    hist_tier_append(&hs->tiers[tier], b->start, vals);
+    b->start = 0;
+    b->n = 0;
+}
+
+static void history_init(history_t *hs, int raw_kb, int m_kb, int h_kb) {
+    if (hist_tier_init(&hs->tiers[HIST_RAW], HIST_RAW_COLS, raw_kb) != 0 ||
+        hist_tier_init(&hs->tiers[HIST_1M], HIST_AGG_COLS, m_kb) != 0 ||
+        hist_tier_init(&hs->tiers[HIST_1H], HIST_AGG_COLS, h_kb) != 0)
+        fprintf(stderr, "history: cannot allocate every tier, some are disabled\n");
+    memset(hs->bucket, 0, sizeof(hs->bucket));
+}
+
+static void history_free(history_t *hs) {
+    for (int i = 0; i < HIST_TIERS && !hs->saved; i++) free(hs->tiers[i].blocks);
+    memset(hs->tiers, 0, sizeof(hs->tiers));
+    hs->saved = NULL;
+}
+
+/* Mirror the encoder state into the state file; caller holds the lock */
+static void history_save(history_t *hs) {
+    if (!hs->saved) return;
+    for (int i = 0; i < HIST_TIERS; i++) {
+        hs->saved->tier[i].head = hs->tiers[i].head;
+        hs->saved->tier[i].count = hs->tiers[i].count;
+        hs->saved->tier[i].enc = hs->tiers[i].enc;
+    }
+    memcpy(hs->saved->bucket, hs->bucket, sizeof(hs->bucket));
+}
+
+static void history_add(history_t *hs, const metric_sample_t *s) {
+    double v[HIST_RAW_COLS] = { s->cpu_usage, s->memory_usage, s->disk_usage, s->cpu_core_max, s->cpu_core_p95 };
+    uint64_t q[HIST_RAW_COLS];
+    for (int c = 0; c < HIST_RAW_COLS; c++) q[c] = hist_quantize(v[c]);
+    int64_t ts = (int64_t)s->timestamp;
+    pthread_mutex_lock(&hs->lock);
+    hist_tier_append(&hs->tiers[HIST_RAW], ts, q);
+    for (int tier = HIST_1M; tier < HIST_TIERS; tier++) {
+        hist_bucket_t *b = &hs->bucket[tier];
+        int64_t start = ts - ts % hist_tier_step[tier];
+        if (b->start && b->start != start) hist_bucket_flush(hs, tier);
+        if (!b->start) b->start = start;
+        for (int c = 0; c < HIST_RAW_COLS; c++) {
+            if (b->n == 0 || v[c] < b->min[c]) b->min[c] = v[c];
+            if (b->n == 0 || v[c] > b->max[c]) b->max[c] = v[c];
+            if (b->n == 0) b->sum[c] = 0.0;
+            b->sum[c] += v[c];
+        }
+        b->n++;
+    }
+    history_save(hs);
+    pthread_mutex_unlock(&hs->lock);
+}
+
+/* Oldest timestamp held by a tier, 0 if empty; caller holds the lock */
+static int64_t hist_tier_oldest(const hist_tier_t *t) {
+    if (!t->count) return 0;
+    size_t first = (t->head + t->nblocks - t->count + 1) % t->nblocks;
+    hist_hdr_t h;
+    hist_hdr_get(t->blocks + first * HIST_BLOCK_BYTES, &h);
+    return h.first_ts;
+}
+
+/* Pick a tier for [from, to]: the finest one that reaches back to from without
+ * exceeding HIST_MAX_POINTS, else the coarsest that has any data */
+static int history_pick_tier(history_t *hs, int64_t from, int64_t to) {
+    int best = -1;
+    unsigned e = rcu_read_lock();
+    int raw_step = (config_get()->cpu_interval_ms + 999) / 1000;
+    rcu_read_unlock(e);
+    pthread_mutex_lock(&hs->lock);
+    for (int tier = 0; tier < HIST_TIERS; tier++) {
+        const hist_tier_t *t = &hs->tiers[tier];
+        if (!t->count) continue;
+        int step = hist_tier_step[tier] ? hist_tier_step[tier] : raw_step;
+        int64_t oldest = hist_tier_oldest(t);
+        best = tier;
+        if (oldest <= from && (to - from) / (step ? step : 1) <= HIST_MAX_POINTS) break;
+    }
+    pthread_mutex_unlock(&hs->lock);
+    return best < 0 ? HIST_RAW : best;
+}
+
+/* Copy out the blocks of tier that overlap [from, to], oldest first */
+static unsigned char *history_copy_blocks(history_t *hs, int tier, int64_t from, int64_t to, size_t *nout) {
+    pthread_mutex_lock(&hs->lock);
+    const hist_tier_t *t = &hs->tiers[tier];
+    unsigned char *out = t->count ? malloc(t->count * HIST_BLOCK_BYTES) : NULL;
+    size_t n = 0;
+    for (size_t i = 0; out && i < t->count; i++) {
+        const unsigned char *blk = t->blocks + ((t->head + t->nblocks - t->count + 1 + i) % t->nblocks) * HIST_BLOCK_BYTES;
+        hist_hdr_t h;
+        hist_hdr_get(blk, &h);
+        if (h.last_ts < from || h.first_ts > to) continue;
+        memcpy(out + n * HIST_BLOCK_BYTES, blk, HIST_BLOCK_HDR + (h.bits + 7) / 8);
+        n++;
+    }
+    pthread_mutex_unlock(&hs->lock);
+    *nout = n;
+    return out;
+}
+
+static atomic_ulong samples_published;
+static void metrics_doc_update(const metric_sample_t *s);
+
+/* Publication point for a finished sample: ring (& a wake-up for the
+ * subscribers following it), pre-serialized status & metrics documents,
+ * history */
+void publish_sample(metric_sample_t *s) {
+    alert_eval(s);
+    ring_push(&ringbuf, s);
+    atomic_fetch_add(&samples_published, 1);
+    if (atomic_load_explicit(&net_subscribers, memory_order_relaxed) && sample_efd >= 0) {
+        uint64_t one = 1;
+        if (write(sample_efd, &one, sizeof(one)) < 0) { /* counter saturated: already signalled */ }
+    }
+    status_doc_update(&statusdoc, s);
+    metrics_doc_update(s);
+    history_add(&history, s);
+}
+
+/* State file (STATE_FILE).
+ *
+ * The sample ring & the history tiers can live in one MAP_SHARED mapping
+ * instead of the heap, so a restart carries on where the last run stopped:
+ * the pages stay in the page cache when the process exits, killed or not, &
+ * the kernel writes them back on its own (shutdown msyncs to hurry it). The
+ * file is a header followed by page-aligned regions:
+ *
+ *   header | raw, 1m, 1h tier blocks | ring store (size, head, count, total, slots)
+ *
+ * The header records sizeof(metric_sample_t) & the size of every region. A
+ * file with another layout (RING_SIZE, a HISTORY_*_KB or the build changed)
+ * is converted into a new one, keeping the newest samples that fit & every
+ * tier whose size did not change, which is then renamed over it; a RING_SIZE
+ * reload does the same while the collectors run. Everything is native-endian:
+ * the file is a cache for this host, --read's binary log is the portable
+ * format. An flock keeps a second instance from sharing the file. */
+
+#define STATE_MAGIC "SWSTATE1"
+#define STATE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version, hdr_size, sample_size;
+    uint64_t file_size;
+    uint64_t tier_off[HIST_TIERS], tier_blocks[HIST_TIERS];
+    uint64_t ring_off, ring_slots;
+    hist_saved_t hist;
+} state_hdr_t;
+
+typedef struct {
+    char path[1024];
+    int fd;
+    unsigned char *map;  // NULL: no state file
+    size_t len;
+    state_hdr_t *hdr;
+    unsigned long restored;  // ring total at startup: sequence numbers up to it are from an earlier run
+} state_file_t;
+
+static state_file_t state = { .fd = -1 };
+
+static size_t state_page_up(size_t n) {
+    long pg = sysconf(_SC_PAGESIZE);
+    size_t p = pg > 0 ? (size_t)pg : 4096;
+    return (n + p - 1) / p * p;
+}
+
+static void state_layout(state_hdr_t *h, size_t slots, const size_t *blocks) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, STATE_MAGIC, sizeof(h->magic));
+    h->version = STATE_VERSION;
+    h->hdr_size = sizeof(*h);
+    h->sample_size = sizeof(metric_sample_t);
+    size_t off = state_page_up(sizeof(*h));
+    for (int i = 0; i < HIST_TIERS; i++) {
+        h->tier_off[i] = off;
+        h->tier_blocks[i] = blocks[i];
+        off = state_page_up(off + blocks[i] * HIST_BLOCK_BYTES);
+    }
+    h->ring_off = off;
+    h->ring_slots = slots;
+    h->file_size = state_page_up(off + sizeof(ring_store_t) + slots * sizeof(metric_sample_t));
+}
+
+static int state_same_layout(const state_hdr_t *a, const state_hdr_t *b) {
+    return a->file_size == b->file_size && a->ring_off == b->ring_off && a->ring_slots == b->ring_slots &&
+           memcmp(a->tier_off, b->tier_off, sizeof(a->tier_off)) == 0 &&
+           memcmp(a->tier_blocks, b->tier_blocks, sizeof(a->tier_blocks)) == 0;
+}
+
+static ring_store_t *state_ring(const state_file_t *sf) {
+    return (ring_store_t *)(sf->map + sf->hdr->ring_off);
+}
+
+/* Written by this build, regions inside the file, positions in range */
+static int state_valid(const state_file_t *sf) {
+    const state_hdr_t *h = sf->hdr;
+    if (memcmp(h->magic, STATE_MAGIC, sizeof(h->magic)) != 0 || h->version != STATE_VERSION ||
+        h->hdr_size != sizeof(*h) || h->sample_size != sizeof(metric_sample_t) || h->file_size != sf->len)
+        return 0;
+    for (int i = 0; i < HIST_TIERS; i++) {
+        if (h->tier_off[i] > sf->len || h->tier_blocks[i] > (sf->len - h->tier_off[i]) / HIST_BLOCK_BYTES)
+            return 0;
+        if (h->hist.tier[i].count > h->tier_blocks[i] ||
+            (h->tier_blocks[i] && h->hist.tier[i].head >= h->tier_blocks[i]))
+            return 0;
+    }
+    if (h->ring_slots == 0 || h->ring_off > sf->len || sf->len - h->ring_off < sizeof(ring_store_t) ||
+        h->ring_slots > (sf->len - h->ring_off - sizeof(ring_store_t)) / sizeof(metric_sample_t))
+        return 0;
+    const ring_store_t *st = state_ring(sf);
+    return st->size == h->ring_slots && st->head < st->size && st->count <= st->size && st->total >= st->count;
+}
+
+static void state_unmap(state_file_t *sf) {
+    if (sf->map) munmap(sf->map, sf->len);
+    if (sf->fd >= 0) close(sf->fd);
+    sf->map = NULL;
+    sf->hdr = NULL;
+    sf->fd = -1;
+}
+
+/* Create path laid out for slots samples & the given tier sizes: an empty
+ * ring & empty tiers. The space is allocated up front, so a full disk fails
+ * here rather than as SIGBUS on a later store to the mapping. */
+static int state_create(state_file_t *sf, const char *path, size_t slots, const size_t *blocks) {
+    state_hdr_t h;
+    state_layout(&h, slots, blocks);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    int err = flock(fd, LOCK_EX | LOCK_NB) != 0 ? errno : posix_fallocate(fd, 0, (off_t)h.file_size);
+    void *m = err ? MAP_FAILED : mmap(NULL, h.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        if (!err) err = errno;
+        close(fd);
+        unlink(path);
+        errno = err;
+        return -1;
+    }
+    memcpy(m, &h, sizeof(h));
+    sf->fd = fd;
+    sf->map = m;
+    sf->len = h.file_size;
+    sf->hdr = m;
+    ring_store_t *st = state_ring(sf);
+    st->size = slots;
+    st->mapped = 1;
+    return 0;
+}
+
+/* Copy the tiers whose size matches & the open buckets from src to dst */
+static void state_copy_tiers(state_file_t *dst, const state_file_t *src) {
+    for (int i = 0; i < HIST_TIERS; i++) {
+        if (!dst->hdr->tier_blocks[i] || dst->hdr->tier_blocks[i] != src->hdr->tier_blocks[i]) continue;
+        memcpy(dst->map + dst->hdr->tier_off[i], src->map + src->hdr->tier_off[i],
+               dst->hdr->tier_blocks[i] * HIST_BLOCK_BYTES);
+        dst->hdr->hist.tier[i] = src->hdr->hist.tier[i];
+    }
+    memcpy(dst->hdr->hist.bucket, src->hdr->hist.bucket, sizeof(dst->hdr->hist.bucket));
+}
+
+/* Map path for slots samples & the given tiers, converting (or, if it is not
+ * a state file, replacing) a file laid out differently */
+static int state_open(state_file_t *sf, const char *path, size_t slots, const size_t *blocks) {
+    state_file_t old = { .fd = -1 };
+    struct stat st;
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        errno = EBUSY;  // another instance has it
+        return -1;
+    }
+    if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(state_hdr_t)) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED) {
+            old.fd = fd;
+            old.map = m;
+            old.len = (size_t)st.st_size;
+            old.hdr = m;
+            fd = -1;
+        }
+    }
+    if (fd >= 0) close(fd);
+    if (old.map && !state_valid(&old)) {
+        fprintf(stderr, "state: %s is not a usable state file, starting empty\n", path);
+        state_unmap(&old);
+    }
+    snprintf(sf->path, sizeof(sf->path), "%s", path);
+    state_hdr_t want;
+    state_layout(&want, slots, blocks);
+    if (old.map && state_same_layout(old.hdr, &want)) {
+        sf->fd = old.fd;
+        sf->map = old.map;
+        sf->len = old.len;
+        sf->hdr = old.hdr;
+        return 0;
+    }
+
+    char tmp[sizeof(sf->path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (state_create(sf, tmp, slots, blocks) != 0) {
+        int err = errno;
+        state_unmap(&old);
+        errno = err;
+        return -1;
+    }
+    if (old.map) {
+        state_copy_tiers(sf, &old);
+        ringbuffer_t prev;
+        ring_attach(&prev, state_ring(&old));
+        ring_swap_store(&prev, state_ring(sf));
+        state_unmap(&old);
+    }
+    if (rename(tmp, path) != 0) {
+        int err = errno;
+        state_unmap(sf);
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Run the ring & history out of sf's mapping, continuing what they hold */
+static void state_attach(state_file_t *sf, ringbuffer_t *r, history_t *hs) {
+    ring_store_t *st = state_ring(sf);
+    st->mapped = 1;
+    ring_attach(r, st);
+    sf->restored = st->total;
+    pthread_mutex_lock(&hs->lock);
+    for (int i = 0; i < HIST_TIERS; i++) {
+        hist_tier_t *t = &hs->tiers[i];
+        memset(t, 0, sizeof(*t));
+        t->ncols = (i == HIST_RAW) ? HIST_RAW_COLS : HIST_AGG_COLS;
+        t->nblocks = sf->hdr->tier_blocks[i];
+        t->blocks = t->nblocks ? sf->map + sf->hdr->tier_off[i] : NULL;
+        t->head = sf->hdr->hist.tier[i].head;
+        t->count = sf->hdr->hist.tier[i].count;
+        t->enc = sf->hdr->hist.tier[i].enc;
+    }
+    memcpy(hs->bucket, sf->hdr->hist.bucket, sizeof(hs->bucket));
+    hs->saved = &sf->hdr->hist;
+    pthread_mutex_unlock(&hs->lock);
+}
+
+/* RING_SIZE changed: move everything into a file laid out for the new size.
+ * Producers wait on the history lock & the ring seqlock only for the copy;
+ * the old mapping goes once no reader can be copying from it. */
+static int state_resize_ring(state_file_t *sf, ringbuffer_t *r, history_t *hs, size_t size) {
+    state_file_t nf = { .fd = -1 };
+    char tmp[sizeof(sf->path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", sf->path);
+    size_t blocks[HIST_TIERS];
+    for (int i = 0; i < HIST_TIERS; i++) blocks[i] = sf->hdr->tier_blocks[i];
+    if (state_create(&nf, tmp, size, blocks) != 0) return -1;
+    snprintf(nf.path, sizeof(nf.path), "%s", sf->path);
+    nf.restored = sf->restored;
+
+    pthread_mutex_lock(&hs->lock);
+    state_copy_tiers(&nf, sf);
+    for (int i = 0; i < HIST_TIERS; i++)
+        if (hs->tiers[i].nblocks) hs->tiers[i].blocks = nf.map + nf.hdr->tier_off[i];
+    hs->saved = &nf.hdr->hist;
+    ring_swap_store(r, state_ring(&nf));
+    pthread_mutex_unlock(&hs->lock);
+
+    if (rename(tmp, nf.path) != 0)
+        fprintf(stderr, "state: cannot rename %s to %s: %s\n", tmp, nf.path, strerror(errno));
+    rcu_synchronize();
+    state_unmap(sf);
+    *sf = nf;
+    return 0;
+}
+
+static void state_close(state_file_t *sf) {
+    if (sf->map && msync(sf->map, sf->len, MS_SYNC) != 0) perror("state: msync");
+    state_unmap(sf);
+}
+
+/* Startup: the ring & history from STATE_FILE, if it is set & usable */
+static int state_start(state_file_t *sf, const config_t *cfg) {
+    if (!cfg->state_file[0]) return -1;
+    size_t blocks[HIST_TIERS] = { hist_tier_blocks(cfg->history_raw_kb), hist_tier_blocks(cfg->history_1m_kb),
+                                  hist_tier_blocks(cfg->history_1h_kb) };
+    if (state_open(sf, cfg->state_file, (size_t)cfg->ring_size, blocks) != 0) {
+        fprintf(stderr, "state: cannot use %s (%s), keeping the ring in memory only\n", cfg->state_file,
+                strerror(errno));
+        return -1;
+    }
+    state_attach(sf, &ringbuf, &history);
+    if (sf->restored)
+        fprintf(stderr, "state: restored %zu samples from %s\n", atomic_load(&ringbuf.count), sf->path);
+    return 0;
+}
+
+/* Rebuild what is derived from the ring (status & metrics documents, the
+ * current values) from the samples the state file brought back */
+static void state_replay(ringbuffer_t *r) {
+    size_t cap = ring_capacity(r), n = 0;
+    metric_sample_t *v = malloc(cap * sizeof(*v));
+    if (v) ring_snapshot(r, v, cap, &n);
+    if (n > 1) {
+        pthread_mutex_lock(&statusdoc.lock);
+        for (size_t i = 0; i + 1 < n; i++) status_frag_put(&statusdoc, &v[i]);
+        pthread_mutex_unlock(&statusdoc.lock);
+    }
+    const metric_sample_t *last = n ? &v[n - 1] : NULL;
+    status_doc_update(&statusdoc, last);
+    metrics_doc_update(last);
+    if (last) {
+        metrics_lock();
+        sys_metrics.cpu_usage = last->cpu_usage;
+        sys_metrics.memory_usage = last->memory_usage;
+        sys_metrics.disk_usage = last->disk_usage;
+        sys_metrics.cpu_core_max = last->cpu_core_max;
+        sys_metrics.cpu_core_p95 = last->cpu_core_p95;
+        pthread_mutex_unlock(&sys_metrics.data_lock);
+    }
+    free(v);
+}
+
+/* Asynchronous writer.
+ *
+ * Collectors, the log monitor & the signal thread never touch the disk: they
+ * push small records into a bounded lock-free MPSC queue (Vyukov style slots
+ * with sequence numbers) & return. A full queue drops the record & counts it.
+ * The writer thread drains the queue every WRITER_FLUSH_MS, or as soon as
+ * WRITER_BATCH records are pending, formats them into one buffer per file,
+ * writes each buffer with a single write()/pwrite() & optionally fdatasync()s. */
+
+#define WREC_TEXT_MAX 384
+
+enum { WREC_SAMPLE, WREC_TEXT, WREC_DUMP };
+
+typedef struct {
+    int kind;
+    union {
+        metric_sample_t sample;
+        struct {
+            uint16_t len;
+            char data[WREC_TEXT_MAX];
+        } text;
+    } u;
+} wrec_t;
+
+typedef struct {
+    atomic_size_t seq;
+    wrec_t rec;
+} wslot_t;
+
+typedef struct {
+    wslot_t *slots;
+    size_t mask;
+    atomic_size_t tail;     // next slot producers claim
+    atomic_size_t head;     // next slot the writer reads (writer-only store)
+    atomic_ulong enqueued, dropped, written;
+    int efd;                // wakes the writer early (batch full, dump, stop)
+    atomic_size_t batch;    // WRITER_BATCH, set again on reload
+    atomic_int stop;
+} wqueue_t;
+
+static wqueue_t wqueue;
+
+static atomic_int writer_reopen;  // set on SIGHUP so rotated text logs are reopened
+
+static void wq_init(wqueue_t *q, size_t size, size_t batch) {
+    size_t n = 2;
+    while (n < size) n <<= 1;
+    q->slots = calloc(n, sizeof(wslot_t));
+    q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!q->slots || q->efd < 0) {
+        fprintf(stderr, "FATAL: cannot allocate writer queue of size %zu\n", n);
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) atomic_init(&q->slots[i].seq, i);
+    q->mask = n - 1;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->enqueued, 0);
+    atomic_init(&q->dropped, 0);
+    atomic_init(&q->written, 0);
+    atomic_init(&q->batch, batch);
+    atomic_init(&q->stop, 0);
+}
+
+static void wq_free(wqueue_t *q) {
+    free(q->slots);
+    if (q->efd >= 0) close(q->efd);
+}
+
+static void wq_kick(wqueue_t *q) {
+    uint64_t one = 1;
+    if (write(q->efd, &one, sizeof(one)) < 0) { /* counter saturated: writer is awake anyway */ }
+}
+
+/* Never blocks. Returns -1 (& counts a drop) if the queue is full. */
+static int wq_push(wqueue_t *q, const wrec_t *r) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    wslot_t *s;
+    for (;;) {
+        s = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    s->rec = *r;
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+    atomic_fetch_add_explicit(&q->enqueued, 1, memory_order_relaxed);
+    size_t depth = pos + 1 - atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (r->kind == WREC_DUMP || depth == atomic_load_explicit(&q->batch, memory_order_relaxed)) wq_kick(q);
+    return 0;
+}
+
+/* Consumer side: oldest ready record or NULL; wq_release() after use */
+static wrec_t *wq_peek(wqueue_t *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    wslot_t *s = &q->slots[head & q->mask];
+    size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(head + 1) < 0) return NULL;
+    return &s->rec;
+}
+
+static void wq_release(wqueue_t *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    atomic_store_explicit(&q->slots[head & q->mask].seq, head + q->mask + 1, memory_order_release);
+    atomic_store_explicit(&q->head, head + 1, memory_order_relaxed);
+}
+
+/* Producer helpers */
+void writer_sample(const metric_sample_t *m) {
+    wrec_t r;
+    r.kind = WREC_SAMPLE;
+    r.u.sample = *m;
+    wq_push(&wqueue, &r);
+}
+
+void writer_text(const char *line) {
+    wrec_t r;
+    r.kind = WREC_TEXT;
+    size_t n = strlen(line);
+    if (n > WREC_TEXT_MAX) n = WREC_TEXT_MAX;
+    memcpy(r.u.text.data, line, n);
+    if (n && r.u.text.data[n - 1] != '\n') {
+        if (n == WREC_TEXT_MAX) n--;
+        r.u.text.data[n++] = '\n';
+    }
+    r.u.text.len = (uint16_t)n;
+    wq_push(&wqueue, &r);
+}
+
+/* Writer-owned output files */
+typedef struct {
+    int fd;
+    char path[1040];
+    char *buf;
+    size_t len, cap;
+} wsink_t;
+
+static int wsink_reserve(wsink_t *s, size_t extra) {
+    if (s->len + extra <= s->cap) return 0;
+    size_t nc = s->cap ? s->cap : 16384;
+    while (nc < s->len + extra) nc *= 2;
+    char *nb = realloc(s->buf, nc);
+    if (!nb) return -1;
+    s->buf = nb;
+    s->cap = nc;
+    return 0;
+}
+
+static void wsink_printf(wsink_t *s, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void wsink_printf(wsink_t *s, const char *fmt, ...) {
+    if (wsink_reserve(s, 512) != 0) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(s->buf + s->len, s->cap - s->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) s->len += ((size_t)n < s->cap - s->len) ? (size_t)n : s->cap - s->len - 1;
+}
+
+static void wsink_target(wsink_t *s, const char *path, int reopen) {
+    if (s->fd >= 0 && !reopen && strcmp(s->path, path) == 0) return;
+    if (s->fd >= 0) close(s->fd);
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    s->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+}
+
+static void wsink_flush(wsink_t *s, int sync) {
+    size_t off = 0;
+    if (s->fd >= 0) {
+        while (off < s->len) {
+            ssize_t w = write(s->fd, s->buf + off, s->len - off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+            off += (size_t)w;
+        }
+        if (off > 0 && sync) fdatasync(s->fd);
+    }
+    s->len = 0;
+}
+
+static void format_sample_line(wsink_t *s, const metric_sample_t *m) {
+    char timestr[64];
+    struct tm tm;
+    localtime_r(&m->timestamp, &tm);
+    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
+    wsink_printf(s,
+                 "%s cpu=%.2f mem=%.2f disk=%.2f net_rx_bps=%.0f net_tx_bps=%.0f net_rx_pps=%.1f net_tx_pps=%.1f "
+                 "net_errors=%.2f net_drops=%.2f net_util=%.2f\n",
+                 timestr, m->cpu_usage, m->memory_usage, m->disk_usage, m->net_rx_bps, m->net_tx_bps, m->net_rx_pps,
+                 m->net_tx_pps, m->net_errors, m->net_drops, m->net_util);
+}
+
+/* Ring dump, formatted on the writer thread */
+static void format_dump(wsink_t *s) {
+    size_t cap = ring_capacity(&ringbuf);
+    metric_sample_t *tmp = calloc(cap, sizeof(metric_sample_t));
+    if (!tmp) return;
+    size_t len = 0;
+    ring_snapshot(&ringbuf, tmp, cap, &len);
+    char timestr[64];
+    time_t t = time(NULL);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
+    wsink_printf(s, "%s DUMP START (last %zu samples)\n", timestr, len);
+    for (size_t i = 0; i < len; i++) format_sample_line(s, &tmp[i]);
+    wsink_printf(s, "%s WRITER enqueued=%lu written=%lu dropped=%lu\n", timestr,
+                 atomic_load(&wqueue.enqueued), atomic_load(&wqueue.written), atomic_load(&wqueue.dropped));
+    pthread_mutex_lock(&logstats.lock);
+    for (size_t i = 0; i < logstats.n; i++)
+        wsink_printf(s, "%s LOG path=%s bytes=%lu lines=%lu alerts=%lu bytes_per_s=%.0f lines_per_s=%.0f\n",
+                     timestr, logstats.v[i].path, (unsigned long)logstats.v[i].bytes,
+                     (unsigned long)logstats.v[i].lines, (unsigned long)logstats.v[i].alerts,
+                     logstats.v[i].bytes_per_s, logstats.v[i].lines_per_s);
+    pthread_mutex_unlock(&logstats.lock);
+    pthread_mutex_lock(&proctop.lock);
+    for (size_t i = 0; i < proctop.n_cpu; i++)
+        wsink_printf(s, "%s PROC top=cpu rank=%zu pid=%d comm=%s cpu=%.2f rss_kb=%lu\n", timestr, i + 1,
+                     proctop.cpu[i].pid, proctop.cpu[i].comm, proctop.cpu[i].cpu, (unsigned long)proctop.cpu[i].rss_kb);
+    for (size_t i = 0; i < proctop.n_rss; i++)
+        wsink_printf(s, "%s PROC top=rss rank=%zu pid=%d comm=%s cpu=%.2f rss_kb=%lu\n", timestr, i + 1,
+                     proctop.rss[i].pid, proctop.rss[i].comm, proctop.rss[i].cpu, (unsigned long)proctop.rss[i].rss_kb);
+    pthread_mutex_unlock(&proctop.lock);
+    for (int i = 0; i < INSTR_COUNT; i++) {
+        instr_snap_t sn;
+        instr_snapshot(i, &sn);
+        const char *u = instr[i].bytes ? "" : "_us";
+        wsink_printf(s, "%s SELF %s count=%lu p50%s=%.1f p90%s=%.1f p99%s=%.1f max%s=%.1f\n", timestr, instr[i].name,
+                     sn.count, u, sn.p50, u, sn.p90, u, sn.p99, u, sn.max);
+    }
+    wsink_printf(s, "%s DUMP END\n", timestr);
+    free(tmp);
+}
+
+void *writer_thread(void *arg) {
+    wqueue_t *q = arg;
+    wsink_t metrics = { -1, "", NULL, 0, 0 }, alerts = { -1, "", NULL, 0, 0 };
+    unsigned char *bin = NULL;
+    size_t bin_cap = 0;
+    /* settings copied out of the config when it changes, so no RCU section
+     * has to span the writes & fdatasync calls below */
+    unsigned long gen = 0;
+    char metrics_path[1024] = "", text_path[1040] = "";
+    int binary = 0, sync = 1, flush_ms = DEFAULT_WRITER_FLUSH_MS;
+    for (;;) {
+        struct pollfd pfd = { q->efd, POLLIN, 0 };
+        int stopping = atomic_load(&q->stop);
+        if (!stopping) poll(&pfd, 1, flush_ms);
+        uint64_t v;
+        if (read(q->efd, &v, sizeof(v)) < 0) { /* timeout, nothing to drain */ }
+
+        int reopen = atomic_exchange(&writer_reopen, 0);
+        unsigned e = rcu_read_lock();
+        const config_t *cfg = config_get();
+        if (cfg->gen != gen) {
+            gen = cfg->gen;
+            snprintf(metrics_path, sizeof(metrics_path), "%s", cfg->metrics_logfile);
+            char pbuf[1040];
+            snprintf(text_path, sizeof(text_path), "%s", text_log_path(cfg, pbuf, sizeof(pbuf)));
+            binary = cfg->metrics_log_binary;
+            sync = cfg->writer_fsync;
+            flush_ms = cfg->writer_flush_ms;
+        }
+        rcu_read_unlock(e);
+        int same = !binary && strcmp(text_path, metrics_path) == 0;
+        wsink_t *msink = binary ? NULL : (same ? &alerts : &metrics);
+        size_t nbin = 0, n = 0;
+        wrec_t *r;
+        while ((r = wq_peek(q)) != NULL) {
+            if (r->kind == WREC_SAMPLE) {
+                if (binary) {
+                    if (nbin * BINLOG_RECORD_SIZE == bin_cap) {
+                        size_t nc = bin_cap ? bin_cap * 2 : 64 * BINLOG_RECORD_SIZE;
+                        unsigned char *nb = realloc(bin, nc);
+                        if (nb) {
+                            bin = nb;
+                            bin_cap = nc;
+                        }
+                    }
+                    if (nbin * BINLOG_RECORD_SIZE < bin_cap) binlog_encode(bin + nbin++ * BINLOG_RECORD_SIZE, &r->u.sample);
+                } else {
+                    format_sample_line(msink, &r->u.sample);
+                }
+            } else if (r->kind == WREC_TEXT) {
+                if (wsink_reserve(&alerts, r->u.text.len) == 0) {
+                    memcpy(alerts.buf + alerts.len, r->u.text.data, r->u.text.len);
+                    alerts.len += r->u.text.len;
+                }
+            } else {
+                format_dump(&alerts);
+            }
+            wq_release(q);
+            n++;
+        }
+        if (metrics.len) {
+            wsink_target(&metrics, metrics_path, reopen);
+            wsink_flush(&metrics, sync);
+        }
+        if (alerts.len) {
+            wsink_target(&alerts, text_path, reopen);
+            wsink_flush(&alerts, sync);
+        }
+        if (nbin) binlog_write_batch(&binlog, metrics_path, bin, nbin, sync);
+        atomic_fetch_add(&q->written, n);
+        if (stopping && !wq_peek(q)) break;
+    }
+    if (metrics.fd >= 0) close(metrics.fd);
+    if (alerts.fd >= 0) close(alerts.fd);
+    free(metrics.buf);
+    free(alerts.buf);
+    free(bin);
+    return NULL;
+}
+
+/* Ask the writer to drain everything & exit (call after producers stopped) */
+static void writer_stop(wqueue_t *q) {
+    atomic_store(&q->stop, 1);
+    wq_kick(q);
+}
+
+/* Logging to file (append): handed to the writer thread, never blocks */
+void append_metrics_log(metric_sample_t *m) {
+    writer_sample(m);
+}
+
+/* Collectors.
+ *
+ * Each collector is a job run by the scheduler thread on every tick of its own
+ * interval; the state it carries between ticks (open /proc files, previous CPU
+ * counters) lives in its context. */
+
+typedef struct {
+    proc_file_t stat_f, meminfo_f, psi_f;
+    int psi_missing;  // no /proc/pressure/memory (kernel without PSI): stop trying
+    size_t ncores;
+    cpu_times_t prev, cur;
+    cpu_times_t *prev_cores, *cur_cores;
+    net_ctx_t net;
+} cpu_mem_ctx_t;
+
+static int cpu_mem_init(cpu_mem_ctx_t *c) {
+    memset(c, 0, sizeof(*c));
+    proc_file_init(&c->stat_f, "/proc/stat");
+    proc_file_init(&c->meminfo_f, "/proc/meminfo");
+    proc_file_init(&c->psi_f, "/proc/pressure/memory");
+    net_init(&c->net);
+    c->ncores = corering.ncores;
+    c->prev_cores = calloc(c->ncores, sizeof(cpu_times_t));
+    c->cur_cores = calloc(c->ncores, sizeof(cpu_times_t));
+    if (!c->prev_cores || !c->cur_cores) {
+        fprintf(stderr, "Failed to allocate per-core CPU state\n");
+        return -1;
+    }
+    if (read_cpu_times(&c->stat_f, &c->prev, c->prev_cores, c->ncores) != 0) {
+        fprintf(stderr, "Failed to read /proc/stat\n");
+        memset(&c->prev, 0, sizeof(c->prev));
+    }
+    memcpy(c->cur_cores, c->prev_cores, c->ncores * sizeof(cpu_times_t));
+    return 0;
+}
+
+static void cpu_mem_destroy(cpu_mem_ctx_t *c) {
+    free(c->prev_cores);
+    free(c->cur_cores);
+    proc_file_close(&c->stat_f);
+    proc_file_close(&c->meminfo_f);
+    proc_file_close(&c->psi_f);
+    net_destroy(&c->net);
+}
+
+/* CPU, memory & network sample (every CPU_INTERVAL_MS) */
+static void collect_cpu_mem(void *arg) {
+    cpu_mem_ctx_t *c = arg;
+    uint64_t t0 = mono_ns();
+    if (read_cpu_times(&c->stat_f, &c->cur, c->cur_cores, c->ncores) != 0) return;
+    double cpu = calc_cpu_usage(&c->prev, &c->cur);
+    c->prev = c->cur;
+    mem_stats_t ms;
+    double mem = read_memory_usage(&c->meminfo_f, &ms);
+    double disk = read_disk_usage_max();
+
+    metric_sample_t sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.cpu_usage = cpu;
+    sample.memory_usage = mem;
+    sample.disk_usage = disk;
+    if (mem >= 0) {
+        sample.swap_usage = swap_used_percent(&ms);
+        sample.mem_avail_kb = meminfo_available(&ms);
+        sample.mem_dirty_kb = ms.dirty;
+        sample.mem_writeback_kb = ms.writeback;
+    }
+    if (!c->psi_missing) {
+        if (proc_file_read(&c->psi_f) == 0) parse_psi(c->psi_f.buf, &sample.mem_psi_some, &sample.mem_psi_full);
+        else if (errno == ENOENT || errno == EOPNOTSUPP) c->psi_missing = 1;
+    }
+    net_sample(&c->net, &sample);
+    sample.timestamp = time(NULL);
+    core_ring_push(&corering, c->prev_cores, c->cur_cores, sample.timestamp, &sample.cpu_core_max,
+                   &sample.cpu_core_p95);
+    memcpy(c->prev_cores, c->cur_cores, c->ncores * sizeof(cpu_times_t));
+    proc_top_attach(&sample);
+
+    metrics_lock();
+    sys_metrics.cpu_usage = cpu;
+    sys_metrics.memory_usage = mem;
+    sys_metrics.disk_usage = disk;
+    sys_metrics.cpu_core_max = sample.cpu_core_max;
+    sys_metrics.cpu_core_p95 = sample.cpu_core_p95;
+    pthread_mutex_unlock(&sys_metrics.data_lock);
+
+    publish_sample(&sample);
+    append_metrics_log(&sample);
+    instr_since(INSTR_CPU_MEM, t0);
+}
+
+/* Process collector (every PROC_INTERVAL_MS).
+ *
+ * /proc is listed with getdents64 into a reusable buffer through one
+ * persistent directory fd, & each /proc/<pid>/stat is read with pread().
+ * The scan is incremental: a process idle for PROC_IDLE_SCANS reads in a row
+ * is only re-read every PROC_IDLE_STRIDE-th scan (staggered by pid), its CPU
+ * averaged over its own read window, & its last comm/RSS reused in between -
+ * most of a large host is asleep. So a sleeper waking up is not missed for
+ * a whole stride, every scan also diffs the busy jiffies of /proc/stat
+ * against the ticks it saw: when more than PROC_UNSEEN_PCT of a CPU is not
+ * accounted for, the next scan reads every process.
+ * Busy processes keep their stat fd open (up to PROC_FD_CACHE, & never more
+ * than half of RLIMIT_NOFILE) so they cost one syscall per scan; the rest
+ * use openat/read/close. Each open /proc stat file pins a page of kernel
+ * seq_file buffer, which is why idle ones give theirs back.
+ * Per-pid state lives in an open-addressing table; pids that exited are
+ * left in place (fd closed) & only compacted away once they are a quarter
+ * of the table. starttime tells a reused pid from the old process. Only the
+ * PROC_TOP_N largest by CPU & by RSS are kept, in two bounded min-heaps, &
+ * published to proctop. */
+
+typedef struct {
+    int pid;                   // 0 = empty slot
+    int fd;                    // cached /proc/<pid>/stat, or -1
+    unsigned long long ticks;  // utime + stime at the last read
+    unsigned long long start;  // starttime
+    uint64_t rss_kb;           // at the last read
+    long long read_ms;         // when stat was last read
+    unsigned int gen;          // scan that last saw it
+    unsigned int read_gen;     // scan that last read it
+    unsigned int scans;        // consecutive scans seen
+    unsigned int idle;         // consecutive reads without new ticks
+    char comm[16];             // TASK_COMM_LEN
+} proc_ent_t;
+
+struct linux_dirent64_s {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    int dirfd;
+    char *dbuf;
+    size_t dbuf_cap;
+    proc_ent_t *tab, *spare;
+    size_t cap, count;
+    unsigned int gen;
+    int cached, fd_budget;
+    int full;                  // read every process on the next scan
+    proc_file_t stat_f;
+    unsigned long long busy;   // user+nice+system jiffies at the last scan
+    unsigned long full_scans;
+    long page_kb, clk_tck;
+    proc_top_t *heap_cpu, *heap_rss;
+    size_t n_cpu, n_rss;
+} proc_ctx_t;
+
+#define PROC_DIRENT_BUF (64 * 1024)
+#define PROC_IDLE_SCANS 2
+#define PROC_IDLE_STRIDE 8
+#define PROC_UNSEEN_PCT 10
+
+static int proc_init(proc_ctx_t *p) {
+    memset(p, 0, sizeof(*p));
+    p->dirfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    proc_file_init(&p->stat_f, "/proc/stat");
+    p->full = 1;
+    p->dbuf_cap = PROC_DIRENT_BUF;
+    p->dbuf = malloc(p->dbuf_cap);
+    p->cap = 1024;
+    p->tab = calloc(p->cap, sizeof(proc_ent_t));
+    p->spare = calloc(p->cap, sizeof(proc_ent_t));
+    p->heap_cpu = calloc(PROC_TOP_MAX, sizeof(proc_top_t));
+    p->heap_rss = calloc(PROC_TOP_MAX, sizeof(proc_top_t));
+    if (p->dirfd < 0 || !p->dbuf || !p->tab || !p->spare || !p->heap_cpu || !p->heap_rss) {
+        fprintf(stderr, "process collector disabled: cannot open /proc or allocate\n");
+        return -1;
+    }
+    p->page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    p->clk_tck = sysconf(_SC_CLK_TCK);
+    if (p->clk_tck <= 0) p->clk_tck = 100;
+    struct rlimit rl;
+    long lim = (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) ? (long)rl.rlim_cur / 2 : 512;
+    int want = config_get()->proc_fd_cache;
+    p->fd_budget = want < lim ? want : (int)lim;
+    return 0;
+}
+
+static void proc_destroy(proc_ctx_t *p) {
+    for (size_t i = 0; p->tab && i < p->cap; i++)
+        if (p->tab[i].pid && p->tab[i].fd >= 0) close(p->tab[i].fd);
+    if (p->dirfd >= 0) close(p->dirfd);
+    proc_file_close(&p->stat_f);
+    free(p->dbuf);
+    free(p->tab);
+    free(p->spare);
+    free(p->heap_cpu);
+    free(p->heap_rss);
+}
+
+static inline size_t proc_hash(int pid, size_t cap) {
+    return ((uint32_t)pid * 2654435761u) & (cap - 1);
+}
+
+static proc_ent_t *proc_slot(proc_ent_t *tab, size_t cap, int pid) {
+    size_t i = proc_hash(pid, cap);
+    while (tab[i].pid && tab[i].pid != pid) i = (i + 1) & (cap - 1);
+    return &tab[i];
+}
+
+/* Rehash every entry into spare; with drop_unseen, entries this scan did not
+ * see have exited & are dropped (their fds are already closed). Grows both
+ * arrays when needed. */
+static int proc_rehash(proc_ctx_t *p, size_t ncap, int drop_unseen) {
+    proc_ent_t *nt = (ncap == p->cap) ? p->spare : calloc(ncap, sizeof(proc_ent_t));
+    proc_ent_t *ns = (ncap == p->cap) ? p->tab : calloc(ncap, sizeof(proc_ent_t));
+    if (!nt || !ns) {
+        if (ncap != p->cap) {
+            free(nt);
+            free(ns);
+        }
+        return -1;
+    }
+    memset(nt, 0, ncap * sizeof(proc_ent_t));
+    size_t live = 0;
+    for (size_t i = 0; i < p->cap; i++) {
+        proc_ent_t *e = &p->tab[i];
+        if (!e->pid) continue;
+        if (drop_unseen && e->gen != p->gen) continue;
+        *proc_slot(nt, ncap, e->pid) = *e;
+        live++;
+    }
+    if (ncap != p->cap) {
+        free(p->tab);
+        free(p->spare);
+    }
+    p->tab = nt;
+    p->spare = ns;
+    p->cap = ncap;
+    p->count = live;
+    return 0;
+}
+
+/* Bounded min-heap of the n largest by cpu (by_rss = 0) or rss */
+static inline int proc_less(const proc_top_t *a, const proc_top_t *b, int by_rss) {
+    return by_rss ? a->rss_kb < b->rss_kb : a->cpu < b->cpu;
+}
+
+static void proc_heap_push(proc_top_t *h, size_t *n, size_t max, const proc_top_t *x, int by_rss) {
+    size_t i;
+    if (*n < max) {
+        i = (*n)++;
+        while (i > 0 && proc_less(x, &h[(i - 1) / 2], by_rss)) {
+            h[i] = h[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        h[i] = *x;
+        return;
+    }
+    if (!max || !proc_less(&h[0], x, by_rss)) return;
+    /* replace the root & sift down */
+    i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= *n) break;
+        if (c + 1 < *n && proc_less(&h[c + 1], &h[c], by_rss)) c++;
+        if (!proc_less(&h[c], x, by_rss)) break;
+        h[i] = h[c];
+        i = c;
+    }
+    h[i] = *x;
+}
+
+static int proc_cmp_cpu(const void *a, const void *b) {
+    const proc_top_t *x = a, *y = b;
+    return (x->cpu < y->cpu) - (x->cpu > y->cpu);
+}
+
+static int proc_cmp_rss(const void *a, const void *b) {
+    const proc_top_t *x = a, *y = b;
+    return (x->rss_kb < y->rss_kb) - (x->rss_kb > y->rss_kb);
+}
+
+/* Parse one /proc/<pid>/stat: comm, utime+stime, starttime, rss pages */
+static int proc_parse_stat(char *buf, char *comm, size_t commsz, unsigned long long *ticks,
+                           unsigned long long *start, unsigned long long *rss) {
+    char *l = strchr(buf, '('), *r = strrchr(buf, ')');
+    if (!l || !r || r < l) return -1;
+    size_t cl = (size_t)(r - l - 1);
+    if (cl >= commsz) cl = commsz - 1;
+    memcpy(comm, l + 1, cl);
+    comm[cl] = '\0';
+    const char *p = r + 2;  // field 3 (state)
+    unsigned long long utime = 0, stime = 0;
+    for (int field = 3; field <= 24 && *p; field++) {
+        while (*p == ' ') p++;
+        if (field == 14 || field == 15 || field == 22 || field == 24) {
+            unsigned long long v = parse_u64(&p);
+            if (field == 14) utime = v;
+            else if (field == 15) stime = v;
+            else if (field == 22) *start = v;
+            else *rss = v;
+        }
+        while (*p && *p != ' ') p++;
+    }
+    *ticks = utime + stime;
+    return 0;
+}
+
+static inline void proc_uncache(proc_ctx_t *p, proc_ent_t *e) {
+    if (e->fd < 0) return;
+    close(e->fd);
+    e->fd = -1;
+    p->cached--;
+}
+
+static void collect_procs(void *arg) {
+    proc_ctx_t *p = arg;
+    const config_t *cfg = config_get();
+    if (cfg->proc_top_n <= 0) return;
+    uint64_t t0 = mono_ns();
+    long long now = now_ms();
+    p->gen++;
+    p->n_cpu = p->n_rss = 0;
+    size_t topn = (size_t)(cfg->proc_top_n < PROC_TOP_MAX ? cfg->proc_top_n : PROC_TOP_MAX);
+    unsigned long seen = 0;
+    int full = p->full;
+    cpu_times_t ct;
+    unsigned long long busy = 0, seen_ticks = 0;
+    if (read_cpu_times(&p->stat_f, &ct, NULL, 0) == 0) busy = ct.user + ct.nice + ct.system;
+
+    lseek(p->dirfd, 0, SEEK_SET);
+    for (;;) {
+        long nread = syscall(SYS_getdents64, p->dirfd, p->dbuf, p->dbuf_cap);
+        if (nread <= 0) break;
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64_s *d = (struct linux_dirent64_s *)(p->dbuf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] < '1' || d->d_name[0] > '9') continue;
+            const char *q = d->d_name;
+            int pid = (int)parse_u64(&q);
+            if (*q || pid <= 0) continue;
+
+            if (p->count * 2 >= p->cap && proc_rehash(p, p->cap * 2, 0) != 0) continue;
+            proc_ent_t *e = proc_slot(p->tab, p->cap, pid);
+            if (!e->pid) {
+                memset(e, 0, sizeof(*e));
+                e->pid = pid;
+                e->fd = -1;
+                p->count++;
+            }
+            int alive = e->gen == p->gen - 1;
+            e->scans = alive ? e->scans + 1 : 0;
+            e->gen = p->gen;
+            seen++;
+            proc_top_t t;
+            if (!full && alive && e->idle >= PROC_IDLE_SCANS && (p->gen + (unsigned int)pid) % PROC_IDLE_STRIDE) {
+                t.pid = pid;
+                t.cpu = 0.0;
+                t.rss_kb = e->rss_kb;
+                memcpy(t.comm, e->comm, sizeof(e->comm));
+                proc_heap_push(p->heap_rss, &p->n_rss, topn, &t, 1);
+                continue;
+            }
+
+            char buf[1024];
+            ssize_t n = -1;
+            if (e->fd >= 0) {
+                n = pread(e->fd, buf, sizeof(buf) - 1, 0);
+                if (n <= 0) proc_uncache(p, e);  // exited (ESRCH); the pid may be back as a new process
+            }
+            if (e->fd < 0) {
+                char path[32];
+                snprintf(path, sizeof(path), "%d/stat", pid);
+                int fd = openat(p->dirfd, path, O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    e->gen = 0;  // vanished mid-scan: dropped below
+                    seen--;
+                    continue;
+                }
+                n = pread(fd, buf, sizeof(buf) - 1, 0);
+                if (alive && e->idle < PROC_IDLE_SCANS && p->cached < p->fd_budget) {
+                    e->fd = fd;
+                    p->cached++;
+                } else {
+                    close(fd);
+                }
+            }
+            if (n <= 0) {
+                e->gen = 0;  // vanished mid-scan: dropped below
+                seen--;
+                continue;
+            }
+            buf[n] = '\0';
+
+            unsigned long long ticks, start = 0, rss = 0;
+            if (proc_parse_stat(buf, t.comm, sizeof(t.comm), &ticks, &start, &rss) != 0) continue;
+            int same = alive && e->start == start;
+            double elapsed = same ? (double)(now - e->read_ms) / 1000.0 : 0.0;
+            t.pid = pid;
+            t.cpu = (elapsed > 0 && ticks >= e->ticks)
+                        ? (double)(ticks - e->ticks) * 100.0 / ((double)p->clk_tck * elapsed)
+                        : 0.0;
+            t.rss_kb = rss * (uint64_t)p->page_kb;
+            e->idle = (same && ticks == e->ticks) ? e->idle + 1 : 0;
+            if (e->idle >= PROC_IDLE_SCANS) proc_uncache(p, e);
+            /* only deltas over exactly the last interval are comparable to /proc/stat */
+            if (same && e->read_gen == p->gen - 1 && ticks >= e->ticks) seen_ticks += ticks - e->ticks;
+            if (!same) e->scans = 0;
+            e->read_gen = p->gen;
+            e->ticks = ticks;
+            e->start = start;
+            e->rss_kb = t.rss_kb;
+            e->read_ms = now;
+            snprintf(e->comm, sizeof(e->comm), "%s", t.comm);
+            if (t.cpu > 0) proc_heap_push(p->heap_cpu, &p->n_cpu, topn, &t, 0);
+            proc_heap_push(p->heap_rss, &p->n_rss, topn, &t, 1);
+        }
+    }
+    /* exited pids: release their fds now, compact the table only now & then */
+    size_t stale = 0;
+    for (size_t i = 0; i < p->cap; i++) {
+        proc_ent_t *e = &p->tab[i];
+        if (!e->pid || e->gen == p->gen) continue;
+        proc_uncache(p, e);
+        stale++;
+    }
+    if (stale * 4 > p->count) proc_rehash(p, p->cap, 1);
+
+    /* busy time no process we read accounts for: some sleeper woke up */
+    unsigned long long unseen = (p->busy && busy > p->busy + seen_ticks) ? busy - p->busy - seen_ticks : 0;
+    p->full = (double)unseen * 100.0 > (double)PROC_UNSEEN_PCT * (double)p->clk_tck * cfg->proc_interval_ms / 1000.0;
+    p->full_scans += (unsigned long)full;
+    p->busy = busy;
+
+    qsort(p->heap_cpu, p->n_cpu, sizeof(proc_top_t), proc_cmp_cpu);
+    qsort(p->heap_rss, p->n_rss, sizeof(proc_top_t), proc_cmp_rss);
+
+    pthread_mutex_lock(&proctop.lock);
+    proctop.ts = time(NULL);
+    proctop.nprocs = seen;
+    proctop.n_cpu = p->n_cpu;
+    proctop.n_rss = p->n_rss;
+    memcpy(proctop.cpu, p->heap_cpu, p->n_cpu * sizeof(proc_top_t));
+    memcpy(proctop.rss, p->heap_rss, p->n_rss * sizeof(proc_top_t));
+    pthread_mutex_unlock(&proctop.lock);
+    instr_since(INSTR_PROC_SCAN, t0);
+}
+
+/* Disk collector.
+ *
+ * collect_disk (on the scheduler) only re-parses the mount table when it
+ * changed, checks on the worker & asks it for a sweep; the worker statvfs()es
+ * every mount into disktab. It publishes nothing: the CPU/memory job is the
+ * only producer of samples & picks the cached disk usage up from there. A
+ * worker stuck in one statvfs for longer than STATVFS_TIMEOUT_MS (a hung NFS
+ * server) is abandoned: its mount is marked hung & skipped, & a fresh worker
+ * takes over. When the stuck call finally returns, that thread records the
+ * result, clears the mark & exits. */
+
+#define DISK_MAX_STUCK 4
+
+static void *disk_worker(void *arg);
+
+static int disk_spawn_worker(void) {
+    pthread_t t;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int r = thread_spawn(&t, &attr, THR_STATVFS, "sw-statvfs", disk_worker, (void *)(uintptr_t)disktab.worker_gen);
+    pthread_attr_destroy(&attr);
+    if (r == 0) disktab.nalive++;
+    return r;
+}
+
+static void *disk_worker(void *arg) {
+    unsigned int gen = (unsigned int)(uintptr_t)arg;
+    pthread_mutex_lock(&disktab.lock);
+    for (;;) {
+        while (!disktab.sweep && !disktab.stop && gen == disktab.worker_gen)
+            pthread_cond_wait(&disktab.cond, &disktab.lock);
+        if (disktab.stop || gen != disktab.worker_gen) break;
+        disktab.sweep = 0;
+        int abandoned = 0;
+        uint64_t sweep_t0 = mono_ns();
+        for (size_t i = 0; i < disktab.n && !abandoned; i++) {
+            mount_ent_t *e = &disktab.m[i];
+            if (e->hung) continue;
+            char *path = strdup(e->path);
+            if (!path) continue;
+            unsigned int major = e->major, minor = e->minor;
+            disktab.busy = 1;
+            disktab.busy_major = major;
+            disktab.busy_minor = minor;
+            disktab.busy_since = now_ms();
+            pthread_mutex_unlock(&disktab.lock);
+
+            struct statvfs st;
+            uint64_t t0 = mono_ns();
+            int ok = statvfs(path, &st) == 0;
+            instr_since(INSTR_STATVFS, t0);
+            free(path);
+
+            pthread_mutex_lock(&disktab.lock);
+            abandoned = gen != disktab.worker_gen;
+            if (!abandoned) disktab.busy = 0;
+            e = mount_find(major, minor);  // the table may have been replaced meanwhile
+            if (!e) continue;
+            e->hung = 0;
+            if (ok) {
+                uint64_t total = (uint64_t)st.f_blocks * st.f_frsize;
+                uint64_t free_b = (uint64_t)st.f_bfree * st.f_frsize;
+                e->total = total;
+                e->used = (total > free_b) ? total - free_b : 0;
+                e->avail = (uint64_t)st.f_bavail * st.f_frsize;
+                e->perc = total ? (double)e->used * 100.0 / (double)total : 0.0;
+                e->have = 1;
+            }
+            /* track the loop position across a table swap */
+            i = (size_t)(e - disktab.m);
+        }
+        if (abandoned) break;
+        disktab.sweeps++;
+        instr_since(INSTR_DISK_SWEEP, sweep_t0);
+        double disk = mount_usage_max();
+        pthread_mutex_unlock(&disktab.lock);
+        metrics_lock();
+        sys_metrics.disk_usage = disk;
+        pthread_mutex_unlock(&sys_metrics.data_lock);
+        pthread_mutex_lock(&disktab.lock);
+    }
+    disktab.nalive--;
+    if (gen != disktab.worker_gen) disktab.nstuck--;  // was abandoned
+    pthread_cond_broadcast(&disktab.cond);
+    pthread_mutex_unlock(&disktab.lock);
+    return NULL;
+}
+
+/* Re-read mountinfo if the kernel flagged a change (or on first use) */
+static void disk_refresh_mounts(void) {
+    proc_file_t *pf = &disktab.mountinfo;
+    if (pf->fd >= 0) {
+        struct pollfd pfd = { pf->fd, POLLPRI, 0 };
+        if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLPRI | POLLERR))) return;
+    }
+    if (proc_file_read(pf) != 0) return;
+    size_t n;
+    mount_ent_t *m = parse_mountinfo(pf->buf, &n);
+    pthread_mutex_lock(&disktab.lock);
+    /* keep what we know about mounts that are still there */
+    for (size_t i = 0; i < n; i++) {
+        mount_ent_t *old = mount_find(m[i].major, m[i].minor);
+        if (!old) continue;
+        m[i].total = old->total;
+        m[i].used = old->used;
+        m[i].avail = old->avail;
+        m[i].perc = old->perc;
+        m[i].have = old->have;
+        m[i].hung = old->hung;
+    }
+    mount_ent_t *old = disktab.m;
+    size_t nold = disktab.n;
+    disktab.m = m;
+    disktab.n = n;
+    disktab.table_gen++;
+    pthread_mutex_unlock(&disktab.lock);
+    mount_ents_free(old, nold);
+}
+
+static void disk_start(void) {
+    proc_file_init(&disktab.mountinfo, "/proc/self/mountinfo");
+    disk_refresh_mounts();
+    pthread_mutex_lock(&disktab.lock);
+    disktab.sweep = 1;  // fill the cache before the first CPU/memory sample
+    if (disk_spawn_worker() != 0) perror("pthread_create disk_worker");
+    pthread_mutex_unlock(&disktab.lock);
+}
+
+static void disk_stop(void) {
+    pthread_mutex_lock(&disktab.lock);
+    disktab.stop = 1;
+    pthread_cond_broadcast(&disktab.cond);
+    /* give the current worker up to a second to leave; stuck ones are left to exit() */
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += 1;
+    while (disktab.nalive > disktab.nstuck)
+        if (pthread_cond_timedwait(&disktab.cond, &disktab.lock, &until) == ETIMEDOUT) break;
+    pthread_mutex_unlock(&disktab.lock);
+}
+
+/* Disk sweep (every DISK_INTERVAL_MS); the worker refreshes disktab */
+static void collect_disk(void *arg) {
+    (void)arg;
+    disk_refresh_mounts();
+    pthread_mutex_lock(&disktab.lock);
+    if (disktab.busy && now_ms() - disktab.busy_since > config_get()->statvfs_timeout_ms) {
+        mount_ent_t *e = mount_find(disktab.busy_major, disktab.busy_minor);
+        if (e) {
+            e->hung = 1;
+            fprintf(stderr, "disk: statvfs(%s) timed out, skipping it until it returns\n", e->path);
+        }
+        disktab.timeouts++;
+        disktab.busy = 0;
+        disktab.nstuck++;
+        disktab.worker_gen++;
+        pthread_cond_broadcast(&disktab.cond);
+        if (disktab.nstuck > DISK_MAX_STUCK) fprintf(stderr, "disk: too many stuck statvfs workers, disk usage stalled\n");
+    }
+    if (disktab.nalive == disktab.nstuck && disktab.nstuck <= DISK_MAX_STUCK) disk_spawn_worker();
+    disktab.sweep = 1;
+    pthread_cond_broadcast(&disktab.cond);
+    pthread_mutex_unlock(&disktab.lock);
+}
+
+/* Disk I/O rates (every DISKIO_INTERVAL_MS), see diskio_ctx_t */
+static int diskio_init(diskio_ctx_t *c) {
+    memset(c, 0, sizeof(*c));
+    c->sysblock = access("/sys/block", F_OK) == 0 ? "/sys/block" : NULL;
+    proc_file_init(&c->f, "/proc/diskstats");
+    if (proc_file_read(&c->f) != 0) {
+        perror("/proc/diskstats");
+        proc_file_close(&c->f);
+        return -1;
+    }
+    diskio_rate_t row[DISKIO_MAX_DEVS];
+    parse_diskstats(c, c->f.buf);
+    diskio_rates(c, 0, row);  // prime the counters
+    c->last_ns = mono_ns();
+    return 0;
+}
+
+static void diskio_destroy(diskio_ctx_t *c) {
+    proc_file_close(&c->f);
+}
+
+static void collect_diskio(void *arg) {
+    diskio_ctx_t *c = arg;
+    uint64_t t0 = mono_ns();
+    if (proc_file_read(&c->f) != 0) return;
+    diskio_rate_t row[DISKIO_MAX_DEVS];
+    parse_diskstats(c, c->f.buf);
+    size_t n = diskio_rates(c, (double)(t0 - c->last_ns) / 1e6, row);
+    c->last_ns = t0;
+    diskio_ring_push(&diskioring, time(NULL), row, n);
+    instr_since(INSTR_DISKIO, t0);
+}
+
+/* cgroup collector (every CGROUP_INTERVAL_MS), see cgtab.
+ *
+ * The tree is walked once at startup; after that inotify on every cgroup
+ * directory reports cgroups as they are created & removed (& files appearing
+ * when a controller is enabled), so a tick only reads counters. A queue
+ * overflow or a failed watch falls back to walking the tree again. The
+ * accounting files of known cgroups stay open & are re-read with pread, up
+ * to a quarter of RLIMIT_NOFILE (the process collector takes half); the rest
+ * are opened per read. */
+
+enum { CG_CPU_STAT, CG_MEMORY_CURRENT, CG_IO_STAT, CG_CPU_PRESSURE, CG_MEMORY_PRESSURE, CG_IO_PRESSURE, CG_FILES };
+
+static const char *const cg_file_names[CG_FILES] = { "cpu.stat",     "memory.current",  "io.stat",
+                                                   "cpu.pressure", "memory.pressure", "io.pressure" };
+
+#define CG_FD_NONE (-1)    // not cached: opened for each read
+#define CG_FD_ABSENT (-2)  // no such file (controller not enabled, or the root's memory.current)
+#define CG_MAX_DEPTH 32
+#define CG_READ_BUF 4096
+
+typedef struct {
+    int fd[CG_FILES];
+    int wd;              // inotify watch, -1 if none
+    unsigned int seen;   // walk that last found it
+    int have;            // the counters below hold a previous read
+    uint64_t usage_us, throttled_us;
+    uint64_t io[4];      // rbytes, wbytes, rios, wios
+} cg_node_t;
+
+typedef struct {
+    char root[1024];
+    int rootfd, inofd;
+    cg_node_t *nodes;    // by cgtab slot
+    cg_rate_t *cur;      // this tick's rows, by cgtab slot
+    cg_index_t bywd;
+    int cached, fd_budget;
+    int rescan;          // walk the whole tree on the next tick
+    unsigned int gen;
+    unsigned long walks;
+    uint64_t last_ns;
+    char buf[CG_READ_BUF];
+} cg_ctx_t;
+
+static void cg_walk_dir(cg_ctx_t *c, const char *rel, int depth);
+
+/* "rel/name", or name for the root */
+static int cg_path(char *out, size_t outsz, const char *rel, const char *name) {
+    int n = rel[0] ? snprintf(out, outsz, "%s/%s", rel, name) : snprintf(out, outsz, "%s", name);
+    return (n < 0 || (size_t)n >= outsz) ? -1 : 0;
+}
+
+static void cg_watch(cg_ctx_t *c, int32_t s) {
+    char path[sizeof(c->root) + CG_PATH_MAX + 1];
+    const char *rel = cgtab.series[s].path;
+    snprintf(path, sizeof(path), "%s%s%s", c->root, rel[0] ? "/" : "", rel);
+    int wd = inotify_add_watch(c->inofd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+    c->nodes[s].wd = wd;
+    if (wd < 0) c->rescan = 1;  // out of watches (or it is gone already): poll by walking instead
+    else cg_index_put(&c->bywd, (uint64_t)wd, s);
+}
+
+/* Known or newly tracked cgroup rel; -1 if the table is full */
+static int32_t cg_track(cg_ctx_t *c, const char *rel) {
+    int32_t s = cgtab_find(rel);
+    if (s < 0) {
+        pthread_mutex_lock(&cgtab.lock);
+        s = cgtab_add(rel);
+        pthread_mutex_unlock(&cgtab.lock);
+        if (s < 0) return -1;
+        cg_node_t *n = &c->nodes[s];
+        memset(n, 0, sizeof(*n));
+        for (int f = 0; f < CG_FILES; f++) n->fd[f] = CG_FD_NONE;
+        n->wd = -1;
+    }
+    if (c->nodes[s].wd < 0) cg_watch(c, s);
+    c->nodes[s].seen = c->gen;
+    return s;
+}
+
+static void cg_uncache(cg_ctx_t *c, cg_node_t *n, int f) {
+    if (n->fd[f] >= 0) {
+        close(n->fd[f]);
+        c->cached--;
+    }
+    n->fd[f] = CG_FD_NONE;
+}
+
+static void cg_untrack(cg_ctx_t *c, int32_t s) {
+    cg_node_t *n = &c->nodes[s];
+    for (int f = 0; f < CG_FILES; f++) cg_uncache(c, n, f);
+    if (n->wd >= 0) {
+        cg_index_del(&c->bywd, (uint64_t)n->wd, s);
+        inotify_rm_watch(c->inofd, n->wd);  // EINVAL once the directory is gone; the watch went with it
+        n->wd = -1;
+    }
+    pthread_mutex_lock(&cgtab.lock);
+    cgtab_remove(s);
+    pthread_mutex_unlock(&cgtab.lock);
+}
+
+/* Track rel & every cgroup below it */
+static void cg_walk_dir(cg_ctx_t *c, const char *rel, int depth) {
+    if (cg_track(c, rel) < 0 || depth >= CG_MAX_DEPTH) return;
+    int fd = openat(c->rootfd, rel[0] ? rel : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!d) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        if (de->d_type != DT_DIR) {
+            struct stat st;
+            if (de->d_type != DT_UNKNOWN || fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+                !S_ISDIR(st.st_mode))
+                continue;
+        }
+        char child[CG_PATH_MAX];
+        if (cg_path(child, sizeof(child), rel, de->d_name) != 0) {
+            pthread_mutex_lock(&cgtab.lock);
+            cgtab.dropped++;  // path longer than CG_PATH_MAX
+            pthread_mutex_unlock(&cgtab.lock);
+            continue;
+        }
+        cg_walk_dir(c, child, depth + 1);
+    }
+    closedir(d);
+}
+
+/* Full walk: track what is there, drop what is not */
+static void cg_walk(cg_ctx_t *c) {
+    c->gen++;
+    c->walks++;
+    c->rescan = 0;
+    cg_walk_dir(c, "", 0);
+    for (size_t s = 0; s < cgtab.cap; s++)
+        if (cgtab.series[s].used && c->nodes[s].seen != c->gen) cg_untrack(c, (int32_t)s);
+}
+
+static int32_t cg_by_wd(cg_ctx_t *c, int wd) {
+    size_t pos = cg_index_home(&c->bywd, (uint64_t)wd);
+    return cg_index_scan(&c->bywd, (uint64_t)wd, &pos);
+}
+
+/* Apply queued inotify events */
+static void cg_events(cg_ctx_t *c) {
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(c->inofd, buf, sizeof(buf));
+        if (len <= 0) break;
+        for (char *p = buf; p < buf + len;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                c->rescan = 1;
+                continue;
+            }
+            int32_t s = cg_by_wd(c, ev->wd);
+            if (s < 0) continue;
+            if (ev->mask & IN_IGNORED) {  // the directory went away under us
+                c->nodes[s].wd = -1;
+                cg_index_del(&c->bywd, (uint64_t)ev->wd, s);
+                cg_untrack(c, s);
+                continue;
+            }
+            if (!ev->len) continue;
+            char child[CG_PATH_MAX];
+            if (cg_path(child, sizeof(child), cgtab.series[s].path, ev->name) != 0) continue;
+            if (!(ev->mask & IN_ISDIR)) {
+                /* a controller was enabled here: look for its files again */
+                for (int f = 0; f < CG_FILES; f++)
+                    if (c->nodes[s].fd[f] == CG_FD_ABSENT) c->nodes[s].fd[f] = CG_FD_NONE;
+                continue;
+            }
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                cg_walk_dir(c, child, 1);  // also picks up anything made before the watch was in place
+            } else {
+                int32_t k = cgtab_find(child);
+                if (k >= 0) cg_untrack(c, k);
+            }
+        }
+    }
+}
+
+/* Read file f of the cgroup in slot s into c->buf; -1 if it is missing */
+static int cg_read(cg_ctx_t *c, int32_t s, int f) {
+    cg_node_t *n = &c->nodes[s];
+    if (n->fd[f] == CG_FD_ABSENT) return -1;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = n->fd[f];
+        if (fd < 0) {
+            char path[CG_PATH_MAX + 32];
+            if (cg_path(path, sizeof(path), cgtab.series[s].path, cg_file_names[f]) != 0) return -1;
+            fd = openat(c->rootfd, path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                if (errno == ENOENT) n->fd[f] = CG_FD_ABSENT;
+                return -1;
+            }
+        }
+        ssize_t r = pread(fd, c->buf, sizeof(c->buf) - 1, 0);
+        if (n->fd[f] >= 0) {
+            if (r >= 0) {
+                c->buf[r] = '\0';
+                return 0;
+            }
+            cg_uncache(c, n, f);  // stale (e.g. the cgroup was recreated): reopen once
+            continue;
+        }
+        if (r >= 0 && c->cached < c->fd_budget) {
+            n->fd[f] = fd;
+            c->cached++;
+        } else {
+            close(fd);
+        }
+        if (r < 0) return -1;
+        c->buf[r] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+static inline float cg_per_s(uint64_t cur, uint64_t prev, double secs) {
+    return (cur >= prev && secs > 0) ? (float)((double)(cur - prev) / secs) : 0.0f;
+}
+
+/* Rates of slot s over secs into c->cur[s] */
+static void cg_sample(cg_ctx_t *c, int32_t s, double secs) {
+    cg_node_t *n = &c->nodes[s];
+    cg_rate_t *r = &c->cur[s];
+    memset(r, 0, sizeof(*r));
+    uint64_t usage = n->usage_us, throttled = n->throttled_us, io[4];
+    memcpy(io, n->io, sizeof(io));
+    if (cg_read(c, s, CG_CPU_STAT) == 0) parse_cg_cpu_stat(c->buf, &usage, &throttled);
+    if (cg_read(c, s, CG_MEMORY_CURRENT) == 0) {
+        const char *p = c->buf;
+        r->mem_bytes = parse_u64(&p);
+    }
+    if (cg_read(c, s, CG_IO_STAT) == 0) parse_cg_io_stat(c->buf, io);
+    double some, full;
+    for (int f = CG_CPU_PRESSURE; f <= CG_IO_PRESSURE; f++) {
+        if (cg_read(c, s, f) != 0 || parse_psi(c->buf, &some, &full) != 0) continue;
+        float v = (float)some;
+        if (f == CG_CPU_PRESSURE) r->cpu_psi = v;
+        else if (f == CG_MEMORY_PRESSURE) r->mem_psi = v;
+        else r->io_psi = v;
+    }
+    if (n->have) {
+        r->cpu = cg_per_s(usage, n->usage_us, secs) / 1e4f;  // usec per s -> percent
+        r->throttled = cg_per_s(throttled, n->throttled_us, secs) / 1e4f;
+        r->rd_bps = cg_per_s(io[0], n->io[0], secs);
+        r->wr_bps = cg_per_s(io[1], n->io[1], secs);
+        r->rd_iops = cg_per_s(io[2], n->io[2], secs);
+        r->wr_iops = cg_per_s(io[3], n->io[3], secs);
+    }
+    n->usage_us = usage;
+    n->throttled_us = throttled;
+    memcpy(n->io, io, sizeof(io));
+    n->have = 1;
+}
+
+/* root: CGROUP_ROOT. A hybrid host mounts cgroup v2 at <root>/unified. */
+static int cg_init(cg_ctx_t *c, const char *root) {
+    memset(c, 0, sizeof(*c));
+    c->rootfd = c->inofd = -1;
+    if (!root[0] || cgtab.cap == 0) return -1;
+    char probe[sizeof(c->root) + 32];
+    snprintf(c->root, sizeof(c->root), "%s", root);
+    snprintf(probe, sizeof(probe), "%s/cgroup.controllers", root);
+    if (access(probe, F_OK) != 0) {
+        snprintf(probe, sizeof(probe), "%s/unified/cgroup.controllers", root);
+        if (access(probe, F_OK) != 0) {
+            fprintf(stderr, "cgroup collector disabled: %s is not a cgroup v2 hierarchy\n", root);
+            return -1;
+        }
+        size_t len = strlen(probe) - strlen("/cgroup.controllers");
+        if (len >= sizeof(c->root)) return -1;
+        memcpy(c->root, probe, len);
+        c->root[len] = '\0';
+    }
+    c->rootfd = open(c->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    c->inofd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    c->nodes = calloc(cgtab.cap, sizeof(cg_node_t));
+    c->cur = calloc(cgtab.cap, sizeof(cg_rate_t));
+    if (c->rootfd < 0 || c->inofd < 0 || !c->nodes || !c->cur || cg_index_init(&c->bywd, cgtab.cap) != 0) {
+        fprintf(stderr, "cgroup collector disabled: cannot open %s or allocate\n", c->root);
+        if (c->rootfd >= 0) close(c->rootfd);
+        if (c->inofd >= 0) close(c->inofd);
+        free(c->nodes);
+        free(c->cur);
+        cg_index_free(&c->bywd);
+        return -1;
+    }
+    struct rlimit rl;
+    long lim = (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) ? (long)rl.rlim_cur / 4 : 256;
+    c->fd_budget = (int)lim;
+    cg_walk(c);
+    for (size_t s = 0; s < cgtab.cap; s++)
+        if (cgtab.series[s].used) cg_sample(c, (int32_t)s, 0);  // prime the counters...
+    pthread_mutex_lock(&cgtab.lock);
+    for (size_t s = 0; s < cgtab.cap; s++) cgtab.series[s].first = cgtab.ticks + 1;  // ...so the first tick has rates
+    pthread_mutex_unlock(&cgtab.lock);
+    c->last_ns = mono_ns();
+    return 0;
+}
+
+static void cg_destroy(cg_ctx_t *c) {
+    for (size_t s = 0; c->nodes && s < cgtab.cap; s++)
+        if (cgtab.series[s].used) cg_untrack(c, (int32_t)s);
+    if (c->rootfd >= 0) close(c->rootfd);
+    if (c->inofd >= 0) close(c->inofd);
+    free(c->nodes);
+    free(c->cur);
+    cg_index_free(&c->bywd);
+}
+
+static void collect_cgroups(void *arg) {
+    cg_ctx_t *c = arg;
+    uint64_t t0 = mono_ns();
+    cg_events(c);
+    if (c->rescan) cg_walk(c);
+    double secs = (double)(t0 - c->last_ns) / 1e9;
+    c->last_ns = t0;
+    for (size_t s = 0; s < cgtab.cap; s++)
+        if (cgtab.series[s].used) cg_sample(c, (int32_t)s, secs);
+    cgtab_publish(time(NULL), c->cur);
+    instr_since(INSTR_CGROUPS, t0);
+}
+
+/* Scheduler.
+ *
+ * One thread, one epoll set: a CLOCK_REALTIME timerfd per job, armed with
+ * TFD_TIMER_ABSTIME on the next multiple of its interval since the epoch, so
+ * ticks stay wall-aligned (a 5 s job fires at :00, :05, ...) & the sampling
+ * cost never accumulates as drift. A tick that finds several expirations was
+ * late; the missed ones are counted & skipped rather than run back to back.
+ * TFD_TIMER_CANCEL_ON_SET re-aligns after the clock is stepped. The shutdown
+ * eventfd is in the same set, so stopping is immediate. */
+
+#define SCHED_MAX_JOBS 8
+#define SCHED_BASELINE_MS 100
+
+typedef struct {
+    const char *name;
+    size_t interval_off;  // offsetof the config_t interval, re-read after every tick
+    int armed_ms;
+    void (*fn)(void *);
+    void *ctx;
+    int tfd;
+    atomic_ulong runs, missed;  // also read by the metrics renderer
+} sched_job_t;
+
+typedef struct {
+    int epfd;
+    sched_job_t jobs[SCHED_MAX_JOBS];
+    atomic_int njobs;
+} scheduler_t;
+
+static scheduler_t sched;
+
+/* The job's interval in cfg */
+static int sched_interval(const sched_job_t *j, const config_t *cfg) {
+    return *(const int *)((const char *)cfg + j->interval_off);
+}
+
+static int sched_arm(sched_job_t *j, const config_t *cfg) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long iv = sched_interval(j, cfg);
+    long long now_ms = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    long long first = (now_ms / iv + 1) * iv;
+    struct itimerspec its;
+    its.it_value.tv_sec = first / 1000;
+    its.it_value.tv_nsec = (first % 1000) * 1000000;
+    its.it_interval.tv_sec = iv / 1000;
+    its.it_interval.tv_nsec = (iv % 1000) * 1000000;
+    j->armed_ms = (int)iv;
+    return timerfd_settime(j->tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+}
+
+static int sched_add(scheduler_t *s, const char *name, size_t interval_off, void (*fn)(void *), void *ctx) {
+    int idx = atomic_load(&s->njobs);
+    if (idx == SCHED_MAX_JOBS) return -1;
+    sched_job_t *j = &s->jobs[idx];
+    memset(j, 0, sizeof(*j));
+    j->name = name;
+    j->interval_off = interval_off;
+    j->fn = fn;
+    j->ctx = ctx;
+    j->tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (j->tfd < 0 || sched_arm(j, config_get()) != 0) {
+        perror("timerfd");
+        if (j->tfd >= 0) close(j->tfd);
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = j;
+    epoll_ctl(s->epfd, EPOLL_CTL_ADD, j->tfd, &ev);
+    atomic_fetch_add(&s->njobs, 1);
+    return 0;
+}
+
+void *scheduler_thread(void *arg) {
+    (void)arg;
+    scheduler_t *s = &sched;
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epfd < 0) {
+        perror("epoll_create1");
+        return NULL;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(s->epfd, EPOLL_CTL_ADD, shutdown_efd, &ev);
+
+    cpu_mem_ctx_t cpu_mem;
+    proc_ctx_t procs;
+    diskio_ctx_t diskio;
+    static cg_ctx_t cgroups;  // with its read buffer, too big for this stack
+    disk_start();
+    unsigned e = rcu_read_lock();
+    int have_cpu_mem = cpu_mem_init(&cpu_mem) == 0;
+    if (have_cpu_mem) sched_add(s, "cpu_mem", offsetof(config_t, cpu_interval_ms), collect_cpu_mem, &cpu_mem);
+    sched_add(s, "disk", offsetof(config_t, disk_interval_ms), collect_disk, NULL);
+    if (proc_init(&procs) == 0) sched_add(s, "procs", offsetof(config_t, proc_interval_ms), collect_procs, &procs);
+    int have_diskio = diskio_init(&diskio) == 0;
+    if (have_diskio) sched_add(s, "diskio", offsetof(config_t, diskio_interval_ms), collect_diskio, &diskio);
+    rcu_read_unlock(e);
+
+    /* The first sample now rather than at the first tick, up to a whole
+     * CPU_INTERVAL_MS away: CPU over the SCHED_BASELINE_MS since cpu_mem_init
+     * read the counters, which also lets the first disk sweep land */
+    struct pollfd pfd = { shutdown_efd, POLLIN, 0 };
+    if (have_cpu_mem && poll(&pfd, 1, SCHED_BASELINE_MS) == 0) {
+        e = rcu_read_lock();
+        collect_cpu_mem(&cpu_mem);
+        rcu_read_unlock(e);
+    }
+    /* after the first sample: the initial walk of a large tree takes a while */
+    e = rcu_read_lock();
+    int have_cgroups = cg_init(&cgroups, config_get()->cgroup_root) == 0;
+    if (have_cgroups) sched_add(s, "cgroups", offsetof(config_t, cgroup_interval_ms), collect_cgroups, &cgroups);
+    rcu_read_unlock(e);
+
+    struct epoll_event events[SCHED_MAX_JOBS + 1];
+    while (atomic_load(&running)) {
+        int n = epoll_wait(s->epfd, events, SCHED_MAX_JOBS + 1, -1);
+        if (n < 0 && errno != EINTR) break;
+        for (int i = 0; i < n && atomic_load(&running); i++) {
+            sched_job_t *j = events[i].data.ptr;
+            if (!j) continue;  // shutdown
+            uint64_t expirations;
+            e = rcu_read_lock();  // collectors read the config; they never block
+            const config_t *cfg = config_get();
+            if (read(j->tfd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                if (errno == ECANCELED) sched_arm(j, cfg);  // clock stepped
+                rcu_read_unlock(e);
+                continue;
+            }
+            if (expirations > 1) atomic_fetch_add(&j->missed, expirations - 1);
+            j->fn(j->ctx);
+            atomic_fetch_add(&j->runs, 1);
+            if (sched_interval(j, cfg) != j->armed_ms) sched_arm(j, cfg);  // changed by SIGHUP
+            rcu_read_unlock(e);
+        }
+    }
+    for (int i = 0; i < atomic_load(&s->njobs); i++) {
+        sched_job_t *j = &s->jobs[i];
+        if (atomic_load(&j->missed))
+            fprintf(stderr, "scheduler: %s ran %lu times, missed %lu ticks\n", j->name, atomic_load(&j->runs),
+                    atomic_load(&j->missed));
+        close(j->tfd);
+    }
+    cpu_mem_destroy(&cpu_mem);
+    proc_destroy(&procs);
+    if (have_diskio) diskio_destroy(&diskio);
+    if (have_cgroups) cg_destroy(&cgroups);
+    disk_stop();
+    close(s->epfd);
+    return NULL;
+}
+
+/* Push exporter (PUSH_TARGET).
+ *
+ * A dedicated thread follows the sample ring by sequence number, moves new
+ * samples into a bounded backlog (PUSH_BACKLOG; the oldest are dropped &
+ * counted when it is full) & every PUSH_INTERVAL_MS sends the whole backlog:
+ * UDP as datagrams of at most PUSH_DATAGRAM_MAX bytes split on line
+ * boundaries, TCP as one write. A failed send keeps the backlog & retries
+ * after an exponential backoff; a TCP batch that failed half-way is resent
+ * whole, so the receiver may see a few samples twice. */
+
+#define PUSH_DATAGRAM_MAX 1400
+#define PUSH_BACKOFF_MIN_MS 1000
+#define PUSH_BACKOFF_MAX_MS 60000
+#define PUSH_CONNECT_TIMEOUT_MS 2000
+
+typedef struct {
+    char target[256], prefix[64];
+    int statsd, tcp;
+    int interval_ms;
+    char host[128];     // local hostname, escaped for the format
+    int fd;
+    metric_sample_t *q; // backlog ring
+    size_t cap, head, len;
+    unsigned long cursor;  // last ring sequence number taken
+    int backoff_ms;
+    long long retry_at, next_flush;
+    sbuf_t out;
+} push_ctx_t;
+
+static struct {
+    atomic_ulong sent, dropped, errors;
+    atomic_ulong backlog;
+    atomic_int connected;
+} pushstats;
+
+static void push_disconnect(push_ctx_t *p) {
+    if (p->fd >= 0) close(p->fd);
+    p->fd = -1;
+    atomic_store(&pushstats.connected, 0);
+}
+
+/* Take the configuration; on a change drop the connection & reformat the host */
+static void push_load_config(push_ctx_t *p, const config_t *cfg) {
+    const char *target = cfg->push_target, *prefix = cfg->push_prefix;
+    int statsd = cfg->push_statsd;
+    p->interval_ms = cfg->push_interval_ms;
+    if (strcmp(target, p->target) == 0 && strcmp(prefix, p->prefix) == 0 && statsd == p->statsd) return;
+    push_disconnect(p);
+    snprintf(p->target, sizeof(p->target), "%s", target);
+    snprintf(p->prefix, sizeof(p->prefix), "%s", prefix);
+    p->statsd = statsd;
+    p->tcp = strncmp(target, "tcp://", 6) == 0;
+    p->backoff_ms = 0;
+    p->retry_at = 0;
+
+    char host[64] = "localhost";
+    gethostname(host, sizeof(host));
+    host[sizeof(host) - 1] = '\0';
+    size_t o = 0;
+    for (const char *c = host; *c && o + 2 < sizeof(p->host); c++) {
+        if (statsd) {
+            p->host[o++] = (*c == '.' || *c == ':' || *c == '|') ? '_' : *c;
+        } else {
+            if (*c == ',' || *c == '=' || *c == ' ') p->host[o++] = '\\';
+            p->host[o++] = *c;
+        }
+    }
+    p->host[o] = '\0';
+}
+
+static int push_connect(push_ctx_t *p) {
+    const char *t = p->target;
+    if (strncmp(t, "udp://", 6) == 0 || strncmp(t, "tcp://", 6) == 0) t += 6;
+    char host[256];
+    snprintf(host, sizeof(host), "%s", t);
+    char *colon = strrchr(host, ':');
+    if (!colon || host[0] == '\0') {
+        fprintf(stderr, "push: PUSH_TARGET must be udp://host:port or tcp://host:port\n");
+        return -1;
+    }
+    *colon = '\0';
+    const char *port = colon + 1;
+    if (host[0] == '[' && colon > host + 1 && colon[-1] == ']') {  // [v6]:port
+        colon[-1] = '\0';
+        memmove(host, host + 1, strlen(host));
+    }
+
+    struct addrinfo hints, *ai = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = p->tcp ? SOCK_STREAM : SOCK_DGRAM;
+    int rc = getaddrinfo(host, port, &hints, &ai);
+    if (rc != 0) {
+        fprintf(stderr, "push: %s: %s\n", p->target, gai_strerror(rc));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = ai; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, a->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+        if (errno == EINPROGRESS) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            int err = 0;
+            socklen_t el = sizeof(err);
+            if (poll(&pfd, 1, PUSH_CONNECT_TIMEOUT_MS) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &el) == 0 &&
+                err == 0)
+                break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+    if (fd < 0) return -1;
+    p->fd = fd;
+    atomic_store(&pushstats.connected, 1);
+    return 0;
+}
+
+/* Move samples published since the last call into the backlog */
+static void push_collect(push_ctx_t *p) {
+    metric_sample_t tmp[64];
+    for (;;) {
+        unsigned long first;
+        size_t n = ring_read_after(&ringbuf, p->cursor, tmp, 64, &first);
+        if (first > p->cursor + 1) atomic_fetch_add(&pushstats.dropped, first - p->cursor - 1);
+        for (size_t i = 0; i < n; i++) {
+            if (p->len == p->cap) {  // full: forget the oldest
+                p->head = (p->head + 1) % p->cap;
+                p->len--;
+                atomic_fetch_add(&pushstats.dropped, 1);
+            }
+            p->q[(p->head + p->len) % p->cap] = tmp[i];
+            p->len++;
+        }
+        if (n == 0) break;
+        p->cursor = first + n - 1;
+    }
+    atomic_store(&pushstats.backlog, p->len);
+}
+
+static void push_format(push_ctx_t *p, const metric_sample_t *s) {
+    if (p->statsd) {
+        for (size_t i = 0; i < N_SAMPLE_FIELDS; i++)
+            sbuf_printf(&p->out, "%s.%s.%s:%.2f|g\n", p->prefix, p->host, sample_fields[i].name, sample_field(s, i));
+    } else {
+        sbuf_printf(&p->out, "%s,host=%s ", p->prefix, p->host);
+        for (size_t i = 0; i < N_SAMPLE_FIELDS; i++) {
+            if (sample_fields[i].is_u64)
+                sbuf_printf(&p->out, "%s%s=%llui", i ? "," : "", sample_fields[i].name, (unsigned long long)sample_field(s, i));
+            else sbuf_printf(&p->out, "%s%s=%.2f", i ? "," : "", sample_fields[i].name, sample_field(s, i));
+        }
+        sbuf_printf(&p->out, " %ld000000000\n", (long)s->timestamp);
+        /* top processes as their own measurement; statsd has no tags to carry pid & comm */
+        for (int list = 0; list < 2; list++) {
+            const sample_proc_t *v = list ? s->top_rss : s->top_cpu;
+            for (int i = 0; i < SAMPLE_TOP_PROCS && v[i].pid; i++) {
+                char comm[2 * sizeof(v[i].comm)];
+                size_t o = 0;
+                for (const char *c = v[i].comm; *c && o + 2 < sizeof(comm); c++) {
+                    if (*c == ',' || *c == '=' || *c == ' ' || *c == '\\') comm[o++] = '\\';
+                    comm[o++] = *c;
+                }
+                comm[o] = '\0';
+                sbuf_printf(&p->out, "%s_proc,host=%s,top=%s,rank=%d,comm=%s pid=%di,cpu=%.2f,rss_kb=%lui %ld000000000\n",
+                            p->prefix, p->host, list ? "rss" : "cpu", i + 1, o ? comm : "-", v[i].pid, v[i].cpu,
+                            (unsigned long)v[i].rss_kb, (long)s->timestamp);
+            }
+        }
+    }
+}
+
+static int push_send_all(int fd, const char *b, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = send(fd, b + off, len - off, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            if (poll(&pfd, 1, PUSH_CONNECT_TIMEOUT_MS) == 1) continue;
+            return -1;
+        }
+        if (w <= 0) return -1;
+        off += (size_t)w;
+    }
+    return 0;
+}
+
+/* Send the backlog; on failure it is kept & the next attempt backs off */
+static void push_flush(push_ctx_t *p, long long now) {
+    if (p->len == 0 || p->target[0] == '\0' || now < p->retry_at) return;
+    if (p->fd < 0 && push_connect(p) != 0) goto fail;
+
+    p->out.len = 0;
+    p->out.err = 0;
+    size_t dgram_start = 0;
+    for (size_t i = 0; i < p->len; i++) {
+        size_t before = p->out.len;
+        push_format(p, &p->q[(p->head + i) % p->cap]);
+        if (p->tcp || p->out.err) continue;
+        /* UDP: ship what we have before this sample would overflow a datagram */
+        if (p->out.len - dgram_start > PUSH_DATAGRAM_MAX && before > dgram_start) {
+            if (push_send_all(p->fd, p->out.p + dgram_start, before - dgram_start) != 0) goto fail;
+            dgram_start = before;
+        }
+    }
+    if (p->out.err) goto fail;
+    if (push_send_all(p->fd, p->out.p + dgram_start, p->out.len - dgram_start) != 0) goto fail;
+    atomic_fetch_add(&pushstats.sent, p->len);
+    p->head = p->len = 0;
+    p->backoff_ms = 0;
+    p->retry_at = 0;
+    atomic_store(&pushstats.backlog, 0);
+    return;
+
+fail:
+    atomic_fetch_add(&pushstats.errors, 1);
+    push_disconnect(p);
+    p->backoff_ms = p->backoff_ms ? p->backoff_ms * 2 : PUSH_BACKOFF_MIN_MS;
+    if (p->backoff_ms > PUSH_BACKOFF_MAX_MS) p->backoff_ms = PUSH_BACKOFF_MAX_MS;
+    p->retry_at = now + p->backoff_ms;
+}
+
+void *push_thread(void *arg) {
+    (void)arg;
+    push_ctx_t p;
+    memset(&p, 0, sizeof(p));
+    p.fd = -1;
+    p.cursor = state.restored;  // an earlier run already exported those
+    unsigned e = rcu_read_lock();
+    const config_t *cfg = config_get();
+    p.cap = (size_t)cfg->push_backlog;
+    unsigned long gen = cfg->gen;
+    push_load_config(&p, cfg);
+    rcu_read_unlock(e);
+    p.q = malloc(p.cap * sizeof(*p.q));
+    if (!p.q) {
+        fprintf(stderr, "push: cannot allocate a backlog of %zu samples\n", p.cap);
+        return NULL;
+    }
+    p.next_flush = now_ms() + p.interval_ms;
+    struct pollfd pfd = { shutdown_efd, POLLIN, 0 };
+    while (atomic_load(&running)) {
+        long long now = now_ms();
+        long long wake = p.next_flush;
+        if (p.len && p.retry_at > now && p.retry_at < wake) wake = p.retry_at;
+        if (poll(&pfd, 1, wake > now ? (int)(wake - now) : 0) < 0 && errno != EINTR) break;
+        if (!atomic_load(&running)) break;
+
+        e = rcu_read_lock();
+        cfg = config_get();
+        if (cfg->gen != gen) {
+            gen = cfg->gen;
+            push_load_config(&p, cfg);
+        }
+        rcu_read_unlock(e);
+        now = now_ms();
+        int due = now >= p.next_flush;
+        if (due) p.next_flush = now + p.interval_ms;
+        if (p.target[0] == '\0') {  // disabled: keep up with the ring, hold nothing
+            p.cursor = atomic_load(&ringbuf.total);
+            p.head = p.len = 0;
+            continue;
+        }
+        push_collect(&p);
+        if (due || (p.retry_at && now >= p.retry_at)) push_flush(&p, now);
+    }
+    /* last chance for what was published before shutdown */
+    if (p.target[0]) {
+        push_collect(&p);
+        push_flush(&p, now_ms());
+    }
+    push_disconnect(&p);
+    free(p.q);
+    free(p.out.p);
+    return NULL;
+}
+
+/* Aggregator (AGGREGATE_AGENTS).
+ *
+ * Fan-in from other syswatch agents: every host:port listed in the file gets
+ * a persistent connection on which the aggregator sends, every
+ * AGGREGATE_INTERVAL_MS, "get after=<seq> limit=AGG_POLL_LIMIT fields=...",
+ * so each poll carries only samples the agent published since the last one.
+ * The agents are split over AGGREGATE_THREADS epoll threads; each owns its
+ * sockets, never blocks on one & keeps the newest values per agent under its
+ * shard lock. On every tick shard 0 merges all shards into one fleet row:
+ * min, p50, p90, p99, max & mean of each AGGREGATE_FIELDS field over the
+ * agents heard from within AGGREGATE_TIMEOUT_MS, kept for the last
+ * AGGREGATE_HISTORY ticks & served by the cluster request. An agent that does
+ * not answer in time is disconnected & retried after an exponential backoff;
+ * one whose seq goes backwards has restarted & is read from its start. */
+
+#define AGG_NAME 64
+#define AGG_POLL_LIMIT 16         // newest samples per poll after an outage
+#define AGG_REPLY_MAX (256 * 1024)
+#define AGG_BACKOFF_MIN_MS 1000
+#define AGG_BACKOFF_MAX_MS 60000
+#define AGG_MAX_EVENTS 256
+#define AGG_STATS 6               // min p50 p90 p99 max mean
+#define AGG_FIELDS_LEN 512        // AGGREGATE_FIELDS names, comma separated
+
+enum { AGG_DOWN, AGG_CONNECTING, AGG_IDLE, AGG_WAIT };
+
+static const char *const agg_stat_names[AGG_STATS] = { "min", "p50", "p90", "p99", "max", "mean" };
+
+typedef struct {
+    char name[AGG_NAME];          // as listed, host:port
+    struct sockaddr_storage addr;
+    socklen_t addrlen;            // 0: did not resolve
+    int fd, state, backoff_ms;
+    unsigned long seq;            // newest sequence number taken
+    char *in;                     // reply being read
+    size_t in_len, in_cap;
+    long long sent_ms, retry_at;
+    /* under the shard lock */
+    long long ok_ms;              // last good reply, 0: none yet
+    time_t t;                     // newest sample, 0: none yet
+    double val[N_SAMPLE_FIELDS];
+    unsigned long samples, skipped, restarts, errors;
+} agg_agent_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    agg_agent_t *agents;          // this shard's slice of aggtab.agents
+    size_t n;
+    int epfd;
+    pthread_t th;
+    int started;
+    char fields[AGG_FIELDS_LEN];  // AGGREGATE_FIELDS as of the last tick, for the polls
+} agg_shard_t;
+
+typedef struct {
+    time_t t;
+    uint32_t agents, up;
+    float stat[N_SAMPLE_FIELDS][AGG_STATS];
+} agg_row_t;
+
+static struct {
+    agg_agent_t *agents;
+    size_t n;
+    agg_shard_t *shards;
+    int nshards;
+    pthread_mutex_t lock;         // the fleet rows
+    agg_row_t *rows;              // rows[tick % hist]
+    size_t hist;
+    unsigned long ticks;
+    uint64_t fields;              // of the newest row
+    double *scratch;              // merge buffer, shard 0 only
+} aggtab = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Reply to "get after=... fields=...": the agent's seq, the number of samples
+ * & the newest one's timestamp & fields (bit i of *got: vals[i] was set).
+ * Returns 0, or -1 for an error reply or anything malformed. */
+int parse_agg_reply(const char *buf, unsigned long *seq, size_t *nsamples, time_t *t, double *vals, uint64_t *got) {
+    const char *p = strstr(buf, "\"seq\": ");
+    if (!p) return -1;
+    char *end;
+    *seq = strtoul(p + 7, &end, 10);
+    if (end == p + 7) return -1;
+    p = strstr(end, "\"samples\": [");
+    if (!p) return -1;
+    p += 12;
+    *nsamples = 0;
+    *got = 0;
+    while (*p == '{') {
+        uint64_t mask = 0;
+        p++;
+        while (*p == '"') {
+            const char *name = ++p;
+            while (*p && *p != '"') p++;
+            if (p[0] != '"' || p[1] != ':') return -1;
+            size_t nl = (size_t)(p - name);
+            p += 2;
+            double v = strtod(p, &end);
+            if (end == p) return -1;
+            p = end;
+            if (nl == 1 && name[0] == 't') {
+                *t = (time_t)v;
+            } else {
+                for (size_t i = 0; i < N_SAMPLE_FIELDS; i++)
+                    if (strncmp(sample_fields[i].name, name, nl) == 0 && sample_fields[i].name[nl] == '\0') {
+                        vals[i] = v;
+                        mask |= 1ULL << i;
+                        break;
+                    }
+            }
+            if (*p == ',') p++;
+        }
+        if (*p++ != '}') return -1;
+        (*nsamples)++;
+        *got = mask;  // the newest sample's fields
+        if (*p == ',') p++;
+    }
+    return *p == ']' ? 0 : -1;
+}
+
+/* Nearest-rank quantile of n sorted values, q in [0, 1] */
+static double agg_quantile(const double *v, size_t n, double q) {
+    size_t k = (size_t)(q * (double)n);
+    if ((double)k < q * (double)n) k++;  // ceil
+    return v[k ? k - 1 : 0];
+}
+
+static int agg_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* "host:port" or "[v6]:port" -> addr; 0, or -1 if it does not resolve */
+static int agg_resolve(agg_agent_t *a) {
+    char host[AGG_NAME];
+    snprintf(host, sizeof(host), "%s", a->name);
+    char *colon = strrchr(host, ':');
+    if (!colon || colon == host) return -1;
+    *colon = '\0';
+    const char *port = colon + 1;
+    if (host[0] == '[' && colon[-1] == ']') {
+        colon[-1] = '\0';
+        memmove(host, host + 1, strlen(host));
+    }
+    struct addrinfo hints, *ai = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host, port, &hints, &ai);
+    if (rc != 0) {
+        fprintf(stderr, "aggregate: %s: %s\n", a->name, gai_strerror(rc));
+        return -1;
+    }
+    memcpy(&a->addr, ai->ai_addr, ai->ai_addrlen);
+    a->addrlen = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    return 0;
+}
+
+static void agg_disconnect(agg_shard_t *sh, agg_agent_t *a, long long now, int failed) {
+    if (a->fd >= 0) {
+        epoll_ctl(sh->epfd, EPOLL_CTL_DEL, a->fd, NULL);
+        close(a->fd);
+    }
+    a->fd = -1;
+    a->state = AGG_DOWN;
+    a->in_len = 0;
+    if (failed) {
+        a->backoff_ms = a->backoff_ms ? a->backoff_ms * 2 : AGG_BACKOFF_MIN_MS;
+        if (a->backoff_ms > AGG_BACKOFF_MAX_MS) a->backoff_ms = AGG_BACKOFF_MAX_MS;
+        a->retry_at = now + a->backoff_ms;
+        pthread_mutex_lock(&sh->lock);
+        a->errors++;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+/* Ask for what is new since a->seq; the request fits any socket buffer */
+static void agg_poll(agg_shard_t *sh, agg_agent_t *a, long long now) {
+    char req[AGG_FIELDS_LEN + 64];
+    int n = snprintf(req, sizeof(req), "get after=%lu limit=%d fields=%s\n", a->seq, AGG_POLL_LIMIT, sh->fields);
+    if (send(a->fd, req, (size_t)n, MSG_NOSIGNAL) != n) {
+        agg_disconnect(sh, a, now, 1);
+        return;
+    }
+    a->state = AGG_WAIT;
+    a->sent_ms = now;
+}
+
+static void agg_connect(agg_shard_t *sh, agg_agent_t *a, long long now) {
+    if (!a->addrlen) return;
+    int fd = socket(a->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        a->retry_at = now + AGG_BACKOFF_MIN_MS;
+        return;
+    }
+    a->fd = fd;
+    a->sent_ms = now;
+    int rc = connect(fd, (const struct sockaddr *)&a->addr, a->addrlen);
+    if (rc != 0 && errno != EINPROGRESS) {
+        agg_disconnect(sh, a, now, 1);
+        return;
+    }
+    a->state = rc == 0 ? AGG_IDLE : AGG_CONNECTING;
+    struct epoll_event ev;
+    ev.events = rc == 0 ? EPOLLIN : EPOLLOUT;
+    ev.data.ptr = a;
+    if (epoll_ctl(sh->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) agg_disconnect(sh, a, now, 1);
+    else if (rc == 0 && sh->fields[0]) agg_poll(sh, a, now);
+}
+
+/* One complete reply line */
+static void agg_reply(agg_shard_t *sh, agg_agent_t *a, const char *line, long long now) {
+    unsigned long seq;
+    size_t n;
+    time_t t = 0;
+    double vals[N_SAMPLE_FIELDS];
+    uint64_t got;
+    if (parse_agg_reply(line, &seq, &n, &t, vals, &got) != 0) {
+        agg_disconnect(sh, a, now, 1);
+        return;
+    }
+    pthread_mutex_lock(&sh->lock);
+    if (seq < a->seq) {  // restarted (or a new state file): read it from the start next time
+        a->restarts++;
+        a->seq = 0;
+    } else {
+        if (a->seq && seq - a->seq > n) a->skipped += seq - a->seq - n;
+        a->seq = seq;
+    }
+    if (n) {
+        a->t = t;
+        for (size_t i = 0; i < N_SAMPLE_FIELDS; i++)
+            if (got >> i & 1u) a->val[i] = vals[i];
+        a->samples += n;
+    }
+    a->ok_ms = now;
+    pthread_mutex_unlock(&sh->lock);
+    a->state = AGG_IDLE;
+    a->backoff_ms = 0;
+}
+
+static void agg_readable(agg_shard_t *sh, agg_agent_t *a, long long now) {
+    for (;;) {
+        if (a->in_cap - a->in_len < 4096) {
+            size_t nc = a->in_cap ? a->in_cap * 2 : 8192;
+            char *nb = nc <= AGG_REPLY_MAX ? realloc(a->in, nc) : NULL;
+            if (!nb) {
+                agg_disconnect(sh, a, now, 1);
+                return;
+            }
+            a->in = nb;
+            a->in_cap = nc;
+        }
+        ssize_t r = recv(a->fd, a->in + a->in_len, a->in_cap - a->in_len - 1, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (r <= 0) {
+            agg_disconnect(sh, a, now, 1);
+            return;
+        }
+        a->in_len += (size_t)r;
+        a->in[a->in_len] = '\0';
+        char *nl = memchr(a->in, '\n', a->in_len);
+        if (nl) {
+            *nl = '\0';
+            if (a->state == AGG_WAIT) agg_reply(sh, a, a->in, now);
+            if (a->fd < 0) return;
+            a->in_len = 0;  // one request in flight, so nothing follows the reply
+            if (a->in_cap > 65536) {  // after a large backlog: give the memory back
+                free(a->in);
+                a->in = NULL;
+                a->in_cap = 0;
+            }
+            break;
+        }
+    }
+}
+
+/* Fleet row from every shard's newest values; shard 0 only */
+static void agg_merge(uint64_t fields, int timeout_ms, long long now) {
+    uint64_t t0 = mono_ns();
+    size_t n = 0;
+    double *m = aggtab.scratch;  // N_SAMPLE_FIELDS columns of aggtab.n
+    for (int s = 0; s < aggtab.nshards; s++) {
+        agg_shard_t *sh = &aggtab.shards[s];
+        pthread_mutex_lock(&sh->lock);
+        for (size_t i = 0; i < sh->n; i++) {
+            const agg_agent_t *a = &sh->agents[i];
+            if (!a->t || !a->ok_ms || now - a->ok_ms > timeout_ms) continue;
+            for (size_t f = 0; f < N_SAMPLE_FIELDS; f++)
+                if (fields >> f & 1u) m[f * aggtab.n + n] = a->val[f];
+            n++;
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+    agg_row_t row;
+    memset(&row, 0, sizeof(row));
+    row.t = time(NULL);
+    row.agents = (uint32_t)aggtab.n;
+    row.up = (uint32_t)n;
+    for (size_t f = 0; n && f < N_SAMPLE_FIELDS; f++) {
+        if (!(fields >> f & 1u)) continue;
+        double *v = &m[f * aggtab.n], sum = 0;
+        qsort(v, n, sizeof(double), agg_cmp_double);
+        for (size_t i = 0; i < n; i++) sum += v[i];
+        static const double q[] = { 0, 0.5, 0.9, 0.99, 1 };
+        for (int k = 0; k < 5; k++) row.stat[f][k] = (float)agg_quantile(v, n, q[k]);
+        row.stat[f][5] = (float)(sum / (double)n);
+    }
+    pthread_mutex_lock(&aggtab.lock);
+    aggtab.rows[++aggtab.ticks % aggtab.hist] = row;
+    aggtab.fields = fields;
+    pthread_mutex_unlock(&aggtab.lock);
+    instr_since(INSTR_AGG_MERGE, t0);
+}
+
+static void *agg_thread(void *arg) {
+    agg_shard_t *sh = arg;
+    int lead = sh == &aggtab.shards[0];
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // shutdown_efd
+    epoll_ctl(sh->epfd, EPOLL_CTL_ADD, shutdown_efd, &ev);
+    long long now = now_ms();
+    for (size_t i = 0; i < sh->n; i++) agg_connect(sh, &sh->agents[i], now);
+    long long next_tick = now;
+    struct epoll_event events[AGG_MAX_EVENTS];
+    while (atomic_load(&running)) {
+        now = now_ms();
+        if (now >= next_tick) {
+            unsigned e = rcu_read_lock();
+            const config_t *cfg = config_get();
+            int interval = cfg->aggregate_interval_ms, timeout = cfg->aggregate_timeout_ms;
+            uint64_t fields = cfg->aggregate_fields;
+            rcu_read_unlock(e);
+            size_t o = 0;
+            for (size_t f = 0; f < N_SAMPLE_FIELDS; f++)
+                if (fields >> f & 1u)
+                    o += (size_t)snprintf(sh->fields + o, sizeof(sh->fields) - o, "%s%s", o ? "," : "",
+                                          sample_fields[f].name);
+            if (lead) agg_merge(fields, timeout, now);  // what the last round brought in
+            for (size_t i = 0; i < sh->n; i++) {
+                agg_agent_t *a = &sh->agents[i];
+                if ((a->state == AGG_WAIT || a->state == AGG_CONNECTING) && now - a->sent_ms > timeout)
+                    agg_disconnect(sh, a, now, 1);
+                if (a->state == AGG_DOWN && now >= a->retry_at) agg_connect(sh, a, now);
+                if (a->state == AGG_IDLE) agg_poll(sh, a, now);
+            }
+            next_tick += interval;
+            if (next_tick <= now) next_tick = now + interval;  // fell behind: skip, don't burst
+        }
+        int nev = epoll_wait(sh->epfd, events, AGG_MAX_EVENTS, (int)(next_tick - now));
+        if (nev < 0 && errno != EINTR) break;
+        now = now_ms();
+        for (int i = 0; i < nev; i++) {
+            agg_agent_t *a = events[i].data.ptr;
+            if (!a) continue;  // shutdown: the loop condition sees it
+            if (a->fd < 0) continue;
+            if (a->state == AGG_CONNECTING) {
+                int err = 0;
+                socklen_t el = sizeof(err);
+                if (getsockopt(a->fd, SOL_SOCKET, SO_ERROR, &err, &el) != 0 || err != 0) {
+                    agg_disconnect(sh, a, now, 1);
+                    continue;
+                }
+                struct epoll_event mod;
+                mod.events = EPOLLIN;
+                mod.data.ptr = a;
+                epoll_ctl(sh->epfd, EPOLL_CTL_MOD, a->fd, &mod);
+                a->state = AGG_IDLE;
+                if (sh->fields[0]) agg_poll(sh, a, now);  // don't wait a whole interval for the first reply
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) agg_readable(sh, a, now);
+        }
+    }
+    for (size_t i = 0; i < sh->n; i++) {
+        agg_disconnect(sh, &sh->agents[i], now, 0);
+        free(sh->agents[i].in);
+        sh->agents[i].in = NULL;
+    }
+    return NULL;
+}
+
+/* Read the agents file & start the shard threads. Returns 0, or -1 if
+ * aggregation is off or could not start. Resolving may block, so the
+ * settings are copied out of the RCU section first. */
+static int agg_start(void) {
+    char path[sizeof(((config_t *)0)->aggregate_agents)];
+    unsigned e = rcu_read_lock();
+    const config_t *cfg = config_get();
+    memcpy(path, cfg->aggregate_agents, sizeof(path));
+    int nthreads = cfg->aggregate_threads, hist = cfg->aggregate_history;
+    rcu_read_unlock(e);
+    if (!path[0]) return -1;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "aggregate: cannot read %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    size_t cap = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        trim(line);
+        if (line[0] == '#' || line[0] == '\0') continue;
+        if (strlen(line) >= AGG_NAME) {
+            fprintf(stderr, "aggregate: agent name too long, skipping '%s'\n", line);
+            continue;
+        }
+        if (aggtab.n == cap) {
+            size_t nc = cap ? cap * 2 : 64;
+            agg_agent_t *na = realloc(aggtab.agents, nc * sizeof(*na));
+            if (!na) break;
+            aggtab.agents = na;
+            cap = nc;
+        }
+        agg_agent_t *a = &aggtab.agents[aggtab.n++];
+        memset(a, 0, sizeof(*a));
+        snprintf(a->name, sizeof(a->name), "%s", line);
+        a->fd = -1;
+        agg_resolve(a);
+    }
+    fclose(f);
+    if (aggtab.n == 0) {
+        fprintf(stderr, "aggregate: no agents in %s\n", path);
+        return -1;
+    }
+    /* one socket per agent, plus room for everything else */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < aggtab.n + 1024) {
+        rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > aggtab.n + 1024) ? aggtab.n + 1024 : rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur < aggtab.n + 64)
+            fprintf(stderr, "aggregate: RLIMIT_NOFILE %llu is low for %zu agents\n", (unsigned long long)rl.rlim_cur,
+                    aggtab.n);
+    }
+    aggtab.hist = (size_t)hist;
+    aggtab.nshards = (size_t)nthreads < aggtab.n ? nthreads : (int)aggtab.n;
+    aggtab.rows = calloc(aggtab.hist, sizeof(agg_row_t));
+    aggtab.scratch = malloc(aggtab.n * N_SAMPLE_FIELDS * sizeof(double));
+    aggtab.shards = calloc((size_t)aggtab.nshards, sizeof(agg_shard_t));
+    if (!aggtab.rows || !aggtab.scratch || !aggtab.shards) {
+        fprintf(stderr, "aggregate: cannot allocate tables for %zu agents\n", aggtab.n);
+        return -1;
+    }
+    for (int s = 0; s < aggtab.nshards; s++) {
+        agg_shard_t *sh = &aggtab.shards[s];
+        size_t lo = aggtab.n * (size_t)s / (size_t)aggtab.nshards, hi = aggtab.n * (size_t)(s + 1) / (size_t)aggtab.nshards;
+        pthread_mutex_init(&sh->lock, NULL);
+        sh->agents = &aggtab.agents[lo];
+        sh->n = hi - lo;
+        sh->epfd = epoll_create1(EPOLL_CLOEXEC);
+        char name[32];
+        snprintf(name, sizeof(name), "sw-agg-%d", s);
+        sh->started = sh->epfd >= 0 && thread_spawn(&sh->th, NULL, THR_AGGREGATE, name, agg_thread, sh) == 0;
+        if (!sh->started) fprintf(stderr, "aggregate: cannot start %s\n", name);
+    }
+    fprintf(stderr, "aggregate: %zu agents over %d threads\n", aggtab.n, aggtab.nshards);
+    return 0;
+}
+
+/* After shutdown_efd fired */
+static void agg_stop(void) {
+    for (int s = 0; s < aggtab.nshards; s++) {
+        agg_shard_t *sh = &aggtab.shards[s];
+        if (sh->started) pthread_join(sh->th, NULL);
+        if (sh->epfd >= 0) close(sh->epfd);
+        pthread_mutex_destroy(&sh->lock);
+    }
+    free(aggtab.shards);
+    free(aggtab.agents);
+    free(aggtab.rows);
+    free(aggtab.scratch);
+    aggtab.shards = NULL;
+    aggtab.agents = NULL;
+    aggtab.rows = NULL;
+    aggtab.scratch = NULL;
+    aggtab.n = 0;
+    aggtab.nshards = 0;
+}
+
+/* Prometheus text exposition (GET /metrics, or "metrics" on the line protocol).
+ *
+ * The page is rendered once per published sample, with its HTTP header in
+ * front, into a metricsdoc buffer from the same pinned pool as the status
+ * document; a scrape is a pin & a send however often it comes. The line
+ * protocol sends the same buffer from body_off. */
+
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+static status_doc_t metricsdoc;
+static atomic_ulong net_requests;
+static atomic_ulong stream_sent, stream_dropped;  // samples streamed to subscribers / lost to a lapped cursor
+
+/* Append s as a label value: backslash, quote & newline escaped */
+static void prom_label(sbuf_t *b, const char *s) {
+    for (; *s; s++) {
+        if (*s == '\\') sbuf_printf(b, "\\\\");
+        else if (*s == '"') sbuf_printf(b, "\\\"");
+        else if (*s == '\n') sbuf_printf(b, "\\n");
+        else sbuf_printf(b, "%c", *s);
+    }
+}
+
+static void prom_head(sbuf_t *b, const char *name, const char *type, const char *help) {
+    sbuf_printf(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void prom_mount_series(sbuf_t *b, const char *name, int which) {
+    for (size_t i = 0; i < disktab.n; i++) {
+        const mount_ent_t *e = &disktab.m[i];
+        if (!e->have) continue;
+        sbuf_printf(b, "%s{mountpoint=\"", name);
+        prom_label(b, e->path);
+        sbuf_printf(b, "\",fstype=\"");
+        prom_label(b, e->fstype);
+        sbuf_printf(b, "\",device=\"%u:%u\"} ", e->major, e->minor);
+        switch (which) {
+        case 0: sbuf_printf(b, "%lu\n", (unsigned long)e->total); break;
+        case 1: sbuf_printf(b, "%lu\n", (unsigned long)e->used); break;
+        case 2: sbuf_printf(b, "%lu\n", (unsigned long)e->avail); break;
+        case 3: sbuf_printf(b, "%.2f\n", e->perc); break;
+        default: sbuf_printf(b, "%d\n", e->hung); break;
+        }
+    }
+}
+
+static void prom_log_series(sbuf_t *b, const char *name, int which) {
+    for (size_t i = 0; i < logstats.n; i++) {
+        const log_stat_t *l = &logstats.v[i];
+        sbuf_printf(b, "%s{path=\"", name);
+        prom_label(b, l->path);
+        sbuf_printf(b, "\"} %lu\n",
+                    (unsigned long)(which == 0 ? l->bytes : which == 1 ? l->lines : l->alerts));
+    }
+}
+
+/* Per-file, per-pattern match counters (logstats.lock held) */
+static void prom_log_pattern_series(sbuf_t *b) {
+    for (size_t i = 0; i < logstats.n; i++) {
+        const log_stat_t *l = &logstats.v[i];
+        const char *name = logstats.patterns;
+        for (int p = 0; p < logstats.npatterns && *name; p++) {
+            size_t n = strcspn(name, ",");
+            char pat[MAX_PATTERN_BYTES + 1];
+            snprintf(pat, sizeof(pat), "%.*s", (int)n, name);
+            sbuf_printf(b, "syswatch_log_pattern_matches_total{path=\"");
+            prom_label(b, l->path);
+            sbuf_printf(b, "\",pattern=\"");
+            prom_label(b, pat);
+            sbuf_printf(b, "\"} %lu\n", (unsigned long)l->hits[p]);
+            name += n + (name[n] == ',');
+        }
+    }
+}
+
+static void metrics_render(sbuf_t *b, const metric_sample_t *s) {
+    prom_head(b, "syswatch_cpu_usage_percent", "gauge", "Busy CPU time over the last sampling interval.");
+    sbuf_printf(b, "syswatch_cpu_usage_percent %.2f\n", s->cpu_usage);
+    prom_head(b, "syswatch_memory_usage_percent", "gauge", "Memory in use (MemTotal - MemAvailable).");
+    sbuf_printf(b, "syswatch_memory_usage_percent %.2f\n", s->memory_usage);
+    prom_head(b, "syswatch_memory_available_bytes", "gauge", "MemAvailable.");
+    sbuf_printf(b, "syswatch_memory_available_bytes %llu\n", (unsigned long long)s->mem_avail_kb * 1024);
+    prom_head(b, "syswatch_memory_dirty_bytes", "gauge", "Dirty page cache waiting for writeback.");
+    sbuf_printf(b, "syswatch_memory_dirty_bytes %llu\n", (unsigned long long)s->mem_dirty_kb * 1024);
+    prom_head(b, "syswatch_memory_writeback_bytes", "gauge", "Page cache under writeback.");
+    sbuf_printf(b, "syswatch_memory_writeback_bytes %llu\n", (unsigned long long)s->mem_writeback_kb * 1024);
+    prom_head(b, "syswatch_swap_usage_percent", "gauge", "Swap in use.");
+    sbuf_printf(b, "syswatch_swap_usage_percent %.2f\n", s->swap_usage);
+    prom_head(b, "syswatch_memory_pressure_percent", "gauge",
+              "Share of time tasks stalled on memory over the last 10 s (/proc/pressure/memory).");
+    sbuf_printf(b, "syswatch_memory_pressure_percent{kind=\"some\"} %.2f\n", s->mem_psi_some);
+    sbuf_printf(b, "syswatch_memory_pressure_percent{kind=\"full\"} %.2f\n", s->mem_psi_full);
+    prom_head(b, "syswatch_disk_usage_max_percent", "gauge", "Usage of the fullest mounted filesystem.");
+    sbuf_printf(b, "syswatch_disk_usage_max_percent %.2f\n", s->disk_usage);
+    prom_head(b, "syswatch_cpu_core_max_percent", "gauge", "Busiest core over the last sampling interval.");
+    sbuf_printf(b, "syswatch_cpu_core_max_percent %.2f\n", s->cpu_core_max);
+    prom_head(b, "syswatch_cpu_core_p95_percent", "gauge", "95th percentile of per-core usage.");
+    sbuf_printf(b, "syswatch_cpu_core_p95_percent %.2f\n", s->cpu_core_p95);
+    prom_head(b, "syswatch_sample_timestamp_seconds", "gauge", "Time of the last published sample.");
+    sbuf_printf(b, "syswatch_sample_timestamp_seconds %ld\n", (long)s->timestamp);
+
+    for (int list = 0; list < 2; list++) {
+        const sample_proc_t *v = list ? s->top_rss : s->top_cpu;
+        const char *name = list ? "syswatch_top_process_rss_bytes" : "syswatch_top_process_cpu_percent";
+        prom_head(b, name, "gauge", list ? "Resident memory of the largest processes at the last scan."
+                                         : "CPU of the busiest processes at the last scan, percent of one CPU.");
+        for (int i = 0; i < SAMPLE_TOP_PROCS && v[i].pid; i++) {
+            sbuf_printf(b, "%s{rank=\"%d\",pid=\"%d\",comm=\"", name, i + 1, v[i].pid);
+            prom_label(b, v[i].comm);
+            if (list) sbuf_printf(b, "\"} %lu\n", (unsigned long)v[i].rss_kb * 1024);
+            else sbuf_printf(b, "\"} %.2f\n", v[i].cpu);
+        }
+    }
+
+    float cores[MAX_REPORTED_CORES];
+    size_t ncores = core_ring_latest(&corering, cores, MAX_REPORTED_CORES);
+    prom_head(b, "syswatch_cpu_core_usage_percent", "gauge", "Per-core busy time over the last sampling interval.");
+    for (size_t i = 0; i < ncores; i++)
+        sbuf_printf(b, "syswatch_cpu_core_usage_percent{core=\"%zu\"} %.2f\n", i, cores[i]);
+
+    pthread_mutex_lock(&disktab.lock);
+    prom_head(b, "syswatch_mount_size_bytes", "gauge", "Filesystem size.");
+    prom_mount_series(b, "syswatch_mount_size_bytes", 0);
+    prom_head(b, "syswatch_mount_used_bytes", "gauge", "Filesystem space in use.");
+    prom_mount_series(b, "syswatch_mount_used_bytes", 1);
+    prom_head(b, "syswatch_mount_avail_bytes", "gauge", "Filesystem space available to unprivileged users.");
+    prom_mount_series(b, "syswatch_mount_avail_bytes", 2);
+    prom_head(b, "syswatch_mount_usage_percent", "gauge", "Filesystem usage.");
+    prom_mount_series(b, "syswatch_mount_usage_percent", 3);
+    prom_head(b, "syswatch_mount_stale", "gauge", "1 while a statvfs on the filesystem is stuck.");
+    prom_mount_series(b, "syswatch_mount_stale", 4);
+    prom_head(b, "syswatch_disk_sweeps_total", "counter", "Completed statvfs sweeps.");
+    sbuf_printf(b, "syswatch_disk_sweeps_total %lu\n", disktab.sweeps);
+    prom_head(b, "syswatch_disk_statvfs_timeouts_total", "counter", "statvfs calls abandoned after STATVFS_TIMEOUT_MS.");
+    sbuf_printf(b, "syswatch_disk_statvfs_timeouts_total %lu\n", disktab.timeouts);
+    prom_head(b, "syswatch_disk_workers_stuck", "gauge", "Abandoned disk workers still inside statvfs.");
+    sbuf_printf(b, "syswatch_disk_workers_stuck %d\n", disktab.nstuck);
+    pthread_mutex_unlock(&disktab.lock);
+
+    static const struct { const char *name, *help; } diskio_metrics[] = {
+        { "syswatch_diskio_reads_per_second", "Completed reads per second." },
+        { "syswatch_diskio_writes_per_second", "Completed writes per second." },
+        { "syswatch_diskio_read_bytes_per_second", "Bytes read per second." },
+        { "syswatch_diskio_written_bytes_per_second", "Bytes written per second." },
+        { "syswatch_diskio_await_milliseconds", "Mean time per completed request, queueing included." },
+        { "syswatch_diskio_utilization_percent", "Share of the interval the disk had requests in flight." },
+    };
+    diskio_rate_t io[DISKIO_MAX_DEVS];
+    time_t io_ts;
+    uint8_t io_n = 0;
+    diskio_ring_read(&diskioring, 1, &io_ts, &io_n, io);
+    for (size_t k = 0; k < sizeof(diskio_metrics) / sizeof(diskio_metrics[0]); k++) {
+        prom_head(b, diskio_metrics[k].name, "gauge", diskio_metrics[k].help);
+        for (size_t i = 0; i < io_n; i++) {
+            const diskio_rate_t *r = &io[i];
+            const float v[] = { r->rd_iops, r->wr_iops, r->rd_bps, r->wr_bps, r->await_ms, r->util };
+            sbuf_printf(b, "%s{device=\"", diskio_metrics[k].name);
+            prom_label(b, r->name);
+            sbuf_printf(b, "\"} %.2f\n", v[k]);
+        }
+    }
+
+    pthread_mutex_lock(&cgtab.lock);
+    size_t cg_n = cgtab.n;
+    unsigned long cg_dropped = cgtab.dropped;
+    pthread_mutex_unlock(&cgtab.lock);
+    if (aggtab.n) {
+        unsigned long samples = 0, errors = 0;
+        size_t up = 0;
+        long long now = now_ms();
+        unsigned e = rcu_read_lock();
+        int timeout = config_get()->aggregate_timeout_ms;
+        rcu_read_unlock(e);
+        for (int s = 0; s < aggtab.nshards; s++) {
+            agg_shard_t *sh = &aggtab.shards[s];
+            pthread_mutex_lock(&sh->lock);
+            for (size_t i = 0; i < sh->n; i++) {
+                up += sh->agents[i].ok_ms && now - sh->agents[i].ok_ms <= timeout;
+                samples += sh->agents[i].samples;
+                errors += sh->agents[i].errors;
+            }
+            pthread_mutex_unlock(&sh->lock);
+        }
+        prom_head(b, "syswatch_aggregate_agents", "gauge", "Agents in AGGREGATE_AGENTS, by whether they answered in time.");
+        sbuf_printf(b, "syswatch_aggregate_agents{state=\"up\"} %zu\n", up);
+        sbuf_printf(b, "syswatch_aggregate_agents{state=\"down\"} %zu\n", aggtab.n - up);
+        prom_head(b, "syswatch_aggregate_samples_total", "counter", "Samples fetched from agents.");
+        sbuf_printf(b, "syswatch_aggregate_samples_total %lu\n", samples);
+        prom_head(b, "syswatch_aggregate_errors_total", "counter", "Agent connections that failed or timed out.");
+        sbuf_printf(b, "syswatch_aggregate_errors_total %lu\n", errors);
+    }
+    prom_head(b, "syswatch_cgroups", "gauge", "cgroups tracked by the cgroup collector (see the cgroups request).");
+    sbuf_printf(b, "syswatch_cgroups %zu\n", cg_n);
+    prom_head(b, "syswatch_cgroups_dropped_total", "counter", "cgroups not tracked: CGROUP_MAX reached or path too long.");
+    sbuf_printf(b, "syswatch_cgroups_dropped_total %lu\n", cg_dropped);
+
+    static const struct { const char *name, *type, *help; } net_metrics[] = {
+        { "syswatch_net_receive_bytes_total", "counter", "Bytes received." },
+        { "syswatch_net_transmit_bytes_total", "counter", "Bytes sent." },
+        { "syswatch_net_receive_packets_total", "counter", "Packets received." },
+        { "syswatch_net_transmit_packets_total", "counter", "Packets sent." },
+        { "syswatch_net_receive_errors_total", "counter", "Receive errors." },
+        { "syswatch_net_transmit_errors_total", "counter", "Transmit errors." },
+        { "syswatch_net_receive_drops_total", "counter", "Received packets dropped." },
+        { "syswatch_net_transmit_drops_total", "counter", "Outgoing packets dropped." },
+        { "syswatch_net_receive_bytes_per_second", "gauge", "Receive rate over the last sampling interval." },
+        { "syswatch_net_transmit_bytes_per_second", "gauge", "Transmit rate over the last sampling interval." },
+        { "syswatch_net_link_utilization_percent", "gauge", "Busier direction as a share of the link speed." },
+    };
+    pthread_mutex_lock(&nettab.lock);
+    for (size_t k = 0; k < sizeof(net_metrics) / sizeof(net_metrics[0]); k++) {
+        prom_head(b, net_metrics[k].name, net_metrics[k].type, net_metrics[k].help);
+        for (size_t i = 0; i < nettab.n; i++) {
+            const net_iface_t *e = &nettab.v[i];
+            const uint64_t c[] = { e->c.rx_bytes, e->c.tx_bytes, e->c.rx_packets, e->c.tx_packets,
+                                   e->c.rx_errs,  e->c.tx_errs,  e->c.rx_drop,    e->c.tx_drop };
+            sbuf_printf(b, "%s{interface=\"", net_metrics[k].name);
+            prom_label(b, e->name);
+            if (k < 8) sbuf_printf(b, "\"} %llu\n", (unsigned long long)c[k]);
+            else sbuf_printf(b, "\"} %.2f\n", k == 8 ? e->rx_bps : k == 9 ? e->tx_bps : e->util);
+        }
+    }
+    pthread_mutex_unlock(&nettab.lock);
+
+    pthread_mutex_lock(&alerts.lock);
+    prom_head(b, "syswatch_alert_firing", "gauge", "1 while an ALERT rule is firing.");
+    for (size_t i = 0; i < alerts.n; i++) {
+        sbuf_printf(b, "syswatch_alert_firing{rule=\"");
+        prom_label(b, alerts.rules[i].text);
+        sbuf_printf(b, "\"} %d\n", alerts.rules[i].firing);
+    }
+    prom_head(b, "syswatch_alert_fired_total", "counter", "Times an ALERT rule has fired.");
+    for (size_t i = 0; i < alerts.n; i++) {
+        sbuf_printf(b, "syswatch_alert_fired_total{rule=\"");
+        prom_label(b, alerts.rules[i].text);
+        sbuf_printf(b, "\"} %lu\n", alerts.rules[i].fired);
+    }
+    pthread_mutex_unlock(&alerts.lock);
+
+    pthread_mutex_lock(&logstats.lock);
+    prom_head(b, "syswatch_log_read_bytes_total", "counter", "Bytes read from a followed log file.");
+    prom_log_series(b, "syswatch_log_read_bytes_total", 0);
+    prom_head(b, "syswatch_log_lines_total", "counter", "Lines read from a followed log file.");
+    prom_log_series(b, "syswatch_log_lines_total", 1);
+    prom_head(b, "syswatch_log_alerts_total", "counter", "Log lines that matched LOG_PATTERNS.");
+    prom_log_series(b, "syswatch_log_alerts_total", 2);
+    prom_head(b, "syswatch_log_pattern_matches_total", "counter", "Log lines that matched each LOG_PATTERNS entry.");
+    prom_log_pattern_series(b);
+    pthread_mutex_unlock(&logstats.lock);
+
+    prom_head(b, "syswatch_samples_published_total", "counter", "Samples published by the collectors.");
+    sbuf_printf(b, "syswatch_samples_published_total %lu\n", atomic_load(&samples_published));
+    prom_head(b, "syswatch_writer_records_total", "counter", "Records offered to the writer queue, by outcome.");
+    sbuf_printf(b, "syswatch_writer_records_total{outcome=\"enqueued\"} %lu\n", atomic_load(&wqueue.enqueued));
+    sbuf_printf(b, "syswatch_writer_records_total{outcome=\"written\"} %lu\n", atomic_load(&wqueue.written));
+    sbuf_printf(b, "syswatch_writer_records_total{outcome=\"dropped\"} %lu\n", atomic_load(&wqueue.dropped));
+    prom_head(b, "syswatch_status_skipped_total", "counter", "Status publications skipped because every buffer was pinned.");
+    sbuf_printf(b, "syswatch_status_skipped_total %lu\n", atomic_load(&statusdoc.skipped));
+    prom_head(b, "syswatch_net_requests_total", "counter", "Requests served on the status port.");
+    sbuf_printf(b, "syswatch_net_requests_total %lu\n", atomic_load(&net_requests));
+    prom_head(b, "syswatch_stream_subscribers", "gauge", "Connections following the sample stream.");
+    sbuf_printf(b, "syswatch_stream_subscribers %u\n", atomic_load(&net_subscribers));
+    prom_head(b, "syswatch_stream_samples_total", "counter", "Samples streamed to subscribers, by outcome.");
+    sbuf_printf(b, "syswatch_stream_samples_total{outcome=\"sent\"} %lu\n", atomic_load(&stream_sent));
+    sbuf_printf(b, "syswatch_stream_samples_total{outcome=\"dropped\"} %lu\n", atomic_load(&stream_dropped));
+    prom_head(b, "syswatch_push_samples_total", "counter", "Samples handed to the push target, by outcome.");
+    sbuf_printf(b, "syswatch_push_samples_total{outcome=\"sent\"} %lu\n", atomic_load(&pushstats.sent));
+    sbuf_printf(b, "syswatch_push_samples_total{outcome=\"dropped\"} %lu\n", atomic_load(&pushstats.dropped));
+    prom_head(b, "syswatch_push_errors_total", "counter", "Failed connects or sends to the push target.");
+    sbuf_printf(b, "syswatch_push_errors_total %lu\n", atomic_load(&pushstats.errors));
+    prom_head(b, "syswatch_push_backlog_samples", "gauge", "Samples waiting for the push target.");
+    sbuf_printf(b, "syswatch_push_backlog_samples %lu\n", atomic_load(&pushstats.backlog));
+    prom_head(b, "syswatch_push_connected", "gauge", "1 while a push socket is open.");
+    sbuf_printf(b, "syswatch_push_connected %d\n", atomic_load(&pushstats.connected));
+    for (int i = 0; i < INSTR_COUNT; i++) {
+        instr_snap_t sn;
+        instr_snapshot(i, &sn);
+        char name[96];
+        snprintf(name, sizeof(name), "syswatch_self_%s%s", instr[i].name, instr[i].bytes ? "" : "_seconds");
+        double scale = instr[i].bytes ? 1.0 : 1e-6;
+        const char *help = instr[i].bytes ? "Self-instrumentation: bytes per event."
+                                          : "Self-instrumentation: time per event.";
+        prom_head(b, name, "summary", help);
+        sbuf_printf(b, "%s{quantile=\"0.5\"} %.9g\n%s{quantile=\"0.9\"} %.9g\n%s{quantile=\"0.99\"} %.9g\n", name,
+                    sn.p50 * scale, name, sn.p90 * scale, name, sn.p99 * scale);
+        sbuf_printf(b, "%s_sum %.9g\n%s_count %lu\n", name, sn.sum * scale, name, sn.count);
+    }
+    int njobs = atomic_load(&sched.njobs);
+    prom_head(b, "syswatch_scheduler_runs_total", "counter", "Collector runs, by job.");
+    for (int i = 0; i < njobs; i++)
+        sbuf_printf(b, "syswatch_scheduler_runs_total{job=\"%s\"} %lu\n", sched.jobs[i].name,
+                    atomic_load(&sched.jobs[i].runs));
+    prom_head(b, "syswatch_scheduler_missed_ticks_total", "counter", "Timer ticks that passed while a job was still running.");
+    for (int i = 0; i < njobs; i++)
+        sbuf_printf(b, "syswatch_scheduler_missed_ticks_total{job=\"%s\"} %lu\n", sched.jobs[i].name,
+                    atomic_load(&sched.jobs[i].missed));
+}
+
+/* Re-render the exposition; s is NULL for the initial (all-zero) page */
+static void metrics_doc_update(const metric_sample_t *s) {
+    static metric_sample_t last;
+    static sbuf_t body;
+    status_doc_t *d = &metricsdoc;
+    uint64_t t0 = mono_ns();
+    pthread_mutex_lock(&d->lock);
+    if (s) last = *s;
+    status_buf_t *b = status_spare(d);
+    if (!b) {
+        atomic_fetch_add(&d->skipped, 1);
+        pthread_mutex_unlock(&d->lock);
+        return;
+    }
+    body.len = 0;
+    body.err = 0;
+    metrics_render(&body, &last);
+    char hdr[192];
+    int hn = snprintf(hdr, sizeof(hdr),
+                      "HTTP/1.1 200 OK\r\nContent-Type: " METRICS_CONTENT_TYPE "\r\nContent-Length: %zu\r\n"
+                      "Connection: close\r\n\r\n",
+                      body.len);
+    if (body.err || status_reserve(b, (size_t)hn + body.len) != 0) {
+        atomic_fetch_add(&d->skipped, 1);
+        pthread_mutex_unlock(&d->lock);
+        return;
+    }
+    memcpy(b->data, hdr, (size_t)hn);
+    memcpy(b->data + hn, body.p, body.len);
+    b->body_off = (size_t)hn;
+    b->len = (size_t)hn + body.len;
+    atomic_store(&d->current, b);
+    pthread_mutex_unlock(&d->lock);
+    instr_since(INSTR_METRICS_BUILD, t0);
+}
+
+/* Multi-pattern log scanner.
+ *
+ * LOG_PATTERNS are compiled into a case-insensitive Aho-Corasick DFA (full
+ * 256-entry transition rows, so the inner loop is one load per byte). While
+ * the automaton sits in the root state a SIMD prefilter (SSE2 or NEON, scalar
+ * table otherwise) skips straight to the next byte that could start a match.
+ * Scan state lives in log_scan_t, so matches straddling read() chunks are
+ * found, & each finished line is reported once with the set of patterns hit. */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+typedef struct {
+    int npatterns;
+    char *patterns[MAX_PATTERNS];
+    int32_t nstates;
+    int32_t *next;              // nstates x 256
+    uint64_t *out;              // patterns completed on entering a state
+    unsigned char start[256];   // bytes that leave the root (scalar prefilter)
+    unsigned char folded[16];   // the same set, |0x20 folded (SIMD prefilter)
+    int nfolded;                // 0 -> SIMD prefilter disabled
+} matcher_t;
+
+/* Per-file scan state, carried across read() chunks */
+typedef struct {
+    int32_t state;
+    uint64_t line_mask;         // patterns seen in the current, unfinished line
+} log_scan_t;
+
+typedef void (*match_cb)(void *ctx, uint64_t mask, size_t eol);  // eol: index of the line's '\n' in buf
+
+void matcher_free(matcher_t *m) {
+    for (int i = 0; i < m->npatterns; i++) free(m->patterns[i]);
+    free(m->next);
+    free(m->out);
+    memset(m, 0, sizeof(*m));
+}
+
+/* Build from a comma separated list; returns 0 or -1 (m left empty) */
+int matcher_build(matcher_t *m, const char *list) {
+    memset(m, 0, sizeof(*m));
+    char *copy = strdup(list ? list : "");
+    if (!copy) return -1;
+    size_t total = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok && m->npatterns < MAX_PATTERNS;
+         tok = strtok_r(NULL, ",", &save)) {
+        trim(tok);
+        size_t n = strlen(tok);
+        if (n == 0 || total + n > MAX_PATTERN_BYTES) continue;
+        for (char *p = tok; *p; p++) *p = (char)tolower((unsigned char)*p);
+        m->patterns[m->npatterns++] = strdup(tok);
+        total += n;
+    }
+    free(copy);
+
+    int32_t cap = (int32_t)total + 1;
+    int32_t *edge = malloc((size_t)cap * 256 * sizeof(int32_t));  // trie, lower-case columns only
+    int32_t *delta = malloc((size_t)cap * 256 * sizeof(int32_t));
+    int32_t *fail = calloc((size_t)cap, sizeof(int32_t));
+    int32_t *queue = malloc((size_t)cap * sizeof(int32_t));
+    m->out = calloc((size_t)cap, sizeof(uint64_t));
+    if (!edge || !delta || !fail || !queue || !m->out) goto fail;
+    memset(edge, 0, (size_t)cap * 256 * sizeof(int32_t)); /* 0: no edge (root is never a child) */
+
+    /* trie over lower-cased patterns */
+    m->nstates = 1;
+    for (int p = 0; p < m->npatterns; p++) {
+        int32_t st = 0;
+        for (const unsigned char *c = (const unsigned char *)m->patterns[p]; *c && *c != '\n'; c++) {
+            int32_t *e = &edge[st * 256 + *c];
+            if (*e == 0) *e = m->nstates++;
+            st = *e;
+        }
+        if (st) m->out[st] |= 1ULL << p;
+    }
+
+    /* BFS: failure links & complete DFA rows. Upper-case bytes follow the
+     * lower-case edge; '\n' always returns to the root. */
+    size_t qh = 0, qt = 0;
+    for (int c = 0; c < 256; c++) {
+        int lc = tolower(c);
+        int32_t t = edge[lc];
+        delta[c] = t;
+        if (t && c == lc) {
+            fail[t] = 0;
+            queue[qt++] = t;
+        }
+    }
+    delta['\n'] = 0;
+    while (qh < qt) {
+        int32_t st = queue[qh++];
+        int32_t *row = &delta[st * 256], *frow = &delta[fail[st] * 256];
+        m->out[st] |= m->out[fail[st]];
+        for (int c = 0; c < 256; c++) {
+            int lc = tolower(c);
+            int32_t t = edge[st * 256 + lc];
+            if (t) {
+                row[c] = t;
+                if (c == lc) {
+                    fail[t] = frow[c];
+                    queue[qt++] = t;
+                }
+            } else {
+                row[c] = frow[c];
+            }
+        }
+        row['\n'] = 0;
+    }
+    m->next = delta;
+    free(edge);
+    free(fail);
+    free(queue);
+
+    /* prefilter sets */
+    m->nfolded = 0;
+    for (int c = 0; c < 256; c++) {
+        m->start[c] = delta[c] != 0;
+        if (!m->start[c]) continue;
+        unsigned char f = (unsigned char)(c | 0x20);
+        int seen = 0;
+        for (int i = 0; i < m->nfolded; i++) seen |= m->folded[i] == f;
+        if (!seen && m->nfolded < 16) m->folded[m->nfolded++] = f;
+        else if (!seen) m->nfolded = 17;
+    }
+    if (m->nfolded > 16) m->nfolded = 0;
+    return 0;
+
+fail:
+    free(edge);
+    free(delta);
+    free(fail);
+    free(queue);
+    matcher_free(m);
+    return -1;
+}
+
+/* Index of the first byte in [p, end) that may leave the root, or end - p */
+static inline size_t prefilter_skip(const matcher_t *m, const unsigned char *p, const unsigned char *end) {
+    size_t n = (size_t)(end - p), i = 0;
+#if defined(__SSE2__)
+    if (m->nfolded > 0) {
+        __m128i fold = _mm_set1_epi8(0x20);
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + i)), fold);
+            __m128i hit = _mm_setzero_si128();
+            for (int k = 0; k < m->nfolded; k++)
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)m->folded[k])));
+            int mask = _mm_movemask_epi8(hit);
+            if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (m->nfolded > 0) {
+        uint8x16_t fold = vdupq_n_u8(0x20);
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t v = vorrq_u8(vld1q_u8(p + i), fold);
+            uint8x16_t hit = vdupq_n_u8(0);
+            for (int k = 0; k < m->nfolded; k++) hit = vorrq_u8(hit, vceqq_u8(v, vdupq_n_u8(m->folded[k])));
+            if (vmaxvq_u8(hit)) break; /* locate within the block below */
+        }
+    }
+#endif
+    for (; i < n; i++)
+        if (m->start[p[i]]) return i;
+    return n;
+}
+
+/* Scan a chunk; cb(ctx, mask, eol) fires for every completed line that matched */
+void matcher_scan(const matcher_t *m, log_scan_t *st, const char *buf, size_t len, match_cb cb, void *ctx) {
+    const unsigned char *p = (const unsigned char *)buf, *end = p + len;
+    int32_t s = st->state;
+    uint64_t mask = st->line_mask;
+    if (m->npatterns == 0) {
+        st->state = 0;
+        st->line_mask = 0;
+        return;
+    }
+    while (p < end) {
+        if (s == 0) {
+            /* in the root only line ends (when a match is pending) & start bytes matter */
+            if (mask) {
+                const unsigned char *nl = memchr(p, '\n', (size_t)(end - p));
+                const unsigned char *lim = nl ? nl : end;
+                p += prefilter_skip(m, p, lim);
+                if (p == lim) {
+                    if (!nl) break;
+                    cb(ctx, mask, (size_t)(nl - (const unsigned char *)buf));
+                    mask = 0;
+                    p = nl + 1;
+                    continue;
+                }
+            } else {
+                p += prefilter_skip(m, p, end);
+                if (p == end) break;
+            }
+        }
+        unsigned char c = *p++;
+        s = m->next[s * 256 + c];
+        mask |= m->out[s];
+        if (c == '\n') {
+            if (mask) cb(ctx, mask, (size_t)(p - 1 - (const unsigned char *)buf));
+            mask = 0;
+        }
+    }
+    st->state = s;
+    st->line_mask = mask;
+}
+
+/* "error,fail" for a match mask */
+static void matcher_names(const matcher_t *m, uint64_t mask, char *out, size_t outsz) {
+    size_t off = 0;
+    out[0] = '\0';
+    for (int i = 0; i < m->npatterns && off + 1 < outsz; i++) {
+        if (!(mask & (1ULL << i))) continue;
+        int n = snprintf(out + off, outsz - off, "%s%s", off ? "," : "", m->patterns[i]);
+        if (n < 0) break;
+        off += (size_t)n;
+    }
+}
+
+/* Where the line being scanned starts, & its first bytes when it began in an
+ * earlier chunk: enough to capture a matched line without reading it again */
+typedef struct {
+    uint64_t off;
+    size_t len;
+    char head[LOG_MATCH_TEXT_MAX + 1];
+} log_line_t;
+
+/* The unfinished line at the end of chunk (read at file offset off) */
+static void log_line_advance(log_line_t *l, const char *chunk, size_t len, uint64_t off) {
+    const char *nl = memrchr(chunk, '\n', len);
+    if (nl) {
+        size_t start = (size_t)(nl + 1 - chunk);
+        l->off = off + start;
+        l->len = logmatch_copy(l->head, nl + 1, len - start, sizeof(l->head) - 1);
+    } else if (l->len + 1 < sizeof(l->head)) {
+        l->len += logmatch_copy(l->head + l->len, chunk, len, sizeof(l->head) - 1 - l->len);
+    }
+}
+
+/* Matches are aggregated per file & reported at most every LOG_ALERT_MIN_MS:
+ * a flood of matching lines costs one writer record & one stderr line per
+ * second, so it can never crowd metric records out of the writer queue. Each
+ * line also counts towards the file's per-pattern totals & goes to logmatch. */
+typedef struct {
+    const char *path;
+    const matcher_t *matcher;
+    size_t lines;          // matching lines in this batch
+    uint64_t first_mask, any_mask;
+    uint32_t hits[MAX_PATTERNS];  // lines matching each pattern
+    char timestr[64];
+    uint64_t *totals;      // the file's per-pattern counters
+    const log_line_t *line;
+    const char *chunk;     // being scanned, read at file offset chunk_off
+    uint64_t chunk_off;
+} log_report_t;
+
+/* The matched line ends at chunk[eol]; it starts in this chunk, or in
+ * rep->line's head when it began in an earlier one */
+static void log_capture(const log_report_t *rep, uint64_t mask, size_t eol) {
+    const char *nl = eol ? memrchr(rep->chunk, '\n', eol) : NULL;
+    char names[LOG_MATCH_NAMES];
+    matcher_names(rep->matcher, mask, names, sizeof(names));
+    if (nl) {
+        size_t start = (size_t)(nl + 1 - rep->chunk);
+        logmatch_put(rep->path, names, rep->chunk_off + start, NULL, 0, nl + 1, eol - start);
+    } else {
+        logmatch_put(rep->path, names, rep->line->off, rep->line->head, rep->line->len, rep->chunk, eol);
+    }
+}
+
+static void report_log_match(void *ctx, uint64_t mask, size_t eol) {
+    log_report_t *rep = ctx;
+    if (rep->lines++ == 0) {
+        time_t t = time(NULL);
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(rep->timestr, sizeof(rep->timestr), "%Y-%m-%d %H:%M:%S", &tm);
+        rep->first_mask = mask;
+    }
+    rep->any_mask |= mask;
+    for (uint64_t m = mask; m; m &= m - 1) {
+        rep->hits[__builtin_ctzll(m)]++;
+        rep->totals[__builtin_ctzll(m)]++;
+    }
+    if (logmatch.size) log_capture(rep, mask, eol);
+}
+
+/* "error:12,fail:3" for the patterns hit in a batch */
+static void report_counts(const log_report_t *rep, char *out, size_t outsz) {
+    size_t off = 0;
+    out[0] = '\0';
+    for (int i = 0; i < rep->matcher->npatterns && off + 1 < outsz; i++) {
+        if (!(rep->any_mask & (1ULL << i))) continue;
+        int n = snprintf(out + off, outsz - off, "%s%s:%u", off ? "," : "", rep->matcher->patterns[i], rep->hits[i]);
+        if (n < 0) break;
+        off += (size_t)n;
+    }
+}
+
+/* one alert record & one stderr line per aggregated batch */
+static void log_report_flush(const log_report_t *rep) {
+    if (!rep->lines) return;
+    char names[256], line[WREC_TEXT_MAX];
+    matcher_names(rep->matcher, rep->first_mask, names, sizeof(names));
+    if (rep->lines == 1) {
+        snprintf(line, sizeof(line), "%s ALERT log=%s match=%s\n", rep->timestr, rep->path, names);
+        writer_text(line);
+        fprintf(stderr, "[ALERT %s] Log %s matched %s\n", rep->timestr, rep->path, names);
+        return;
+    }
+    char counts[256];
+    report_counts(rep, counts, sizeof(counts));
+    snprintf(line, sizeof(line), "%s ALERT log=%s lines=%zu match=%s\n", rep->timestr, rep->path, rep->lines, counts);
+    writer_text(line);
+    fprintf(stderr, "[ALERT %s] Log %s: %zu lines matched (first: %s)\n", rep->timestr, rep->path, rep->lines, names);
+}
+
+static size_t count_lines(const char *p, size_t n) {
+    size_t lines = 0;
+    const char *end = p + n;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        lines++;
+        p++;
+    }
+    return lines;
+}
+
+/* Log following with inotify.
+ *
+ * Each configured log gets a watch on the file itself (IN_MODIFY for new data,
+ * IN_MOVE_SELF/IN_DELETE_SELF for rotation) & one on its parent directory
+ * (IN_CREATE/IN_MOVED_TO, to pick the new file up after rotation or when it did
+ * not exist yet). The thread sleeps in poll() on the inotify fd & only wakes
+ * when something happened; there is no per-loop stat() & no fixed file limit. */
+
+typedef struct {
+    char *path;
+    const char *base;   // basename inside path
+    int fd;
+    int wd;             // file watch, -1 if none
+    int dir_wd;         // parent directory watch, -1 if none
+    off_t offset;       // bytes consumed, for truncation detection
+    log_scan_t scan;    // matcher state carries partial lines between chunks
+    char *buf;          // LOG_BUFFER_SIZE read buffer, allocated on first use
+    size_t buf_cap;
+    uint64_t bytes, lines;            // ingest totals
+    uint64_t alerts;                  // matching lines
+    uint64_t hits[MAX_PATTERNS];      // ... per pattern
+    uint64_t rate_bytes, rate_lines;  // totals at the last rate update
+    log_report_t pend;                // matches not reported yet
+    long long alert_ms;               // last alert record
+    log_line_t line;                  // the unfinished last line, for captures
+} log_watch_t;
+
+#define LOG_ALERT_MIN_MS 1000
+
+/* Write out pending matches once LOG_ALERT_MIN_MS has passed (or now, with force) */
+static void watch_report(log_watch_t *w, long long now, int force) {
+    if (!w->pend.lines || (!force && now - w->alert_ms < LOG_ALERT_MIN_MS)) return;
+    log_report_flush(&w->pend);
+    memset(&w->pend, 0, sizeof(w->pend));
+    w->alert_ms = now;
+}
+
+typedef struct {
+    int ifd;
+    log_watch_t *w;
+    size_t n, cap;
+    int *wd_file;       // wd -> watch index + 1 (0: none); wds are small ints
+    size_t wd_cap;
+    int missing;        // watches whose directory could not be watched
+    long long rate_ms;  // last throughput publication
+} log_follow_t;
+
+static void wd_map_set(log_follow_t *lf, int wd, int idx) {
+    if (wd < 0) return;
+    if ((size_t)wd >= lf->wd_cap) {
+        size_t nc = lf->wd_cap ? lf->wd_cap : 64;
+        while (nc <= (size_t)wd) nc *= 2;
+        int *nm = realloc(lf->wd_file, nc * sizeof(int));
+        if (!nm) return;
+        memset(nm + lf->wd_cap, 0, (nc - lf->wd_cap) * sizeof(int));
+        lf->wd_file = nm;
+        lf->wd_cap = nc;
+    }
+    lf->wd_file[wd] = idx + 1;
+}
+
+static log_watch_t *wd_map_get(log_follow_t *lf, int wd) {
+    if (wd < 0 || (size_t)wd >= lf->wd_cap || lf->wd_file[wd] == 0) return NULL;
+    return &lf->w[lf->wd_file[wd] - 1];
+}
+
+/* (Re)open w->path; from_start is used for files created after we started */
+static void watch_open(log_follow_t *lf, log_watch_t *w, int from_start) {
+    if (w->fd >= 0) return;
+    w->fd = open(w->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (w->fd < 0) return;
+    w->offset = from_start ? 0 : lseek(w->fd, 0, SEEK_END);
+    if (w->offset < 0) w->offset = 0;
+    memset(&w->scan, 0, sizeof(w->scan));
+    w->line.off = (uint64_t)w->offset;
+    w->line.len = 0;
+    if (w->wd >= 0) wd_map_set(lf, w->wd, -1);
+    w->wd = inotify_add_watch(lf->ifd, w->path, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    wd_map_set(lf, w->wd, (int)(w - lf->w));
+}
+
+static void watch_close(log_follow_t *lf, log_watch_t *w) {
+    if (w->wd >= 0) {
+        inotify_rm_watch(lf->ifd, w->wd);
+        wd_map_set(lf, w->wd, -1);
+        w->wd = -1;
+    }
+    if (w->fd >= 0) close(w->fd);
+    w->fd = -1;
+}
+
+static void watch_dir(log_follow_t *lf, log_watch_t *w) {
+    if (w->dir_wd >= 0) return;
+    char dir[4096];
+    size_t dl = (size_t)(w->base - w->path);
+    if (dl == 0) snprintf(dir, sizeof(dir), ".");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)(dl > 1 ? dl - 1 : 1), w->path);
+    w->dir_wd = inotify_add_watch(lf->ifd, dir, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (w->dir_wd < 0) lf->missing++;
+}
+
+#define LOG_MMAP_WINDOW (64L * 1024 * 1024)
+
+/* Scan one chunk read at w->offset & account for it */
+static void watch_scan(log_watch_t *w, const matcher_t *matcher, log_report_t *rep, const char *buf, size_t len) {
+    rep->chunk = buf;
+    rep->chunk_off = (uint64_t)w->offset;
+    matcher_scan(matcher, &w->scan, buf, len, report_log_match, rep);
+    log_line_advance(&w->line, buf, len, (uint64_t)w->offset);
+    w->lines += count_lines(buf, len);
+    w->offset += (off_t)len;
+    w->bytes += len;
+}
+
+/* Scan [offset, size) of a regular file straight from the page cache */
+static int watch_scan_mmap(log_watch_t *w, off_t size, const matcher_t *matcher, log_report_t *rep) {
+    static long page;
+    if (!page) page = sysconf(_SC_PAGESIZE);
+    while (w->offset < size) {
+        off_t base = w->offset & ~(off_t)(page - 1);
+        size_t skip = (size_t)(w->offset - base);
+        size_t len = (size_t)((size - w->offset < LOG_MMAP_WINDOW) ? size - w->offset : LOG_MMAP_WINDOW);
+        char *map = mmap(NULL, skip + len, PROT_READ, MAP_PRIVATE, w->fd, base);
+        if (map == MAP_FAILED) return -1;
+        madvise(map, skip + len, MADV_SEQUENTIAL);
+        watch_scan(w, matcher, rep, map + skip, len);
+        munmap(map, skip + len);
+    }
+    lseek(w->fd, w->offset, SEEK_SET);
+    return 0;
+}
+
+/* read everything new (handles copytruncate-style truncation) & scan it in
+ * place: large backlogs via mmap, the rest through the per-file buffer */
+static void watch_drain(log_watch_t *w, const matcher_t *matcher) {
+    if (w->fd < 0) return;
+    uint64_t t0 = mono_ns(), bytes0 = w->bytes;
+    log_report_t *rep = &w->pend;
+    size_t matched0 = rep->lines;
+    rep->path = w->path;
+    rep->matcher = matcher;
+    rep->totals = w->hits;
+    rep->line = &w->line;
+    const config_t *cfg = config_get();
+    struct stat st;
+    if (fstat(w->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size < w->offset) {
+            lseek(w->fd, 0, SEEK_SET);
+            w->offset = 0;
+            memset(&w->scan, 0, sizeof(w->scan));
+            w->line.off = 0;
+            w->line.len = 0;
+        }
+        if (cfg->log_mmap_min > 0 && st.st_size - w->offset >= cfg->log_mmap_min)
+            watch_scan_mmap(w, st.st_size, matcher, rep);
+    }
+    if (w->buf_cap != (size_t)cfg->log_buffer_size) {
+        char *nb = realloc(w->buf, (size_t)cfg->log_buffer_size);
+        if (nb) {
+            w->buf = nb;
+            w->buf_cap = (size_t)cfg->log_buffer_size;
+        }
+    }
+    ssize_t r;
+    while (w->buf && (r = read(w->fd, w->buf, w->buf_cap)) > 0) watch_scan(w, matcher, rep, w->buf, (size_t)r);
+    w->alerts += rep->lines - matched0;
+    watch_report(w, now_ms(), 0);
+    instr_since(INSTR_LOG_DRAIN, t0);
+    instr_record(INSTR_LOG_DRAIN_BYTES, w->bytes - bytes0);
+}
+
+/* Publish per-file bytes/s & lines/s since the previous call, & the match
+ * counters */
+static void follow_publish_rates(log_follow_t *lf, const matcher_t *matcher, long long now) {
+    double dt = (double)(now - lf->rate_ms) / 1000.0;
+    pthread_mutex_lock(&logstats.lock);
+    logstats.npatterns = matcher->npatterns;
+    matcher_names(matcher, ~0ULL, logstats.patterns, sizeof(logstats.patterns));
+    if (logstats.cap < lf->n) {
+        log_stat_t *nv = realloc(logstats.v, lf->n * sizeof(*nv));
+        if (!nv) {
+            pthread_mutex_unlock(&logstats.lock);
+            return;
+        }
+        logstats.v = nv;
+        logstats.cap = lf->n;
+    }
+    for (size_t i = 0; i < lf->n; i++) {
+        log_watch_t *w = &lf->w[i];
+        log_stat_t *l = &logstats.v[i];
+        snprintf(l->path, sizeof(l->path), "%s", w->path);
+        l->bytes = w->bytes;
+        l->lines = w->lines;
+        l->alerts = w->alerts;
+        memcpy(l->hits, w->hits, sizeof(l->hits));
+        l->bytes_per_s = dt > 0 ? (double)(w->bytes - w->rate_bytes) / dt : 0.0;
+        l->lines_per_s = dt > 0 ? (double)(w->lines - w->rate_lines) / dt : 0.0;
+        w->rate_bytes = w->bytes;
+        w->rate_lines = w->lines;
+    }
+    logstats.n = lf->n;
+    pthread_mutex_unlock(&logstats.lock);
+    lf->rate_ms = now;
+}
+
+static void follow_report_all(log_follow_t *lf, long long now, int force) {
+    for (size_t i = 0; i < lf->n; i++) watch_report(&lf->w[i], now, force);
+}
+
+/* LOG_PATTERNS changed: counters follow their pattern by name, new ones start at 0 */
+static void follow_remap_hits(log_follow_t *lf, const matcher_t *old, const matcher_t *m) {
+    for (size_t i = 0; i < lf->n; i++) {
+        uint64_t hits[MAX_PATTERNS] = { 0 };
+        for (int p = 0; p < m->npatterns; p++)
+            for (int q = 0; q < old->npatterns; q++)
+                if (strcmp(m->patterns[p], old->patterns[q]) == 0) hits[p] = lf->w[i].hits[q];
+        memcpy(lf->w[i].hits, hits, sizeof(hits));
+    }
+}
+
+static void follow_add(log_follow_t *lf, const char *path) {
+    if (lf->n == lf->cap) {
+        size_t nc = lf->cap ? lf->cap * 2 : 16;
+        log_watch_t *nw = realloc(lf->w, nc * sizeof(*nw));
+        if (!nw) return;
+        lf->w = nw;
+        lf->cap = nc;
+    }
+    log_watch_t *w = &lf->w[lf->n];
+    memset(w, 0, sizeof(*w));
+    w->path = strdup(path);
+    if (!w->path) return;
+    const char *slash = strrchr(w->path, '/');
+    w->base = slash ? slash + 1 : w->path;
+    w->fd = w->wd = w->dir_wd = -1;
+    lf->n++;
+    watch_dir(lf, w);
+    watch_open(lf, w, 0);
+}
+
+/* Directory watch ids are shared by every file in that directory */
+static int dir_wd_in_use(log_follow_t *lf, int wd) {
+    for (size_t i = 0; i < lf->n; i++)
+        if (lf->w[i].dir_wd == wd) return 1;
+    return 0;
+}
+
+/* Make the watch set match paths[]: keep existing watches, drop & add the rest */
+static void follow_sync(log_follow_t *lf, char **paths, int npaths) {
+    for (size_t i = 0; i < lf->n;) {
+        int keep = 0;
+        for (int j = 0; j < npaths && !keep; j++) keep = strcmp(lf->w[i].path, paths[j]) == 0;
+        if (keep) {
+            i++;
+            continue;
+        }
+        log_watch_t *w = &lf->w[i];
+        watch_report(w, 0, 1);
+        watch_close(lf, w);
+        int dwd = w->dir_wd;
+        free(w->path);
+        free(w->buf);
+        lf->w[i] = lf->w[--lf->n];
+        if (dwd >= 0 && !dir_wd_in_use(lf, dwd)) inotify_rm_watch(lf->ifd, dwd);
+    }
+    for (int j = 0; j < npaths; j++) {
+        int have = 0;
+        for (size_t i = 0; i < lf->n && !have; i++) have = strcmp(lf->w[i].path, paths[j]) == 0;
+        if (!have) follow_add(lf, paths[j]);
+    }
+    /* indexes moved: rebuild wd -> index */
+    if (lf->wd_file) memset(lf->wd_file, 0, lf->wd_cap * sizeof(int));
+    for (size_t i = 0; i < lf->n; i++) wd_map_set(lf, lf->w[i].wd, (int)i);
+}
+
+static void follow_handle(log_follow_t *lf, const struct inotify_event *ev, const matcher_t *matcher) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        /* lost events: catch up on everything & retry missing files */
+        for (size_t i = 0; i < lf->n; i++) {
+            log_watch_t *w = &lf->w[i];
+            watch_drain(w, matcher);
+            struct stat a, b;
+            if (w->fd >= 0 && (stat(w->path, &a) != 0 || fstat(w->fd, &b) != 0 || a.st_ino != b.st_ino)) {
+                watch_close(lf, w);
+            }
+            watch_open(lf, w, 1);
+        }
+        return;
+    }
+    log_watch_t *w = wd_map_get(lf, ev->wd);
+    if (w) {
+        if (ev->mask & (IN_MODIFY | IN_MOVE_SELF)) watch_drain(w, matcher);
+        /* renamed: keep reading the old inode (writers may still append to it)
+         * until the directory watch sees the replacement appear */
+        if (ev->mask & IN_DELETE_SELF) watch_close(lf, w);
+        if (ev->mask & IN_IGNORED) {
+            wd_map_set(lf, ev->wd, -1);
+            if (w->wd == ev->wd) w->wd = -1;
+        }
+        return;
+    }
+    if (ev->len == 0 || !(ev->mask & (IN_CREATE | IN_MOVED_TO))) return;
+    for (size_t i = 0; i < lf->n; i++) {
+        w = &lf->w[i];
+        if (w->dir_wd != ev->wd || strcmp(w->base, ev->name) != 0) continue;
+        if (w->fd >= 0) {
+            struct stat a, b;
+            if (stat(w->path, &a) == 0 && fstat(w->fd, &b) == 0 && a.st_ino == b.st_ino) continue;
+            watch_drain(w, matcher);
+            watch_close(lf, w);
+        }
+        watch_open(lf, w, 1);
+        watch_drain(w, matcher);
+    }
+}
+
+/* Log monitor thread: inotify driven */
+void *log_monitor_thread(void *arg) {
+    (void)arg;
+    log_follow_t lf;
+    memset(&lf, 0, sizeof(lf));
+    lf.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (lf.ifd < 0) {
+        perror("inotify_init1");
+        return NULL;
+    }
+    matcher_t matcher;
+    memset(&matcher, 0, sizeof(matcher));
+    char patterns[sizeof(((config_t *)0)->log_patterns)] = "";
+    unsigned long gen = 0;
+    char evbuf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    long long last_retry = now_ms();
+    lf.rate_ms = last_retry;
+
+    while (atomic_load(&running)) {
+        struct pollfd pfd[2] = { { lf.ifd, POLLIN, 0 }, { shutdown_efd, POLLIN, 0 } };
+        int ret = gen ? poll(pfd, 2, 1000) : 0;
+        if (ret < 0 && errno != EINTR) break;
+
+        /* everything below reads the config (the watch list, buffer sizes) */
+        unsigned e = rcu_read_lock();
+        const config_t *cfg = config_get();
+        if (gen != cfg->gen) {
+            /* config changed (or first pass): follow_sync adds & drops watches */
+            gen = cfg->gen;
+            if (strcmp(cfg->log_patterns, patterns) != 0 || matcher.next == NULL) {
+                follow_report_all(&lf, now_ms(), 1);  // pending counts refer to the old patterns
+                matcher_t old = matcher;
+                if (matcher_build(&matcher, cfg->log_patterns) != 0) fprintf(stderr, "LOG_PATTERNS: cannot compile\n");
+                follow_remap_hits(&lf, &old, &matcher);
+                matcher_free(&old);
+                memcpy(patterns, cfg->log_patterns, sizeof(patterns));
+                for (size_t i = 0; i < lf.n; i++) memset(&lf.w[i].scan, 0, sizeof(lf.w[i].scan));
+            }
+            follow_sync(&lf, cfg->logfiles, cfg->n_logfiles);
+        }
+        if (ret > 0 && (pfd[0].revents & POLLIN)) {
+            ssize_t len;
+            while ((len = read(lf.ifd, evbuf, sizeof(evbuf))) > 0) {
+                for (char *p = evbuf; p < evbuf + len;) {
+                    const struct inotify_event *ev = (const struct inotify_event *)p;
+                    follow_handle(&lf, ev, &matcher);
+                    p += sizeof(struct inotify_event) + ev->len;
+                }
+            }
+        }
+        /* directories that did not exist yet: retry now & then */
+        if (lf.missing && now_ms() - last_retry >= 5000) {
+            lf.missing = 0;
+            for (size_t i = 0; i < lf.n; i++) {
+                watch_dir(&lf, &lf.w[i]);
+                if (lf.w[i].fd < 0 && lf.w[i].dir_wd >= 0) {
+                    watch_open(&lf, &lf.w[i], 1);
+                    watch_drain(&lf.w[i], &matcher);
+                }
+            }
+            last_retry = now_ms();
+        }
+        long long now = now_ms();
+        if (now - lf.rate_ms >= 1000) {
+            follow_publish_rates(&lf, &matcher, now);
+            follow_report_all(&lf, now, 0);
+        }
+        rcu_read_unlock(e);
+    }
+    follow_report_all(&lf, now_ms(), 1);
+    for (size_t i = 0; i < lf.n; i++) {
+        watch_close(&lf, &lf.w[i]);
+        free(lf.w[i].path);
+        free(lf.w[i].buf);
+    }
+    free(lf.w);
+    free(lf.wd_file);
+    close(lf.ifd);
+    matcher_free(&matcher);
+    return NULL;
+}
+
+/* TCP network service: allow clients to connect & get JSON status.
+ *
+ * One epoll thread owns every socket (non-blocking). A client may send
+ * newline terminated requests on a persistent connection; a client that sends
+ * nothing (e.g. `nc host 9999 < /dev/null`) gets the status after
+ * REQUEST_WAIT_MS, or as soon as it half-closes, & is disconnected, which
+ * keeps the original one-shot behaviour. With NET_WORKERS > 0 responses are
+ * serialized by a small worker pool & handed back through an eventfd.
+ *
+ * Subscriptions. `subscribe [fields=cpu,memory] [after=SEQ]` turns a
+ * connection into a stream of one JSON line per published sample; over HTTP,
+ * GET /subscribe?... is the same stream as Server-Sent Events, & a client
+ * reconnecting with Last-Event-ID carries on where it stopped. A subscriber is
+ * only a cursor (the last sequence number queued) into the sample ring: each
+ * publication pokes sample_efd, & the epoll thread gives every subscriber
+ * whose previous chunk has gone out the samples after its cursor, up to
+ * STREAM_BATCH at a time, straight from ring_read_after. Subscribers at the
+ * same cursor with the same fields share one formatted chunk.
+ *
+ * Nothing is queued for a subscriber whose socket is full, it just falls
+ * behind. If the ring laps its cursor the stream says how many samples were
+ * lost & goes on from the oldest one left; one whose socket takes nothing for
+ * CLIENT_IDLE_TIMEOUT is dropped. A quiet stream gets a heartbeat every
+ * SUBSCRIBE_HEARTBEAT_S so that proxies keep it open. */
+
+#define NET_INBUF 4096
+#define NET_MAX_EVENTS 256
+#define STREAM_BATCH 64  // samples per chunk
+
+enum { SUB_NONE, SUB_LINE, SUB_SSE };
+
+typedef struct {
+    int refs;                   // connections sending it, & stream_cache; epoll thread only
+    unsigned long first, last;  // sequence numbers it carries
+    uint64_t fields;
+    int sse;
+    size_t len;
+    char *data;
+} stream_chunk_t;
+
+typedef struct net_conn {
+    int fd;
+    uint32_t gen;        // guards against handing a worker result to a reused fd
+    char in[NET_INBUF];
+    size_t in_len;
+    char *out;           // malloc'd, or points into pin or chunk
+    status_buf_t *pin;   // pinned status document being sent
+    stream_chunk_t *chunk;
+    size_t out_len, out_off;
+    uint64_t out_t0;     // when out was queued
+    int got_request;     // at least one request line seen -> keep-alive
+    int busy;            // a worker is building our response
+    int closing;         // close once output is flushed
+    int peer_closed;     // read side hit EOF
+    uint32_t events;     // currently registered epoll mask
+    long long accepted_ms;
+    long long last_ms;
+    char *http_cmd;      // HTTP request seen, skipping its headers
+    int http_err;        // ... & answered with this status instead (405/501/400)
+    int sub;             // SUB_LINE/SUB_SSE: streaming samples instead of answering requests
+    uint64_t sub_fields;
+    unsigned long sub_seq;  // cursor: last sequence number queued (or a Last-Event-ID)
+    int sub_resume;         // sub_seq came from Last-Event-ID
+    struct net_conn *sub_prev, *sub_next;  // on net_subs while sub is set
+    long long armed;        // deadline queued in net_timers, 0 = none
+} net_conn_t;
+
+typedef struct {
+    int fd;
+    uint32_t gen;
+    char req[NET_INBUF];
+    int http;            // wrap the reply in an HTTP response
+    char *out;           // filled by the worker
+    size_t out_len;
+} net_job_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    net_job_t **jobs;    // pending requests
+    size_t cap, head, count;
+    net_job_t **done;    // finished, waiting for the epoll thread (same capacity)
+    size_t done_count;
+    int efd;             // wakes the epoll thread when done_count > 0
+    int nworkers;
+    int stop;
+} net_pool_t;
+
+static net_conn_t **net_conns;  // indexed by fd
+static size_t net_conns_cap;
+static size_t net_nconns;
+static net_conn_t *net_subs;     // subscribers, so a publication touches only them
+static uint32_t net_gen;
+
+static int is_status_request(const char *req) {
+    return req[0] == '\0' || strcmp(req, "status") == 0;
+}
+
+/* history [from=T] [to=T] [tier=raw|1m|1h]: T is epoch seconds, a date as for
+ * --from, or -N for N seconds ago; the default range is the last hour */
+typedef struct {
+    sbuf_t *sb;
+    int agg;
+    size_t n;
+} hist_reply_t;
+
+static void hist_reply_point(void *ctx, int64_t ts, const double *v) {
+    hist_reply_t *r = ctx;
+    sbuf_printf(r->sb, "%s{\"t\":%lld", r->n++ ? "," : "", (long long)ts);
+    for (int c = 0; c < HIST_RAW_COLS; c++) {
+        if (r->agg) sbuf_printf(r->sb, ",\"%s\":[%.2f,%.2f,%.2f]", hist_col_names[c], v[3 * c], v[3 * c + 1], v[3 * c + 2]);
+        else sbuf_printf(r->sb, ",\"%s\":%.2f", hist_col_names[c], v[c]);
+    }
+    sbuf_printf(r->sb, "}");
+}
+
+static int parse_history_time(const char *s, time_t now, time_t *out) {
+    if (s[0] == '-') {
+        char *end;
+        long long ago = strtoll(s + 1, &end, 10);
+        if (!*end) {
+            *out = now - (time_t)ago;
+            return 0;
+        }
+    }
+    return parse_time_arg(s, out);
+}
+
+static char *history_request(const char *args, size_t *out_len) {
+    time_t now = time(NULL), from = now - 3600, to = now;
+    int tier = -1;
+    char buf[NET_INBUF];
+    snprintf(buf, sizeof(buf), "%s", args);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return NULL;
+        *eq++ = '\0';
+        if (strcmp(tok, "from") == 0) {
+            if (parse_history_time(eq, now, &from) != 0) return NULL;
+        } else if (strcmp(tok, "to") == 0) {
+            if (parse_history_time(eq, now, &to) != 0) return NULL;
+        } else if (strcmp(tok, "tier") == 0) {
+            for (tier = HIST_TIERS - 1; tier >= 0 && strcmp(eq, hist_tier_names[tier]) != 0; tier--);
+            if (tier < 0) return NULL;
+        } else {
+            return NULL;
+        }
+    }
+    if (tier < 0) tier = history_pick_tier(&history, from, to);
+    size_t nblocks;
+    unsigned char *blocks = history_copy_blocks(&history, tier, from, to, &nblocks);
+
+    sbuf_t sb = { NULL, 0, 0, 0 };
+    sbuf_printf(&sb, "{ \"tier\": \"%s\", \"from\": %lld, \"to\": %lld, \"points\": [", hist_tier_names[tier],
+                (long long)from, (long long)to);
+    hist_reply_t r = { &sb, tier != HIST_RAW, 0 };
+    for (size_t i = 0; i < nblocks; i++)
+        hist_block_decode(blocks + i * HIST_BLOCK_BYTES, history.tiers[tier].ncols, from, to, hist_reply_point, &r);
+    sbuf_printf(&sb, "] }\n");
+    free(blocks);
+    if (sb.err) {
+        free(sb.p);
+        return NULL;
+    }
+    *out_len = sb.len;
+    return sb.p;
+}
+
+/* get [since=T] [limit=N] [after=SEQ] [fields=cpu,memory,...] (any of sample_fields)
+ *     [cores=all|none|0,2-5] [mounts=all|none|/,/home] [procs=all|cpu|rss|none]
+ * Serializes only the requested slice of a ring_snapshot: samples with a
+ * timestamp >= since (the newest limit of them), only the chosen fields, &
+ * per-core / per-mount values in "current" & per-sample top processes only
+ * when asked for. "seq" is the sequence number of the newest sample; with
+ * after= only samples past that sequence number are read (incremental
+ * polling, as the aggregator does) & a "seq" below after means the ring
+ * started over. */
+
+#define QF_ALL ((1ULL << N_SAMPLE_FIELDS) - 1)
+
+typedef struct {
+    uint64_t fields;       // bit i: sample_fields[i]
+    time_t since;
+    long limit;            // -1: no limit
+    unsigned long after;   // after=SEQ
+    int has_after;
+    int cores;             // 0 none, 1 all, 2 core_sel
+    unsigned char core_sel[MAX_REPORTED_CORES / 8];
+    int mounts;            // 0 none, 1 all, 2 mount_sel
+    char mount_sel[1024];  // ",/,/home," for strstr lookups
+    int procs;             // bit 0: top_cpu, bit 1: top_rss
+} query_t;
+
+static int query_parse_cores(query_t *q, char *v) {
+    if (strcmp(v, "all") == 0) q->cores = 1;
+    else if (strcmp(v, "none") == 0) q->cores = 0;
+    else {
+        q->cores = 2;
+        char *save = NULL;
+        for (char *tok = strtok_r(v, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+            char *end;
+            long a = strtol(tok, &end, 10), b = a;
+            if (*end == '-') b = strtol(end + 1, &end, 10);
+            if (end == tok || *end || a < 0 || b < a || b >= MAX_REPORTED_CORES) return -1;
+            for (long i = a; i <= b; i++) q->core_sel[i / 8] |= (unsigned char)(1u << (i % 8));
+        }
+    }
+    return 0;
+}
+
+static int query_parse(query_t *q, const char *args) {
+    memset(q, 0, sizeof(*q));
+    q->fields = QF_ALL;
+    q->limit = -1;
+    time_t now = time(NULL);
+    char buf[NET_INBUF];
+    snprintf(buf, sizeof(buf), "%s", args);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq++ = '\0';
+        if (strcmp(tok, "since") == 0) {
+            if (parse_history_time(eq, now, &q->since) != 0) return -1;
+        } else if (strcmp(tok, "limit") == 0) {
+            char *end;
+            q->limit = strtol(eq, &end, 10);
+            if (end == eq || *end || q->limit < 0) return -1;
+        } else if (strcmp(tok, "after") == 0) {
+            char *end;
+            errno = 0;
+            q->after = strtoul(eq, &end, 10);
+            if (end == eq || *end || *eq == '-' || errno) return -1;
+            q->has_after = 1;
+        } else if (strcmp(tok, "fields") == 0) {
+            q->fields = 0;
+            char *fsave = NULL;
+            for (char *f = strtok_r(eq, ",", &fsave); f; f = strtok_r(NULL, ",", &fsave)) {
+                int i = sample_field_find(f);
+                if (i < 0) return -1;
+                q->fields |= 1ULL << i;
+            }
+        } else if (strcmp(tok, "cores") == 0) {
+            if (query_parse_cores(q, eq) != 0) return -1;
+        } else if (strcmp(tok, "procs") == 0) {
+            if (strcmp(eq, "all") == 0) q->procs = 3;
+            else if (strcmp(eq, "cpu") == 0) q->procs = 1;
+            else if (strcmp(eq, "rss") == 0) q->procs = 2;
+            else if (strcmp(eq, "none") == 0) q->procs = 0;
+            else return -1;
+        } else if (strcmp(tok, "mounts") == 0) {
+            if (strcmp(eq, "all") == 0) q->mounts = 1;
+            else if (strcmp(eq, "none") == 0) q->mounts = 0;
+            else {
+                q->mounts = 2;
+                snprintf(q->mount_sel, sizeof(q->mount_sel), ",%s,", eq);
+            }
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void query_put_fields(sbuf_t *sb, uint64_t fields, const metric_sample_t *s) {
+    for (size_t i = 0; i < N_SAMPLE_FIELDS; i++) {
+        if (!(fields & (1ULL << i))) continue;
+        char f[96];
+        sample_field_format(f, sizeof(f), s, i, ",", ":");
+        sbuf_printf(sb, "%s", f);
+    }
+}
+
+static void query_put_procs(sbuf_t *sb, int procs, const metric_sample_t *s) {
+    for (int list = 0; list < 2; list++) {
+        if (!(procs & (1 << list))) continue;
+        const sample_proc_t *v = list ? s->top_rss : s->top_cpu;
+        sbuf_printf(sb, ",\"%s\":[", list ? "top_rss" : "top_cpu");
+        for (int i = 0; i < SAMPLE_TOP_PROCS && v[i].pid; i++) {
+            char comm[6 * sizeof(v[i].comm) + 1];
+            json_escape(comm, sizeof(comm), v[i].comm);
+            sbuf_printf(sb, "%s{\"pid\":%d,\"comm\":\"%s\",\"cpu\":%.2f,\"rss_kb\":%lu}", i ? "," : "", v[i].pid,
+                        comm, v[i].cpu, (unsigned long)v[i].rss_kb);
+        }
+        sbuf_printf(sb, "]");
+    }
+}
+
+static int query_mount_selected(const query_t *q, const char *path) {
+    if (q->mounts == 1) return 1;
+    const char *p = q->mount_sel;
+    size_t n = strlen(path);
+    while ((p = strstr(p, path)) != NULL) {
+        if (p[-1] == ',' && p[n] == ',') return 1;
+        p++;
+    }
+    return 0;
+}
+
+static char *query_request(const char *args, size_t *out_len) {
+    query_t q;
+    if (query_parse(&q, args) != 0) return NULL;
+    size_t cap = ring_capacity(&ringbuf);
+    metric_sample_t *snap = malloc(cap * sizeof(metric_sample_t));
+    if (!snap) return NULL;
+    size_t len = 0;
+    unsigned long seq;
+    if (q.has_after) {
+        unsigned long first;
+        len = ring_read_after(&ringbuf, q.after, snap, cap, &first);
+        if (len) {
+            seq = first + len - 1;
+        } else {
+            seq = atomic_load(&ringbuf.total);
+            if (seq > q.after) seq = q.after;  // pushed since the read: the next poll gets it
+        }
+    } else {
+        ring_snapshot(&ringbuf, snap, cap, &len);
+        seq = atomic_load(&ringbuf.total);
+    }
+
+    sbuf_t sb = { NULL, 0, 0, 0 };
+    sbuf_printf(&sb, "{ \"seq\": %lu, \"current\": {", seq);
+    if (len) {
+        sbuf_printf(&sb, "\"t\":%lld", (long long)snap[len - 1].timestamp);
+        query_put_fields(&sb, q.fields, &snap[len - 1]);
+    }
+    if (q.cores) {
+        float cores[MAX_REPORTED_CORES];
+        size_t ncores = core_ring_latest(&corering, cores, MAX_REPORTED_CORES);
+        sbuf_printf(&sb, "%s\"cores\":{", len ? "," : "");
+        for (size_t i = 0, first = 1; i < ncores; i++) {
+            if (q.cores == 2 && !(q.core_sel[i / 8] & (1u << (i % 8)))) continue;
+            sbuf_printf(&sb, "%s\"%zu\":%.2f", first ? "" : ",", i, cores[i]);
+            first = 0;
+        }
+        sbuf_printf(&sb, "}");
+    }
+    sbuf_printf(&sb, "}");
+    if (q.mounts) {
+        sbuf_printf(&sb, ", \"mounts\": [");
+        pthread_mutex_lock(&disktab.lock);
+        for (size_t i = 0, first = 1; i < disktab.n; i++) {
+            const mount_ent_t *e = &disktab.m[i];
+            if (!e->have || !query_mount_selected(&q, e->path)) continue;
+            char path[6 * 1024 + 1];
+            json_escape(path, sizeof(path), e->path);
+            sbuf_printf(&sb, "%s{\"path\":\"%s\",\"total\":%lu,\"used\":%lu,\"avail\":%lu,\"percent\":%.2f}",
+                        first ? "" : ",", path, (unsigned long)e->total, (unsigned long)e->used,
+                        (unsigned long)e->avail, e->perc);
+            first = 0;
+        }
+        pthread_mutex_unlock(&disktab.lock);
+        sbuf_printf(&sb, "]");
+    }
+
+    /* newest limit samples at or after since */
+    size_t start = 0;
+    while (start < len && snap[start].timestamp < q.since) start++;
+    if (q.limit >= 0 && len - start > (size_t)q.limit) start = len - (size_t)q.limit;
+    sbuf_printf(&sb, ", \"count\": %zu, \"samples\": [", len - start);
+    for (size_t i = start; i < len; i++) {
+        sbuf_printf(&sb, "%s{\"t\":%lld", i > start ? "," : "", (long long)snap[i].timestamp);
+        query_put_fields(&sb, q.fields, &snap[i]);
+        query_put_procs(&sb, q.procs, &snap[i]);
+        sbuf_printf(&sb, "}");
+    }
+    sbuf_printf(&sb, "] }\n");
+    free(snap);
+    if (sb.err) {
+        free(sb.p);
+        return NULL;
+    }
+    *out_len = sb.len;
+    return sb.p;
+}
+
+/* diskio [since=T] [limit=N] [devs=all|sda,nvme0n1]
+ * The per-disk rate series from diskioring, oldest first: rows with a
+ * timestamp >= since (the newest limit of them), each listing the chosen
+ * disks. */
+static char *diskio_request(const char *args, size_t *out_len) {
+    time_t since = 0, now = time(NULL);
+    long limit = -1;
+    char sel[1024] = "";  // ",sda,nvme0n1," or "" for all
+    char buf[NET_INBUF];
+    snprintf(buf, sizeof(buf), "%s", args);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return NULL;
+        *eq++ = '\0';
+        if (strcmp(tok, "since") == 0) {
+            if (parse_history_time(eq, now, &since) != 0) return NULL;
+        } else if (strcmp(tok, "limit") == 0) {
+            char *end;
+            limit = strtol(eq, &end, 10);
+            if (end == eq || *end || limit < 0) return NULL;
+        } else if (strcmp(tok, "devs") == 0) {
+            if (strcmp(eq, "all") == 0) sel[0] = '\0';
+            else snprintf(sel, sizeof(sel), ",%s,", eq);
+        } else {
+            return NULL;
+        }
+    }
+
+    size_t size = diskioring.size;
+    time_t *ts = malloc(size * sizeof(time_t));
+    uint8_t *ndev = malloc(size);
+    diskio_rate_t *rows = malloc(size * DISKIO_MAX_DEVS * sizeof(diskio_rate_t));
+    if (!ts || !ndev || !rows) {
+        free(ts);
+        free(ndev);
+        free(rows);
+        return NULL;
+    }
+    size_t n = diskio_ring_read(&diskioring, size, ts, ndev, rows);
+    size_t start = 0;
+    while (start < n && ts[start] < since) start++;
+    if (limit >= 0 && n - start > (size_t)limit) start = n - (size_t)limit;
+
+    unsigned e = rcu_read_lock();
+    int interval_ms = config_get()->diskio_interval_ms;
+    rcu_read_unlock(e);
+    sbuf_t sb = { NULL, 0, 0, 0 };
+    sbuf_printf(&sb, "{ \"interval_ms\": %d, \"count\": %zu, \"samples\": [", interval_ms, n - start);
+    for (size_t i = start; i < n; i++) {
+        sbuf_printf(&sb, "%s{\"t\":%lld,\"devs\":[", i > start ? "," : "", (long long)ts[i]);
+        for (size_t k = 0, first = 1; k < ndev[i]; k++) {
+            const diskio_rate_t *r = &rows[i * DISKIO_MAX_DEVS + k];
+            if (sel[0]) {
+                char key[DISKIO_NAME + 3];
+                snprintf(key, sizeof(key), ",%s,", r->name);
+                if (!strstr(sel, key)) continue;
+            }
+            diskio_put(&sb, r, first);
+            first = 0;
+        }
+        sbuf_printf(&sb, "]}");
+    }
+    sbuf_printf(&sb, "] }\n");
+    free(ts);
+    free(ndev);
+    free(rows);
+    if (sb.err) {
+        free(sb.p);
+        return NULL;
+    }
+    *out_len = sb.len;
+    return sb.p;
+}
+
+/* One cgroup row as a JSON object (the cgroups request) */
+static void cg_rate_put(sbuf_t *sb, time_t t, const cg_rate_t *r, int first) {
+    sbuf_printf(sb,
+                "%s{\"t\":%lld,\"cpu\":%.2f,\"throttled\":%.2f,\"mem_bytes\":%llu,\"rd_bps\":%.0f,\"wr_bps\":%.0f,"
+                "\"rd_iops\":%.1f,\"wr_iops\":%.1f,\"cpu_psi\":%.2f,\"mem_psi\":%.2f,\"io_psi\":%.2f}",
+                first ? "" : ",", (long long)t, r->cpu, r->throttled, (unsigned long long)r->mem_bytes, r->rd_bps,
+                r->wr_bps, r->rd_iops, r->wr_iops, r->cpu_psi, r->mem_psi, r->io_psi);
+}
+
+typedef struct {
+    char path[CG_PATH_MAX];
+    double key;     // sort key, from the newest row
+    size_t off, n;  // rows in the copy
+} cg_pick_t;
+
+static int cg_pick_cmp(const void *a, const void *b) {
+    const cg_pick_t *x = a, *y = b;
+    return (x->key < y->key) - (x->key > y->key);
+}
+
+/* cgroups [path=/a/b] [since=T] [limit=N] [top=N] [sort=cpu|mem|io]
+ * Per-cgroup series from cgtab, oldest row first: the cgroups at or below
+ * path (default all) with rows at or after since, the newest limit (default
+ * 1) of them. top keeps the N highest by sort on the newest row. */
+static char *cgroups_request(const char *args, size_t *out_len) {
+    time_t since = 0, now = time(NULL);
+    long limit = -2, top = 0;  // limit -2: not given
+    int sort = 0;              // cpu, mem, io
+    char prefix[CG_PATH_MAX] = "";
+    char buf[NET_INBUF];
+    snprintf(buf, sizeof(buf), "%s", args);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return NULL;
+        *eq++ = '\0';
+        if (strcmp(tok, "since") == 0) {
+            if (parse_history_time(eq, now, &since) != 0) return NULL;
+        } else if (strcmp(tok, "limit") == 0 || strcmp(tok, "top") == 0) {
+            char *end;
+            long v = strtol(eq, &end, 10);
+            if (end == eq || *end || v < 0) return NULL;
+            *(tok[0] == 'l' ? &limit : &top) = v;
+        } else if (strcmp(tok, "sort") == 0) {
+            if (strcmp(eq, "cpu") == 0) sort = 0;
+            else if (strcmp(eq, "mem") == 0) sort = 1;
+            else if (strcmp(eq, "io") == 0) sort = 2;
+            else return NULL;
+        } else if (strcmp(tok, "path") == 0) {
+            while (*eq == '/') eq++;
+            snprintf(prefix, sizeof(prefix), "%s", eq);
+            size_t pl = strlen(prefix);
+            while (pl && prefix[pl - 1] == '/') prefix[--pl] = '\0';
+        } else {
+            return NULL;
+        }
+    }
+    if (limit == -2) limit = since ? -1 : 1;  // every row since T, else the newest
+    size_t plen = strlen(prefix);
+
+    pthread_mutex_lock(&cgtab.lock);
+    size_t hist = cgtab.hist;
+    unsigned long ticks = cgtab.ticks, lo = ticks >= hist ? ticks - hist + 1 : 1;
+    while (lo <= ticks && cgtab.ts[lo % hist] < since) lo++;
+    if (limit >= 0 && ticks + 1 - lo > (unsigned long)limit) lo = ticks + 1 - (unsigned long)limit;
+    size_t nt = ticks + 1 - lo;
+    time_t *ts = malloc((nt ? nt : 1) * sizeof(time_t));
+    cg_pick_t *picks = malloc((cgtab.n ? cgtab.n : 1) * sizeof(cg_pick_t));
+    cg_rate_t *rows = malloc((cgtab.n && nt ? cgtab.n * nt : 1) * sizeof(cg_rate_t));
+    size_t np = 0, nr = 0;
+    for (size_t i = 0; ts && i < nt; i++) ts[i] = cgtab.ts[(lo + i) % hist];
+    for (size_t s = 0; ts && picks && rows && s < cgtab.cap; s++) {
+        const cg_series_t *e = &cgtab.series[s];
+        if (!e->used) continue;
+        if (plen && (strncmp(e->path, prefix, plen) != 0 || (e->path[plen] && e->path[plen] != '/'))) continue;
+        cg_pick_t *p = &picks[np++];
+        memcpy(p->path, e->path, sizeof(p->path));
+        p->off = nr;
+        p->n = 0;
+        p->key = -1.0;  // no rows yet: last
+        for (unsigned long t = lo > e->first ? lo : e->first; t <= ticks; t++)
+            rows[nr + p->n++] = cgtab.rows[s * hist + t % hist];
+        if (p->n) {
+            const cg_rate_t *r = &rows[nr + p->n - 1];
+            p->key = sort == 0 ? r->cpu : sort == 1 ? (double)r->mem_bytes : (double)r->rd_bps + r->wr_bps;
+        }
+        nr += p->n;
+    }
+    size_t tracked = cgtab.n;
+    unsigned long dropped = cgtab.dropped;
+    pthread_mutex_unlock(&cgtab.lock);
+    if (!ts || !picks || !rows) {
+        free(ts);
+        free(picks);
+        free(rows);
+        return NULL;
+    }
+    if (top) {
+        qsort(picks, np, sizeof(cg_pick_t), cg_pick_cmp);
+        if (np > (size_t)top) np = (size_t)top;
+    }
+
+    unsigned e = rcu_read_lock();
+    int interval_ms = config_get()->cgroup_interval_ms;
+    rcu_read_unlock(e);
+    sbuf_t sb = { NULL, 0, 0, 0 };
+    sbuf_printf(&sb, "{ \"interval_ms\": %d, \"tracked\": %zu, \"dropped\": %lu, \"count\": %zu, \"cgroups\": [",
+                interval_ms, tracked, dropped, np);
+    for (size_t i = 0; i < np; i++) {
+        const cg_pick_t *p = &picks[i];
+        char path[6 * CG_PATH_MAX + 1];
+        json_escape(path, sizeof(path), p->path);
+        sbuf_printf(&sb, "%s{\"path\":\"/%s\",\"samples\":[", i ? "," : "", path);
+        for (size_t k = 0; k < p->n; k++) cg_rate_put(&sb, ts[nt - p->n + k], &rows[p->off + k], k == 0);
+        sbuf_printf(&sb, "]}");
+    }
+    sbuf_printf(&sb, "] }\n");
+    free(ts);
+    free(picks);
+    free(rows);
+    if (sb.err) {
+        free(sb.p);
+        return NULL;
+    }
+    *out_len = sb.len;
+    return sb.p;
+}
+
+/* Is pattern one of the comma-separated names? */
+static int log_names_has(const char *names, const char *pattern) {
+    size_t n = strlen(pattern);
+    for (const char *p = names; *p;) {
+        size_t k = strcspn(p, ",");
+        if (k == n && memcmp(p, pattern, n) == 0) return 1;
+        p += k + (p[k] == ',');
+    }
+    return 0;
+}
+
+/* "error,fail" -> ["error","fail"] */
+static void log_names_json(sbuf_t *sb, const char *names, int max) {
+    sbuf_printf(sb, "[");
+    for (int i = 0; i < max && *names; i++) {
+        size_t n = strcspn(names, ",");
+        char name[MAX_PATTERN_BYTES + 1], esc[6 * 256 + 1];
+        snprintf(name, sizeof(name), "%.*s", (int)n, names);
+        json_escape(esc, sizeof(esc), name);
+        sbuf_printf(sb, "%s\"%s\"", i ? "," : "", esc);
+        names += n + (names[n] == ',');
+    }
+    sbuf_printf(sb, "]");
+}
+
+/* logs [file=PATH] [pattern=NAME] [after=SEQ] [limit=N]
+ * Match counters per followed file & pattern, then the newest limit (default
+ * 50) captured lines from logmatch with a seq above after, oldest first. A
+ * client polling with after=<last seq> sees every line still in the ring;
+ * "seq" is the newest capture overall, so a jump past after+count means the
+ * ring overwrote some. */
+static char *logs_request(const char *args, size_t *out_len) {
+    unsigned long long after = 0;
+    long limit = 50;
+    char file[LOG_MATCH_PATH] = "", pattern[MAX_PATTERN_BYTES + 1] = "";
+    char buf[NET_INBUF];
+    snprintf(buf, sizeof(buf), "%s", args);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return NULL;
+        *eq++ = '\0';
+        if (strcmp(tok, "after") == 0) {
+            char *end;
+            after = strtoull(eq, &end, 10);
+            if (end == eq || *end) return NULL;
+        } else if (strcmp(tok, "limit") == 0) {
+            char *end;
+            limit = strtol(eq, &end, 10);
+            if (end == eq || *end || limit < 0) return NULL;
+        } else if (strcmp(tok, "file") == 0) {
+            snprintf(file, sizeof(file), "%s", eq);
+        } else if (strcmp(tok, "pattern") == 0) {
+            snprintf(pattern, sizeof(pattern), "%s", eq);
+            for (char *c = pattern; *c; c++) *c = (char)tolower((unsigned char)*c);  // compiled lowercased
+        } else {
+            return NULL;
+        }
+    }
+
+    sbuf_t sb = { NULL, 0, 0, 0 };
+    char esc[6 * LOG_MATCH_TEXT_MAX + 1];
+    pthread_mutex_lock(&logstats.lock);
+    sbuf_printf(&sb, "{ \"patterns\": ");
+    log_names_json(&sb, logstats.patterns, logstats.npatterns);
+    sbuf_printf(&sb, ", \"files\": [");
+    size_t nf = 0;
+    for (size_t i = 0; i < logstats.n; i++) {
+        const log_stat_t *l = &logstats.v[i];
+        if (*file && strcmp(l->path, file) != 0) continue;
+        json_escape(esc, sizeof(esc), l->path);
+        sbuf_printf(&sb, "%s{\"path\":\"%s\",\"lines\":%lu,\"alerts\":%lu,\"matches\":{", nf++ ? "," : "", esc,
+                    (unsigned long)l->lines, (unsigned long)l->alerts);
+        const char *name = logstats.patterns;
+        for (int p = 0; p < logstats.npatterns && *name; p++) {
+            size_t n = strcspn(name, ",");
+            char pat[MAX_PATTERN_BYTES + 1];
+            snprintf(pat, sizeof(pat), "%.*s", (int)n, name);
+            json_escape(esc, sizeof(esc), pat);
+            sbuf_printf(&sb, "%s\"%s\":%lu", p ? "," : "", esc, (unsigned long)l->hits[p]);
+            name += n + (name[n] == ',');
+        }
+        sbuf_printf(&sb, "}}");
+    }
+    pthread_mutex_unlock(&logstats.lock);
+
+    pthread_mutex_lock(&logmatch.lock);
+    /* newest first to find where the limit starts, then out oldest first */
+    size_t first = logmatch.count, n = 0;
+    while (first > 0 && n < (size_t)limit) {
+        const log_match_t *m = logmatch_at(first - 1);
+        if (m->seq <= after) break;
+        const char *p = logmatch.arena + m->pos % logmatch.arena_size;
+        first--;
+        if ((*file && strcmp(p, file) != 0) || (*pattern && !log_names_has(p + m->path_len + 1, pattern))) continue;
+        n++;
+    }
+    sbuf_printf(&sb, "], \"seq\": %lu, \"count\": %zu, \"lines\": [", (unsigned long)logmatch.total, n);
+    for (size_t i = first, k = 0; i < logmatch.count; i++) {
+        const log_match_t *m = logmatch_at(i);
+        const char *p = logmatch.arena + m->pos % logmatch.arena_size;
+        const char *names = p + m->path_len + 1;
+        if ((*file && strcmp(p, file) != 0) || (*pattern && !log_names_has(names, pattern))) continue;
+        json_escape(esc, sizeof(esc), p);
+        sbuf_printf(&sb, "%s{\"seq\":%lu,\"t\":%lld,\"path\":\"%s\",\"offset\":%lu,\"patterns\":", k++ ? "," : "",
+                    (unsigned long)m->seq, (long long)m->t, esc, (unsigned long)m->offset);
+        log_names_json(&sb, names, MAX_PATTERNS);
+        sbuf_printf(&sb, ",\"line\":\"");
+        json_escape(esc, sizeof(esc), names + m->names_len + 1);
+        sbuf_printf(&sb, "%s\"}", esc);
+    }
+    pthread_mutex_unlock(&logmatch.lock);
+    sbuf_printf(&sb, "] }\n");
+    if (sb.err) {
+        free(sb.p);
+        return NULL;
+    }
+    *out_len = sb.len;
+    return sb.p;
+}
+
+/* cluster [since=T] [limit=N] [hosts=none|all|down] [top=N] [sort=field]
+ * The aggregator's fleet view: rows of min/p50/p90/p99/max/mean per
+ * AGGREGATE_FIELDS field at or after since (the newest limit, default 1, or
+ * all since T), then optionally per-agent entries: every agent, only those
+ * not heard from within AGGREGATE_TIMEOUT_MS, or the top N up agents by one
+ * field (default the first aggregated one). */
+typedef struct {
+    const agg_agent_t *a;
+    double key;
+    int up;
+} agg_pick_t;
+
+static int agg_pick_cmp(const void *a, const void *b) {
+    double x = ((const agg_pick_t *)a)->key, y = ((const agg_pick_t *)b)->key;
+    return (x < y) - (x > y);
+}
+
+static char *cluster_request(const char *args, size_t *out_len) {
+    time_t since = 0, now = time(NULL);
+    long limit = -2, top = 0;  // limit -2: not given
+    int hosts = 0, sort = -1;  // hosts: 0 none, 1 all, 2 down
+    char buf[NET_INBUF];
+    snprintf(buf, sizeof(buf), "%s", args);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return NULL;
+        *eq++ = '\0';
+        if (strcmp(tok, "since") == 0) {
+            if (parse_history_time(eq, now, &since) != 0) return NULL;
+        } else if (strcmp(tok, "limit") == 0 || strcmp(tok, "top") == 0) {
+            char *end;
+            long v = strtol(eq, &end, 10);
+            if (end == eq || *end || v < 0) return NULL;
+            *(tok[0] == 'l' ? &limit : &top) = v;
+        } else if (strcmp(tok, "hosts") == 0) {
+            if (strcmp(eq, "none") == 0) hosts = 0;
+            else if (strcmp(eq, "all") == 0) hosts = 1;
+            else if (strcmp(eq, "down") == 0) hosts = 2;
+            else return NULL;
+        } else if (strcmp(tok, "sort") == 0) {
+            if ((sort = sample_field_find(eq)) < 0) return NULL;
+        } else {
+            return NULL;
+        }
+    }
+    if (limit == -2) limit = since ? -1 : 1;
+    unsigned e = rcu_read_lock();
+    const config_t *cfg = config_get();
+    int timeout = cfg->aggregate_timeout_ms;
+    uint64_t fields = cfg->aggregate_fields;
+    rcu_read_unlock(e);
+    if (sort < 0)
+        for (sort = 0; sort < (int)N_SAMPLE_FIELDS - 1 && !(fields >> sort & 1u); sort++) {}
+
+    /* fleet rows, oldest first */
+    pthread_mutex_lock(&aggtab.lock);
+    size_t hist = aggtab.hist;
+    unsigned long ticks = aggtab.ticks, lo = ticks >= hist ? ticks - hist + 1 : 1;
+    while (lo <= ticks && aggtab.rows[lo % hist].t < since) lo++;
+    if (limit >= 0 && ticks + 1 - lo > (unsigned long)limit) lo = ticks + 1 - (unsigned long)limit;
+    size_t nrows = ticks + 1 - lo;
+    agg_row_t *rows = malloc((nrows ? nrows : 1) * sizeof(agg_row_t));
+    for (size_t i = 0; rows && i < nrows; i++) rows[i] = aggtab.rows[(lo + i) % hist];
+    uint64_t row_fields = aggtab.fields ? aggtab.fields : fields;
+    pthread_mutex_unlock(&aggtab.lock);
+
+    /* per-agent entries, copied shard by shard */
+    size_t npick = 0, nup = 0;
+    agg_agent_t *copy = malloc((aggtab.n ? aggtab.n : 1) * sizeof(agg_agent_t));
+    agg_pick_t *picks = malloc((aggtab.n ? aggtab.n : 1) * sizeof(agg_pick_t));
+    long long nowms = now_ms();
+    for (int s = 0; copy && picks && s < aggtab.nshards; s++) {
+        agg_shard_t *sh = &aggtab.shards[s];
+        pthread_mutex_lock(&sh->lock);
+        for (size_t i = 0; i < sh->n; i++) {
+            const agg_agent_t *a = &sh->agents[i];
+            int up = a->ok_ms && nowms - a->ok_ms <= timeout;
+            nup += (size_t)up;
+            if (!hosts && !top) continue;
+            if ((hosts == 2 && up) || (top && !hosts && (!up || !a->t))) continue;
+            agg_agent_t *c = &copy[npick];
+            memcpy(c->name, a->name, sizeof(c->name));
+            c->t = a->t;
+            c->seq = a->seq;
+            c->samples = a->samples;
+            c->skipped = a->skipped;
+            c->restarts = a->restarts;
+            c->errors = a->errors;
+            memcpy(c->val, a->val, sizeof(c->val));
+            picks[npick].a = c;
+            picks[npick].key = a->val[sort];
+            picks[npick].up = up;
+            npick++;
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+    if (!rows || !copy || !picks) {
+        free(rows);
+        free(copy);
+        free(picks);
+        return NULL;
+    }
+    if (top) {
+        qsort(picks, npick, sizeof(agg_pick_t), agg_pick_cmp);
+        if (npick > (size_t)top) npick = (size_t)top;
+    }
+
+    sbuf_t sb = { NULL, 0, 0, 0 };
+    sbuf_printf(&sb, "{ \"agents\": %zu, \"up\": %zu, \"fields\": [", aggtab.n, nup);
+    for (size_t f = 0, first = 1; f < N_SAMPLE_FIELDS; f++) {
+        if (!(row_fields >> f & 1u)) continue;
+        sbuf_printf(&sb, "%s\"%s\"", first ? "" : ",", sample_fields[f].name);
+        first = 0;
+    }
+    sbuf_printf(&sb, "], \"count\": %zu, \"fleet\": [", nrows);
+    for (size_t i = 0; i < nrows; i++) {
+        const agg_row_t *r = &rows[i];
+        sbuf_printf(&sb, "%s{\"t\":%lld,\"up\":%u", i ? "," : "", (long long)r->t, r->up);
+        for (size_t f = 0; r->up && f < N_SAMPLE_FIELDS; f++) {
+            if (!(row_fields >> f & 1u)) continue;
+            sbuf_printf(&sb, ",\"%s\":{", sample_fields[f].name);
+            for (int k = 0; k < AGG_STATS; k++)
+                sbuf_printf(&sb, "%s\"%s\":%.2f", k ? "," : "", agg_stat_names[k], r->stat[f][k]);
+            sbuf_printf(&sb, "}");
+        }
+        sbuf_printf(&sb, "}");
+    }
+    sbuf_printf(&sb, "]");
+    if (hosts || top) {
+        sbuf_printf(&sb, ", \"hosts\": [");
+        for (size_t i = 0; i < npick; i++) {
+            const agg_agent_t *a = picks[i].a;
+            char name[6 * AGG_NAME + 1];
+            json_escape(name, sizeof(name), a->name);
+            sbuf_printf(&sb,
+                        "%s{\"agent\":\"%s\",\"up\":%s,\"t\":%lld,\"seq\":%lu,\"samples\":%lu,\"skipped\":%lu,"
+                        "\"restarts\":%lu,\"errors\":%lu",
+                        i ? "," : "", name, picks[i].up ? "true" : "false", (long long)a->t, a->seq, a->samples,
+                        a->skipped, a->restarts, a->errors);
+            for (size_t f = 0; a->t && f < N_SAMPLE_FIELDS; f++)
+                if (row_fields >> f & 1u) sbuf_printf(&sb, ",\"%s\":%.2f", sample_fields[f].name, a->val[f]);
+            sbuf_printf(&sb, "}");
+        }
+        sbuf_printf(&sb, "]");
+    }
+    sbuf_printf(&sb, " }\n");
+    free(rows);
+    free(copy);
+    free(picks);
+    if (sb.err) {
+        free(sb.p);
+        return NULL;
+    }
+    *out_len = sb.len;
+    return sb.p;
+}
+
+/* HTTP: "GET /path?a=1&b=2 HTTP/1.x" maps onto the line commands
+ * ("/get?a=1&b=2" -> "get a=1 b=2", "/" & "/status" -> "status"); the reply
+ * carries Content-Length & the connection is closed after it. Any other
+ * "METHOD target HTTP/x.y" line still has its headers consumed, then gets one
+ * 405 (a standard method) or 501 (anything else). */
+
+static int http_hex(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+static const char *const http_methods[] = { "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH" };
+
+/* Translate a request line. Returns 0 & fills cmd for a GET, an HTTP status
+ * to answer with for other requests, -1 if it is not an HTTP request line
+ * (i.e. a line command). */
+static int http_to_command(const char *line, char *cmd, size_t cmdsz) {
+    const char *m = line;
+    while ((*m >= 'A' && *m <= 'Z') || *m == '-' || *m == '_') m++;
+    size_t mlen = (size_t)(m - line);
+    if (mlen == 0 || *m != ' ') return -1;
+    const char *p = m + 1, *end = strchr(p, ' ');
+    if (!end || end == p || strncmp(end, " HTTP/", 6) != 0) return -1;
+    if (mlen != 3 || strncmp(line, "GET", 3) != 0) {
+        for (size_t i = 0; i < sizeof(http_methods) / sizeof(http_methods[0]); i++)
+            if (strlen(http_methods[i]) == mlen && strncmp(line, http_methods[i], mlen) == 0) return 405;
+        return 501;
+    }
+    const char *q = memchr(p, '?', (size_t)(end - p));
+    const char *path_end = q ? q : end;
+    size_t plen = (size_t)(path_end - p);
+    size_t o;
+    if ((plen == 1 && p[0] == '/') || (plen == 7 && strncmp(p, "/status", 7) == 0))
+        o = (size_t)snprintf(cmd, cmdsz, "status");
+    else if (plen > 1 && p[0] == '/') o = (size_t)snprintf(cmd, cmdsz, "%.*s", (int)(plen - 1), p + 1);
+    else return 400;
+    if (q && o + 1 < cmdsz) {
+        cmd[o++] = ' ';
+        for (const char *s = q + 1; s < end && o + 1 < cmdsz; s++) {
+            char c = *s;
+            if (c == '&' || c == '+') c = ' ';
+            else if (c == '%' && end - s > 2 && http_hex(s[1]) >= 0 && http_hex(s[2]) >= 0) {
+                c = (char)(http_hex(s[1]) * 16 + http_hex(s[2]));
+                s += 2;
+            }
+            cmd[o++] = c;
+        }
+        cmd[o] = '\0';
+    }
+    return 0;
+}
+
+static char *http_wrap(int code, const char *ctype, char *body, size_t *len) {
+    if (!body) return NULL;
+    const char *reason = code == 200   ? "OK"
+                         : code == 404 ? "Not Found"
+                         : code == 405 ? "Method Not Allowed"
+                         : code == 501 ? "Not Implemented"
+                                       : "Bad Request";
+    char hdr[256];
+    int hn = snprintf(hdr, sizeof(hdr),
+                      "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%sConnection: close\r\n\r\n",
+                      code, reason, ctype, *len, code == 405 ? "Allow: GET\r\n" : "");
+    char *out = malloc((size_t)hn + *len);
+    if (out) {
+        memcpy(out, hdr, (size_t)hn);
+        memcpy(out + hn, body, *len);
+        *len += (size_t)hn;
+    }
+    free(body);
+    return out;
+}
+
+/* "name" or "name args" -> args (possibly ""), else NULL */
+static const char *command_args(const char *req, const char *name) {
+    size_t n = strlen(name);
+    if (strncmp(req, name, n) != 0 || (req[n] != '\0' && req[n] != ' ')) return NULL;
+    return req + n;
+}
+
+static char *json_error(const char *msg, size_t *out_len) {
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "{ \"error\": \"%s\" }\n", msg);
+    *out_len = (size_t)n;
+    return strdup(buf);
+}
+
+/* Request line -> malloc'd response. On the line protocol the status itself is
+ * served from statusdoc without copying (metrics always is, see net_dispatch);
+ * other HTTP replies come through here. */
+static char *net_handle_request(const char *req, int http, size_t *out_len) {
+    uint64_t t0 = mono_ns();
+    int code = 200;
+    char *out = NULL;
+    const char *args;
+    if (is_status_request(req)) {
+        status_buf_t *b = status_acquire(&statusdoc);
+        if (!b) return NULL;
+        out = malloc(b->len);
+        if (out) memcpy(out, b->data, b->len);
+        *out_len = b->len;
+        status_release(b);
+    } else if ((args = command_args(req, "get")) != NULL) {
+        out = query_request(args, out_len);
+        if (!out) {
+            code = 400;
+            out = json_error("bad get request", out_len);
+        }
+    } else if ((args = command_args(req, "history")) != NULL) {
+        out = history_request(args, out_len);
+        if (!out) {
+            code = 400;
+            out = json_error("bad history request", out_len);
+        }
+    } else if ((args = command_args(req, "diskio")) != NULL) {
+        out = diskio_request(args, out_len);
+        if (!out) {
+            code = 400;
+            out = json_error("bad diskio request", out_len);
+        }
+    } else if ((args = command_args(req, "cgroups")) != NULL) {
+        out = cgroups_request(args, out_len);
+        if (!out) {
+            code = 400;
+            out = json_error("bad cgroups request", out_len);
+        }
+    } else if ((args = command_args(req, "logs")) != NULL) {
+        out = logs_request(args, out_len);
+        if (!out) {
+            code = 400;
+            out = json_error("bad logs request", out_len);
+        }
+    } else if ((args = command_args(req, "cluster")) != NULL) {
+        out = cluster_request(args, out_len);
+        if (!out) {
+            code = 400;
+            out = json_error("bad cluster request", out_len);
+        }
+    } else {
+        code = 404;
+        out = json_error("unknown request", out_len);
+    }
+    if (!out) return NULL;
+    if (http) out = http_wrap(code, "application/json", out, out_len);
+    instr_since(INSTR_NET_HANDLE, t0);
+    return out;
+}
+
+static void *net_worker(void *arg) {
+    net_pool_t *p = arg;
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        while (p->count == 0 && !p->stop) pthread_cond_wait(&p->cond, &p->lock);
+        if (p->count == 0 && p->stop) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        net_job_t *job = p->jobs[p->head];
+        p->head = (p->head + 1) % p->cap;
+        p->count--;
+        pthread_mutex_unlock(&p->lock);
+
+        job->out = net_handle_request(job->req, job->http, &job->out_len);
+
+        /* one job per busy connection, so done[] can never overflow cap */
+        pthread_mutex_lock(&p->lock);
+        p->done[p->done_count++] = job;
+        pthread_mutex_unlock(&p->lock);
+        uint64_t one = 1;
+        if (write(p->efd, &one, sizeof(one)) < 0) { /* counter saturated: already signalled */ }
+    }
+    return NULL;
+}
+
+static int net_pool_submit(net_pool_t *p, net_conn_t *c, const char *req, int http) {
+    net_job_t *job = malloc(sizeof(*job));
+    if (!job) return -1;
+    job->fd = c->fd;
+    job->gen = c->gen;
+    snprintf(job->req, sizeof(job->req), "%s", req);
+    job->http = http;
+    job->out = NULL;
+    job->out_len = 0;
+    pthread_mutex_lock(&p->lock);
+    if (p->count == p->cap) {
+        pthread_mutex_unlock(&p->lock);
+        free(job);
+        return -1;
+    }
+    p->jobs[(p->head + p->count) % p->cap] = job;
+    p->count++;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+static stream_chunk_t *stream_cache;  // newest chunk, for the next subscriber at its cursor
+static metric_sample_t stream_scratch[STREAM_BATCH];
+
+static void stream_chunk_put(stream_chunk_t *k) {
+    if (k && --k->refs == 0) {
+        free(k->data);
+        free(k);
+    }
+}
+
+/* Drop the output buffer, whichever kind it is */
+static void net_out_free(net_conn_t *c) {
+    if (c->pin) status_release(c->pin);
+    else if (c->chunk) stream_chunk_put(c->chunk);
+    else free(c->out);
+    c->pin = NULL;
+    c->chunk = NULL;
+    c->out = NULL;
+}
+
+static int net_dispatch_raw(int epfd, net_conn_t *c, char *out, size_t len);
+
+/* Put c on net_subs as a subscriber of the given kind / take it off */
+static void net_sub_attach(net_conn_t *c, int kind) {
+    if (!c->sub) {
+        atomic_fetch_add(&net_subscribers, 1);
+        c->sub_prev = NULL;
+        c->sub_next = net_subs;
+        if (net_subs) net_subs->sub_prev = c;
+        net_subs = c;
+    }
+    c->sub = kind;
+}
+
+static void net_sub_detach(net_conn_t *c) {
+    if (!c->sub) return;
+    atomic_fetch_sub(&net_subscribers, 1);
+    if (c->sub_prev) c->sub_prev->sub_next = c->sub_next;
+    else net_subs = c->sub_next;
+    if (c->sub_next) c->sub_next->sub_prev = c->sub_prev;
+    c->sub_prev = c->sub_next = NULL;
+    c->sub = SUB_NONE;
+}
+
+static void net_close(int epfd, net_conn_t *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    net_conns[c->fd] = NULL;
+    net_nconns--;
+    net_sub_detach(c);
+    net_out_free(c);
+    free(c->http_cmd);
+    free(c);
+}
+
+static void net_set_events(int epfd, net_conn_t *c) {
+    uint32_t want = 0;
+    if (!c->peer_closed && c->in_len < sizeof(c->in)) want |= EPOLLIN | EPOLLRDHUP;
+    if (c->out) want |= EPOLLOUT;
+    if (want == c->events) return;
+    struct epoll_event ev;
+    ev.events = want;
+    ev.data.fd = c->fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+}
+
+/* Flush pending output. Returns -1 if the connection was closed. */
+static int net_flush(int epfd, net_conn_t *c) {
+    while (c->out && c->out_off < c->out_len) {
+        ssize_t w = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            net_close(epfd, c);
+            return -1;
+        }
+        c->out_off += (size_t)w;
+        if (c->sub) c->last_ms = now_ms();  // a subscriber is idle when its socket takes nothing
+    }
+    if (c->out && c->out_off == c->out_len) {
+        instr_since(INSTR_NET_SEND, c->out_t0);
+        net_out_free(c);
+        c->out_len = c->out_off = 0;
+        if (c->closing) {
+            net_close(epfd, c);
+            return -1;
+        }
+    }
+    net_set_events(epfd, c);
+    return 0;
+}
+
+/* Queue a ready response (NULL means allocation failure -> close). */
+static int net_dispatch_raw(int epfd, net_conn_t *c, char *out, size_t len) {
+    if (!out) {
+        net_close(epfd, c);
+        return -1;
+    }
+    c->out = out;
+    c->out_len = len;
+    c->out_off = 0;
+    c->out_t0 = mono_ns();
+    return net_flush(epfd, c);
+}
+
+/* subscribe args -> fields (default all) & an optional starting cursor */
+static int stream_parse(const char *args, uint64_t *fields, unsigned long *after, int *has_after) {
+    *fields = QF_ALL;
+    *has_after = 0;
+    char buf[NET_INBUF];
+    snprintf(buf, sizeof(buf), "%s", args);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq++ = '\0';
+        if (strcmp(tok, "fields") == 0) {
+            if ((*fields = sample_field_mask(eq)) == 0) return -1;
+        } else if (strcmp(tok, "after") == 0) {
+            char *end;
+            errno = 0;
+            *after = strtoul(eq, &end, 10);
+            if (end == eq || *end || *eq == '-' || errno) return -1;
+            *has_after = 1;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* One event per sample of s[0..n) (sequence numbers from first), after a
+ * notice of the `dropped` samples the ring overwrote before they went out */
+static stream_chunk_t *stream_format(const metric_sample_t *s, size_t n, unsigned long first, uint64_t fields,
+                                     int sse, unsigned long dropped) {
+    sbuf_t sb = { NULL, 0, 0, 0 };
+    if (dropped) sbuf_printf(&sb, sse ? "event: dropped\ndata: {\"dropped\":%lu}\n\n" : "{\"dropped\":%lu}\n", dropped);
+    for (size_t i = 0; i < n; i++) {
+        if (sse) sbuf_printf(&sb, "id: %lu\ndata: ", first + i);
+        sbuf_printf(&sb, "{\"seq\":%lu,\"t\":%lld", first + i, (long long)s[i].timestamp);
+        query_put_fields(&sb, fields, &s[i]);
+        sbuf_printf(&sb, sse ? "}\n\n" : "}\n");
+    }
+    stream_chunk_t *k = sb.err ? NULL : malloc(sizeof(*k));
+    if (!k) {
+        free(sb.p);
+        return NULL;
+    }
+    k->refs = 1;
+    k->first = first;
+    k->last = first + n - 1;
+    k->fields = fields;
+    k->sse = sse;
+    k->len = sb.len;
+    k->data = sb.p;
+    return k;
+}
+
+/* Send c what follows its cursor for as long as the socket takes it. Returns
+ * -1 if c was closed. */
+static int stream_fill(int epfd, net_conn_t *c) {
+    while (c->sub && !c->out && !c->busy && c->sub_seq < atomic_load(&ringbuf.total)) {
+        int sse = c->sub == SUB_SSE;
+        unsigned long dropped = 0;
+        stream_chunk_t *k = stream_cache;
+        if (k && k->first == c->sub_seq + 1 && k->fields == c->sub_fields && k->sse == sse) {
+            k->refs++;
+        } else {
+            unsigned long first;
+            size_t n = ring_read_after(&ringbuf, c->sub_seq, stream_scratch, STREAM_BATCH, &first);
+            if (n == 0) break;
+            dropped = first - c->sub_seq - 1;
+            k = stream_format(stream_scratch, n, first, c->sub_fields, sse, dropped);
+            if (!k) {
+                net_close(epfd, c);
+                return -1;
+            }
+            if (!dropped && k->last == atomic_load(&ringbuf.total)) {
+                /* up to date: the subscribers after this one most likely want the same */
+                stream_chunk_put(stream_cache);
+                stream_cache = k;
+                k->refs++;
+            }
+        }
+        c->chunk = k;
+        c->out = k->data;
+        c->out_len = k->len;
+        c->out_off = 0;
+        c->out_t0 = mono_ns();
+        c->sub_seq = k->last;
+        atomic_fetch_add(&stream_sent, k->last - k->first + 1);
+        if (dropped) atomic_fetch_add(&stream_dropped, dropped);
+        if (net_flush(epfd, c) < 0) return -1;
+    }
+    return 0;
+}
+
+/* A sample was published: feed every subscriber not still sending */
+static void stream_wake(int epfd) {
+    uint64_t v;
+    if (sample_efd >= 0 && read(sample_efd, &v, sizeof(v)) < 0) { /* spurious wakeup */ }
+    for (net_conn_t *c = net_subs, *next; c; c = next) {
+        next = c->sub_next;  // stream_fill may close c
+        stream_fill(epfd, c);
+    }
+}
+
+static int stream_heartbeat(int epfd, net_conn_t *c) {
+    char buf[64];
+    int n = c->sub == SUB_SSE ? snprintf(buf, sizeof(buf), ": heartbeat\n\n")
+                              : snprintf(buf, sizeof(buf), "{\"seq\":%lu}\n", c->sub_seq);
+    return net_dispatch_raw(epfd, c, strdup(buf), (size_t)n);
+}
+
+/* Start streaming: an acknowledgement (over HTTP the event-stream header),
+ * then whatever follows the cursor. A bad request leaves c as it was. */
+static int net_subscribe(int epfd, net_conn_t *c, const char *args, int http) {
+    uint64_t fields;
+    unsigned long after = 0;
+    int has_after;
+    size_t len = 0;
+    if (stream_parse(args, &fields, &after, &has_after) != 0) {
+        char *out = json_error("bad subscribe request", &len);
+        if (http) out = http_wrap(400, "application/json", out, &len);
+        return net_dispatch_raw(epfd, c, out, len);
+    }
+    if (!has_after && c->sub_resume) {
+        after = c->sub_seq;
+        has_after = 1;
+    }
+    net_sub_attach(c, http ? SUB_SSE : SUB_LINE);  // before reading total, so a racing publication still wakes us
+    unsigned long total = atomic_load(&ringbuf.total);
+    c->sub_fields = fields;
+    c->sub_seq = (has_after && after < total) ? after : total;
+    c->closing = 0;
+    c->last_ms = now_ms();
+    char ack[160];
+    int n = http ? snprintf(ack, sizeof(ack), "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                                              "Cache-Control: no-cache\r\nConnection: close\r\n\r\n")
+                 : snprintf(ack, sizeof(ack), "{ \"subscribed\": true, \"seq\": %lu }\n", c->sub_seq);
+    if (net_dispatch_raw(epfd, c, strdup(ack), (size_t)n) < 0) return -1;
+    return stream_fill(epfd, c);
+}
+
+/* Dispatch one request, inline or to the pool. Returns -1 if c was closed. */
+static int net_dispatch(int epfd, net_pool_t *pool, net_conn_t *c, const char *req, int http) {
+    if (!http && strcmp(req, "quit") == 0) {
+        c->closing = 1;
+        if (!c->out) {
+            net_close(epfd, c);
+            return -1;
+        }
+        return 0;
+    }
+    if (c->sub) {
+        /* a line protocol subscriber can only stop */
+        size_t len = 0;
+        char *out;
+        if (strcmp(req, "unsubscribe") == 0) {
+            net_sub_detach(c);
+            char buf[64];
+            len = (size_t)snprintf(buf, sizeof(buf), "{ \"unsubscribed\": true, \"seq\": %lu }\n", c->sub_seq);
+            out = strdup(buf);
+        } else {
+            out = json_error("subscribed: send unsubscribe first", &len);
+        }
+        return net_dispatch_raw(epfd, c, out, len);
+    }
+    atomic_fetch_add(&net_requests, 1);
+    const char *args = command_args(req, "subscribe");
+    if (args) return net_subscribe(epfd, c, args, http);
+    int metrics = strcmp(req, "metrics") == 0;
+    if (metrics || (!http && is_status_request(req))) {
+        status_buf_t *b = status_acquire(metrics ? &metricsdoc : &statusdoc);
+        if (!b) {
+            net_close(epfd, c);
+            return -1;
+        }
+        size_t off = (metrics && !http) ? b->body_off : 0;
+        c->pin = b;
+        c->out = b->data + off;
+        c->out_len = b->len - off;
+        c->out_off = 0;
+        c->out_t0 = mono_ns();
+        return net_flush(epfd, c);
+    }
+    if (pool && pool->nworkers > 0 && net_pool_submit(pool, c, req, http) == 0) {
+        c->busy = 1;
+        return 0;
+    }
+    size_t len = 0;
+    char *out = net_handle_request(req, http, &len);
+    return net_dispatch_raw(epfd, c, out, len);
+}
+
+/* Parse complete lines from the input buffer; one request in flight per
+ * connection so responses stay in order. Returns -1 if c was closed. */
+static int net_process_input(int epfd, net_pool_t *pool, net_conn_t *c) {
+    if (c->sub == SUB_SSE) c->in_len = 0;  // an event stream has nothing more to say but EOF
+    while (!c->busy && !c->out) {
+        char *nl = memchr(c->in, '\n', c->in_len);
+        if (!nl) break;
+        *nl = '\0';
+        char req[NET_INBUF];
+        snprintf(req, sizeof(req), "%s", c->in);
+        size_t used = (size_t)(nl - c->in) + 1;
+        memmove(c->in, nl + 1, c->in_len - used);
+        c->in_len -= used;
+        c->got_request = 1;
+        trim(req);
+        if (c->http_cmd) {
+            /* HTTP: headers are ignored but for an SSE resume; the blank line ends the request */
+            if (req[0]) {
+                if (strncasecmp(req, "Last-Event-ID:", 14) == 0) {
+                    char *end;
+                    unsigned long id = strtoul(req + 14, &end, 10);
+                    if (end != req + 14 && !*end) {
+                        c->sub_seq = id;
+                        c->sub_resume = 1;
+                    }
+                }
+                continue;
+            }
+            snprintf(req, sizeof(req), "%s", c->http_cmd);
+            free(c->http_cmd);
+            c->http_cmd = NULL;
+            c->closing = 1;
+            if (c->http_err) {
+                /* any request body is never parsed: the connection closes after the reply */
+                int code = c->http_err;
+                size_t len = 0;
+                c->in_len = 0;
+                char *out = http_wrap(code, "application/json",
+                                      json_error(code == 405 ? "method not allowed"
+                                                 : code == 501 ? "method not implemented"
+                                                               : "bad request target",
+                                                 &len),
+                                      &len);
+                return net_dispatch_raw(epfd, c, out, len);
+            }
+            if (net_dispatch(epfd, pool, c, req, 1) < 0) return -1;
+            continue;
+        }
+        char cmd[NET_INBUF];
+        int hc = http_to_command(req, cmd, sizeof(cmd));
+        if (hc >= 0) {
+            c->http_err = hc;
+            c->http_cmd = strdup(hc == 0 ? cmd : "");
+            if (c->http_cmd) continue;
+        }
+        if (net_dispatch(epfd, pool, c, req, 0) < 0) return -1;
+    }
+    if (c->busy || c->out) {
+        net_set_events(epfd, c);
+        return 0;
+    }
+    if (c->in_len == sizeof(c->in)) {
+        /* request too long */
+        const char *err = "{ \"error\": \"request too long\" }\n";
+        c->closing = 1;
+        c->in_len = 0;
+        return net_dispatch_raw(epfd, c, strdup(err), strlen(err));
+    }
+    if (c->peer_closed) {
+        if (c->got_request) {
+            net_close(epfd, c);
+            return -1;
+        }
+        /* legacy client: half-closed without asking for anything */
+        c->got_request = 1;
+        c->closing = 1;
+        return net_dispatch(epfd, pool, c, "", 0);
+    }
+    net_set_events(epfd, c);
+    return 0;
+}
+
+static void net_read(int epfd, net_pool_t *pool, net_conn_t *c) {
+    for (;;) {
+        if (c->in_len == sizeof(c->in)) break;
+        ssize_t r = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+        if (r > 0) {
+            c->in_len += (size_t)r;
+            continue;
+        }
+        if (r == 0) {
+            c->peer_closed = 1;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        net_close(epfd, c);
+        return;
+    }
+    c->last_ms = now_ms();
+    net_process_input(epfd, pool, c);
+}
+
+/* Connection limits & timeouts, copied out of the config when it changes */
+typedef struct {
+    size_t max_clients;
+    int request_wait_ms, idle_timeout_s, heartbeat_s;
+    int port, backlog;  // what server_fd is bound with
+} net_limits_t;
+
+/* Connection deadlines: a min-heap of (when, fd, gen), so an idle network
+ * thread sleeps until the nearest one instead of scanning every fd. Entries are
+ * lazy: activity only ever moves a deadline later, so an entry that fires
+ * early is re-queued at the new deadline; a deadline that moves earlier (a
+ * subscribe, a drained subscriber) queues a second entry, & c->armed says
+ * which one is current. Entries for closed or reused fds fall out by gen. */
+typedef struct {
+    long long at;
+    int fd;
+    uint32_t gen;
+} net_timer_t;
+
+static net_timer_t *net_timers;
+static size_t net_ntimers, net_timers_cap;
+
+static void net_timer_push(long long at, int fd, uint32_t gen) {
+    if (net_ntimers == net_timers_cap) {
+        size_t nc = net_timers_cap ? net_timers_cap * 2 : 64;
+        net_timer_t *n = realloc(net_timers, nc * sizeof(*n));
+        if (!n) return;  // the connection goes unwatched until its next event
+        net_timers = n;
+        net_timers_cap = nc;
+    }
+    size_t i = net_ntimers++;
+    while (i > 0 && net_timers[(i - 1) / 2].at > at) {
+        net_timers[i] = net_timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    net_timers[i] = (net_timer_t){ at, fd, gen };
+}
+
+static net_timer_t net_timer_pop(void) {
+    net_timer_t top = net_timers[0], last = net_timers[--net_ntimers];
+    size_t i = 0;
+    for (;;) {
+        size_t k = 2 * i + 1;
+        if (k >= net_ntimers) break;
+        if (k + 1 < net_ntimers && net_timers[k + 1].at < net_timers[k].at) k++;
+        if (net_timers[k].at >= last.at) break;
+        net_timers[i] = net_timers[k];
+        i = k;
+    }
+    if (net_ntimers) net_timers[i] = last;
+    return top;
+}
+
+/* When c next needs looking at: the legacy wait for a silent client, the idle
+ * timeout, a stalled subscriber's timeout or its heartbeat; 0 = never (a
+ * worker owns it, & hands it back through net_collect_done) */
+static long long net_deadline(const net_conn_t *c, const net_limits_t *lim) {
+    if (c->busy) return 0;
+    if (c->sub) {
+        if (c->out) return c->last_ms + (long long)lim->idle_timeout_s * 1000;
+        return lim->heartbeat_s > 0 ? c->last_ms + (long long)lim->heartbeat_s * 1000 : 0;
+    }
+    if (!c->got_request && !c->out) return c->accepted_ms + lim->request_wait_ms;
+    return c->last_ms + (long long)lim->idle_timeout_s * 1000;
+}
+
+static void net_arm(net_conn_t *c, const net_limits_t *lim) {
+    long long d = net_deadline(c, lim);
+    if (d == 0 || (c->armed && c->armed <= d)) return;
+    net_timer_push(d, c->fd, c->gen);
+    c->armed = d;
+}
+
+/* c if fd still holds the connection with that gen */
+static net_conn_t *net_conn_live(int fd, uint32_t gen) {
+    net_conn_t *c = ((size_t)fd < net_conns_cap) ? net_conns[fd] : NULL;
+    return (c && c->gen == gen) ? c : NULL;
+}
+
+static void net_accept(int epfd, int server_fd, int *spare_fd, const net_limits_t *lim) {
+    for (;;) {
+        int c = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (c < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EMFILE || errno == ENFILE) && *spare_fd >= 0) {
+                /* out of fds: free the spare, accept & drop, so epoll stops reporting */
+                close(*spare_fd);
+                int d = accept(server_fd, NULL, NULL);
+                if (d >= 0) close(d);
+                *spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                continue;
+            }
+            return;
+        }
+        if (net_nconns >= lim->max_clients) {
+            close(c);
+            continue;
+        }
+        if ((size_t)c >= net_conns_cap) {
+            size_t nc = net_conns_cap ? net_conns_cap : 64;
+            while (nc <= (size_t)c) nc *= 2;
+            net_conn_t **n = realloc(net_conns, nc * sizeof(*n));
+            if (!n) {
+                close(c);
+                continue;
+            }
+            memset(n + net_conns_cap, 0, (nc - net_conns_cap) * sizeof(*n));
+            net_conns = n;
+            net_conns_cap = nc;
+        }
+        net_conn_t *conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            close(c);
+            continue;
+        }
+        conn->fd = c;
+        conn->gen = ++net_gen;
+        conn->accepted_ms = conn->last_ms = now_ms();
+        conn->events = EPOLLIN | EPOLLRDHUP;
+        struct epoll_event ev;
+        ev.events = conn->events;
+        ev.data.fd = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, c, &ev) < 0) {
+            close(c);
+            free(conn);
+            continue;
+        }
+        net_conns[c] = conn;
+        net_nconns++;
+        net_arm(conn, lim);
+    }
+}
+
+/* Attach worker results to their connections */
+static void net_collect_done(int epfd, net_pool_t *pool, net_job_t **scratch, const net_limits_t *lim) {
+    uint64_t v;
+    if (read(pool->efd, &v, sizeof(v)) < 0) { /* spurious wakeup */ }
+    pthread_mutex_lock(&pool->lock);
+    size_t n = pool->done_count;
+    memcpy(scratch, pool->done, n * sizeof(*scratch));
+    pool->done_count = 0;
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < n; i++) {
+        net_job_t *job = scratch[i];
+        net_conn_t *c = net_conn_live(job->fd, job->gen);
+        if (c) {
+            c->busy = 0;
+            if (net_dispatch_raw(epfd, c, job->out, job->out_len) == 0 && !c->out)
+                net_process_input(epfd, pool, c);
+            if ((c = net_conn_live(job->fd, job->gen)) != NULL) net_arm(c, lim);
+        } else {
+            free(job->out);
+        }
+        free(job);
+    }
+}
+
+/* Idle & legacy (silent client) timeouts, stalled & quiet subscribers, for
+ * the connections whose deadline has passed; returns the epoll_wait timeout
+ * until the next one */
+static int net_run_timers(int epfd, net_pool_t *pool, const net_limits_t *lim) {
+    long long now = now_ms();
+    while (net_ntimers && net_timers[0].at <= now) {
+        net_timer_t t = net_timer_pop();
+        net_conn_t *c = net_conn_live(t.fd, t.gen);
+        if (!c || c->armed != t.at) continue;  // closed, or superseded by an earlier entry
+        c->armed = 0;
+        if (c->busy) continue;
+        if (c->sub) {
+            if (c->out) {
+                if (now - c->last_ms >= (long long)lim->idle_timeout_s * 1000) net_close(epfd, c);
+            } else if (stream_fill(epfd, c) == 0 && !c->out && lim->heartbeat_s > 0 &&
+                       now - c->last_ms >= (long long)lim->heartbeat_s * 1000) {
+                stream_heartbeat(epfd, c);
+            }
+        } else if (!c->got_request && !c->out && now - c->accepted_ms >= lim->request_wait_ms) {
+            c->got_request = 1;
+            c->closing = 1;
+            net_dispatch(epfd, pool, c, "", 0);
+        } else if (now - c->last_ms >= (long long)lim->idle_timeout_s * 1000) {
+            net_close(epfd, c);
+        }
+        if ((c = net_conn_live(t.fd, t.gen)) != NULL) net_arm(c, lim);
+    }
+    int timeout = -1;
+    if (net_ntimers) {
+        long long d = net_timers[0].at - now;
+        timeout = d > 3600000 ? 3600000 : (int)d;
+    }
+    /* without sample_efd, subscribers are fed (& config changes seen) by polling */
+    if (sample_efd < 0 && (timeout < 0 || timeout > 50)) timeout = 50;
+    return timeout;
+}
+
+/* A non-blocking listening socket on port, or -1 */
+static int net_listen(int port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, backlog) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Pick up a reloaded config. A new PORT is bound before the old socket is
+ * closed, so a port that is taken leaves the service where it was; accepted
+ * connections stay up either way. A new LISTEN_BACKLOG is a listen() again. */
+static void net_apply_config(int epfd, int *server_fd, net_limits_t *lim, const net_pool_t *pool,
+                             const config_t *cfg) {
+    lim->max_clients = (size_t)cfg->max_clients;
+    if (pool && lim->max_clients > pool->cap) lim->max_clients = pool->cap;  // pool queues are sized at startup
+    lim->request_wait_ms = cfg->request_wait_ms;
+    lim->idle_timeout_s = cfg->client_idle_timeout;
+    lim->heartbeat_s = cfg->subscribe_heartbeat_s;
+    if (cfg->listen_port != lim->port) {
+        int fd = net_listen(cfg->listen_port, cfg->listen_backlog);
+        if (fd < 0) {
+            fprintf(stderr, "network: cannot listen on port %d, staying on %d\n", cfg->listen_port, lim->port);
+            return;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, *server_fd, NULL);
+        close(*server_fd);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        fprintf(stderr, "network: listening on port %d (was %d)\n", cfg->listen_port, lim->port);
+        *server_fd = fd;
+        lim->port = cfg->listen_port;
+        lim->backlog = cfg->listen_backlog;
+    } else if (cfg->listen_backlog != lim->backlog && listen(*server_fd, cfg->listen_backlog) == 0) {
+        lim->backlog = cfg->listen_backlog;
+    }
+}
+
+void *network_thread(void *arg) {
+    (void)arg;
+    unsigned e = rcu_read_lock();
+    const config_t *cfg = config_get();
+    unsigned long gen = cfg->gen;
+    net_limits_t lim = { (size_t)cfg->max_clients, cfg->request_wait_ms, cfg->client_idle_timeout,
+                         cfg->subscribe_heartbeat_s, cfg->listen_port, cfg->listen_backlog };
+    int nworkers_want = cfg->net_workers;
+    rcu_read_unlock(e);
+    int server_fd = net_listen(lim.port, lim.backlog);
+    if (server_fd < 0) return NULL;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        close(server_fd);
+        return NULL;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = server_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &ev);
+    ev.data.fd = shutdown_efd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, shutdown_efd, &ev);
+    if (sample_efd >= 0) {
+        ev.data.fd = sample_efd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, sample_efd, &ev);
+    }
+    int spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    /* optional serialization pool */
+    net_pool_t pool_storage, *pool = NULL;
+    net_job_t **done_scratch = NULL;
+    pthread_t *workers = NULL;
+    int nworkers = 0;
+    if (nworkers_want > 0) {
+        memset(&pool_storage, 0, sizeof(pool_storage));
+        pool_storage.cap = lim.max_clients;
+        pool_storage.jobs = calloc(pool_storage.cap, sizeof(net_job_t *));
+        pool_storage.done = calloc(pool_storage.cap, sizeof(net_job_t *));
+        done_scratch = calloc(pool_storage.cap, sizeof(net_job_t *));
+        pool_storage.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        workers = calloc((size_t)nworkers_want, sizeof(pthread_t));
+        if (pool_storage.jobs && pool_storage.done && done_scratch && pool_storage.efd >= 0 && workers) {
+            pthread_mutex_init(&pool_storage.lock, NULL);
+            pthread_cond_init(&pool_storage.cond, NULL);
+            pool = &pool_storage;
+            for (; nworkers < nworkers_want; nworkers++) {
+                char name[32];
+                snprintf(name, sizeof(name), "sw-net-w%d", nworkers);
+                if (thread_spawn(&workers[nworkers], NULL, THR_NET, name, net_worker, pool) != 0) break;
+            }
+            pool->nworkers = nworkers;
+            ev.events = EPOLLIN;
+            ev.data.fd = pool->efd;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, pool->efd, &ev);
+        } else {
+            fprintf(stderr, "network: worker pool unavailable, serializing inline\n");
+            free(pool_storage.jobs);
+            free(pool_storage.done);
+            if (pool_storage.efd >= 0) close(pool_storage.efd);
+        }
+    }
+
+    struct epoll_event events[NET_MAX_EVENTS];
+    int timeout = 0;
+    while (atomic_load(&running)) {
+        int n = epoll_wait(epfd, events, NET_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) break;
+        e = rcu_read_lock();
+        cfg = config_get();
+        if (cfg->gen != gen) {
+            gen = cfg->gen;
+            net_apply_config(epfd, &server_fd, &lim, pool, cfg);
+            /* timeouts may have shrunk: queue every connection again */
+            for (size_t fd = 0; fd < net_conns_cap; fd++)
+                if (net_conns[fd]) {
+                    net_conns[fd]->armed = 0;
+                    net_arm(net_conns[fd], &lim);
+                }
+        }
+        rcu_read_unlock(e);
+        if (sample_efd < 0) stream_wake(epfd);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server_fd) {
+                net_accept(epfd, server_fd, &spare_fd, &lim);
+                continue;
+            }
+            if (pool && fd == pool->efd) {
+                net_collect_done(epfd, pool, done_scratch, &lim);
+                continue;
+            }
+            if (fd == shutdown_efd) continue;
+            if (fd == sample_efd) {
+                stream_wake(epfd);
+                continue;
+            }
+            net_conn_t *c = ((size_t)fd < net_conns_cap) ? net_conns[fd] : NULL;
+            if (!c) continue;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                net_close(epfd, c);
+                continue;
+            }
+            uint32_t cgen = c->gen;
+            if (events[i].events & EPOLLOUT) {
+                if (net_flush(epfd, c) < 0) continue;
+                if (!c->out && net_process_input(epfd, pool, c) < 0) continue;
+                if (stream_fill(epfd, c) < 0) continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP)) net_read(epfd, pool, c);
+            if ((c = net_conn_live(fd, cgen)) != NULL) net_arm(c, &lim);
+        }
+        timeout = net_run_timers(epfd, pool, &lim);
+    }
+
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+        for (int i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+        for (size_t i = 0; i < pool->count; i++) free(pool->jobs[(pool->head + i) % pool->cap]);
+        for (size_t i = 0; i < pool->done_count; i++) {
+            free(pool->done[i]->out);
+            free(pool->done[i]);
+        }
+        free(pool->done);
+        free(pool->jobs);
+        free(done_scratch);
+        close(pool->efd);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->cond);
+    }
+    else free(done_scratch);
+    free(workers);
+    for (size_t fd = 0; fd < net_conns_cap; fd++)
+        if (net_conns[fd]) net_close(epfd, net_conns[fd]);
+    stream_chunk_put(stream_cache);
+    stream_cache = NULL;
+    free(net_conns);
+    net_conns = NULL;
+    net_conns_cap = 0;
+    if (spare_fd >= 0) close(spare_fd);
+    close(epfd);
+    close(server_fd);
+    return NULL;
+}
+
+/* Stop every loop: clear running & make shutdown_efd readable for good */
+void request_shutdown(void) {
+    atomic_store(&running, 0);
+    uint64_t one = 1;
+    if (write(shutdown_efd, &one, sizeof(one)) < 0) { /* already signalled */ }
+}
+
+/* Signal handling thread using sigwait */
+void *signal_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGHUP);
+
+    while (atomic_load(&running)) {
+        int sig;
+        int r = sigwait(&set, &sig);
+        if (r != 0) continue;
+        if (sig == SIGTERM) {
+            fprintf(stderr, "Received SIGTERM -> shutting down gracefully\n");
+            request_shutdown();
+        } else if (sig == SIGUSR1) {
+            fprintf(stderr, "Received SIGUSR1 -> forcing metrics dump\n");
+            dump_metrics_to_file();
+        } else if (sig == SIGHUP) {
+            fprintf(stderr, "Received SIGHUP -> reload config\n");
+            reload_config();
+        }
+    }
+    return NULL;
+}
+
+/* Dump ring buffer to the text log (metrics_logfile unless it is binary).
+ * The writer thread takes the snapshot & formats it. */
+void dump_metrics_to_file() {
+    wrec_t r;
+    r.kind = WREC_DUMP;
+    wq_push(&wqueue, &r);
+}
+
+/* Settings that size something allocated once at startup */
+static const struct {
+    const char *key;
+    size_t off;
+} config_startup_keys[] = {
+    { "NET_WORKERS", offsetof(config_t, net_workers) },
+    { "WRITER_QUEUE", offsetof(config_t, writer_queue_size) },
+    { "DISKIO_HISTORY", offsetof(config_t, diskio_history) },
+    { "CGROUP_MAX", offsetof(config_t, cgroup_max) },
+    { "CGROUP_HISTORY", offsetof(config_t, cgroup_history) },
+    { "MLOCK", offsetof(config_t, mlock) },
+    { "AGGREGATE_THREADS", offsetof(config_t, aggregate_threads) },
+    { "AGGREGATE_HISTORY", offsetof(config_t, aggregate_history) },
+    { "HISTORY_RAW_KB", offsetof(config_t, history_raw_kb) },
+    { "HISTORY_1M_KB", offsetof(config_t, history_1m_kb) },
+    { "HISTORY_1H_KB", offsetof(config_t, history_1h_kb) },
+    { "CORE_HISTORY", offsetof(config_t, core_history) },
+    { "PROC_FD_CACHE", offsetof(config_t, proc_fd_cache) },
+    { "PUSH_BACKLOG", offsetof(config_t, push_backlog) },
+    { "LOG_MATCH_RING", offsetof(config_t, log_match_ring) },
+    { "LOG_MATCH_ARENA_KB", offsetof(config_t, log_match_arena_kb) },
+};
+
+/* Bring the state built from old in line with c, which is already current.
+ * Threads pick up everything else on their next pass: the network thread
+ * (woken through sample_efd) rebinds, the log thread adds & drops watches,
+ * the push thread reconnects, the writer switches files & the scheduler
+ * re-arms a changed interval after the job's next tick. */
+static void config_apply(const config_t *old, const config_t *c) {
+    if (c->ring_size != old->ring_size) {
+        size_t size = (size_t)c->ring_size;
+        int rc = state.map ? state_resize_ring(&state, &ringbuf, &history, size) : ring_resize(&ringbuf, size);
+        if (rc == 0 &&
+            status_doc_resize(&statusdoc, (size_t)c->ring_size) == 0) {
+            status_doc_update(&statusdoc, NULL);
+            fprintf(stderr, "config: ring resized from %d to %d samples\n", old->ring_size, c->ring_size);
+        } else {
+            fprintf(stderr, "config: cannot resize the ring to %d samples\n", c->ring_size);
+        }
+    }
+    if (c->n_alert_rules != old->n_alert_rules || c->alert_hysteresis != old->alert_hysteresis ||
+        c->cpu_interval_ms != old->cpu_interval_ms ||
+        memcmp(c->alert_rules, old->alert_rules, sizeof(c->alert_rules)) != 0)
+        alert_config_commit(c);
+    atomic_store(&wqueue.batch, (size_t)c->writer_batch);
+    if (c->cpu_affinity_set != old->cpu_affinity_set || c->collector_idle != old->collector_idle ||
+        c->collector_nice != old->collector_nice ||
+        memcmp(c->cpu_affinity, old->cpu_affinity, sizeof(c->cpu_affinity)) != 0)
+        threads_retune(c);
+    for (size_t i = 0; i < sizeof(config_startup_keys) / sizeof(config_startup_keys[0]); i++) {
+        size_t off = config_startup_keys[i].off;
+        if (*(const int *)((const char *)c + off) != *(const int *)((const char *)old + off))
+            fprintf(stderr, "config: %s takes effect after a restart\n", config_startup_keys[i].key);
+    }
+    if (strcmp(c->state_file, old->state_file) != 0)
+        fprintf(stderr, "config: STATE_FILE takes effect after a restart\n");
+    if (strcmp(c->cgroup_root, old->cgroup_root) != 0)
+        fprintf(stderr, "config: CGROUP_ROOT takes effect after a restart\n");
+    if (strcmp(c->aggregate_agents, old->aggregate_agents) != 0)
+        fprintf(stderr, "config: AGGREGATE_AGENTS takes effect after a restart\n");
+    if (sample_efd >= 0) {
+        uint64_t one = 1;  // the network thread sleeps until its next deadline
+        if (write(sample_efd, &one, sizeof(one)) < 0) { /* counter saturated: already signalled */ }
+    }
+}
+
+/* Startup: path (or only the defaults, if path is NULL or unreadable) */
+static const config_t *config_init(const char *path) {
+    config_t *c = path ? config_parse(path) : NULL;
+    if (!c) c = config_new();
+    if (!c) {
+        fprintf(stderr, "FATAL: cannot allocate the config\n");
+        exit(1);
+    }
+    config_publish(c);
+    alert_config_commit(c);
+    return c;
+}
+
+/* Make c current, apply the difference & free the old config once no reader
+ * can still be using it. Only one thread may replace the config at a time. */
+static void config_replace(config_t *c) {
+    config_t *old = config_publish(c);
+    config_apply(old, c);
+    rcu_synchronize();
+    config_free(old);
+}
+
+/* reload_config callable from SIGHUP handler */
+void reload_config() {
+    fprintf(stderr, "Reloading config: %s\n", config_path);
+    config_t *c = config_parse(config_path);
+    if (!c) {
+        fprintf(stderr, "config: cannot read %s, keeping the current settings\n", config_path);
+        return;
+    }
+    config_replace(c);
+    atomic_store(&writer_reopen, 1);
+}
+
+#ifdef SYSWATCH_BENCH
+/* Benchmarks (make bench; --bench parse|log|net|all).
+ *
+ * parse: synthetic /proc/stat, /proc/meminfo & mountinfo fixtures read back
+ *        through the collectors' pread path & parsers.
+ * log:   lines appended to a temp file at --log-rate MB/s (0 = flat out)
+ *        while the real log thread follows & scans it.
+ * net:   --clients keep-alive connections sending --request in a loop
+ *        against the real network thread.
+ * procs: --procs sleeping children, then back-to-back process collector
+ *        scans; reports CPU per scan & the projected load at PROC_INTERVAL_MS.
+ * aggregate: --agents connections from the aggregator to the real network
+ *        thread, polled every 1 s while a new sample is published every
+ *        100 ms; reports the poll round trips, merge time & process CPU.
+ * subscribe: --clients subscribers on the real network thread while a
+ *        sample is published every 10 ms; reports publish-to-receive latency.
+ * Each reports throughput, p50/p99 latency & RSS. Fixtures & logs live in a
+ * mkdtemp() directory that is removed afterwards. */
+
+typedef struct {
+    const char *scenario;
+    const char *request;
+    int clients, duration_ms, cores, mounts, procs, agents;
+    double log_rate_mb;
+    char dir[64];
+} bench_opts_t;
+
+/* Deep copy, for callers that change a setting programmatically */
+static config_t *config_dup(const config_t *src) {
+    config_t *c = malloc(sizeof(*c));
+    if (!c) return NULL;
+    *c = *src;
+    c->logfiles = calloc((size_t)src->n_logfiles + 1, sizeof(char *));
+    c->n_logfiles = 0;
+    if (!c->logfiles) {
+        free(c);
+        return NULL;
+    }
+    for (int i = 0; i < src->n_logfiles; i++)
+        if ((c->logfiles[c->n_logfiles] = strdup(src->logfiles[i])) != NULL) c->n_logfiles++;
+    return c;
+}
+
+static void bench_rss(const char *label) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return;
+    char line[256];
+    long rss = 0, hwm = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmRSS:", 6) == 0) rss = atol(line + 6);
+        else if (strncmp(line, "VmHWM:", 6) == 0) hwm = atol(line + 6);
+    }
+    fclose(f);
+    printf("%-6s rss %.1f MiB (peak %.1f MiB)\n", label, (double)rss / 1024.0, (double)hwm / 1024.0);
+}
+
+static void bench_report(const char *scenario, const char *what, instr_hist_t *h, double seconds, const char *unit) {
+    instr_snap_t s;
+    instr_hist_snapshot(h, &s);
+    printf("%-6s %-22s %10.0f %s/s   p50 %8.1f us   p99 %8.1f us   max %8.1f us\n", scenario, what,
+           seconds > 0 ? (double)s.count / seconds : 0.0, unit, s.p50, s.p99, s.max);
+}
+
+static instr_hist_t *bench_hist(void) {
+    instr_hist_t *h = calloc(1, sizeof(*h));
+    if (!h) {
+        perror("calloc");
+        exit(1);
+    }
+    return h;
+}
+
+static int bench_write_file(const char *path, const char *data, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    ssize_t w = write(fd, data, len);
+    close(fd);
+    return w == (ssize_t)len ? 0 : -1;
+}
+
+/* Threads started for a scenario stop on shutdown_efd; re-arm it afterwards */
+static void bench_rearm(void) {
+    uint64_t v;
+    if (read(shutdown_efd, &v, sizeof(v)) < 0) { /* was not signalled */ }
+    atomic_store(&running, 1);
+}
+
+/* Synthetic /proc/stat (o->cores cores), /proc/meminfo & mountinfo (o->mounts
+ * real mounts plus as many pseudo ones) in o->dir; also the --check fixtures */
+static int bench_fixtures(const bench_opts_t *o, const char *path_stat, const char *path_mem, const char *path_mnt) {
+    sbuf_t b = { 0 };
+    sbuf_printf(&b, "cpu  %d 0 %d %d 100 0 5 0 0 0\n", 1000 * o->cores, 500 * o->cores, 90000 * o->cores);
+    for (int i = 0; i < o->cores; i++) sbuf_printf(&b, "cpu%d 1000 0 500 90000 100 0 5 0 0 0\n", i);
+    sbuf_printf(&b, "intr 123456789 0 0 0\nctxt 987654321\nbtime 1700000000\nprocesses 123456\n"
+                    "procs_running 3\nprocs_blocked 0\nsoftirq 1 2 3 4 5 6 7 8 9 10 11\n");
+    int err = b.err || bench_write_file(path_stat, b.p, b.len);
+    b.len = 0;
+    static const char *mem_keys[] = { "MemTotal", "MemFree", "MemAvailable", "Buffers", "Cached", "SwapCached",
+                                      "Active", "Inactive", "SwapTotal", "SwapFree", "Dirty", "Writeback",
+                                      "AnonPages", "Mapped", "Shmem", "Slab", "SReclaimable", "PageTables" };
+    for (size_t i = 0; i < sizeof(mem_keys) / sizeof(mem_keys[0]); i++)
+        sbuf_printf(&b, "%s:%*lu kB\n", mem_keys[i], (int)(16 - strlen(mem_keys[i])), 8000000UL - i * 400000UL);
+    err |= b.err || bench_write_file(path_mem, b.p, b.len);
+    b.len = 0;
+    for (int i = 0; i < o->mounts; i++)
+        sbuf_printf(&b, "%d 1 %d:%d / %s rw,relatime shared:%d - %s /dev/sd%c%d rw\n", 20 + i, 8, i,
+                    i == 0 ? "/" : "/srv/data", i, i % 3 ? "xfs" : "ext4", 'a' + i % 26, i);
+    for (int i = 0; i < o->mounts; i++) /* pseudo filesystems the parser must skip */
+        sbuf_printf(&b, "%d 1 0:%d / /sys/fs/cgroup/x%d rw - cgroup2 cgroup2 rw\n", 1000 + i, 100 + i, i);
+    err |= b.err || bench_write_file(path_mnt, b.p, b.len);
+    free(b.p);
+    if (err) fprintf(stderr, "bench: cannot write fixtures in %s\n", o->dir);
+    return err ? -1 : 0;
+}
+
+static int bench_parse(const bench_opts_t *o) {
+    char path_stat[128], path_mem[128], path_mnt[128];
+    snprintf(path_stat, sizeof(path_stat), "%s/stat", o->dir);
+    snprintf(path_mem, sizeof(path_mem), "%s/meminfo", o->dir);
+    snprintf(path_mnt, sizeof(path_mnt), "%s/mountinfo", o->dir);
+    if (bench_fixtures(o, path_stat, path_mem, path_mnt) != 0) return 1;
+
+    proc_file_t pf_stat, pf_mem, pf_mnt;
+    proc_file_init(&pf_stat, path_stat);
+    proc_file_init(&pf_mem, path_mem);
+    proc_file_init(&pf_mnt, path_mnt);
+    cpu_times_t total, *cores = calloc((size_t)o->cores, sizeof(cpu_times_t));
+    instr_hist_t *h_stat = bench_hist(), *h_mem = bench_hist(), *h_mnt = bench_hist();
+    if (!cores) return 1;
+    /* each parser gets its own third of the run, so every row's rate is its own */
+    double sink = 0.0, secs[3];
+    instr_hist_t *hist[3] = { h_stat, h_mem, h_mnt };
+    uint64_t slice = (uint64_t)o->duration_ms * 1000000u / 3;
+    for (int which = 0; which < 3; which++) {
+        uint64_t start = mono_ns(), end = start + slice;
+        while (mono_ns() < end) {
+            for (int k = 0; k < 64; k++) {
+                uint64_t t0 = mono_ns();
+                size_t n = 0;
+                if (which == 0) {
+                    read_cpu_times(&pf_stat, &total, cores, (size_t)o->cores);
+                } else if (which == 1) {
+                    mem_stats_t ms;
+                    sink += read_memory_usage(&pf_mem, &ms);
+                } else if (proc_file_read(&pf_mnt) == 0) {
+                    mount_ent_t *m = parse_mountinfo(pf_mnt.buf, &n);
+                    mount_ents_free(m, n);
+                }
+                instr_hist_record(hist[which], mono_ns() - t0);
+                sink += (double)n;
+            }
+        }
+        secs[which] = (double)(mono_ns() - start) / 1e9;
+    }
+    char what[64];
+    snprintf(what, sizeof(what), "stat (%d cores)", o->cores);
+    bench_report("parse", what, h_stat, secs[0], "ops");
+    bench_report("parse", "meminfo", h_mem, secs[1], "ops");
+    snprintf(what, sizeof(what), "mountinfo (%d+%d)", o->mounts, o->mounts);
+    bench_report("parse", what, h_mnt, secs[2], "ops");
+    bench_rss("parse");
+    if (sink < 0) printf("%f\n", sink);  // keep the results live
+    proc_file_close(&pf_stat);
+    proc_file_close(&pf_mem);
+    proc_file_close(&pf_mnt);
+    free(cores);
+    free(h_stat);
+    free(h_mem);
+    free(h_mnt);
+    unlink(path_stat);
+    unlink(path_mem);
+    unlink(path_mnt);
+    return 0;
+}
+
+static int bench_log(const bench_opts_t *o) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/app.log", o->dir);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    config_t *c = config_dup(config_get());
+    if (!c) return 1;
+    config_free_logfiles(c);
+    c->logfiles = calloc(1, sizeof(char *));
+    if (c->logfiles) c->logfiles[0] = strdup(path);
+    c->n_logfiles = (c->logfiles && c->logfiles[0]) ? 1 : 0;
+    config_replace(c);
+
+    /* ~100 byte lines, one in 1000 matching */
+    enum { CHUNK_LINES = 1024 };
+    char *chunk = malloc(CHUNK_LINES * 128);
+    if (!chunk) return 1;
+    size_t clen = 0;
+    for (int i = 0; i < CHUNK_LINES; i++)
+        clen += (size_t)sprintf(chunk + clen, "2025-11-12T17:00:00.%03d host app[%5d]: %s request id=%08x took %3dms\n",
+                                i % 1000, 1000 + i, i % 1000 == 999 ? "ERROR" : "info ", i * 2654435761u, i % 977);
+
+    /* the per-batch alert lines on stderr would swamp the report */
+    fflush(stderr);
+    int saved_err = dup(STDERR_FILENO), devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (saved_err >= 0 && devnull >= 0) dup2(devnull, STDERR_FILENO);
+    logmatch_init((size_t)c->log_match_ring, (size_t)c->log_match_arena_kb);
+    pthread_t t;
+    if (pthread_create(&t, NULL, log_monitor_thread, NULL) != 0) {
+        perror("pthread_create log_monitor_thread");
+        return 1;
+    }
+    usleep(200 * 1000);  // let it open the file & seek to the end
+
+    uint64_t written = 0, start = mono_ns(), end = start + (uint64_t)o->duration_ms * 1000000u;
+    double bytes_per_ns = o->log_rate_mb * 1024.0 * 1024.0 / 1e9;
+    for (uint64_t now = start; now < end; now = mono_ns()) {
+        if (bytes_per_ns > 0 && (double)written > (double)(now - start) * bytes_per_ns) {
+            usleep(1000);
+            continue;
+        }
+        if (write(fd, chunk, clen) != (ssize_t)clen) {
+            perror("write");
+            break;
+        }
+        written += clen;
+    }
+    double wsecs = (double)(mono_ns() - start) / 1e9;
+    /* wait (up to 10 s) for the follower to catch up */
+    uint64_t deadline = mono_ns() + 10000000000ull;
+    while (atomic_load(&instr[INSTR_LOG_DRAIN_BYTES].sum) < written && mono_ns() < deadline) usleep(1000);
+    uint64_t caught = atomic_load(&instr[INSTR_LOG_DRAIN_BYTES].sum);  // nothing else is followed
+    double secs = (double)(mono_ns() - start) / 1e9;
+    request_shutdown();
+    pthread_join(t, NULL);
+    bench_rearm();
+    fflush(stderr);
+    if (saved_err >= 0) {
+        dup2(saved_err, STDERR_FILENO);
+        close(saved_err);
+    }
+    if (devnull >= 0) close(devnull);
+
+    printf("log    offered %.1f MB/s, ingested %.1f MB/s (%.1f MB in %.2f s, %s)\n",
+           (double)written / wsecs / 1048576.0, (double)caught / secs / 1048576.0, (double)caught / 1048576.0, secs,
+           caught >= written ? "caught up" : "fell behind");
+    printf("log    captured %lu matched lines, %zu kept\n", (unsigned long)logmatch.total, logmatch.count);
+    logmatch_free();
+    bench_report("log", "drain", &instr[INSTR_LOG_DRAIN], secs, "drains");
+    bench_rss("log");
+    close(fd);
+    free(chunk);
+    unlink(path);
+    return 0;
+}
+
+typedef struct {
+    const bench_opts_t *o;
+    instr_hist_t *h;
+    atomic_ulong *errors;
+    uint64_t end;
+    int port;
+} bench_client_t;
+
+static void *bench_client(void *arg) {
+    bench_client_t *bc = arg;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_port = htons((uint16_t)bc->port);
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&a, sizeof(a)) != 0) {
+        atomic_fetch_add(bc->errors, 1);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    char req[256], buf[65536];
+    int rl = snprintf(req, sizeof(req), "%s\n", bc->o->request);
+    while (mono_ns() < bc->end) {
+        uint64_t t0 = mono_ns();
+        if (send(fd, req, (size_t)rl, MSG_NOSIGNAL) != rl) break;
+        ssize_t r;
+        while ((r = recv(fd, buf, sizeof(buf), 0)) > 0)  // replies are one line
+            if (buf[r - 1] == '\n') break;
+        if (r <= 0) break;
+        instr_hist_record(bc->h, mono_ns() - t0);
+    }
+    if (mono_ns() < bc->end) atomic_fetch_add(bc->errors, 1);
+    close(fd);
+    return NULL;
+}
+
+static int bench_net(const bench_opts_t *o) {
+    /* an ephemeral port that was free a moment ago */
+    int probe = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in a;
+    socklen_t al = sizeof(a);
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (probe < 0 || bind(probe, (struct sockaddr *)&a, sizeof(a)) != 0 ||
+        getsockname(probe, (struct sockaddr *)&a, &al) != 0) {
+        perror("bench: port probe");
+        return 1;
+    }
+    close(probe);
+    config_t *c = config_dup(config_get());
+    if (!c) return 1;
+    c->listen_port = ntohs(a.sin_port);
+    if (c->max_clients < o->clients + 16) c->max_clients = o->clients + 16;
+    config_replace(c);
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, network_thread, NULL) != 0) {
+        perror("pthread_create network_thread");
+        return 1;
+    }
+    usleep(200 * 1000);
+
+    pthread_t *th = calloc((size_t)o->clients, sizeof(pthread_t));
+    instr_hist_t *h = bench_hist();
+    atomic_ulong errors;
+    atomic_init(&errors, 0);
+    uint64_t start = mono_ns();
+    bench_client_t bc = { o, h, &errors, start + (uint64_t)o->duration_ms * 1000000u, config_get()->listen_port };
+    int started = 0;
+    for (; th && started < o->clients; started++)
+        if (pthread_create(&th[started], NULL, bench_client, &bc) != 0) break;
+    for (int i = 0; i < started; i++) pthread_join(th[i], NULL);
+    double secs = (double)(mono_ns() - start) / 1e9;
+    request_shutdown();
+    pthread_join(t, NULL);
+    bench_rearm();
+
+    char what[64];
+    snprintf(what, sizeof(what), "%d clients, %.12s", started, o->request);
+    bench_report("net", what, h, secs, "req");
+    if (atomic_load(&errors)) printf("net    %lu clients failed or were disconnected early\n", atomic_load(&errors));
+    bench_rss("net");
+    free(th);
+    free(h);
+    return 0;
+}
+
+/* The aggregator against o->agents "agents" that are all the real network
+ * thread on one loopback port, so both ends of every connection are measured */
+static int bench_aggregate(const bench_opts_t *o) {
+    size_t need = 2 * (size_t)o->agents + 1024;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < need) {
+        rl.rlim_cur = rl.rlim_max < need ? rl.rlim_max : need;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    int probe = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in a;
+    socklen_t al = sizeof(a);
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (probe < 0 || bind(probe, (struct sockaddr *)&a, sizeof(a)) != 0 ||
+        getsockname(probe, (struct sockaddr *)&a, &al) != 0) {
+        perror("bench: port probe");
+        return 1;
+    }
+    close(probe);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/agents", o->dir);
+    FILE *f = fopen(path, "w");
+    if (!f) return 1;
+    for (int i = 0; i < o->agents; i++) fprintf(f, "127.0.0.1:%d\n", ntohs(a.sin_port));
+    fclose(f);
+    config_t *c = config_dup(config_get());
+    if (!c) return 1;
+    c->listen_port = ntohs(a.sin_port);
+    c->listen_backlog = o->agents;
+    c->request_wait_ms = 60000;  // the accept burst can outlast the silent-client wait on a small box
+    if (c->max_clients < o->agents + 16) c->max_clients = o->agents + 16;
+    snprintf(c->aggregate_agents, sizeof(c->aggregate_agents), "%s", path);
+    c->aggregate_interval_ms = 1000;
+    config_replace(c);
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, network_thread, NULL) != 0) {
+        perror("pthread_create network_thread");
+        return 1;
+    }
+    usleep(200 * 1000);
+    instr_hist_t *h = &instr[INSTR_AGG_MERGE];
+    unsigned long merges0 = atomic_load(&h->count), sum0 = atomic_load(&h->sum);
+    struct rusage ru0, ru1;
+    getrusage(RUSAGE_SELF, &ru0);
+    uint64_t start = mono_ns(), end = start + (uint64_t)o->duration_ms * 1000000u;
+    int rc = agg_start();
+    time_t now = time(NULL);
+    while (rc == 0 && mono_ns() < end) {
+        metric_sample_t s = { .cpu_usage = (double)(rand() % 100), .memory_usage = 40.0, .timestamp = now++ };
+        publish_sample(&s);
+        usleep(100 * 1000);
+    }
+    unsigned long samples = 0, errors = 0;
+    size_t up = 0;
+    long long nowms = now_ms();
+    for (int s = 0; s < aggtab.nshards; s++) {
+        agg_shard_t *sh = &aggtab.shards[s];
+        pthread_mutex_lock(&sh->lock);
+        for (size_t i = 0; i < sh->n; i++) {
+            up += sh->agents[i].ok_ms && nowms - sh->agents[i].ok_ms <= 2000;
+            samples += sh->agents[i].samples;
+            errors += sh->agents[i].errors;
         }
-        if (active == 0) {
-            sleep(1);
+        pthread_mutex_unlock(&sh->lock);
+    }
+    getrusage(RUSAGE_SELF, &ru1);
+    double secs = (double)(mono_ns() - start) / 1e9;
+    request_shutdown();
+    pthread_join(t, NULL);
+    agg_stop();
+    bench_rearm();
+    unlink(path);
+    if (rc != 0) return 1;
+    double cpu = (double)(ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec + ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) +
+                 (double)(ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec + ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+    unsigned long merges = atomic_load(&h->count) - merges0;
+    printf("aggregate %d agents: %zu up at the end, %.0f samples/s fetched, %lu errors, %lu merges of %.0f us, "
+           "%.1f%% of one CPU (both ends)\n",
+           o->agents, up, (double)samples / secs, errors, merges,
+           merges ? (double)(atomic_load(&h->sum) - sum0) / (double)merges / 1e3 : 0.0, cpu / secs * 100.0);
+    bench_rss("aggregate");
+    return 0;
+}
+
+/* Subscriber side of the stream: complete lines in, latencies out. The publish
+ * time rides in net_rx_bps, in microseconds. */
+typedef struct {
+    char part[256];
+    size_t len;
+} bench_sub_t;
+
+static void bench_sub_lines(bench_sub_t *b, const char *data, size_t n, instr_hist_t *h, unsigned long *dropped) {
+    for (size_t i = 0; i < n; i++) {
+        if (data[i] != '\n') {
+            if (b->len + 1 < sizeof(b->part)) b->part[b->len++] = data[i];
             continue;
         }
-        struct pollfd pfd[MAX_LOGFILES];
-        int pcount = 0;
-        for (int i = 0; i < n_logfiles; i++) {
-            if (fds[i] >= 0) {
-                pfd[pcount].fd = fds[i];
-                pfd[pcount].events = POLLIN | POLLPRI;
-                pfd[pcount].revents = 0;
-                pcount++;
-            }
-        }
-        int ret = poll(pfd, pcount, 2000);
-        if (ret > 0) {
-            int idx = 0;
-            for (int i = 0; i < n_logfiles; i++) {
-                if (fds[i] < 0) continue;
-                if (pfd[idx].revents & (POLLIN | POLLPRI)) {
-                    process_log_data(logfiles[i], fds[i]);
-                }
-                idx++;
+        b->part[b->len] = '\0';
+        b->len = 0;
+        const char *v = strstr(b->part, "\"net_rx_bps\":");
+        if (v) {
+            uint64_t sent = (uint64_t)(strtod(v + 13, NULL) * 1000.0);
+            uint64_t now = mono_ns();
+            instr_hist_record(h, now > sent ? now - sent : 0);
+        } else if ((v = strstr(b->part, "\"dropped\":")) != NULL) {
+            *dropped += strtoul(v + 10, NULL, 10);
+        }
+    }
+}
+
+static int bench_subscribe(const bench_opts_t *o) {
+    int probe = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in a;
+    socklen_t al = sizeof(a);
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (probe < 0 || bind(probe, (struct sockaddr *)&a, sizeof(a)) != 0 ||
+        getsockname(probe, (struct sockaddr *)&a, &al) != 0) {
+        perror("bench: port probe");
+        return 1;
+    }
+    close(probe);
+    config_t *c = config_dup(config_get());
+    if (!c) return 1;
+    c->listen_port = ntohs(a.sin_port);
+    if (c->max_clients < o->clients + 16) c->max_clients = o->clients + 16;
+    config_replace(c);
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, network_thread, NULL) != 0) {
+        perror("pthread_create network_thread");
+        return 1;
+    }
+    usleep(200 * 1000);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int *fds = calloc((size_t)o->clients, sizeof(int));
+    bench_sub_t *subs = calloc((size_t)o->clients, sizeof(bench_sub_t));
+    instr_hist_t *h = bench_hist();
+    int nsubs = 0;
+    static const char req[] = "subscribe fields=net_rx_bps\n";
+    for (; epfd >= 0 && fds && subs && nsubs < o->clients; nsubs++) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&a, sizeof(a)) != 0 ||
+            send(fd, req, sizeof(req) - 1, MSG_NOSIGNAL) != (ssize_t)(sizeof(req) - 1)) {
+            if (fd >= 0) close(fd);
+            break;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)nsubs };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        fds[nsubs] = fd;
+    }
+
+    unsigned long dropped = 0, published = 0;
+    int closed = 0;
+    char buf[65536];
+    struct epoll_event events[NET_MAX_EVENTS];
+    uint64_t start = mono_ns(), end = start + (uint64_t)o->duration_ms * 1000000u, next = start;
+    time_t now = time(NULL);
+    while (epfd >= 0 && mono_ns() < end) {
+        uint64_t tn = mono_ns();
+        if (tn >= next) {
+            metric_sample_t s = { .net_rx_bps = (double)(tn / 1000), .timestamp = now };
+            publish_sample(&s);
+            published++;
+            next += 10 * 1000000u;
+        }
+        tn = mono_ns();
+        int n = epoll_wait(epfd, events, NET_MAX_EVENTS, next > tn ? (int)((next - tn) / 1000000u) : 0);
+        for (int i = 0; i < n; i++) {
+            uint32_t k = events[i].data.u32;
+            ssize_t r;
+            while ((r = recv(fds[k], buf, sizeof(buf), 0)) > 0) bench_sub_lines(&subs[k], buf, (size_t)r, h, &dropped);
+            if (r == 0) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fds[k], NULL);
+                closed++;
             }
-        } else if (ret == 0) {
-            /* timeout */
-        } else {
-            if (errno == EINTR) continue;
         }
     }
-    for (int i = 0; i < n_logfiles; i++) if (fds[i] >= 0) close(fds[i]);
-    return NULL;
+    double secs = (double)(mono_ns() - start) / 1e9;
+    request_shutdown();
+    pthread_join(t, NULL);
+    bench_rearm();
+    for (int i = 0; i < nsubs; i++) close(fds[i]);
+    if (epfd >= 0) close(epfd);
+
+    char what[64];
+    snprintf(what, sizeof(what), "%d subscribers", nsubs);
+    bench_report("subscribe", what, h, secs, "msg");
+    printf("subscribe %lu samples published, %lu dropped by lapped cursors, %d streams closed early\n", published,
+           dropped, closed);
+    bench_rss("subscribe");
+    free(fds);
+    free(subs);
+    free(h);
+    return 0;
 }
 
-/* TCP network service: allow clients to connect & get JSON status */
-void *network_thread(void *arg) {
-    (void)arg;
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        perror("socket");
-        return NULL;
+static int bench_procs(const bench_opts_t *o) {
+    pid_t *kids = calloc((size_t)o->procs, sizeof(pid_t));
+    if (!kids) return 1;
+    int nkids = 0;
+    fflush(stdout);
+    for (; nkids < o->procs; nkids++) {
+        pid_t pid = fork();
+        if (pid < 0) break;
+        if (pid == 0) {
+            for (;;) pause();
+        }
+        kids[nkids] = pid;
     }
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(listen_port);
-    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        close(server_fd);
-        return NULL;
+    if (nkids < o->procs) printf("procs  fork stopped after %d children: %s\n", nkids, strerror(errno));
+
+    proc_ctx_t ctx;
+    int rc = 0;
+    if (proc_init(&ctx) != 0) {
+        rc = 1;
+    } else {
+        instr_hist_t *h_cpu = bench_hist(), *h_wall = bench_hist();
+        collect_procs(&ctx);  // first sight of every pid: opens & reads all, not steady state
+        uint64_t start = mono_ns(), end = start + (uint64_t)o->duration_ms * 1000000u;
+        int scans = 0;
+        uint64_t cpu_total = 0;
+        while (mono_ns() < end || scans < PROC_IDLE_STRIDE) {
+            struct timespec c0, c1;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c0);
+            uint64_t t0 = mono_ns();
+            collect_procs(&ctx);
+            uint64_t wall = mono_ns() - t0;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+            uint64_t cpu = (uint64_t)(c1.tv_sec - c0.tv_sec) * 1000000000u + (uint64_t)c1.tv_nsec - (uint64_t)c0.tv_nsec;
+            instr_hist_record(h_cpu, cpu);
+            instr_hist_record(h_wall, wall);
+            cpu_total += cpu;
+            scans++;
+        }
+        double secs = (double)(mono_ns() - start) / 1e9;
+        char what[64];
+        snprintf(what, sizeof(what), "scan cpu (%lu procs)", proctop.nprocs);
+        bench_report("procs", what, h_cpu, secs, "scans");
+        bench_report("procs", "scan wall", h_wall, secs, "scans");
+        double per_scan = (double)cpu_total / scans;
+        printf("procs  %.0f us cpu per scan (%.2f us per process, %d of %d stat fds cached, %lu of %d scans full) = "
+               "%.2f%% of one CPU at PROC_INTERVAL_MS=%d\n",
+               per_scan / 1e3, per_scan / 1e3 / (double)(proctop.nprocs ? proctop.nprocs : 1), ctx.cached,
+               ctx.fd_budget, ctx.full_scans - 1, scans, per_scan / 1e6 / config_get()->proc_interval_ms * 100.0,
+               config_get()->proc_interval_ms);
+        bench_rss("procs");
+        proc_destroy(&ctx);
+        free(h_cpu);
+        free(h_wall);
     }
-    if (listen(server_fd, 5) < 0) {
-        perror("listen");
-        close(server_fd);
-        return NULL;
+    for (int i = 0; i < nkids; i++) kill(kids[i], SIGKILL);
+    for (int i = 0; i < nkids; i++) waitpid(kids[i], NULL, 0);
+    free(kids);
+    return rc;
+}
+
+/* Correctness checks (make check; --check).
+ *
+ * Run against the bench fixtures & a few hand-written edge cases: the stat,
+ * meminfo & mountinfo parsers, the Gorilla history encoding (bit-exact round
+ * trip), ring_read_after, the get query & HTTP request-line parsers, & the
+ * log matcher against a naive per-line search with every chunk split. Each
+ * failed expectation is printed with its line; the exit status is non-zero if
+ * any failed. */
+
+static int check_failures;
+
+#define CHECK(cond)                                                               \
+    do {                                                                          \
+        if (!(cond)) {                                                            \
+            fprintf(stderr, "check failed: %s (syswatch.c:%d)\n", #cond, __LINE__); \
+            check_failures++;                                                     \
+        }                                                                         \
+    } while (0)
+
+static int check_near(double a, double b) {
+    return a - b < 1e-9 && b - a < 1e-9;
+}
+
+static void check_report(const char *what, int failures0) {
+    printf("check  %-28s %s\n", what, check_failures == failures0 ? "ok" : "FAILED");
+}
+
+static void check_parsers(const bench_opts_t *o) {
+    int f0 = check_failures;
+    char path_stat[128], path_mem[128], path_mnt[128];
+    snprintf(path_stat, sizeof(path_stat), "%s/stat", o->dir);
+    snprintf(path_mem, sizeof(path_mem), "%s/meminfo", o->dir);
+    snprintf(path_mnt, sizeof(path_mnt), "%s/mountinfo", o->dir);
+    CHECK(bench_fixtures(o, path_stat, path_mem, path_mnt) == 0);
+
+    /* stat: aggregate & per-core lines, through the pread path */
+    proc_file_t pf;
+    proc_file_init(&pf, path_stat);
+    cpu_times_t t, cores[8];
+    memset(cores, 0, sizeof(cores));
+    CHECK(read_cpu_times(&pf, &t, cores, 8) == 0);
+    CHECK(t.user == 1000ULL * (unsigned)o->cores && t.system == 500ULL * (unsigned)o->cores);
+    CHECK(t.idle == 90000ULL * (unsigned)o->cores && t.iowait == 100 && t.softirq == 5);
+    for (int i = 0; i < o->cores && i < 8; i++) CHECK(cores[i].user == 1000 && cores[i].idle == 90000);
+    proc_file_close(&pf);
+    cpu_times_t a = { 100, 0, 100, 700, 100, 0, 0, 0 }, b = { 200, 0, 200, 1300, 200, 50, 50, 0 };
+    CHECK(check_near(calc_cpu_usage(&a, &b), 30.0));  // 300 busy of 1000
+    CHECK(calc_cpu_usage(&a, &a) == 0.0);
+    CHECK(parse_cpu_stat("intr 1 2 3\n", &t, NULL, 0) == -1);
+    check_report("stat parser", f0);
+
+    /* meminfo */
+    f0 = check_failures;
+    mem_stats_t ms;
+    CHECK(parse_meminfo("MemTotal:       1000 kB\nMemFree:         100 kB\nMemAvailable:    600 kB\n"
+                        "Buffers:          50 kB\nCached:          500 kB\nSwapCached:        0 kB\n"
+                        "SwapTotal:       200 kB\nSwapFree:         150 kB\nDirty:             7 kB\n"
+                        "Writeback:         3 kB\nShmem:            20 kB\nSReclaimable:     40 kB\n"
+                        "MemTotal:          1 kB\n",  // past the last key: never read
+                        &ms) == 0);
+    CHECK(ms.total == 1000 && ms.have_available && ms.dirty == 7 && ms.writeback == 3);
+    CHECK(check_near(mem_used_percent(&ms), 40.0));  // Total - Free - Buffers - Cached would underflow
+    CHECK(check_near(swap_used_percent(&ms), 25.0));
+    CHECK(parse_meminfo("MemTotal: 1000 kB\nMemFree: 100 kB\nBuffers: 50 kB\nCached: 300 kB\n"
+                        "Shmem: 100 kB\nSReclaimable: 50 kB\n",
+                        &ms) == 0);
+    CHECK(!ms.have_available && check_near(mem_used_percent(&ms), 60.0));  // 1000 - (100+50+300+50-100)
+    CHECK(parse_meminfo("MemFree: 100 kB\n", &ms) == -1 && mem_used_percent(&ms) == 0.0);
+    proc_file_init(&pf, path_mem);
+    double mem = read_memory_usage(&pf, &ms);
+    CHECK(check_near(mem, 10.0));  // fixture: MemTotal 8000000, MemAvailable 7200000
+    proc_file_close(&pf);
+    double some, full;
+    CHECK(parse_psi("some avg10=1.25 avg60=0.50 avg300=0.10 total=12345\n"
+                    "full avg10=0.75 avg60=0.20 avg300=0.05 total=2345\n",
+                    &some, &full) == 0);
+    CHECK(check_near(some, 1.25) && check_near(full, 0.75));
+    CHECK(parse_psi("", &some, &full) == -1);
+    check_report("meminfo parser", f0);
+
+    /* mountinfo: fixtures (pseudo filesystems skipped), then optional fields,
+     * octal escapes & the same device mounted twice */
+    f0 = check_failures;
+    proc_file_init(&pf, path_mnt);
+    size_t n = 0;
+    mount_ent_t *m = proc_file_read(&pf) == 0 ? parse_mountinfo(pf.buf, &n) : NULL;
+    CHECK(n == (size_t)o->mounts);
+    for (size_t i = 0; m && i < n; i++) {
+        CHECK(m[i].major == 8 && m[i].minor == i);
+        CHECK(strcmp(m[i].fstype, i % 3 ? "xfs" : "ext4") == 0);
+        CHECK(strcmp(m[i].path, i ? "/srv/data" : "/") == 0);
     }
-    fd_set readset;
-    struct timeval tv;
-    while (atomic_load(&running)) {
-        FD_ZERO(&readset);
-        FD_SET(server_fd, &readset);
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        int r = select(server_fd + 1, &readset, NULL, NULL, &tv);
-        if (r > 0 && FD_ISSET(server_fd, &readset)) {
-            int c = accept(server_fd, NULL, NULL);
-            if (c >= 0) {
-                metric_sample_t *snap = calloc(ringbuf.size, sizeof(metric_sample_t));
-                if (!snap) { close(c); continue; }
-                size_t len = 0;
-                ring_snapshot(&ringbuf, snap, &len);
-
-                pthread_mutex_lock(&sys_metrics.data_lock);
-                double cpu = sys_metrics.cpu_usage;
-                double mem = sys_metrics.memory_usage;
-                double disk = sys_metrics.disk_usage;
-                pthread_mutex_unlock(&sys_metrics.data_lock);
-
-                char out[8192];
-                int offs = snprintf(out, sizeof(out),
-                                     "{ \"current\": { \"cpu\": %.2f, \"memory\": %.2f, \"disk\": %.2f }, \"samples\": [",
-                                     cpu, mem, disk);
-                for (size_t i = 0; i < len; i++) {
-                    char ts[64];
-                    struct tm tm;
-                    localtime_r(&snap[i].timestamp, &tm);
-                    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
-                    offs += snprintf(out + offs, sizeof(out) - offs,
-                                     "{\"timestamp\":\"%s\",\"cpu\":%.2f,\"memory\":%.2f,\"disk\":%.2f}%s",
-                                     ts, snap[i].cpu_usage, snap[i].memory_usage, snap[i].disk_usage,
-                                     (i + 1 < len) ? "," : "");
-                    if (offs > (int)sizeof(out) - 200) break;
+    mount_ents_free(m, n);
+    proc_file_close(&pf);
+    m = parse_mountinfo("36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 shared:7 - ext3 /dev/root rw\n"
+                        "37 35 98:1 / /mnt/with\\040space rw - xfs /dev/sdb1 rw\n"
+                        "38 35 98:0 / /srv rw - ext3 /dev/root rw\n"
+                        "39 35 0:22 / /proc rw - proc proc rw\n",
+                        &n);
+    CHECK(n == 2);
+    if (m && n == 2) {
+        CHECK(m[0].major == 98 && m[0].minor == 0 && strcmp(m[0].path, "/srv") == 0);  // root mount wins
+        CHECK(strcmp(m[0].fstype, "ext3") == 0);
+        CHECK(strcmp(m[1].path, "/mnt/with space") == 0 && strcmp(m[1].fstype, "xfs") == 0);
+    }
+    mount_ents_free(m, n);
+    check_report("mountinfo parser", f0);
+}
+
+typedef struct {
+    size_t n, cap;
+    int64_t *ts;
+    double *v;  // HIST_RAW_COLS per point
+} check_points_t;
+
+static void check_collect_point(void *ctx, int64_t ts, const double *vals) {
+    check_points_t *c = ctx;
+    if (c->n == c->cap) return;
+    c->ts[c->n] = ts;
+    memcpy(&c->v[c->n * HIST_RAW_COLS], vals, HIST_RAW_COLS * sizeof(double));
+    c->n++;
+}
+
+static void check_history(void) {
+    int f0 = check_failures;
+    enum { NPOINTS = 5000 };
+    hist_tier_t t;
+    CHECK(hist_tier_init(&t, HIST_RAW_COLS, 1024) == 0);
+    int64_t *ts = calloc(NPOINTS, sizeof(int64_t));
+    uint64_t *q = calloc((size_t)NPOINTS * HIST_RAW_COLS, sizeof(uint64_t));
+    check_points_t got = { 0, NPOINTS, calloc(NPOINTS, sizeof(int64_t)),
+                           calloc((size_t)NPOINTS * HIST_RAW_COLS, sizeof(double)) };
+    if (!ts || !q || !got.ts || !got.v || !t.blocks) {
+        CHECK(!"allocation");
+        return;
+    }
+    /* regular ticks, jitter, long gaps & repeats; values that stay, creep & jump */
+    uint32_t rnd = 12345;
+    int64_t now = 1700000000;
+    for (int i = 0; i < NPOINTS; i++) {
+        rnd = rnd * 1103515245u + 12345u;
+        int r = (int)(rnd >> 16) % 100;
+        now += r < 70 ? 5 : r < 90 ? 4 + r % 3 : r < 97 ? 600 : 90000 + r;
+        ts[i] = now;
+        double v[HIST_RAW_COLS] = { (rnd >> 8) % 10000 / 100.0, 40.0 + (i % 7) * 0.01, 63.0, r < 50 ? 0.0 : 100.0,
+                                    -(double)(i % 3) };
+        for (int c = 0; c < HIST_RAW_COLS; c++) q[(size_t)i * HIST_RAW_COLS + c] = hist_quantize(v[c]);
+        hist_tier_append(&t, ts[i], &q[(size_t)i * HIST_RAW_COLS]);
+    }
+    CHECK(t.count > 1 && t.count < t.nblocks);  // spans blocks, nothing dropped
+    for (size_t b = 0; b < t.count; b++)
+        hist_block_decode(t.blocks + b * HIST_BLOCK_BYTES, HIST_RAW_COLS, INT64_MIN, INT64_MAX, check_collect_point,
+                          &got);
+    CHECK(got.n == NPOINTS);
+    for (size_t i = 0; i < got.n && i < NPOINTS; i++) {
+        CHECK(got.ts[i] == ts[i]);
+        for (int c = 0; c < HIST_RAW_COLS; c++)
+            CHECK(hist_quantize(got.v[i * HIST_RAW_COLS + c]) == q[i * HIST_RAW_COLS + c]);
+        if (check_failures - f0 > 10) break;
+    }
+    /* range filter */
+    got.n = 0;
+    for (size_t b = 0; b < t.count; b++)
+        hist_block_decode(t.blocks + b * HIST_BLOCK_BYTES, HIST_RAW_COLS, ts[100], ts[199], check_collect_point, &got);
+    CHECK(got.n == 100 && got.ts[0] == ts[100]);
+    free(t.blocks);
+    free(ts);
+    free(q);
+    free(got.ts);
+    free(got.v);
+    check_report("gorilla round trip", f0);
+}
+
+static void check_ring(void) {
+    int f0 = check_failures;
+    for (size_t size = 1; size <= 8; size++) {
+        ringbuffer_t r;
+        ring_init(&r, size);
+        for (unsigned long pushes = 0; pushes <= 20; pushes++) {
+            for (unsigned long after = 0; after <= pushes + 1; after++) {
+                for (size_t max = 0; max <= 9; max++) {
+                    metric_sample_t out[9];
+                    unsigned long first;
+                    size_t n = ring_read_after(&r, after, out, max, &first);
+                    unsigned long oldest = pushes >= size ? pushes - size + 1 : 1;
+                    unsigned long want_first = after + 1 > oldest ? after + 1 : oldest;
+                    size_t want = pushes >= want_first ? (size_t)(pushes - want_first + 1) : 0;
+                    if (want > max) want = max;
+                    CHECK(n == want);
+                    for (size_t i = 0; i < n && n == want; i++) CHECK(out[i].timestamp == (time_t)(want_first + i));
                 }
-                offs += snprintf(out + offs, sizeof(out) - offs, "] }\n");
-                send(c, out, strlen(out), 0);
-                close(c);
-                free(snap);
             }
-        } else if (r < 0 && errno != EINTR) {
-            /* error */
+            metric_sample_t smp = { .timestamp = (time_t)(pushes + 1) };
+            ring_push(&r, &smp);
         }
+        ring_free(&r);
     }
-    close(server_fd);
+    check_report("ring_read_after", f0);
+
+    /* resizing keeps the newest samples & their sequence numbers */
+    f0 = check_failures;
+    for (size_t from = 1; from <= 6; from++)
+        for (size_t to = 1; to <= 6; to++)
+            for (unsigned long pushes = 0; pushes <= 9; pushes++) {
+                ringbuffer_t r;
+                ring_init(&r, from);
+                for (unsigned long i = 1; i <= pushes; i++) {
+                    metric_sample_t smp = { .timestamp = (time_t)i };
+                    ring_push(&r, &smp);
+                }
+                CHECK(ring_resize(&r, to) == 0 && ring_capacity(&r) == to);
+                metric_sample_t smp = { .timestamp = (time_t)(pushes + 1) };
+                ring_push(&r, &smp);
+                size_t held = pushes < from ? pushes : from, want = held + 1 < to ? held + 1 : to;
+                metric_sample_t out[8];
+                size_t len;
+                ring_snapshot(&r, out, 8, &len);
+                CHECK(len == want);
+                for (size_t i = 0; i < len && len == want; i++)
+                    CHECK(out[i].timestamp == (time_t)(pushes + 2 - want + i));
+                unsigned long first;
+                CHECK(ring_read_after(&r, 0, out, 8, &first) == want && first == pushes + 2 - want);
+                ring_snapshot(&r, out, 1, &len);  // a short copy takes the newest
+                CHECK(len == 1 && out[0].timestamp == (time_t)(pushes + 1));
+                ring_free(&r);
+            }
+    check_report("ring_resize", f0);
+}
+
+/* config_parse: every parse starts from the defaults */
+static void check_config(const bench_opts_t *o) {
+    int f0 = check_failures;
+    char path[128];
+    snprintf(path, sizeof(path), "%s/syswatch.cfg", o->dir);
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fputs("# comment\nPORT=12345\nRING_SIZE=7\nLOGFILES=/a.log, /b.log,,\nLOGFILES=/c.log,/d.log\n"
+          "LOG_PATTERNS=oops\nALERT cpu>90 for 30s\nALERT=disk>95\nCPU_INTERVAL_MS=3\nPUSH_FORMAT=statsd\n"
+          "CPU_AFFINITY=2-3\nCPU_AFFINITY_NET=0,5\nCPU_AFFINITY_NET=x\nCPU_AFFINITY_BOGUS=1\nCPU_AFFINITY_LOG=\n"
+          "COLLECTOR_SCHED=idle\nCOLLECTOR_NICE=25\nMLOCK=1\n", f);
+    fclose(f);
+    config_t *c = config_parse(path);
+    CHECK(c != NULL);
+    if (c) {
+        CHECK(c->listen_port == 12345 && c->ring_size == 7 && c->n_logfiles == 2);
+        CHECK(c->n_logfiles == 2 && strcmp(c->logfiles[0], "/c.log") == 0 && strcmp(c->logfiles[1], "/d.log") == 0);
+        CHECK(strcmp(c->log_patterns, "oops") == 0 && c->push_statsd == 1);
+        CHECK(c->n_alert_rules == 2 && strcmp(c->alert_rules[1], "disk>95") == 0);
+        CHECK(c->cpu_interval_ms == DEFAULT_CPU_INTERVAL_MS);  // below MIN_INTERVAL_MS
+        CHECK(c->listen_backlog == DEFAULT_LISTEN_BACKLOG && c->writer_fsync == 1);
+        CHECK(c->cpu_affinity_set == (1u << THR_NET | 1u << THR_ROLES) && CPU_COUNT(&c->cpu_affinity[THR_ROLES]) == 2);
+        CHECK(CPU_ISSET(0, &c->cpu_affinity[THR_NET]) && CPU_ISSET(5, &c->cpu_affinity[THR_NET]) &&
+              CPU_COUNT(&c->cpu_affinity[THR_NET]) == 2);  // the bad list keeps the earlier one
+        CHECK(c->collector_idle == 1 && c->collector_nice == COLLECTOR_NICE_UNSET && c->mlock == 1);
+        config_t *d = config_dup(c);
+        CHECK(d && d->n_logfiles == 2 && d->logfiles[0] != c->logfiles[0] && strcmp(d->logfiles[1], "/d.log") == 0);
+        config_free(d);
+        config_free(c);
+    }
+    f = fopen(path, "w");
+    if (f) {
+        fputs("PORT=0\n", f);
+        fclose(f);
+    }
+    c = config_parse(path);
+    CHECK(c && c->listen_port == DEFAULT_PORT && c->ring_size == DEFAULT_RING_SIZE && c->n_logfiles == 0 &&
+          c->n_alert_rules == 0 && strcmp(c->log_patterns, DEFAULT_LOG_PATTERNS) == 0);
+    config_free(c);
+    unlink(path);
+    CHECK(config_parse(path) == NULL);
+    cpu_set_t set;
+    CHECK(parse_cpu_list("0-2, 7,9-9", &set) == 0 && CPU_COUNT(&set) == 5 && CPU_ISSET(7, &set) && CPU_ISSET(9, &set));
+    CHECK(parse_cpu_list("", &set) == 0 && CPU_COUNT(&set) == 0);
+    CHECK(parse_cpu_list("3-1", &set) != 0 && parse_cpu_list("1,", &set) == 0 && parse_cpu_list("a", &set) != 0);
+    CHECK(parse_cpu_list("-1", &set) != 0 && parse_cpu_list("0-99999", &set) != 0 && parse_cpu_list("1 2", &set) != 0);
+    check_report("config_parse", f0);
+}
+
+typedef struct {
+    atomic_int step;  // 1: sampled at start, 2: sample again, 3: sampled again
+    char name[16];
+    cpu_set_t cpus[2];
+    int nice[2];
+} check_thread_t;
+
+static void check_thread_sample(check_thread_t *t, int i) {
+    sched_getaffinity(0, sizeof(t->cpus[i]), &t->cpus[i]);
+    t->nice[i] = getpriority(PRIO_PROCESS, 0);
+}
+
+static void *check_thread_fn(void *arg) {
+    check_thread_t *t = arg;
+    pthread_getname_np(pthread_self(), t->name, sizeof(t->name));
+    check_thread_sample(t, 0);
+    atomic_store(&t->step, 1);
+    while (atomic_load(&t->step) != 2) {
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+    }
+    check_thread_sample(t, 1);
+    atomic_store(&t->step, 3);
     return NULL;
 }
 
-/* Signal handling thread using sigwait */
-void *signal_thread(void *arg) {
-    (void)arg;
-    sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGTERM);
-    sigaddset(&set, SIGUSR1);
-    sigaddset(&set, SIGHUP);
+static void check_thread_wait(check_thread_t *t, int step) {
+    for (int i = 0; i < 5000 && atomic_load(&t->step) != step; i++) {
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+    }
+}
 
-    while (atomic_load(&running)) {
-        int sig;
-        int r = sigwait(&set, &sig);
-        if (r != 0) continue;
-        if (sig == SIGTERM) {
-            fprintf(stderr, "Received SIGTERM -> shutting down gracefully\n");
-            atomic_store(&running, 0);
-        } else if (sig == SIGUSR1) {
-            fprintf(stderr, "Received SIGUSR1 -> forcing metrics dump\n");
-            dump_metrics_to_file();
-        } else if (sig == SIGHUP) {
-            fprintf(stderr, "Received SIGHUP -> reload config\n");
-            reload_config();
+/* thread_spawn: the name, a pinned CPU & nice at start, then both re-applied
+ * by a reload (the pin dropped back to the inherited set) */
+static void check_threads(void) {
+    int f0 = check_failures;
+    cpu_set_t base;
+    CHECK(sched_getaffinity(0, sizeof(base), &base) == 0);
+    int cpu = 0;
+    while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &base)) cpu++;
+    int nice0 = getpriority(PRIO_PROCESS, 0), nice1 = nice0 < 18 ? nice0 + 1 : nice0;
+    config_t *c = config_dup(config_get());
+    if (!c) return;
+    CPU_ZERO(&c->cpu_affinity[THR_COLLECT]);
+    CPU_SET(cpu, &c->cpu_affinity[THR_COLLECT]);
+    c->cpu_affinity_set = 1u << THR_COLLECT;
+    c->collector_nice = nice1;
+    config_replace(c);
+    static check_thread_t t;
+    pthread_t th;
+    CHECK(thread_spawn(&th, NULL, THR_COLLECT, "sw-check-thread-long", check_thread_fn, &t) == 0);
+    check_thread_wait(&t, 1);
+    CHECK(strcmp(t.name, "sw-check-thread") == 0);  // 15 characters kept
+    CHECK(CPU_COUNT(&t.cpus[0]) == 1 && CPU_ISSET(cpu, &t.cpus[0]) && t.nice[0] == nice1);
+    c = config_dup(config_get());
+    if (c) {
+        c->cpu_affinity_set = 0;
+        c->collector_nice = COLLECTOR_NICE_UNSET;
+        config_replace(c);
+    }
+    atomic_store(&t.step, 2);
+    check_thread_wait(&t, 3);
+    pthread_join(th, NULL);
+    CHECK(CPU_EQUAL(&t.cpus[1], &base) && (t.nice[1] == nice0 || geteuid() != 0));  // lowering nice is privileged
+    check_report("thread placement", f0);
+}
+
+static void check_count_point(void *ctx, int64_t ts, const double *vals) {
+    (void)ts;
+    (void)vals;
+    (*(size_t *)ctx)++;
+}
+
+/* raw history points held by hs */
+static size_t check_state_points(history_t *hs) {
+    size_t nblk, n = 0;
+    unsigned char *b = history_copy_blocks(hs, HIST_RAW, 0, INT64_MAX, &nblk);
+    for (size_t i = 0; i < nblk; i++)
+        hist_block_decode(b + i * HIST_BLOCK_BYTES, HIST_RAW_COLS, 0, INT64_MAX, check_count_point, &n);
+    free(b);
+    return n;
+}
+
+/* Attach a fresh ring & history to path, as a restart would */
+static int check_state_open(state_file_t *sf, const char *path, size_t slots, const size_t *blocks,
+                            ringbuffer_t *r, history_t *hs) {
+    memset(sf, 0, sizeof(*sf));
+    sf->fd = -1;
+    memset(hs, 0, sizeof(*hs));
+    pthread_mutex_init(&hs->lock, NULL);
+    if (state_open(sf, path, slots, blocks) != 0) return -1;
+    state_attach(sf, r, hs);
+    return 0;
+}
+
+/* state file: samples & history survive a restart, a layout change & a live
+ * ring resize; a damaged file is replaced & a locked one refused */
+/* Every sample field survives the binary log; a version 1 file is refused */
+static void check_binlog(const bench_opts_t *o) {
+    int f0 = check_failures;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/metrics.bin", o->dir);
+    metric_sample_t m[2];
+    memset(m, 0, sizeof(m));
+    for (int r = 0; r < 2; r++) {
+        m[r].timestamp = 1700000000 + r;
+        for (size_t i = 0; i < N_SAMPLE_FIELDS; i++) {
+            char *p = (char *)&m[r] + sample_fields[i].off;
+            if (sample_fields[i].is_u64) *(uint64_t *)p = 1000000007ull * (i + 1) + (uint64_t)r;
+            else *(double *)p = 1.25 * (double)(i + 1) + r;
         }
     }
-    return NULL;
+    unsigned char recs[2 * BINLOG_RECORD_SIZE];
+    binlog_encode(recs, &m[0]);
+    binlog_encode(recs + BINLOG_RECORD_SIZE, &m[1]);
+    binlog_t b = { PTHREAD_MUTEX_INITIALIZER, -1, "", 0, 0 };
+    CHECK(binlog_write_batch(&b, path, recs, 2, 0) == 0);
+    binlog_close(&b);
+
+    CHECK(binlog_open(&b, path) == 0 && b.next == BINLOG_HEADER_SIZE + 2 * (off_t)BINLOG_RECORD_SIZE);
+    unsigned char rec[BINLOG_RECORD_SIZE];
+    for (int r = 0; r < 2 && b.fd >= 0; r++) {
+        metric_sample_t got;
+        CHECK(pread(b.fd, rec, sizeof(rec), BINLOG_HEADER_SIZE + r * (off_t)BINLOG_RECORD_SIZE) == (ssize_t)sizeof(rec));
+        binlog_decode(rec, &got);
+        CHECK(got.timestamp == m[r].timestamp);
+        for (size_t i = 0; i < N_SAMPLE_FIELDS; i++) CHECK(sample_field(&got, i) == sample_field(&m[r], i));
+    }
+    binlog_close(&b);
+
+    unsigned char hdr[BINLOG_HEADER_SIZE];
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    CHECK(fd >= 0 && pread(fd, hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) && binlog_header_check(hdr) == NULL);
+    put_le64(hdr + 8, 1);
+    put_le64(hdr + 16, 48);
+    CHECK(binlog_header_check(hdr) != NULL);
+    CHECK(fd >= 0 && pwrite(fd, hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr));
+    if (fd >= 0) close(fd);
+    CHECK(binlog_open(&b, path) != 0);
+    unlink(path);
+    check_report("binary log records", f0);
 }
 
-/* Dump ring buffer to metrics_logfile now */
-void dump_metrics_to_file() {
-    metric_sample_t *tmp = calloc(ringbuf.size, sizeof(metric_sample_t));
-    if (!tmp) return;
-    size_t len = 0;
-    ring_snapshot(&ringbuf, tmp, &len);
-    FILE *f = fopen(metrics_logfile, "a");
-    if (!f) { free(tmp); return; }
-    char timestr[64];
-    time_t t = time(NULL);
-    struct tm tm;
-    localtime_r(&t, &tm);
-    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
-    fprintf(f, "%s DUMP START (last %zu samples)\n", timestr, len);
-    for (size_t i = 0; i < len; i++) {
-        struct tm tm2;
-        localtime_r(&tmp[i].timestamp, &tm2);
-        char ts[64];
-        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm2);
-        fprintf(f, "%s cpu=%.2f mem=%.2f disk=%.2f\n", ts, tmp[i].cpu_usage, tmp[i].memory_usage,
-                tmp[i].disk_usage);
-    }
-    fprintf(f, "%s DUMP END\n", timestr);
-    fclose(f);
-    free(tmp);
+static void check_state(const bench_opts_t *o) {
+    int f0 = check_failures;
+    char path[128];
+    snprintf(path, sizeof(path), "%s/syswatch.state", o->dir);
+    size_t blocks[HIST_TIERS] = { 2, 1, 0 };
+    state_file_t sf, other;
+    ringbuffer_t r, r2;
+    history_t hs, hs2;
+    metric_sample_t out[8];
+    size_t len;
+    unlink(path);
+    CHECK(check_state_open(&sf, path, 4, blocks, &r, &hs) == 0 && sf.restored == 0);
+    for (int i = 1; i <= 6; i++) {
+        metric_sample_t smp = { .cpu_usage = i, .timestamp = 1700000000 + 5 * i };
+        ring_push(&r, &smp);
+        history_add(&hs, &smp);
+    }
+    CHECK(check_state_open(&other, path, 4, blocks, &r2, &hs2) != 0 && errno == EBUSY);
+    state_unmap(&sf);  // exits without msync: the page cache has it all
+
+    CHECK(check_state_open(&sf, path, 4, blocks, &r, &hs) == 0 && sf.restored == 6);
+    ring_snapshot(&r, out, 8, &len);
+    CHECK(len == 4 && out[0].cpu_usage == 3 && out[3].timestamp == 1700000030);
+    CHECK(check_state_points(&hs) == 6);
+    metric_sample_t smp = { .cpu_usage = 7, .timestamp = 1700000035 };
+    ring_push(&r, &smp);
+    history_add(&hs, &smp);  // continues the open block
+    CHECK(check_state_points(&hs) == 7 && hs.tiers[HIST_RAW].count == 1);
+    state_unmap(&sf);
+
+    /* RING_SIZE & HISTORY_1M_KB changed across the restart */
+    size_t blocks2[HIST_TIERS] = { 2, 3, 0 };
+    CHECK(check_state_open(&sf, path, 2, blocks2, &r, &hs) == 0 && sf.restored == 7);
+    ring_snapshot(&r, out, 8, &len);
+    CHECK(len == 2 && out[0].cpu_usage == 6 && out[1].cpu_usage == 7);
+    CHECK(check_state_points(&hs) == 7 && hs.tiers[HIST_1M].nblocks == 3);
+
+    /* reload: RING_SIZE=8 while running */
+    CHECK(state_resize_ring(&sf, &r, &hs, 8) == 0 && ring_capacity(&r) == 8);
+    smp.cpu_usage = 8;
+    smp.timestamp += 5;
+    ring_push(&r, &smp);
+    history_add(&hs, &smp);
+    state_close(&sf);
+    CHECK(check_state_open(&sf, path, 8, blocks2, &r, &hs) == 0 && sf.restored == 8);
+    ring_snapshot(&r, out, 8, &len);
+    CHECK(len == 3 && out[2].cpu_usage == 8 && check_state_points(&hs) == 8);
+    state_unmap(&sf);
+
+    FILE *f = fopen(path, "r+");
+    if (f) {
+        fputs("garbage", f);
+        fclose(f);
+    }
+    CHECK(check_state_open(&sf, path, 8, blocks2, &r, &hs) == 0 && sf.restored == 0 && atomic_load(&r.count) == 0);
+    CHECK(check_state_points(&hs) == 0);
+    state_unmap(&sf);
+    unlink(path);
+    check_report("state_file", f0);
 }
 
-/* reload_config callable from SIGHUP handler */
-void reload_config() {
-    fprintf(stderr, "Reloading config: %s\n", config_path);
-    parse_config(config_path);
-    /* In this simple implementation we won't resize ring dynamically. */
+/* diskstats parsing & rates, with a fake /sys/block listing sda & nvme0n1 */
+static void check_diskio(const bench_opts_t *o) {
+    int f0 = check_failures;
+    char sysblock[128], path[160];
+    snprintf(sysblock, sizeof(sysblock), "%s/block", o->dir);
+    mkdir(sysblock, 0700);
+    static const char *const disks[] = { "sda", "nvme0n1" };
+    for (size_t i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/%s", sysblock, disks[i]);
+        mkdir(path, 0700);
+    }
+    static diskio_ctx_t c;
+    memset(&c, 0, sizeof(c));
+    c.sysblock = sysblock;
+    diskio_rate_t row[DISKIO_MAX_DEVS];
+    CHECK(parse_diskstats(&c, "   7       0 loop0 10 0 80 1 0 0 0 0 0 1 1 0 0 0 0\n"
+                              "   8       0 sda 100 5 800 50 200 7 1600 150 0 300 400 0 0 0 0 0 0\n"
+                              "   8       1 sda1 90 5 700 45 190 7 1500 140 0 280 380\n"
+                              " 259       0 nvme0n1 1000 0 8000 100 0 0 0 0 0 100 100\n") == 2);
+    CHECK(diskio_rates(&c, 1000, row) == 0);  // first read only primes
+    CHECK(c.nskip == 2);
+    CHECK(parse_diskstats(&c, "   7       0 loop0 10 0 80 1 0 0 0 0 0 1 1\n"
+                              "   8       0 sda 150 5 1200 100 250 7 2400 250 2 800 900\n"
+                              "   8       1 sda1 140 5 1100 95 240 7 2300 240 0 780 880\n"
+                              " 259       0 nvme0n1 900 0 7000 90 0 0 0 0 0 90 90\n") == 2);
+    size_t n = diskio_rates(&c, 2000, row);
+    CHECK(n == 1 && strcmp(row[0].name, "sda") == 0);  // nvme0n1 went backwards: re-primed instead
+    if (n == 1) {
+        CHECK(check_near(row[0].rd_iops, 25.0) && check_near(row[0].wr_iops, 25.0));
+        CHECK(check_near(row[0].rd_bps, 400.0 * 512 / 2) && check_near(row[0].wr_bps, 800.0 * 512 / 2));
+        CHECK(check_near(row[0].await_ms, 150.0 / 100.0) && check_near(row[0].util, 25.0));
+    }
+    CHECK(parse_diskstats(&c, " 259       0 nvme0n1 1900 0 15000 190 0 0 0 0 0 5090 5090\n") == 1);
+    n = diskio_rates(&c, 1000, row);
+    CHECK(n == 1 && strcmp(row[0].name, "nvme0n1") == 0 && check_near(row[0].rd_iops, 1000.0) &&
+          check_near(row[0].util, 100.0));  // clamped
+    size_t used = 0;
+    for (size_t i = 0; i < DISKIO_MAX_DEVS; i++) used += c.devs[i].used;
+    CHECK(used == 1);  // sda's slot was freed
+
+    diskio_ring_t r;
+    diskio_ring_init(&r, 3);
+    for (int i = 0; i < 5; i++) {
+        diskio_rate_t one = { .rd_iops = (float)i };
+        snprintf(one.name, sizeof(one.name), "d%d", i);
+        diskio_ring_push(&r, (time_t)(100 + i), &one, 1);
+    }
+    static diskio_rate_t rows[4 * DISKIO_MAX_DEVS];
+    time_t ts[4];
+    uint8_t nd[4];
+    CHECK(diskio_ring_read(&r, 4, ts, nd, rows) == 3);
+    CHECK(ts[0] == 102 && ts[2] == 104 && nd[1] == 1 && strcmp(rows[2 * DISKIO_MAX_DEVS].name, "d4") == 0);
+    diskio_ring_free(&r);
+
+    for (size_t i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/%s", sysblock, disks[i]);
+        rmdir(path);
+    }
+    rmdir(sysblock);
+    check_report("diskstats parser & rates", f0);
+}
+
+/* Write one accounting file of the fixture tree */
+static void check_cg_file(const char *root, const char *rel, const char *name, const char *data) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s%s/%s", root, rel[0] ? "/" : "", rel, name);
+    bench_write_file(path, data, strlen(data));
+}
+
+/* cgroup parsers, the slot index under churn & the collector on a fake tree:
+ * rates, inotify tracking of new & removed cgroups, the cgroups request */
+static void check_cgroups(const bench_opts_t *o) {
+    int f0 = check_failures;
+    uint64_t usage, throttled, io[4];
+    CHECK(parse_cg_cpu_stat("usage_usec 1500\nuser_usec 1000\nsystem_usec 500\nnr_periods 4\n"
+                            "nr_throttled 1\nthrottled_usec 250\n", &usage, &throttled) == 0);
+    CHECK(usage == 1500 && throttled == 250);
+    CHECK(parse_cg_cpu_stat("user_usec 1\n", &usage, &throttled) != 0);
+    parse_cg_io_stat("8:0 rbytes=100 wbytes=200 rios=1 wios=2 dbytes=0 dios=0\n"
+                     "259:0 rbytes=1000 wbytes=2000 rios=10 wios=20 dbytes=5 dios=1\n", io);
+    CHECK(io[0] == 1100 && io[1] == 2200 && io[2] == 11 && io[3] == 22);
+
+    cg_index_t ix;
+    CHECK(cg_index_init(&ix, 512) == 0);
+    for (int32_t i = 0; i < 512; i++) cg_index_put(&ix, (uint64_t)(i % 97) << 40 | (uint64_t)i, i);
+    for (int32_t i = 0; i < 512; i += 2) cg_index_del(&ix, (uint64_t)(i % 97) << 40 | (uint64_t)i, i);
+    int found = 0;
+    for (int32_t i = 0; i < 512; i++) {
+        uint64_t key = (uint64_t)(i % 97) << 40 | (uint64_t)i;
+        size_t pos = cg_index_home(&ix, key);
+        found += cg_index_scan(&ix, key, &pos) == ((i & 1) ? i : -1);
+    }
+    CHECK(found == 512);
+    cg_index_free(&ix);
+
+    char root[128], path[256];
+    snprintf(root, sizeof(root), "%s/cgroup", o->dir);
+    static const char *const dirs[] = { "", "a", "a/b", "c" };
+    for (size_t i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s%s%s", root, dirs[i][0] ? "/" : "", dirs[i]);
+        mkdir(path, 0700);
+        check_cg_file(root, dirs[i], "cpu.stat", "usage_usec 1000000\nthrottled_usec 0\n");
+        check_cg_file(root, dirs[i], "memory.current", "4096\n");
+    }
+    check_cg_file(root, "", "cgroup.controllers", "cpu io memory\n");
+    check_cg_file(root, "a", "io.stat", "8:0 rbytes=0 wbytes=0 rios=0 wios=0\n");
+    check_cg_file(root, "a", "memory.pressure", "some avg10=2.50 avg60=1.00 avg300=0.50 total=1\n"
+                                                "full avg10=1.00 avg60=0.00 avg300=0.00 total=1\n");
+    cgtab_init(8, 4);
+    static cg_ctx_t c;
+    CHECK(cg_init(&c, root) == 0 && cgtab.n == 4 && cgtab_find("a/b") >= 0);
+    check_cg_file(root, "a", "cpu.stat", "usage_usec 1500000\nthrottled_usec 100000\n");
+    check_cg_file(root, "a", "io.stat", "8:0 rbytes=1048576 wbytes=0 rios=256 wios=0\n");
+    c.last_ns = mono_ns() - 1000000000u;  // one second since the priming read
+    collect_cgroups(&c);
+    int32_t a = cgtab_find("a");
+    if (a >= 0) {
+        const cg_rate_t *r = &cgtab.rows[(size_t)a * cgtab.hist + cgtab.ticks % cgtab.hist];
+        // the interval is measured, so allow a few percent of scheduling slack
+        CHECK(r->cpu > 48.0f && r->cpu < 51.0f && r->throttled > 9.5f && r->throttled < 10.2f);
+        CHECK(r->rd_bps > 1000000.0f && r->rd_bps < 1050000.0f && r->rd_iops > 244.0f && r->rd_iops < 257.0f);
+        CHECK(r->mem_bytes == 4096 && r->mem_psi == 2.5f);
+    }
+
+    snprintf(path, sizeof(path), "%s/a/d", root);
+    mkdir(path, 0700);
+    check_cg_file(root, "c", "cpu.stat", "usage_usec 1000000\n");  // fd already open: re-read in place
+    for (int f = 0; f < CG_FILES; f++) {
+        snprintf(path, sizeof(path), "%s/c/%s", root, cg_file_names[f]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/c", root);
+    rmdir(path);
+    collect_cgroups(&c);
+    CHECK(cgtab.n == 4 && cgtab_find("a/d") >= 0 && cgtab_find("c") < 0);
+
+    size_t len;
+    char *reply = cgroups_request("path=/a top=1 sort=cpu", &len);
+    CHECK(reply && strstr(reply, "\"count\": 1") && strstr(reply, "\"path\":\"/a\"") &&
+          strstr(reply, "\"mem_psi\":2.50"));
+    free(reply);
+    reply = cgroups_request("path=/a/b limit=10", &len);
+    CHECK(reply && strstr(reply, "\"count\": 1") && strstr(reply, "\"path\":\"/a/b\",\"samples\":[{") &&
+          strstr(reply, "},{"));  // both ticks
+    free(reply);
+    CHECK(cgroups_request("sort=disk", &len) == NULL);
+
+    cg_destroy(&c);
+    CHECK(cgtab.n == 0);
+    cgtab_free();
+    static const char *const rm[] = { "a/d", "a/b", "a", "" };
+    for (size_t i = 0; i < 4; i++) {
+        for (int f = 0; f < CG_FILES; f++) {
+            snprintf(path, sizeof(path), "%s%s%s/%s", root, rm[i][0] ? "/" : "", rm[i], cg_file_names[f]);
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), "%s%s%s", root, rm[i][0] ? "/" : "", rm[i]);
+        if (!rm[i][0]) {
+            char ctl[300];
+            snprintf(ctl, sizeof(ctl), "%s/cgroup.controllers", root);
+            unlink(ctl);
+        }
+        rmdir(path);
+    }
+    check_report("cgroup collector", f0);
+}
+
+/* /proc/net/dev parsing & rates, with a fake /sys/class/net giving eth0 100 Mb/s */
+static void check_net(const bench_opts_t *o) {
+    int f0 = check_failures;
+    char sysnet[128], path[192];
+    snprintf(sysnet, sizeof(sysnet), "%s/net", o->dir);
+    mkdir(sysnet, 0700);
+    snprintf(path, sizeof(path), "%s/eth0", sysnet);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/eth0/speed", sysnet);
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fputs("100\n", f);
+        fclose(f);
+    }
+    static const char hdr[] =
+        "Inter-|   Receive                                                |  Transmit\n"
+        " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls "
+        "carrier compressed\n";
+    char buf[1024];
+    static net_ctx_t c;
+    memset(&c, 0, sizeof(c));
+    c.sysnet = sysnet;
+    snprintf(buf, sizeof(buf), "%s    lo: 5000 50 0 0 0 0 0 0 5000 50 0 0 0 0 0 0\n"
+                               "  eth0: 1000000 1000 1 2 0 0 0 0 2000000 1500 0 0 0 0 0 0\n"
+                               "  wlan0: 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n", hdr);
+    CHECK(parse_net_dev(&c, buf) == 3);
+    metric_sample_t s;
+    memset(&s, 0, sizeof(s));
+    net_rates(&c, 1000, &s);
+    CHECK(s.net_rx_bps == 0.0 && s.net_util == 0.0);  // first read only primes
+    snprintf(buf, sizeof(buf), "%s    lo: 9000 90 0 0 0 0 0 0 9000 90 0 0 0 0 0 0\n"
+                               "  eth0:3500000 3000 3 2 0 0 0 0 2500000 2500 0 4 0 0 0 0\n", hdr);
+    CHECK(parse_net_dev(&c, buf) == 2);
+    net_rates(&c, 2000, &s);
+    CHECK(check_near(s.net_rx_bps, 1250000.0) && check_near(s.net_tx_bps, 250000.0));  // lo left out
+    CHECK(check_near(s.net_rx_pps, 1000.0) && check_near(s.net_tx_pps, 500.0));
+    CHECK(check_near(s.net_errors, 1.0) && check_near(s.net_drops, 2.0));
+    CHECK(check_near(s.net_util, 10.0));  // 1.25 MB/s = 10 Mb/s of eth0's 100
+    size_t used = 0;
+    for (size_t i = 0; i < NET_MAX_IFACES; i++) used += c.ifs[i].used;
+    CHECK(used == 2);  // wlan0's slot was freed
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/eth0", sysnet);
+    rmdir(path);
+    rmdir(sysnet);
+    check_report("net/dev parser & rates", f0);
+}
+
+/* Feed one value per interval_ms from t0 and count the edges */
+static int check_alert_feed(alert_rule_t *r, const double *v, size_t n, int64_t *t, int interval_ms, int *fired,
+                            int *cleared) {
+    int last = 0;
+    for (size_t i = 0; i < n; i++, *t += interval_ms) {
+        int e = alert_rule_step(r, v[i], *t);
+        if (e > 0) (*fired)++;
+        if (e < 0) (*cleared)++;
+        if (e) last = e;
+    }
+    return last;
+}
+
+static void check_alerts(void) {
+    int f0 = check_failures;
+    alert_rule_t r;
+    int fired = 0, cleared = 0;
+    int64_t t = 0;
+
+    /* sustained threshold: fires only after a full 30 s above, & clears below 85.5 (5 % back) */
+    CHECK(alert_rule_parse(&r, "cpu>90 for 30s") == 0 && r.kind == ALERT_THRESH && r.window_ms == 30000 &&
+          check_near(r.clear, 85.5));
+    CHECK(alert_rule_alloc(&r, 5000) == 0);
+    double high[6] = { 95, 95, 95, 95, 95, 95 };  // t = 0 .. 25 s
+    CHECK(check_alert_feed(&r, high, 6, &t, 5000, &fired, &cleared) == 0 && !r.firing);
+    double one[1] = { 95 };  // t = 30 s
+    CHECK(check_alert_feed(&r, one, 1, &t, 5000, &fired, &cleared) == 1 && r.firing);
+    double hover[8] = { 89, 91, 88, 92, 89, 91, 87, 93 };  // flaps around 90: no new edges
+    check_alert_feed(&r, hover, 8, &t, 5000, &fired, &cleared);
+    CHECK(fired == 1 && cleared == 0 && r.firing);
+    double low[7] = { 80, 80, 80, 80, 80, 80, 80 };
+    CHECK(check_alert_feed(&r, low, 7, &t, 5000, &fired, &cleared) == -1 && !r.firing && cleared == 1);
+    CHECK(check_alert_feed(&r, hover, 8, &t, 5000, &fired, &cleared) == 0 && fired == 1);  // 85.5..90 again
+    alert_rule_free(&r);
+
+    /* rate of change, default window of one unit */
+    CHECK(alert_rule_parse(&r, "disk rate>1%/min") == 0 && r.kind == ALERT_RATE && r.unit_ms == 60000 &&
+          r.window_ms == 60000);
+    CHECK(alert_rule_alloc(&r, 10000) == 0);
+    t = 0;
+    fired = cleared = 0;
+    double disk[8];
+    for (int i = 0; i < 8; i++) disk[i] = 50.0 + 0.5 * i;  // 3 %/min
+    CHECK(check_alert_feed(&r, disk, 8, &t, 10000, &fired, &cleared) == 1 && check_near(r.value, 3.0));
+    double flat[8] = { 53.5, 53.5, 53.5, 53.5, 53.5, 53.5, 53.5, 53.5 };
+    CHECK(check_alert_feed(&r, flat, 8, &t, 10000, &fired, &cleared) == -1 && check_near(r.value, 0.0));
+    alert_rule_free(&r);
+
+    /* window mean & an explicit clear level */
+    CHECK(alert_rule_parse(&r, "memory avg>=80 over 20s clear 70") == 0 && r.kind == ALERT_AVG &&
+          r.op == ALERT_GE && r.clear == 70.0);
+    CHECK(alert_rule_alloc(&r, 1000) == 0);
+    t = 0;
+    fired = cleared = 0;
+    double mem[40];
+    for (int i = 0; i < 40; i++) mem[i] = (i % 2) ? 90 : 72;  // mean 81
+    CHECK(check_alert_feed(&r, mem, 40, &t, 1000, &fired, &cleared) == 1 && fired == 1 && check_near(r.value, 81.0));
+    for (int i = 0; i < 40; i++) mem[i] = 60;
+    CHECK(check_alert_feed(&r, mem, 40, &t, 1000, &fired, &cleared) == -1 && check_near(r.value, 60.0));
+    alert_rule_free(&r);
+
+    CHECK(alert_rule_parse(&r, "net_util<=5 clear 10") == 0 && r.op == ALERT_LE && r.window_ms == 0);
+    CHECK(alert_rule_parse(&r, "swap rate>2/10s over 1m") == 0 && r.unit_ms == 10000 && r.window_ms == 60000);
+    static const char *const bad[] = { "bogus>1", "cpu>>1", "cpu=1", "cpu>", "cpu avg>1", "cpu>1/min",
+                                       "cpu rate>1/", "cpu>90 for", "cpu>90 clear 95", "cpu>90 soon" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) CHECK(alert_rule_parse(&r, bad[i]) == -1);
+    check_report("alert rules", f0);
+}
+
+static void check_query(void) {
+    int f0 = check_failures;
+    query_t q;
+    CHECK(query_parse(&q, "") == 0 && q.fields == QF_ALL && q.limit == -1 && !q.cores && !q.mounts && !q.procs);
+    CHECK(query_parse(&q, "limit=5 fields=cpu,disk,mem_psi_full") == 0 && q.limit == 5 &&
+          q.fields == ((1ULL << sample_field_find("cpu")) | (1ULL << sample_field_find("disk")) |
+                       (1ULL << sample_field_find("mem_psi_full"))));
+    CHECK(query_parse(&q, "cores=0,2-4") == 0 && q.cores == 2 && q.core_sel[0] == 0x1d);
+    CHECK(query_parse(&q, "cores=all mounts=/,/home procs=rss") == 0 && q.cores == 1 && q.mounts == 2 && q.procs == 2);
+    CHECK(query_mount_selected(&q, "/home") && query_mount_selected(&q, "/") && !query_mount_selected(&q, "/hom"));
+    time_t now = time(NULL);
+    CHECK(query_parse(&q, "since=-60") == 0 && q.since >= now - 61 && q.since <= now - 59);
+    CHECK(query_parse(&q, "since=1700000000") == 0 && q.since == 1700000000);
+    CHECK(query_parse(&q, "after=42 limit=16") == 0 && q.has_after && q.after == 42 && q.limit == 16);
+    static const char *const bad[] = { "limit", "limit=-1", "limit=x", "fields=cpu,bogus", "cores=4-2", "cores=a",
+                                       "procs=some", "nosuch=1", "since=soon", "after=-1", "after=x" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) CHECK(query_parse(&q, bad[i]) == -1);
+
+    char cmd[256];
+    CHECK(http_to_command("GET /get?limit=1&fields=cpu%2Cdisk HTTP/1.1", cmd, sizeof(cmd)) == 0 &&
+          strcmp(cmd, "get limit=1 fields=cpu,disk") == 0);
+    CHECK(http_to_command("GET / HTTP/1.0", cmd, sizeof(cmd)) == 0 && strcmp(cmd, "status") == 0);
+    CHECK(http_to_command("GET /metrics HTTP/1.1", cmd, sizeof(cmd)) == 0 && strcmp(cmd, "metrics") == 0);
+    CHECK(http_to_command("POST /get HTTP/1.1", cmd, sizeof(cmd)) == 405);
+    CHECK(http_to_command("HEAD / HTTP/1.1", cmd, sizeof(cmd)) == 405);
+    CHECK(http_to_command("BREW /pot HTTP/1.1", cmd, sizeof(cmd)) == 501);
+    CHECK(http_to_command("GET x HTTP/1.1", cmd, sizeof(cmd)) == 400);
+    CHECK(http_to_command("get limit=1", cmd, sizeof(cmd)) == -1);
+    CHECK(http_to_command("status", cmd, sizeof(cmd)) == -1);
+    check_report("query & http parsers", f0);
+}
+
+/* Whatever the epoll side has sent to peer so far */
+static size_t check_drain(int peer, char *buf, size_t cap) {
+    size_t n = 0;
+    ssize_t r;
+    while (n + 1 < cap && (r = recv(peer, buf + n, cap - 1 - n, MSG_DONTWAIT)) > 0) n += (size_t)r;
+    buf[n] = '\0';
+    return n;
+}
+
+/* The deadline heap pops in order, & each connection state maps to its timeout */
+static void check_net_timers(void) {
+    int f0 = check_failures;
+    uint32_t rnd = 777;
+    for (int i = 0; i < 500; i++) {
+        rnd = rnd * 1103515245u + 12345u;
+        net_timer_push((long long)(rnd >> 12) % 10000, i, (uint32_t)i);
+    }
+    long long prev = -1;
+    size_t popped = 0;
+    while (net_ntimers) {
+        net_timer_t t = net_timer_pop();
+        CHECK(t.at >= prev);
+        prev = t.at;
+        popped++;
+    }
+    CHECK(popped == 500);
+
+    const net_limits_t lim = { 16, 200, 30, 15, 0, 0 };
+    net_conn_t c;
+    memset(&c, 0, sizeof(c));
+    c.accepted_ms = 1000;
+    c.last_ms = 5000;
+    CHECK(net_deadline(&c, &lim) == 1200);  // silent so far: the legacy wait
+    c.got_request = 1;
+    CHECK(net_deadline(&c, &lim) == 35000);
+    c.sub = SUB_LINE;
+    CHECK(net_deadline(&c, &lim) == 20000);  // quiet subscriber: heartbeat
+    c.out = "x";
+    CHECK(net_deadline(&c, &lim) == 35000);  // stalled subscriber: idle timeout
+    c.busy = 1;
+    CHECK(net_deadline(&c, &lim) == 0);
+    free(net_timers);
+    net_timers = NULL;
+    net_timers_cap = 0;
+    check_report("net deadlines", f0);
+}
+
+/* Subscribers over socketpairs against an 8-slot ring: shared chunks, a lapped
+ * cursor, SSE framing & the line protocol's subscribe/unsubscribe */
+static void check_stream(void) {
+    int f0 = check_failures;
+    uint64_t fields;
+    unsigned long after;
+    int has_after;
+    CHECK(stream_parse("", &fields, &after, &has_after) == 0 && fields == QF_ALL && !has_after);
+    CHECK(stream_parse("fields=cpu,disk after=42", &fields, &after, &has_after) == 0 && has_after && after == 42 &&
+          fields == (1ULL << sample_field_find("cpu") | 1ULL << sample_field_find("disk")));
+    CHECK(stream_parse("fields=bogus", &fields, &after, &has_after) != 0);
+    CHECK(stream_parse("after=-1", &fields, &after, &has_after) != 0 && stream_parse("cpu", &fields, &after, &has_after) != 0);
+
+    ring_init(&ringbuf, 8);
+    for (int i = 1; i <= 3; i++) {
+        metric_sample_t m = { .cpu_usage = i, .timestamp = 1000 + i };
+        ring_push(&ringbuf, &m);
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC), sp[3][2];
+    net_conn_t *c[3];
+    net_conns_cap = 64;
+    net_conns = calloc(net_conns_cap, sizeof(*net_conns));
+    for (int i = 0; i < 3; i++) {
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sp[i]) == 0);
+        c[i] = calloc(1, sizeof(net_conn_t));
+        c[i]->fd = sp[i][0];
+        c[i]->got_request = 1;
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = sp[i][0] };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, sp[i][0], &ev);
+        c[i]->events = EPOLLIN;
+        net_conns[sp[i][0]] = c[i];
+        net_nconns++;
+    }
+    char buf[4096];
+    CHECK(net_dispatch(epfd, NULL, c[0], "subscribe fields=nope", 0) == 0 && !c[0]->sub);
+    CHECK(check_drain(sp[0][1], buf, sizeof(buf)) && strstr(buf, "bad subscribe request"));
+    CHECK(net_dispatch(epfd, NULL, c[0], "subscribe fields=cpu after=0", 0) == 0 && c[0]->sub == SUB_LINE);
+    CHECK(net_dispatch(epfd, NULL, c[1], "subscribe fields=cpu after=0", 0) == 0 && atomic_load(&net_subscribers) == 2);
+    CHECK(net_subs == c[1] && c[1]->sub_next == c[0] && !c[0]->sub_next && c[0]->sub_prev == c[1]);
+    CHECK(c[0]->sub_seq == 3 && c[1]->sub_seq == 3 && stream_cache && stream_cache->refs == 1);  // both sent, shared
+    check_drain(sp[0][1], buf, sizeof(buf));
+    CHECK(strstr(buf, "{ \"subscribed\": true, \"seq\": 0 }\n{\"seq\":1,\"t\":1001,\"cpu\":1.00}\n") &&
+          strstr(buf, "{\"seq\":3,\"t\":1003,\"cpu\":3.00}\n"));
+
+    /* c[0] stops reading & the ring laps it; c[1] keeps up */
+    for (int i = 4; i <= 14; i++) {
+        metric_sample_t m = { .cpu_usage = i, .timestamp = 1000 + i };
+        ring_push(&ringbuf, &m);
+        if (i <= 5) stream_fill(epfd, c[1]);
+    }
+    unsigned long d0 = atomic_load(&stream_dropped);
+    stream_fill(epfd, c[0]);
+    check_drain(sp[0][1], buf, sizeof(buf));
+    CHECK(atomic_load(&stream_dropped) - d0 == 3 && strncmp(buf, "{\"dropped\":3}\n{\"seq\":7,", 21) == 0);
+    CHECK(c[0]->sub_seq == 14 && stream_fill(epfd, c[1]) == 0 && c[1]->sub_seq == 14);
+
+    /* SSE: event ids are sequence numbers */
+    CHECK(net_subscribe(epfd, c[2], "fields=cpu after=12", 1) == 0 && c[2]->sub == SUB_SSE);
+    check_drain(sp[2][1], buf, sizeof(buf));
+    CHECK(strstr(buf, "Content-Type: text/event-stream\r\n") &&
+          strstr(buf, "\r\n\r\nid: 13\ndata: {\"seq\":13,\"t\":1013,\"cpu\":13.00}\n\nid: 14\n"));
+    CHECK(stream_heartbeat(epfd, c[2]) == 0 && check_drain(sp[2][1], buf, sizeof(buf)) && strcmp(buf, ": heartbeat\n\n") == 0);
+
+    CHECK(net_dispatch(epfd, NULL, c[1], "get", 0) == 0 && c[1]->sub);
+    check_drain(sp[1][1], buf, sizeof(buf));
+    CHECK(strstr(buf, "send unsubscribe first"));
+    CHECK(net_dispatch(epfd, NULL, c[1], "unsubscribe", 0) == 0 && !c[1]->sub);
+    check_drain(sp[1][1], buf, sizeof(buf));
+    CHECK(strstr(buf, "{ \"unsubscribed\": true, \"seq\": 14 }\n"));
+    for (int i = 0; i < 3; i++) {
+        net_close(epfd, c[i]);
+        close(sp[i][1]);
+    }
+    CHECK(atomic_load(&net_subscribers) == 0 && net_nconns == 0 && net_subs == NULL);
+    stream_chunk_put(stream_cache);
+    stream_cache = NULL;
+    free(net_conns);
+    net_conns = NULL;
+    net_conns_cap = 0;
+    close(epfd);
+    ring_free(&ringbuf);
+    check_report("subscriptions", f0);
+}
+
+/* Agent replies as the aggregator parses them, the fleet merge over a
+ * hand-filled shard & the cluster request built from it */
+static void check_aggregate(void) {
+    int f0 = check_failures;
+    unsigned long seq;
+    size_t n;
+    time_t t = 0;
+    double vals[N_SAMPLE_FIELDS];
+    uint64_t got;
+    int cpu = sample_field_find("cpu"), mem = sample_field_find("memory"), rx = sample_field_find("net_rx_bps");
+    CHECK(parse_agg_reply("{ \"seq\": 42, \"current\": {\"t\":9,\"cpu\":3.00}, \"count\": 2, \"samples\": "
+                          "[{\"t\":8,\"cpu\":2.50,\"memory\":40.00},{\"t\":9,\"cpu\":3.00,\"net_rx_bps\":1200.50}] }",
+                          &seq, &n, &t, vals, &got) == 0);
+    CHECK(seq == 42 && n == 2 && t == 9 && got == (1ULL << cpu | 1ULL << rx) && vals[cpu] == 3.0 && vals[rx] == 1200.5);
+    CHECK(parse_agg_reply("{ \"seq\": 7, \"current\": {}, \"count\": 0, \"samples\": [] }", &seq, &n, &t, vals, &got) == 0 &&
+          seq == 7 && n == 0 && got == 0);
+    CHECK(parse_agg_reply("{ \"error\": \"bad get request\" }", &seq, &n, &t, vals, &got) != 0);
+    CHECK(parse_agg_reply("{ \"seq\": 7, \"samples\": [{\"t\":1,\"cpu\":}] }", &seq, &n, &t, vals, &got) != 0);
+    CHECK(parse_agg_reply("{ \"seq\": 7, \"samples\": [{\"t\":1", &seq, &n, &t, vals, &got) != 0);
+    static const double sorted[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    CHECK(agg_quantile(sorted, 10, 0) == 1 && agg_quantile(sorted, 10, 0.5) == 5 && agg_quantile(sorted, 10, 0.9) == 9 &&
+          agg_quantile(sorted, 10, 0.99) == 10 && agg_quantile(sorted, 1, 0.99) == 1);
+
+    /* four agents, one of them silent: the fleet covers three */
+    static agg_agent_t agents[4];
+    static agg_shard_t shard;
+    static agg_row_t rows[4];
+    static double scratch[4 * N_SAMPLE_FIELDS];
+    memset(agents, 0, sizeof(agents));
+    long long now = now_ms();
+    for (int i = 0; i < 4; i++) {
+        snprintf(agents[i].name, sizeof(agents[i].name), "host%d:9999", i);
+        agents[i].fd = -1;
+        agents[i].ok_ms = i < 3 ? now : 0;
+        agents[i].t = i < 3 ? 1000 + i : 0;
+        agents[i].val[cpu] = 10.0 * (i + 1);
+        agents[i].val[mem] = 50.0;
+        agents[i].seq = 100 + (unsigned long)i;
+    }
+    pthread_mutex_init(&shard.lock, NULL);
+    shard.agents = agents;
+    shard.n = 4;
+    aggtab.agents = agents;
+    aggtab.n = 4;
+    aggtab.shards = &shard;
+    aggtab.nshards = 1;
+    aggtab.rows = rows;
+    aggtab.hist = 4;
+    aggtab.ticks = 0;
+    aggtab.scratch = scratch;
+    uint64_t fields = 1ULL << cpu | 1ULL << mem;
+    agg_merge(fields, 15000, now);
+    const agg_row_t *r = &rows[1];
+    CHECK(aggtab.ticks == 1 && r->agents == 4 && r->up == 3);
+    CHECK(r->stat[cpu][0] == 10.0f && r->stat[cpu][1] == 20.0f && r->stat[cpu][4] == 30.0f && r->stat[cpu][5] == 20.0f &&
+          r->stat[mem][3] == 50.0f);
+    config_t *c = config_dup(config_get());
+    if (c) {
+        c->aggregate_fields = fields;
+        config_replace(c);
+    }
+    size_t len;
+    char *reply = cluster_request("", &len);
+    CHECK(reply && strstr(reply, "\"agents\": 4, \"up\": 3, \"fields\": [\"cpu\",\"memory\"], \"count\": 1") &&
+          strstr(reply, "\"cpu\":{\"min\":10.00,\"p50\":20.00") && !strstr(reply, "\"hosts\""));
+    free(reply);
+    reply = cluster_request("top=1 sort=cpu", &len);
+    CHECK(reply && strstr(reply, "\"hosts\": [{\"agent\":\"host2:9999\",\"up\":true,\"t\":1002,\"seq\":102") &&
+          !strstr(reply, "host1:"));
+    free(reply);
+    reply = cluster_request("hosts=down", &len);
+    CHECK(reply && strstr(reply, "\"agent\":\"host3:9999\",\"up\":false") && !strstr(reply, "host0:"));
+    free(reply);
+    CHECK(cluster_request("hosts=some", &len) == NULL && cluster_request("sort=bogus", &len) == NULL);
+    aggtab.agents = NULL;  // detach the fixture
+    aggtab.n = 0;
+    aggtab.shards = NULL;
+    aggtab.nshards = 0;
+    aggtab.rows = NULL;
+    aggtab.scratch = NULL;
+    aggtab.ticks = 0;
+    pthread_mutex_destroy(&shard.lock);
+    check_report("aggregator", f0);
+}
+
+typedef struct {
+    uint64_t masks[64];
+    size_t n;
+} check_lines_t;
+
+static void check_collect_line(void *ctx, uint64_t mask, size_t eol) {
+    (void)eol;
+    check_lines_t *c = ctx;
+    if (c->n < 64) c->masks[c->n] = mask;
+    c->n++;
+}
+
+static void check_matcher(void) {
+    int f0 = check_failures;
+    static const char *const pats[] = { "error", "fail", "rr", "panic", "e" };
+    matcher_t m;
+    CHECK(matcher_build(&m, "error,FAIL,rr,panic,e") == 0 && m.npatterns == 5);
+    static const char text[] = "all good\n"
+                               "ERROR: disk\n"
+                               "kernel PaNiC\n"
+                               "failover done\n"
+                               "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxerror\n"
+                               "nothing to see\n"
+                               "\n"
+                               "r\n"
+                               "rfailrrr\n";
+    /* expected: naive case-insensitive search per matching line */
+    check_lines_t want = { { 0 }, 0 };
+    for (const char *l = text; *l;) {
+        const char *nl = strchr(l, '\n');
+        char line[256];
+        snprintf(line, sizeof(line), "%.*s", (int)(nl - l), l);
+        uint64_t mask = 0;
+        for (int i = 0; i < 5; i++)
+            if (strcasestr(line, pats[i])) mask |= 1ULL << i;
+        if (mask) check_collect_line(&want, mask, 0);
+        l = nl + 1;
+    }
+    size_t len = strlen(text);
+    for (size_t split = 0; split <= len; split++) {
+        check_lines_t got = { { 0 }, 0 };
+        log_scan_t st = { 0, 0 };
+        matcher_scan(&m, &st, text, split, check_collect_line, &got);
+        matcher_scan(&m, &st, text + split, len - split, check_collect_line, &got);
+        CHECK(got.n == want.n && memcmp(got.masks, want.masks, want.n * sizeof(uint64_t)) == 0);
+        if (check_failures != f0) break;
+    }
+    char names[64];
+    matcher_names(&m, (1ULL << 0) | (1ULL << 3), names, sizeof(names));
+    CHECK(strcmp(names, "error,panic") == 0);
+    matcher_free(&m);
+
+    /* no patterns: nothing matches */
+    CHECK(matcher_build(&m, "") == 0);
+    check_lines_t got = { { 0 }, 0 };
+    log_scan_t st = { 0, 0 };
+    matcher_scan(&m, &st, text, len, check_collect_line, &got);
+    CHECK(got.n == 0);
+    matcher_free(&m);
+    check_report("aho-corasick matcher", f0);
+}
+
+static const char *check_logmatch_text(size_t i) {  // 0 = oldest
+    const log_match_t *m = logmatch_at(i);
+    const char *p = logmatch.arena + m->pos % logmatch.arena_size;
+    return p + m->path_len + m->names_len + 2;
+}
+
+static void check_logmatch(void) {
+    int f0 = check_failures;
+    matcher_t m;
+    CHECK(matcher_build(&m, "error,panic") == 0);
+    char text[2048];
+    int k = snprintf(text, sizeof(text), "ok\nERROR one\na panic and error\r\n");
+    size_t long_off = (size_t)k;
+    memset(text + k, 'x', 1500);
+    k += 1500;
+    k += snprintf(text + k, sizeof(text) - (size_t)k, "error\nfine\n");
+    size_t len = (size_t)k;
+
+    /* every split: a line that starts in one chunk & ends in the next is
+     * captured whole, at its own offset */
+    for (size_t split = 0; split <= len; split++) {
+        logmatch_free();
+        CHECK(logmatch_init(4, 4) == 0);
+        log_watch_t w;
+        memset(&w, 0, sizeof(w));
+        log_report_t rep;
+        memset(&rep, 0, sizeof(rep));
+        rep.path = "t.log";
+        rep.matcher = &m;
+        rep.totals = w.hits;
+        rep.line = &w.line;
+        watch_scan(&w, &m, &rep, text, split);
+        watch_scan(&w, &m, &rep, text + split, len - split);
+        CHECK(w.hits[0] == 3 && w.hits[1] == 1 && rep.lines == 3 && w.lines == 5 && logmatch.total == 3);
+        CHECK(logmatch.count == 3 && logmatch_at(0)->offset == 3 && logmatch_at(1)->offset == 13 &&
+              logmatch_at(2)->offset == long_off);
+        CHECK(strcmp(check_logmatch_text(0), "ERROR one") == 0);
+        CHECK(strcmp(check_logmatch_text(1), "a panic and error") == 0);
+        CHECK(logmatch_at(2)->text_len == LOG_MATCH_TEXT_MAX && strspn(check_logmatch_text(2), "x") == LOG_MATCH_TEXT_MAX);
+        const log_match_t *r = logmatch_at(1);
+        CHECK(strcmp(logmatch.arena + r->pos % logmatch.arena_size + r->path_len + 1, "error,panic") == 0);
+        if (check_failures != f0) break;
+    }
+
+    /* the arena holds three long records: older ones go as it wraps, the
+     * rest stay intact */
+    logmatch_free();
+    CHECK(logmatch_init(8, 4) == 0);
+    char line[LOG_MATCH_TEXT_MAX];
+    for (int i = 0; i < 10; i++) {
+        memset(line, 'a' + i, sizeof(line));
+        logmatch_put("t.log", "error", (uint64_t)i * 2000, NULL, 0, line, sizeof(line));
+    }
+    CHECK(logmatch.total == 10 && logmatch.count == 3 && logmatch_at(0)->seq == 8);
+    for (size_t i = 0; i < logmatch.count; i++)
+        CHECK(strspn(check_logmatch_text(i), (char[]){ (char)('a' + 7 + i), 0 }) == LOG_MATCH_TEXT_MAX);
+    logmatch_put("t.log", "panic", 99, "nearly ", 7, "done", 4);
+    CHECK(logmatch.count == 3 && strcmp(check_logmatch_text(2), "nearly done") == 0);
+
+    size_t n = 0;
+    char *out = logs_request(" pattern=PANIC", &n);
+    CHECK(out && strstr(out, "\"seq\": 11, \"count\": 1,") &&
+          strstr(out, "{\"seq\":11,") && strstr(out, "\"offset\":99,\"patterns\":[\"panic\"],\"line\":\"nearly done\"}"));
+    free(out);
+    out = logs_request(" after=9 limit=1", &n);
+    CHECK(out && strstr(out, "\"count\": 1,") && strstr(out, "{\"seq\":11,"));
+    free(out);
+    CHECK(logs_request(" limit=x", &n) == NULL && logs_request(" nope", &n) == NULL);
+    logmatch_free();
+    matcher_free(&m);
+    check_report("log match capture", f0);
+}
+
+static int check_main(bench_opts_t *o) {
+    snprintf(o->dir, sizeof(o->dir), "/tmp/syswatch-check.XXXXXX");
+    if (!mkdtemp(o->dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    o->cores = 4;
+    o->mounts = 5;
+    config_init(NULL);
+    check_parsers(o);
+    check_history();
+    check_ring();
+    check_config(o);
+    check_threads();
+    check_binlog(o);
+    check_state(o);
+    check_diskio(o);
+    check_cgroups(o);
+    check_net(o);
+    check_alerts();
+    check_query();
+    check_net_timers();
+    check_stream();
+    check_aggregate();
+    check_matcher();
+    check_logmatch();
+    static const char *const files[] = { "stat", "meminfo", "mountinfo" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/%s", o->dir, files[i]);
+        unlink(path);
+    }
+    rmdir(o->dir);
+    printf("check  %s\n", check_failures ? "FAILED" : "all passed");
+    return check_failures ? 1 : 0;
+}
+
+static int bench_main(bench_opts_t *o) {
+    snprintf(o->dir, sizeof(o->dir), "/tmp/syswatch-bench.XXXXXX");
+    if (!mkdtemp(o->dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    config_t *cfg = config_new();
+    if (!cfg) return 1;
+    snprintf(cfg->metrics_logfile, sizeof(cfg->metrics_logfile), "%s/metrics.log", o->dir);
+    cfg->writer_fsync = 0;
+    config_publish(cfg);
+
+    /* the daemon's shared state, with a full ring of synthetic samples */
+    pthread_mutex_init(&sys_metrics.data_lock, NULL);
+    int ring_size = cfg->ring_size;
+    ring_init(&ringbuf, (size_t)ring_size);
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    core_ring_init(&corering, ncpu > 0 ? (size_t)ncpu : 1, (size_t)cfg->core_history);
+    diskio_ring_init(&diskioring, (size_t)cfg->diskio_history);
+    status_doc_init(&statusdoc, (size_t)ring_size);
+    status_doc_init(&metricsdoc, 1);
+    history_init(&history, cfg->history_raw_kb, cfg->history_1m_kb, cfg->history_1h_kb);
+    time_t now = time(NULL);
+    for (int i = 0; i < ring_size; i++) {
+        metric_sample_t s = { .cpu_usage = 10.0 + i % 50, .memory_usage = 40.0 + i % 7, .disk_usage = 63.0,
+                              .cpu_core_max = 20.0 + i % 60, .cpu_core_p95 = 18.0 + i % 40,
+                              .timestamp = now - (ring_size - i) * 5 };
+        publish_sample(&s);
+    }
+    shutdown_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sample_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    wq_init(&wqueue, (size_t)cfg->writer_queue_size, (size_t)cfg->writer_batch);
+    pthread_t t_writer;
+    if (shutdown_efd < 0 || pthread_create(&t_writer, NULL, writer_thread, &wqueue) != 0) {
+        perror("bench: setup");
+        return 1;
+    }
+
+    static const struct {
+        const char *name;
+        int (*fn)(const bench_opts_t *);
+    } scenarios[] = { { "parse", bench_parse }, { "log", bench_log },         { "net", bench_net },
+                      { "procs", bench_procs }, { "aggregate", bench_aggregate }, { "subscribe", bench_subscribe } };
+    int all = strcmp(o->scenario, "all") == 0, rc = 0, ran = 0;
+    printf("syswatch bench: %d ms per scenario\n", o->duration_ms);
+    bench_rss("start");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]) && rc == 0; i++) {
+        if (!all && strcmp(o->scenario, scenarios[i].name) != 0) continue;
+        ran++;
+        rc = scenarios[i].fn(o);
+    }
+    if (!ran) {
+        fprintf(stderr, "unknown scenario %s (parse, log, net, procs, aggregate, subscribe or all)\n", o->scenario);
+        rc = 1;
+    }
+
+    writer_stop(&wqueue);
+    pthread_join(t_writer, NULL);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/metrics.log", o->dir);
+    unlink(path);
+    rmdir(o->dir);
+    return rc;
 }
+#endif /* SYSWATCH_BENCH */
 
 /* Simple usage */
 void usage(const char *p) {
     fprintf(stderr, "Usage: %s [-c configfile]\n", p);
+    fprintf(stderr, "       %s --read FILE [--from TIME] [--to TIME] [--summary]\n", p);
+#ifdef SYSWATCH_BENCH
+    fprintf(stderr, "       %s --bench parse|log|net|procs|aggregate|subscribe|all [--duration MS] [--clients N]\n"
+                    "                [--request LINE] [--log-rate MB_PER_S] [--cores N] [--mounts N] [--procs N]\n"
+                    "                [--agents N]\n"
+                    "       %s --check\n", p, p);
+#endif
 }
 
 /* main */
 int main(int argc, char **argv) {
+    static const struct option long_opts[] = {
+        { "config", required_argument, NULL, 'c' },
+        { "read", required_argument, NULL, 'r' },
+        { "from", required_argument, NULL, 'F' },
+        { "to", required_argument, NULL, 'T' },
+        { "summary", no_argument, NULL, 'S' },
+#ifdef SYSWATCH_BENCH
+        { "bench", required_argument, NULL, 'B' },
+        { "duration", required_argument, NULL, 'D' },
+        { "clients", required_argument, NULL, 'N' },
+        { "request", required_argument, NULL, 'Q' },
+        { "log-rate", required_argument, NULL, 'L' },
+        { "cores", required_argument, NULL, 'C' },
+        { "mounts", required_argument, NULL, 'M' },
+        { "procs", required_argument, NULL, 'P' },
+        { "agents", required_argument, NULL, 'A' },
+        { "check", no_argument, NULL, 'K' },
+#endif
+        { NULL, 0, NULL, 0 },
+    };
+#ifdef SYSWATCH_BENCH
+    bench_opts_t bench = { NULL, "status", 64, 3000, 64, 32, 2000, 5000, 50.0, "" };
+    int run_check = 0;
+#endif
+    const char *read_path = NULL;
+    time_t read_from = 0, read_to = (time_t)INT64_MAX;
+    int read_summary = 0;
     int opt;
-    while ((opt = getopt(argc, argv, "c:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "c:", long_opts, NULL)) != -1) {
         switch (opt) {
             case 'c':
                 strncpy(config_path, optarg, sizeof(config_path) - 1);
                 config_path[sizeof(config_path) - 1] = '\0';
                 break;
+            case 'r':
+                read_path = optarg;
+                break;
+            case 'F':
+            case 'T':
+                if (parse_time_arg(optarg, opt == 'F' ? &read_from : &read_to) != 0) {
+                    fprintf(stderr, "bad time: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'S':
+                read_summary = 1;
+                break;
+#ifdef SYSWATCH_BENCH
+            case 'B':
+                bench.scenario = optarg;
+                break;
+            case 'D':
+                bench.duration_ms = atoi(optarg) > 0 ? atoi(optarg) : bench.duration_ms;
+                break;
+            case 'N':
+                bench.clients = atoi(optarg) > 0 ? atoi(optarg) : bench.clients;
+                break;
+            case 'Q':
+                bench.request = optarg;
+                break;
+            case 'L':
+                bench.log_rate_mb = atof(optarg) >= 0 ? atof(optarg) : bench.log_rate_mb;
+                break;
+            case 'C':
+                bench.cores = atoi(optarg) > 0 ? atoi(optarg) : bench.cores;
+                break;
+            case 'M':
+                bench.mounts = atoi(optarg) > 0 ? atoi(optarg) : bench.mounts;
+                break;
+            case 'P':
+                bench.procs = atoi(optarg) >= 0 ? atoi(optarg) : bench.procs;
+                break;
+            case 'A':
+                bench.agents = atoi(optarg) > 0 ? atoi(optarg) : bench.agents;
+                break;
+            case 'K':
+                run_check = 1;
+                break;
+#endif
             default:
                 usage(argv[0]);
                 return 1;
         }
     }
+    if (read_path) return binlog_read_main(read_path, read_from, read_to, read_summary);
+#ifdef SYSWATCH_BENCH
+    if (run_check) return check_main(&bench);
+    if (bench.scenario) return bench_main(&bench);
+#endif
 
-    parse_config(config_path);
+    const config_t *cfg = config_init(config_path);
 
     /* init shared metrics */
     sys_metrics.cpu_usage = sys_metrics.memory_usage = sys_metrics.disk_usage = 0.0;
     pthread_mutex_init(&sys_metrics.data_lock, NULL);
-    pthread_cond_init(&sys_metrics.update_cond, NULL);
 
-    /* init ring */
-    ring_init(&ringbuf, (size_t)ring_size);
+    /* init ring & history: mapped from the state file, else on the heap */
+    if (state_start(&state, cfg) != 0) {
+        ring_init(&ringbuf, (size_t)cfg->ring_size);
+        history_init(&history, cfg->history_raw_kb, cfg->history_1m_kb, cfg->history_1h_kb);
+    }
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    core_ring_init(&corering, ncpu > 0 ? (size_t)ncpu : 1, (size_t)cfg->core_history);
+    diskio_ring_init(&diskioring, (size_t)cfg->diskio_history);
+    cgtab_init((size_t)cfg->cgroup_max, (size_t)cfg->cgroup_history);
+    status_doc_init(&statusdoc, (size_t)cfg->ring_size);
+    status_doc_init(&metricsdoc, 1);
+    if (logmatch_init((size_t)cfg->log_match_ring, (size_t)cfg->log_match_arena_kb) != 0)
+        fprintf(stderr, "LOG_MATCH_RING: cannot allocate, matched lines are not kept\n");
+    state_replay(&ringbuf);
 
     /* block signals in all threads; we'll handle them using sigwait in a dedicated thread */
     sigset_t set;
@@ -600,68 +11412,88 @@ int main(int argc, char **argv) {
     sigaddset(&set, SIGHUP);
     pthread_sigmask(SIG_BLOCK, &set, NULL);
 
+    shutdown_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shutdown_efd < 0) {
+        perror("eventfd");
+        return 1;
+    }
+    sample_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);  // without it the network thread polls every 50 ms
+
     /* create threads */
-    pthread_t t_cpu, t_disk, t_log, t_net, t_sig;
-    if (pthread_create(&t_cpu, NULL, cpu_mem_thread, NULL) != 0) {
-        perror("pthread_create cpu_mem_thread");
+    pthread_t t_sched, t_log, t_net, t_sig, t_writer, t_push;
+    wq_init(&wqueue, (size_t)cfg->writer_queue_size, (size_t)cfg->writer_batch);
+    if (cfg->mlock) memory_lock();  // after the startup allocations, before the stacks
+    if (thread_spawn(&t_writer, NULL, THR_WRITER, "sw-writer", writer_thread, &wqueue) != 0) {
+        perror("pthread_create writer_thread");
         return 1;
     }
-    if (pthread_create(&t_disk, NULL, disk_thread, NULL) != 0) {
-        perror("pthread_create disk_thread");
-        atomic_store(&running, 0);
-        pthread_join(t_cpu, NULL);
+    if (thread_spawn(&t_sched, NULL, THR_COLLECT, "sw-collect", scheduler_thread, NULL) != 0) {
+        perror("pthread_create scheduler_thread");
         return 1;
     }
-    if (pthread_create(&t_log, NULL, log_monitor_thread, NULL) != 0) {
+    if (thread_spawn(&t_log, NULL, THR_LOG, "sw-log", log_monitor_thread, NULL) != 0) {
         perror("pthread_create log_monitor_thread");
-        atomic_store(&running, 0);
-        pthread_join(t_cpu, NULL);
-        pthread_join(t_disk, NULL);
+        request_shutdown();
+        pthread_join(t_sched, NULL);
         return 1;
     }
-    if (pthread_create(&t_net, NULL, network_thread, NULL) != 0) {
+    if (thread_spawn(&t_net, NULL, THR_NET, "sw-net", network_thread, NULL) != 0) {
         perror("pthread_create network_thread");
-        atomic_store(&running, 0);
-        pthread_join(t_cpu, NULL);
-        pthread_join(t_disk, NULL);
+        request_shutdown();
+        pthread_join(t_sched, NULL);
         pthread_join(t_log, NULL);
         return 1;
     }
-    if (pthread_create(&t_sig, NULL, signal_thread, NULL) != 0) {
+    if (thread_spawn(&t_sig, NULL, THR_SIGNAL, "sw-signal", signal_thread, NULL) != 0) {
         perror("pthread_create signal_thread");
-        atomic_store(&running, 0);
-        pthread_join(t_cpu, NULL);
-        pthread_join(t_disk, NULL);
+        request_shutdown();
+        pthread_join(t_sched, NULL);
         pthread_join(t_log, NULL);
         pthread_join(t_net, NULL);
         return 1;
     }
+    int have_push = thread_spawn(&t_push, NULL, THR_PUSH, "sw-push", push_thread, NULL) == 0;
+    if (!have_push) perror("pthread_create push_thread");  // optional; run without it
+    agg_start();  // AGGREGATE_AGENTS; its threads run until shutdown
 
-    /* main loop: wait for running -> 0 */
+    /* main: wait for shutdown */
+    struct pollfd pfd = { shutdown_efd, POLLIN, 0 };
     while (atomic_load(&running)) {
-        sleep(1);
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) break;
     }
 
-    /* join threads & cleanup */
-    pthread_join(t_cpu, NULL);
-    pthread_join(t_disk, NULL);
+    /* join threads & cleanup; all of them wake on shutdown_efd */
+    pthread_join(t_sched, NULL);
     pthread_join(t_log, NULL);
     pthread_join(t_net, NULL);
+    if (have_push) pthread_join(t_push, NULL);
+    agg_stop();
 
     /* cancel & join the signal thread (it may be blocked in sigwait) */
     pthread_cancel(t_sig);
     pthread_join(t_sig, NULL);
 
-    /* final dump */
+    /* final dump, then let the writer drain & exit */
     dump_metrics_to_file();
+    writer_stop(&wqueue);
+    pthread_join(t_writer, NULL);
+    if (atomic_load(&wqueue.dropped))
+        fprintf(stderr, "writer dropped %lu records (queue full)\n", atomic_load(&wqueue.dropped));
+    wq_free(&wqueue);
 
-    /* free duplicated logfile strings */
-    for (int i = 0; i < n_logfiles; ++i) {
-        free(logfiles[i]);
-        logfiles[i] = NULL;
-    }
-
-    if (ringbuf.buf) free(ringbuf.buf);
+    binlog_close(&binlog);
+    ring_free(&ringbuf);
+    core_ring_free(&corering);
+    diskio_ring_free(&diskioring);
+    cgtab_free();
+    status_doc_free(&statusdoc);
+    status_doc_free(&metricsdoc);
+    logmatch_free();
+    history_free(&history);
+    state_close(&state);
+    close(shutdown_efd);
+    if (sample_efd >= 0) close(sample_efd);
+    config_free(atomic_load(&cur_config));
 
     fprintf(stderr, "SysWatch stopped.\n");
     return 0;